@@ -0,0 +1,27 @@
+// Calls the same small functions many times - measures per-call overhead
+// With ESPR_FUNCTION_TOKEN_CACHE, function code is tokenised on the first
+// call so later calls don't have to re-lex comments, whitespace and keywords
+function clamp(value, min, max) {
+  // keep the value within range
+  if (value < min) {
+    return min;
+  } else if (value > max) {
+    return max;
+  }
+  return value;
+}
+function average(arr) {
+  var total = 0;
+  for (var i = 0; i < arr.length; i++) {
+    // accumulate each element
+    total += clamp(arr[i], 0, 100);
+  }
+  return total / arr.length;
+}
+var data = [1, 50, 200, -5, 99, 42, 7, 150];
+var t = getTime();
+var sum = 0;
+for (var n = 0; n < 2000; n++) {
+  sum += average(data);
+}
+print("function_call: " + Math.round((getTime() - t) * 1000) + "ms");
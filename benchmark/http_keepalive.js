@@ -0,0 +1,37 @@
+// Sequential requests to the HTTP server from a local client - run on Linux builds
+// Compares opening a new connection for every request with reusing one (keepAlive)
+var http = require("http");
+var REQUESTS = 300;
+
+var server = http.createServer(function (req, res) {
+  res.writeHead(200, {"Content-Type":"text/plain"});
+  res.end(req.url);
+});
+server.listen(8092);
+
+function run(keepAlive, callback) {
+  var count = 0;
+  var t = getTime();
+  function next() {
+    if (count>=REQUESTS) {
+      print("http_keepalive "+(keepAlive?"reused":"new connections")+": " + Math.round((getTime() - t) * 1000) + "ms for "+REQUESTS+" requests");
+      return callback();
+    }
+    http.get({host:"localhost", port:8092, path:"/test"+count, keepAlive:keepAlive}, function(res) {
+      var body = "";
+      res.on("data", function(d) { body += d; });
+      res.on("close", function() {
+        if (body!="/test"+count) print("Bad response "+JSON.stringify(body));
+        count++;
+        next();
+      });
+    });
+  }
+  next();
+}
+
+run(false, function() {
+  run(true, function() {
+    server.close();
+  });
+});
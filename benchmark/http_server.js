@@ -0,0 +1,33 @@
+// Drives the HTTP server with a local client - run on Linux builds
+// Each request carries a few KB of headers, which arrive in several chunks,
+// so this measures how well the server copes with headers split across packets
+var http = require("http");
+var REQUESTS = 200;
+var headers = {};
+for (var i=0;i<40;i++) headers["X-Header-"+i] = "value of header number "+i+" - padding padding padding";
+
+var server = http.createServer(function (req, res) {
+  res.writeHead(200, {"Content-Type":"text/plain"});
+  res.end(req.url+" "+req.headers["X-Header-39"].length);
+});
+server.listen(8090);
+
+var count = 0;
+var t = getTime();
+function next() {
+  if (count>=REQUESTS) {
+    print("http_server: " + Math.round((getTime() - t) * 1000) + "ms for "+REQUESTS+" requests");
+    server.close();
+    return;
+  }
+  http.request({host:"localhost", port:8090, path:"/test"+count, method:"GET", headers:headers}, function(res) {
+    var body = "";
+    res.on("data", function(d) { body += d; });
+    res.on("close", function() {
+      if (body!="/test"+count+" 51") print("Bad response "+JSON.stringify(body));
+      count++;
+      next();
+    });
+  }).end();
+}
+next();
@@ -0,0 +1,53 @@
+// Streams a large generated response from the HTTP server to a local client - run on Linux builds
+// The server writes whenever write() says there's space (or on 'drain'), and the client
+// counts what it gets. Reports the time taken and the most memory used along the way.
+// This is done with a Content-Length, and without one (where the response is chunked)
+var http = require("http");
+var LINES = 20000;
+var LINE = ",some,generated,csv,data,for,this,line\n";
+var peak = 0;
+function checkMemory() {
+  var m = process.memory(false).usage;
+  if (m>peak) peak = m;
+}
+
+var server = http.createServer(function (req, res) {
+  var line = 0;
+  function write() {
+    while (line<LINES) {
+      if (!(line&255)) checkMemory();
+      if (!res.write(line+LINE)) { line++; return; }
+      line++;
+    }
+    res.end();
+  }
+  res.on("drain", write);
+  var headers = {"Content-Type":"text/csv"};
+  if (req.url=="/length") {
+    var length = 0;
+    for (var i=0;i<LINES;i++) length += (i+LINE).length;
+    headers["Content-Length"] = length;
+  }
+  res.writeHead(200, headers);
+  write();
+});
+server.listen(8094);
+
+function run(path, callback) {
+  var t = getTime();
+  peak = 0;
+  http.get({host:"localhost", port:8094, path:path}, function(res) {
+    var received = 0;
+    res.on("data", function(d) { received += d.length; });
+    res.on("close", function() {
+      print("http_stream "+path+": " + Math.round((getTime() - t) * 1000) + "ms for "+received+" bytes, peak "+peak+" vars");
+      callback();
+    });
+  });
+}
+
+run("/length", function() {
+  run("/chunked", function() {
+    server.close();
+  });
+});
@@ -0,0 +1,29 @@
+// Times save() of a RAM image with some data in it - run on Linux builds
+// Reports the time for a normal save, then (if this build has E.setFlags({saveDelta:1}))
+// the time for a first delta save, and for a second one where only a little has changed
+var s = require("Storage");
+s.eraseAll();
+var data = []; for (var i=0;i<2000;i++) data.push({i:i, s:"item"+i});
+var t, tests = [
+  function() { print("save: "+Math.round((getTime()-t)*1000)+"ms"); },
+  function() { print("save_delta_first: "+Math.round((getTime()-t)*1000)+"ms"); },
+  function() { print("save_delta_again: "+Math.round((getTime()-t)*1000)+"ms"); }
+];
+function next() {
+  setTimeout(function() {
+    tests.shift()();
+    if (!tests.length || E.getFlags().saveDelta===undefined) {
+      E.setFlags({saveDelta:0});
+      s.eraseAll();
+      return;
+    }
+    E.setFlags({saveDelta:1});
+    data[5].s = "changed";
+    t = getTime();
+    save();
+    next();
+  }, 0);
+}
+t = getTime();
+save();
+next();
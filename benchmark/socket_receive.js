@@ -0,0 +1,25 @@
+// Sends data over a local socket faster than it is read - run on Linux builds
+// The client has no 'data' listener and reads with read(), so received data
+// has to be buffered until the reader gets to it
+var net = require("net");
+var SIZE = 200000;
+var server = net.createServer(function(c) {
+  var s = "";
+  for (var i=0;i<SIZE/10;i++) s += ("000000000"+i).substr(-9)+",";
+  c.write(s);
+});
+server.listen(8091);
+
+var t = getTime();
+var received = 0;
+var client = net.connect({port: 8091}, function() {
+  function read() {
+    received += client.read(300).length;
+    if (received >= SIZE) {
+      print("socket_receive: " + Math.round((getTime() - t) * 1000) + "ms");
+      client.end();
+      server.close();
+    } else setTimeout(read, 0);
+  }
+  read();
+});
@@ -0,0 +1,24 @@
+// Stores app-like JS files in Storage with {compress:true} - run on Linux builds
+// Writes FILES files of code, then reports the time to write them, the flash they use,
+// and the time for READS reads of them (which decompress them if they're compressed).
+var s = require("Storage");
+var FILES = 20;
+var READS = 200;
+var code = "";
+for (var i=0;i<60;i++)
+  code += "exports.draw"+i+" = function(g) { g.clear(); g.drawString('Item "+i+"', 10, "+(i*10)+"); };\n";
+
+s.eraseAll();
+var t = getTime();
+for (var i=0;i<FILES;i++)
+  s.write("app"+i+".js", "// app "+i+"\n"+code, {compress:true});
+print("storage_compress_write: "+Math.round((getTime()-t)*1000)+"ms");
+var stats = s.getStats();
+print("storage_compress_flash: "+stats.fileBytes+" bytes for "+(FILES*code.length)+" bytes of files");
+
+t = getTime();
+var n = 0;
+for (var i=0;i<READS;i++)
+  n += s.read("app"+(i%FILES)+".js").length;
+print("storage_compress_read: "+Math.round((getTime()-t)*1000)+"ms");
+s.eraseAll();
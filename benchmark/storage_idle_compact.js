@@ -0,0 +1,33 @@
+// Compacts Storage with lots of trash in it - run on Linux builds
+// Reports how long a blocking Storage.compact() holds everything up for, and
+// the longest time between callbacks while the same Storage is compacted when idle.
+var s = require("Storage");
+var FILES = 100;
+function fill() {
+  s.eraseAll();
+  for (var i=0;i<FILES;i++)
+    s.write("file"+i, ("file"+i+" ").repeat(400).substr(0,2000+i));
+  for (var i=0;i<FILES;i+=2) s.erase("file"+i);
+}
+
+fill();
+var t = getTime();
+s.compact();
+print("storage_compact_blocking: "+Math.round((getTime()-t)*1000)+"ms");
+
+fill();
+if (s.getStats().compacting===undefined) {
+  print("storage_compact_idle_step: (not supported)");
+} else {
+  var last = getTime(), longest = 0, start = last;
+  var interval = setInterval(function() {
+    var now = getTime();
+    if (now-last > longest) longest = now-last;
+    last = now;
+    if (s.getStats().compacting || s.getStats().trashBytes) return;
+    clearInterval(interval);
+    print("storage_compact_idle_step: "+Math.round(longest*1000)+"ms");
+    print("storage_compact_idle_total: "+Math.round((now-start)*1000)+"ms");
+    s.eraseAll();
+  }, 0);
+}
@@ -0,0 +1,36 @@
+// Finds files in Storage when there are a lot of them - run on Linux builds
+// Writes FILES files, replaces some and compacts (which writes the hash index of filenames),
+// then writes a few more (which go in the index's log). Reports the time for READS reads
+// of files that exist, READS lookups of files that don't, and READS reads of a settings
+// file while other files are also being read.
+var s = require("Storage");
+var FILES = 300;
+var READS = 3000;
+
+s.eraseAll();
+for (var i=0;i<FILES;i++)
+  s.write("setting"+i+".json", '{"value":'+i+'}');
+for (var i=0;i<FILES;i+=7)
+  s.write("setting"+i+".json", '{"value":'+i+',"new":1}');
+s.compact();
+for (var i=0;i<10;i++)
+  s.write("late"+i+".json", '{"late":'+i+'}');
+
+var t = getTime();
+var n = 0;
+for (var i=0;i<READS;i++)
+  n += s.read("setting"+((i*37)%FILES)+".json").length;
+print("storage_read: "+Math.round((getTime()-t)*1000)+"ms");
+
+t = getTime();
+for (var i=0;i<READS;i++)
+  if (s.read("missing"+(i%FILES)+".json")!==undefined) n++;
+print("storage_missing: "+Math.round((getTime()-t)*1000)+"ms");
+
+t = getTime();
+for (var i=0;i<READS;i++) {
+  n += s.read("setting0.json").length;
+  n += s.read("setting"+(i%FILES)+".json").length;
+}
+print("storage_hot: "+Math.round((getTime()-t)*1000)+"ms");
+s.eraseAll();
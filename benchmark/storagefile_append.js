@@ -0,0 +1,23 @@
+// Appends to a StorageFile and checks its length - run on Linux builds
+// Writes LINES lines to a log file, reopening it in append mode every REOPEN lines
+// (as an app that logs data would), then calls getLength READS times.
+var s = require("Storage");
+var LINES = 2000;
+var REOPEN = 20;
+var READS = 200;
+
+s.eraseAll();
+var t = getTime();
+var f;
+for (var i=0;i<LINES;i++) {
+  if ((i%REOPEN)==0) f = s.open("log","a");
+  f.write("Line "+i+" of the log file\n");
+}
+print("storagefile_append: "+Math.round((getTime()-t)*1000)+"ms");
+
+t = getTime();
+var n = 0;
+for (var i=0;i<READS;i++)
+  n += s.open("log","r").getLength();
+print("storagefile_length: "+Math.round((getTime()-t)*1000)+"ms");
+s.eraseAll();
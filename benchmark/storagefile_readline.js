@@ -0,0 +1,26 @@
+// Reads a CSV log file from a StorageFile line by line - run on Linux builds
+// Writes LINES lines, then reports the time to read them all with readLine, and
+// (if it exists) with readLines in batches of BATCH.
+var s = require("Storage");
+var LINES = 3000;
+var BATCH = 50;
+
+s.eraseAll();
+var f = s.open("log.csv","w");
+for (var i=0;i<LINES;i++)
+  f.write(i+","+(i*7%1000)+","+(i*13%997)+",sensor reading\n");
+
+var t = getTime();
+var n = 0;
+f = s.open("log.csv","r");
+while (f.readLine()!==undefined) n++;
+print("storagefile_readline: "+Math.round((getTime()-t)*1000)+"ms");
+
+if (f.readLines) {
+  t = getTime();
+  f = s.open("log.csv","r");
+  var lines;
+  while (lines = f.readLines(BATCH)) n += lines.length;
+  print("storagefile_readlines: "+Math.round((getTime()-t)*1000)+"ms");
+}
+s.eraseAll();
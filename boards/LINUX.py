@@ -33,6 +33,26 @@ info = {
 #     'DEFINES+=-DFLASH_64BITS_ALIGNMENT=1', # For testing 64 bit flash writes
 #     'CFLAGS+=-m32', 'LDFLAGS+=-m32', 'DEFINES+=-DUSE_CALLFUNCTION_HACK', # For testing 32 bit builds
      'DEFINES+=-DESPR_UNICODE_SUPPORT=1',
+     'DEFINES+=-DESPR_FUNCTION_TOKEN_CACHE=1', # Tokenise function code on first call for faster subsequent calls
+     'DEFINES+=-DESPR_PROPERTY_CACHE=1', # Cache property lookups in prototype chains
+     'DEFINES+=-DESPR_PROPERTY_INDEX=1', # Hash index for objects with many properties
+     'DEFINES+=-DESPR_SCOPE_SLOTS=1', # Remember where identifiers were found in the current scope
+     'DEFINES+=-DESPR_GC_INCREMENTAL=1', # Garbage collect a little at a time from the idle loop
+     'DEFINES+=-DESPR_FREE_RUN_INDEX=1', # Index free memory by size for best-fit flat string allocation
+     'DEFINES+=-DESPR_STRING_TAIL_CACHE=1', # Remember the ends of strings being appended to
+     'DEFINES+=-DESPR_TIMER_HEAP=1', # Keep timers in a heap so the idle loop doesn't have to check them all
+     'DEFINES+=-DESPR_WATCH_INDEX=1', # Find the watches for a pin event without checking them all
+     'DEFINES+=-DESPR_LINUX_EVENT_WAIT=1', # Block on stdin, devices, GPIO, sockets and a timer rather than polling
+     'DEFINES+=-DESPR_SOCKET_RECV_QUEUE=1', # Queue received socket data in chunks, and stop receiving when the queue is full
+     'DEFINES+=-DESPR_HTTP_KEEP_ALIVE=1', # HTTP/1.1 keep-alive and pipelining for the http server, and pooled connections for http.request
+     'DEFINES+=-DESPR_HTTP_STREAMING=1', # Chunked HTTP bodies are sent when there's no length, and decoded as they arrive. write() returns true while there's buffer space
+     'DEFINES+=-DESPR_STORAGE_HASH_INDEX=1', # Hashed index of Storage filenames, written when compacting, so files can be found without a scan
+     'DEFINES+=-DESPR_USE_STORAGE_CACHE=32', # Add a 32 entry cache to speed up finding files
+     'DEFINES+=-DESPR_STORAGE_IDLE_COMPACT=1', # Compact Storage a few pages at a time when idle, with a journal in case of power loss
+     'DEFINES+=-DESPR_STORAGEFILE_DIRECTORY=1', # StorageFiles keep a record of where they end, so appending and getLength don't read the whole file
+     'DEFINES+=-DESPR_STORAGEFILE_READ_BUFFER=1', # StorageFile.read/readLine/readLines read flash ahead into a buffer kept with the open file
+     'DEFINES+=-DESPR_STORAGE_COMPRESS=1', # Storage.write(name,data,{compress:true}) writes heatshrink-compressed files that are decompressed when read
+     'DEFINES+=-DESPR_SAVE_DELTA=1', # E.setFlags({saveDelta:1}) makes save() only write the parts of RAM that changed since the last save
      'DEFINES+=-DUSE_FONT_6X8 -DGRAPHICS_PALETTED_IMAGES -DGRAPHICS_ANTIALIAS -DESPR_PBF_FONTS',
      'DEFINES+=-DSPIFLASH_BASE=0 -DSPIFLASH_LENGTH=FLASH_SAVED_CODE_LENGTH', # For Testing Flash Strings
      'LINUX=1',
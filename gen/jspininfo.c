@@ -0,0 +1,40 @@
+// auto-generated pin info file
+// for board LINUX
+#include "jspininfo.h"
+
+const JshPinInfo pinInfo[JSH_PIN_COUNT] = {
+/* PD0  */ { JSH_PORTD, JSH_PIN0+0, JSH_ANALOG_NONE, {  } },
+/* PD1  */ { JSH_PORTD, JSH_PIN0+1, JSH_ANALOG_NONE, {  } },
+/* PD2  */ { JSH_PORTD, JSH_PIN0+2, JSH_ANALOG_NONE, {  } },
+/* PD3  */ { JSH_PORTD, JSH_PIN0+3, JSH_ANALOG_NONE, {  } },
+/* PD4  */ { JSH_PORTD, JSH_PIN0+4, JSH_ANALOG_NONE, {  } },
+/* PD5  */ { JSH_PORTD, JSH_PIN0+5, JSH_ANALOG_NONE, {  } },
+/* PD6  */ { JSH_PORTD, JSH_PIN0+6, JSH_ANALOG_NONE, {  } },
+/* PD7  */ { JSH_PORTD, JSH_PIN0+7, JSH_ANALOG_NONE, {  } },
+/* PD8  */ { JSH_PORTD, JSH_PIN0+8, JSH_ANALOG_NONE, {  } },
+/* PD9  */ { JSH_PORTD, JSH_PIN0+9, JSH_ANALOG_NONE, {  } },
+/* PD10 */ { JSH_PORTD, JSH_PIN0+10, JSH_ANALOG_NONE, {  } },
+/* PD11 */ { JSH_PORTD, JSH_PIN0+11, JSH_ANALOG_NONE, {  } },
+/* PD12 */ { JSH_PORTD, JSH_PIN0+12, JSH_ANALOG_NONE, {  } },
+/* PD13 */ { JSH_PORTD, JSH_PIN0+13, JSH_ANALOG_NONE, {  } },
+/* PD14 */ { JSH_PORTD, JSH_PIN0+14, JSH_ANALOG_NONE, {  } },
+/* PD15 */ { JSH_PORTD, JSH_PIN0+15, JSH_ANALOG_NONE, {  } },
+/* PD16 */ { JSH_PORTD, JSH_PIN0+16, JSH_ANALOG_NONE, {  } },
+/* PD17 */ { JSH_PORTD, JSH_PIN0+17, JSH_ANALOG_NONE, {  } },
+/* PD18 */ { JSH_PORTD, JSH_PIN0+18, JSH_ANALOG_NONE, {  } },
+/* PD19 */ { JSH_PORTD, JSH_PIN0+19, JSH_ANALOG_NONE, {  } },
+/* PD20 */ { JSH_PORTD, JSH_PIN0+20, JSH_ANALOG_NONE, {  } },
+/* PD21 */ { JSH_PORTD, JSH_PIN0+21, JSH_ANALOG_NONE, {  } },
+/* PD22 */ { JSH_PORTD, JSH_PIN0+22, JSH_ANALOG_NONE, {  } },
+/* PD23 */ { JSH_PORTD, JSH_PIN0+23, JSH_ANALOG_NONE, {  } },
+/* PD24 */ { JSH_PORTD, JSH_PIN0+24, JSH_ANALOG_NONE, {  } },
+/* PD25 */ { JSH_PORTD, JSH_PIN0+25, JSH_ANALOG_NONE, {  } },
+/* PD26 */ { JSH_PORTD, JSH_PIN0+26, JSH_ANALOG_NONE, {  } },
+/* PD27 */ { JSH_PORTD, JSH_PIN0+27, JSH_ANALOG_NONE, {  } },
+/* PD28 */ { JSH_PORTD, JSH_PIN0+28, JSH_ANALOG_NONE, {  } },
+/* PD29 */ { JSH_PORTD, JSH_PIN0+29, JSH_ANALOG_NONE, {  } },
+/* PD30 */ { JSH_PORTD, JSH_PIN0+30, JSH_ANALOG_NONE, {  } },
+/* PD31 */ { JSH_PORTD, JSH_PIN0+31, JSH_ANALOG_NONE, {  } },
+/* PD32 */ { JSH_PORTD, JSH_PIN0+32, JSH_ANALOG_NONE, {  } },
+};
+
@@ -0,0 +1,1983 @@
+// Automatically generated wrapper file 
+// Generated by scripts/build_jswrapper.py
+
+#include "jswrapper.h"
+#include "jsnative.h"
+#include "jsparse.h"
+#include "libs/graphics/jswrap_graphics.h"
+#include "src/jswrap_pin.h"
+#include "src/jswrap_array.h"
+#include "src/jswrap_arraybuffer.h"
+#include "src/jswrap_dataview.h"
+#include "src/jswrap_date.h"
+#include "src/jswrap_error.h"
+#include "src/jswrap_functions.h"
+#include "src/jswrap_json.h"
+#include "src/jswrap_number.h"
+#include "src/jswrap_object.h"
+#include "src/jswrap_regexp.h"
+#include "src/jswrap_string.h"
+#include "src/jswrap_modules.h"
+#include "src/jswrap_math.h"
+#include "src/jswrap_espruino.h"
+#include "src/jswrap_flash.h"
+#include "src/jswrap_interactive.h"
+#include "src/jswrap_io.h"
+#include "src/jswrap_pipe.h"
+#include "src/jswrap_process.h"
+#include "src/jswrap_onewire.h"
+#include "src/jswrap_promise.h"
+#include "src/jswrap_serial.h"
+#include "src/jswrap_storage.h"
+#include "src/jswrap_spi_i2c.h"
+#include "src/jswrap_stream.h"
+#include "src/jswrap_waveform.h"
+#include "libs/compression/jswrap_heatshrink.h"
+#include "libs/filesystem/jswrap_fs.h"
+#include "libs/filesystem/jswrap_file.h"
+#include "libs/network/jswrap_net.h"
+#include "libs/network/http/jswrap_http.h"
+#include "libs/network/js/jswrap_jsnetwork.h"
+#include "libs/network/telnet/jswrap_telnet.h"
+#include "libs/crypto/jswrap_crypto.h"
+#include "libs/tensorflow/jswrap_tensorflow.h"
+
+
+// -----------------------------------------------------------------------------------------
+// ----------------------------------------------------------------- AUTO-GENERATED WRAPPERS
+// -----------------------------------------------------------------------------------------
+
+static JsVar* gen_jswrap_Array_pop(JsVar *parent) {
+  return jsvSkipNameAndUnLock(jsvArrayPop(parent));
+}
+
+static bool gen_jswrap_Array_isArray(JsVar* var) {
+  return jsvIsArray(var);
+}
+
+static JsVarInt gen_jswrap_ArrayBuffer_byteLength(JsVar *parent) {
+  return (JsVarInt)(parent->varData.arraybuffer.length);
+}
+
+static JsVar* gen_jswrap_Uint8Array_Uint8Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_UINT8, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Uint8ClampedArray_Uint8ClampedArray(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_UINT8|ARRAYBUFFERVIEW_CLAMPED, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Int8Array_Int8Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_INT8, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Uint16Array_Uint16Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_UINT16, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Int16Array_Int16Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_INT16, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Uint24Array_Uint24Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_UINT24, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Uint32Array_Uint32Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_UINT32, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Int32Array_Int32Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_INT32, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Float32Array_Float32Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_FLOAT32, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_Float64Array_Float64Array(JsVar* arr, JsVarInt byteOffset, JsVarInt length) {
+  return jswrap_typedarray_constructor(ARRAYBUFFERVIEW_FLOAT64, arr, byteOffset, length);
+}
+
+static JsVar* gen_jswrap_ArrayBufferView_buffer(JsVar *parent) {
+  return jsvLock(jsvGetFirstChild(parent));
+}
+
+static JsVarInt gen_jswrap_ArrayBufferView_byteLength(JsVar *parent) {
+  return (JsVarInt)(parent->varData.arraybuffer.length * JSV_ARRAYBUFFER_GET_SIZE(parent->varData.arraybuffer.type));
+}
+
+static JsVarInt gen_jswrap_ArrayBufferView_byteOffset(JsVar *parent) {
+  return parent->varData.arraybuffer.byteOffset;
+}
+
+static JsVar* gen_jswrap_DataView_getFloat32(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_FLOAT32, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getFloat64(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_FLOAT64, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getInt8(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_INT8, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getInt16(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_INT16, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getInt32(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_INT32, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getUint8(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_UINT8, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getUint16(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_UINT16, byteOffset, littleEndian);
+}
+
+static JsVar* gen_jswrap_DataView_getUint32(JsVar *parent, JsVarInt byteOffset, bool littleEndian) {
+  return jswrap_dataview_get(parent, ARRAYBUFFERVIEW_UINT32, byteOffset, littleEndian);
+}
+
+static void gen_jswrap_DataView_setFloat32(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_FLOAT32, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setFloat64(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_FLOAT64, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setInt8(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_INT8, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setInt16(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_INT16, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setInt32(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_INT32, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setUint8(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_UINT8, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setUint16(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_UINT16, byteOffset, value, littleEndian);
+}
+
+static void gen_jswrap_DataView_setUint32(JsVar *parent, JsVarInt byteOffset, JsVar* value, bool littleEndian) {
+  jswrap_dataview_set(parent, ARRAYBUFFERVIEW_UINT32, byteOffset, value, littleEndian);
+}
+
+static JsVarFloat gen_jswrap_NaN() {
+  return NAN;
+}
+
+static JsVarFloat gen_jswrap_Infinity() {
+  return INFINITY;
+}
+
+static JsVarFloat gen_jswrap_Number_NaN() {
+  return NAN;
+}
+
+static JsVarFloat gen_jswrap_Number_MAX_VALUE() {
+  return DBL_MAX;
+}
+
+static JsVarFloat gen_jswrap_Number_MIN_VALUE() {
+  return DBL_MIN;
+}
+
+static JsVarFloat gen_jswrap_Number_NEGATIVE_INFINITY() {
+  return -INFINITY;
+}
+
+static JsVarFloat gen_jswrap_Number_POSITIVE_INFINITY() {
+  return INFINITY;
+}
+
+static int gen_jswrap_HIGH() {
+  return 1;
+}
+
+static int gen_jswrap_LOW() {
+  return 0;
+}
+
+static JsVar* gen_jswrap_Object_keys(JsVar* object) {
+  return jswrap_object_keys_or_property_names(object, JSWOKPF_NONE);
+}
+
+static JsVar* gen_jswrap_Object_getOwnPropertyNames(JsVar* object) {
+  return jswrap_object_keys_or_property_names(object, JSWOKPF_INCLUDE_NON_ENUMERABLE);
+}
+
+static JsVar* gen_jswrap_Object_values(JsVar* object) {
+  return jswrap_object_values_or_entries(object, false);;
+}
+
+static JsVar* gen_jswrap_Object_entries(JsVar* object) {
+  return jswrap_object_values_or_entries(object, true);;
+}
+
+static int gen_jswrap_String_indexOf(JsVar *parent, JsVar* substring, JsVar* fromIndex) {
+  return jswrap_string_indexOf(parent, substring, fromIndex, false);
+}
+
+static int gen_jswrap_String_lastIndexOf(JsVar *parent, JsVar* substring, JsVar* fromIndex) {
+  return jswrap_string_indexOf(parent, substring, fromIndex, true);
+}
+
+static JsVar* gen_jswrap_String_toLowerCase(JsVar *parent) {
+  return jswrap_string_toUpperLowerCase(parent, false);
+}
+
+static JsVar* gen_jswrap_String_toUpperCase(JsVar *parent) {
+  return jswrap_string_toUpperLowerCase(parent, true);
+}
+
+static JsVar* gen_jswrap_String_removeAccents(JsVar *parent) {
+  return jswrap_string_removeAccents(parent);
+}
+
+static bool gen_jswrap_String_includes(JsVar *parent, JsVar* substring, JsVar* fromIndex) {
+  return jswrap_string_indexOf(parent, substring, fromIndex, false)>=0;
+}
+
+static JsVar* gen_jswrap_String_padStart(JsVar *parent, JsVarInt targetLength, JsVar* padString) {
+  return jswrap_string_padX(parent, targetLength, padString, true);
+}
+
+static JsVar* gen_jswrap_String_padEnd(JsVar *parent, JsVarInt targetLength, JsVar* padString) {
+  return jswrap_string_padX(parent, targetLength, padString, false);
+}
+
+static JsVarFloat gen_jswrap_Math_E() {
+  return 2.718281828459045;
+}
+
+static JsVarFloat gen_jswrap_Math_PI() {
+  return PI;
+}
+
+static JsVarFloat gen_jswrap_Math_LN2() {
+  return 0.6931471805599453;
+}
+
+static JsVarFloat gen_jswrap_Math_LN10() {
+  return 2.302585092994046;
+}
+
+static JsVarFloat gen_jswrap_Math_LOG2E() {
+  return 1.4426950408889634;
+}
+
+static JsVarFloat gen_jswrap_Math_LOG10E() {
+  return 0.4342944819032518;
+}
+
+static JsVarFloat gen_jswrap_Math_SQRT2() {
+  return 1.4142135623730951;
+}
+
+static JsVarFloat gen_jswrap_Math_SQRT1_2() {
+  return 0.7071067811865476;
+}
+
+static JsVarFloat gen_jswrap_Math_acos(JsVarFloat x) {
+  return (PI/2) - jswrap_math_asin(x);
+}
+
+static JsVarFloat gen_jswrap_Math_random() {
+  return (JsVarFloat)rand() / (JsVarFloat)RAND_MAX;
+}
+
+static JsVarFloat gen_jswrap_Math_tan(JsVarFloat theta) {
+  return jswrap_math_sin(theta) / jswrap_math_sin(theta+(PI/2));
+}
+
+static JsVarFloat gen_jswrap_Math_min(JsVar* args) {
+  return jswrap_math_minmax(args, false);
+}
+
+static JsVarFloat gen_jswrap_Math_max(JsVar* args) {
+  return jswrap_math_minmax(args, true);
+}
+
+static JsVarFloat gen_jswrap_E_getAnalogVRef() {
+  return jshReadVRef();
+}
+
+static void gen_jswrap_dump() {
+  jsiDumpState(vcbprintf_callback_jsiConsolePrintString, 0);
+}
+
+static void gen_jswrap_save() {
+  jsiStatus|=JSIS_TODO_FLASH_SAVE;;
+}
+
+static JsVarFloat gen_jswrap_getTime() {
+  return (JsVarFloat)jshGetSystemTime() / (JsVarFloat)jshGetTimeFromMilliseconds(1000);
+}
+
+static JsVar* gen_jswrap_peek8(JsVarInt addr, JsVarInt count) {
+  return jswrap_io_peek(addr,count,1);
+}
+
+static void gen_jswrap_poke8(JsVarInt addr, JsVar* value) {
+  jswrap_io_poke(addr,value,1);
+}
+
+static JsVar* gen_jswrap_peek16(JsVarInt addr, JsVarInt count) {
+  return jswrap_io_peek(addr,count,2);
+}
+
+static void gen_jswrap_poke16(JsVarInt addr, JsVar* value) {
+  jswrap_io_poke(addr,value,2);
+}
+
+static JsVar* gen_jswrap_peek32(JsVarInt addr, JsVarInt count) {
+  return jswrap_io_peek(addr,count,4);
+}
+
+static void gen_jswrap_poke32(JsVarInt addr, JsVar* value) {
+  jswrap_io_poke(addr,value,4);
+}
+
+static JsVar* gen_jswrap_process_version() {
+  return jsvNewFromString(JS_VERSION);
+}
+
+static JsVar* gen_jswrap_Serial_find(Pin pin) {
+  return jshGetDeviceObjectFor(JSH_USART1, JSH_USARTMAX, pin);
+}
+
+static JsVar* gen_jswrap_USB() {
+  return jspNewObject("USB", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial1() {
+  return jspNewObject("Serial1", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial2() {
+  return jspNewObject("Serial2", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial3() {
+  return jspNewObject("Serial3", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial4() {
+  return jspNewObject("Serial4", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial5() {
+  return jspNewObject("Serial5", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Serial6() {
+  return jspNewObject("Serial6", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_LoopbackA() {
+  return jspNewObject("LoopbackA", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_LoopbackB() {
+  return jspNewObject("LoopbackB", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_Telnet() {
+  return jspNewObject("Telnet", "Serial") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_SPI1() {
+  return jspNewObject("SPI1", "SPI") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_SPI2() {
+  return jspNewObject("SPI2", "SPI") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_SPI3() {
+  return jspNewObject("SPI3", "SPI") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_SPI_find(Pin pin) {
+  return jshGetDeviceObjectFor(JSH_SPI1, JSH_SPIMAX, pin);
+}
+
+static JsVar* gen_jswrap_I2C_find(Pin pin) {
+  return jshGetDeviceObjectFor(JSH_I2C1, JSH_I2CMAX, pin);
+}
+
+static JsVar* gen_jswrap_I2C1() {
+  return jspNewObject("I2C1", "I2C") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_I2C2() {
+  return jspNewObject("I2C2", "I2C") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static JsVar* gen_jswrap_I2C3() {
+  return jspNewObject("I2C3", "I2C") /* needs JSWAT_EXECUTE_IMMEDIATELY */;
+}
+
+static bool gen_jswrap_fs_writeFile(JsVar* path, JsVar* data) {
+  return  jswrap_fs_writeOrAppendFile(path, data, false);
+}
+
+static bool gen_jswrap_fs_writeFileSync(JsVar* path, JsVar* data) {
+  return  jswrap_fs_writeOrAppendFile(path, data, false);
+}
+
+static bool gen_jswrap_fs_appendFile(JsVar* path, JsVar* data) {
+  return  jswrap_fs_writeOrAppendFile(path, data, true);
+}
+
+static bool gen_jswrap_fs_appendFileSync(JsVar* path, JsVar* data) {
+  return jswrap_fs_writeOrAppendFile(path, data, true);
+}
+
+static void gen_jswrap_File_close(JsVar *parent) {
+  jswrap_file_close(parent);
+}
+
+static void gen_jswrap_File_skip(JsVar *parent, int nBytes) {
+  jswrap_file_skip_or_seek(parent,nBytes,true);
+}
+
+static void gen_jswrap_File_seek(JsVar *parent, int nBytes) {
+  jswrap_file_skip_or_seek(parent,nBytes,false);
+}
+
+static JsVarInt gen_jswrap_Graphics_getWidth(JsVar *parent) {
+  return jswrap_graphics_getWidthOrHeight(parent, false);
+}
+
+static JsVarInt gen_jswrap_Graphics_getHeight(JsVar *parent) {
+  return jswrap_graphics_getWidthOrHeight(parent, true);
+}
+
+static JsVar* gen_jswrap_Graphics_setColor(JsVar *parent, JsVar* r, JsVar* g, JsVar* b) {
+  return jswrap_graphics_setColorX(parent, r,g,b, true);
+}
+
+static JsVar* gen_jswrap_Graphics_setBgColor(JsVar *parent, JsVar* r, JsVar* g, JsVar* b) {
+  return jswrap_graphics_setColorX(parent, r,g,b, false);
+}
+
+static JsVarInt gen_jswrap_Graphics_getColor(JsVar *parent) {
+  return jswrap_graphics_getColorX(parent, true);
+}
+
+static JsVarInt gen_jswrap_Graphics_getBgColor(JsVar *parent) {
+  return jswrap_graphics_getColorX(parent, false);
+}
+
+static JsVar* gen_jswrap_Graphics_setFontBitmap(JsVar *parent) {
+  return jswrap_graphics_setFontSizeX(parent, 1+JSGRAPHICS_FONTSIZE_4X6, false);
+}
+
+static JsVar* gen_jswrap_Graphics_setFontVector(JsVar *parent, int size) {
+  return jswrap_graphics_setFontSizeX(parent, size, true);
+}
+
+static JsVar* gen_jswrap_Graphics_drawPoly(JsVar *parent, JsVar* poly, bool closed) {
+  return jswrap_graphics_drawPoly_X(parent, poly, closed, false);
+}
+
+static JsVar* gen_jswrap_Graphics_drawPolyAA(JsVar *parent, JsVar* poly, bool closed) {
+  return jswrap_graphics_drawPoly_X(parent, poly, closed, true);
+}
+
+static JsVar* gen_jswrap_Graphics_fillPoly(JsVar *parent, JsVar* poly) {
+  return jswrap_graphics_fillPoly_X(parent, poly, false);;
+}
+
+static JsVar* gen_jswrap_Graphics_fillPolyAA(JsVar *parent, JsVar* poly) {
+  return jswrap_graphics_fillPoly_X(parent, poly, true);;
+}
+
+static JsVar* gen_jswrap_net_connect(JsVar* options, JsVar* callback) {
+  return jswrap_net_connect(options, callback, ST_NORMAL);
+}
+
+static JsVar* gen_jswrap_dgram_createSocket(JsVar* type, JsVar* callback) {
+  return jswrap_dgram_createSocket(type, callback);
+}
+
+static JsVar* gen_jswrap_tls_connect(JsVar* options, JsVar* callback) {
+  return jswrap_net_connect(options, callback, ST_NORMAL | ST_TLS);
+}
+
+static JsVar* gen_jswrap_Server_listen(JsVar *parent, int port) {
+  return jswrap_net_server_listen(parent, port, ST_NORMAL);
+}
+
+static JsVar* gen_jswrap_http_request(JsVar* options, JsVar* callback) {
+  return jswrap_net_connect(options, callback, ST_HTTP);
+}
+
+static JsVar* gen_jswrap_httpSrv_listen(JsVar *parent, int port) {
+  return jswrap_net_server_listen(parent, port, ST_HTTP);
+}
+
+static JsVar* gen_jswrap_crypto_AES() {
+  return jspNewBuiltin("AES");;
+}
+
+static JsVar* gen_jswrap_crypto_SHA1(JsVar* message) {
+  return jswrap_crypto_SHAx(message, 1);
+}
+
+static JsVar* gen_jswrap_crypto_SHA224(JsVar* message) {
+  return jswrap_crypto_SHAx(message, 224);
+}
+
+static JsVar* gen_jswrap_crypto_SHA256(JsVar* message) {
+  return jswrap_crypto_SHAx(message, 256);
+}
+
+static JsVar* gen_jswrap_crypto_SHA384(JsVar* message) {
+  return jswrap_crypto_SHAx(message, 384);
+}
+
+static JsVar* gen_jswrap_crypto_SHA512(JsVar* message) {
+  return jswrap_crypto_SHAx(message, 512);
+}
+
+static JsVar* gen_jswrap_ArrayBufferView_ArrayBufferView() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_console_console() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_JSON_JSON() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Modules_Modules() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Math_Math() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_E_E() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Flash_Flash() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_fs_fs() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_process_process() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Storage_Storage() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_StorageFile_StorageFile() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_heatshrink_heatshrink() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_File_File() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Graphics_Graphics() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_url_url() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_net_net() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Server_Server() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_Socket_Socket() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_dgram_dgram() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_dgramSocket_dgramSocket() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_tls_tls() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_http_http() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_httpSrv_httpSrv() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_httpSRq_httpSRq() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_httpSRs_httpSRs() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_httpCRq_httpCRq() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_httpCRs_httpCRs() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_NetworkJS_NetworkJS() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_TelnetServer_TelnetServer() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_crypto_crypto() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_AES_AES() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_tensorflow_tensorflow() {
+  return NULL;
+}
+
+static JsVar* gen_jswrap_TFMicroInterpreter_TFMicroInterpreter() {
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------
+
+
+// Binary search coded to allow for JswSyms to be in flash on the esp8266 where they require
+// word accesses
+JsVar *jswBinarySearch(const JswSymList *symbolsPtr, JsVar *parent, const char *name) {
+  uint8_t symbolCount = READ_FLASH_UINT8(&symbolsPtr->symbolCount);
+  int searchMin = 0;
+  int searchMax = symbolCount - 1;
+  while (searchMin <= searchMax) {
+    int idx = (searchMin+searchMax) >> 1;
+    const JswSymPtr *sym = &symbolsPtr->symbols[idx];
+    int cmp = FLASH_STRCMP(name, &symbolsPtr->symbolChars[JSWSYMPTR_OFFSET(sym)]);
+    if (cmp==0) {
+      unsigned short functionSpec = sym->functionSpec;
+      if ((functionSpec & JSWAT_EXECUTE_IMMEDIATELY_MASK) == JSWAT_EXECUTE_IMMEDIATELY)
+        return jsnCallFunction(JSWSYMPTR_FUNCTION_PTR(sym), functionSpec, parent, 0, 0);
+      return jsvNewNativeFunction(JSWSYMPTR_FUNCTION_PTR(sym), functionSpec);
+    } else {
+      if (cmp<0) {
+        // searchMin is the same
+        searchMax = idx-1;
+      } else {
+        searchMin = idx+1;
+        // searchMax is the same
+      }
+    }
+  }
+  return 0;
+}
+
+
+// -----------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------------------
+
+
+#ifdef ESP8266
+#define FLASH_SECT __attribute__((section(".irom.literal2"))) __attribute__((aligned(4)))
+#else
+#define FLASH_SECT
+#endif
+
+static const JswSymPtr jswSymbols_Pin[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_Pin = 0;
+static const JswSymPtr jswSymbols_Pin_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG, (void*)jswrap_pin_analog),
+  JSWSYMPTR_ENTRY(7, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_pin_getInfo),
+  JSWSYMPTR_ENTRY(15, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_pin_getMode),
+  JSWSYMPTR_ENTRY(23, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_pin_mode),
+  JSWSYMPTR_ENTRY(28, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pin_pulse),
+  JSWSYMPTR_ENTRY(34, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pin_pwm),
+  JSWSYMPTR_ENTRY(38, JSWAT_BOOL | JSWAT_THIS_ARG, (void*)jswrap_pin_read),
+  JSWSYMPTR_ENTRY(43, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_pin_reset),
+  JSWSYMPTR_ENTRY(49, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_pin_set),
+  JSWSYMPTR_ENTRY(53, JSWAT_BOOL | JSWAT_THIS_ARG, (void*)jswrap_pin_toggle),
+  JSWSYMPTR_ENTRY(60, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_pin_write),
+  JSWSYMPTR_ENTRY(66, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)jswrap_pin_writeAtTime)
+};
+static const unsigned char jswSymbolIndex_Pin_proto = 1;
+static const JswSymPtr jswSymbols_global[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR, (void*)gen_jswrap_AES_AES),
+  JSWSYMPTR_ENTRY(4, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_array_constructor),
+  JSWSYMPTR_ENTRY(10, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_arraybuffer_constructor),
+  JSWSYMPTR_ENTRY(22, JSWAT_JSVAR, (void*)gen_jswrap_ArrayBufferView_ArrayBufferView),
+  JSWSYMPTR_ENTRY(38, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_boolean_constructor),
+  JSWSYMPTR_ENTRY(46, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_dataview_constructor),
+  JSWSYMPTR_ENTRY(55, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_date_constructor),
+  JSWSYMPTR_ENTRY(60, JSWAT_JSVAR, (void*)gen_jswrap_E_E),
+  JSWSYMPTR_ENTRY(62, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_error_constructor),
+  JSWSYMPTR_ENTRY(68, JSWAT_JSVAR, (void*)gen_jswrap_File_File),
+  JSWSYMPTR_ENTRY(73, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Float32Array_Float32Array),
+  JSWSYMPTR_ENTRY(86, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Float64Array_Float64Array),
+  JSWSYMPTR_ENTRY(99, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_function_constructor),
+  JSWSYMPTR_ENTRY(108, JSWAT_JSVAR, (void*)gen_jswrap_Graphics_Graphics),
+  JSWSYMPTR_ENTRY(117, JSWAT_INT32 | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_HIGH),
+  JSWSYMPTR_ENTRY(122, JSWAT_JSVAR, (void*)jswrap_i2c_constructor),
+  JSWSYMPTR_ENTRY(126, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_I2C1),
+  JSWSYMPTR_ENTRY(131, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_I2C2),
+  JSWSYMPTR_ENTRY(136, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_I2C3),
+  JSWSYMPTR_ENTRY(141, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Infinity),
+  JSWSYMPTR_ENTRY(150, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Int16Array_Int16Array),
+  JSWSYMPTR_ENTRY(161, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Int32Array_Int32Array),
+  JSWSYMPTR_ENTRY(172, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Int8Array_Int8Array),
+  JSWSYMPTR_ENTRY(182, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_internalerror_constructor),
+  JSWSYMPTR_ENTRY(196, JSWAT_JSVAR, (void*)gen_jswrap_JSON_JSON),
+  JSWSYMPTR_ENTRY(201, JSWAT_INT32 | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_LOW),
+  JSWSYMPTR_ENTRY(205, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_LoopbackA),
+  JSWSYMPTR_ENTRY(215, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_LoopbackB),
+  JSWSYMPTR_ENTRY(225, JSWAT_JSVAR, (void*)gen_jswrap_Math_Math),
+  JSWSYMPTR_ENTRY(230, JSWAT_JSVAR, (void*)gen_jswrap_Modules_Modules),
+  JSWSYMPTR_ENTRY(238, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_NaN),
+  JSWSYMPTR_ENTRY(242, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_number_constructor),
+  JSWSYMPTR_ENTRY(249, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_constructor),
+  JSWSYMPTR_ENTRY(256, JSWAT_JSVAR | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)jswrap_onewire_constructor),
+  JSWSYMPTR_ENTRY(264, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_pin_constructor),
+  JSWSYMPTR_ENTRY(268, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_promise_constructor),
+  JSWSYMPTR_ENTRY(276, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_referenceerror_constructor),
+  JSWSYMPTR_ENTRY(291, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_regexp_constructor),
+  JSWSYMPTR_ENTRY(298, JSWAT_JSVAR, (void*)jswrap_spi_constructor),
+  JSWSYMPTR_ENTRY(302, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_SPI1),
+  JSWSYMPTR_ENTRY(307, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_SPI2),
+  JSWSYMPTR_ENTRY(312, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_SPI3),
+  JSWSYMPTR_ENTRY(317, JSWAT_JSVAR, (void*)jswrap_serial_constructor),
+  JSWSYMPTR_ENTRY(324, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial1),
+  JSWSYMPTR_ENTRY(332, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial2),
+  JSWSYMPTR_ENTRY(340, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial3),
+  JSWSYMPTR_ENTRY(348, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial4),
+  JSWSYMPTR_ENTRY(356, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial5),
+  JSWSYMPTR_ENTRY(364, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Serial6),
+  JSWSYMPTR_ENTRY(372, JSWAT_JSVAR, (void*)gen_jswrap_Server_Server),
+  JSWSYMPTR_ENTRY(379, JSWAT_JSVAR, (void*)gen_jswrap_Socket_Socket),
+  JSWSYMPTR_ENTRY(386, JSWAT_JSVAR, (void*)gen_jswrap_StorageFile_StorageFile),
+  JSWSYMPTR_ENTRY(398, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_string_constructor),
+  JSWSYMPTR_ENTRY(405, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_syntaxerror_constructor),
+  JSWSYMPTR_ENTRY(417, JSWAT_JSVAR, (void*)gen_jswrap_TFMicroInterpreter_TFMicroInterpreter),
+  JSWSYMPTR_ENTRY(436, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Telnet),
+  JSWSYMPTR_ENTRY(443, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_typeerror_constructor),
+  JSWSYMPTR_ENTRY(453, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_USB),
+  JSWSYMPTR_ENTRY(457, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Uint16Array_Uint16Array),
+  JSWSYMPTR_ENTRY(469, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Uint24Array_Uint24Array),
+  JSWSYMPTR_ENTRY(481, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Uint32Array_Uint32Array),
+  JSWSYMPTR_ENTRY(493, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Uint8Array_Uint8Array),
+  JSWSYMPTR_ENTRY(504, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)gen_jswrap_Uint8ClampedArray_Uint8ClampedArray),
+  JSWSYMPTR_ENTRY(522, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_waveform_constructor),
+  JSWSYMPTR_ENTRY(531, JSWAT_JSVARFLOAT | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)jshPinAnalog),
+  JSWSYMPTR_ENTRY(542, JSWAT_VOID | (JSWAT_PIN << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_io_analogWrite),
+  JSWSYMPTR_ENTRY(554, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_arguments),
+  JSWSYMPTR_ENTRY(564, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_atob),
+  JSWSYMPTR_ENTRY(569, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_btoa),
+  JSWSYMPTR_ENTRY(574, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)jswrap_interface_changeInterval),
+  JSWSYMPTR_ENTRY(589, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_interface_clearInterval),
+  JSWSYMPTR_ENTRY(603, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_interface_clearTimeout),
+  JSWSYMPTR_ENTRY(616, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_interface_clearWatch),
+  JSWSYMPTR_ENTRY(627, JSWAT_JSVAR, (void*)gen_jswrap_console_console),
+  JSWSYMPTR_ENTRY(635, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_decodeURIComponent),
+  JSWSYMPTR_ENTRY(654, JSWAT_JSVAR, (void*)gen_jswrap_dgramSocket_dgramSocket),
+  JSWSYMPTR_ENTRY(666, JSWAT_VOID | (JSWAT_PIN << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_io_digitalPulse),
+  JSWSYMPTR_ENTRY(679, JSWAT_INT32 | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_io_digitalRead),
+  JSWSYMPTR_ENTRY(691, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_io_digitalWrite),
+  JSWSYMPTR_ENTRY(704, JSWAT_VOID, (void*)gen_jswrap_dump),
+  JSWSYMPTR_ENTRY(709, JSWAT_VOID | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_interface_echo),
+  JSWSYMPTR_ENTRY(714, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_interface_edit),
+  JSWSYMPTR_ENTRY(719, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_encodeURIComponent),
+  JSWSYMPTR_ENTRY(738, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_eval),
+  JSWSYMPTR_ENTRY(743, JSWAT_JSVAR | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)jswrap_io_getPinMode),
+  JSWSYMPTR_ENTRY(754, JSWAT_JSVAR, (void*)jswrap_interface_getSerial),
+  JSWSYMPTR_ENTRY(764, JSWAT_JSVARFLOAT, (void*)gen_jswrap_getTime),
+  JSWSYMPTR_ENTRY(772, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_global),
+  JSWSYMPTR_ENTRY(779, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_global),
+  JSWSYMPTR_ENTRY(790, JSWAT_JSVAR, (void*)gen_jswrap_httpCRq_httpCRq),
+  JSWSYMPTR_ENTRY(798, JSWAT_JSVAR, (void*)gen_jswrap_httpCRs_httpCRs),
+  JSWSYMPTR_ENTRY(806, JSWAT_JSVAR, (void*)gen_jswrap_httpSRq_httpSRq),
+  JSWSYMPTR_ENTRY(814, JSWAT_JSVAR, (void*)gen_jswrap_httpSRs_httpSRs),
+  JSWSYMPTR_ENTRY(822, JSWAT_JSVAR, (void*)gen_jswrap_httpSrv_httpSrv),
+  JSWSYMPTR_ENTRY(830, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_isFinite),
+  JSWSYMPTR_ENTRY(839, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_isNaN),
+  JSWSYMPTR_ENTRY(845, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_interface_load),
+  JSWSYMPTR_ENTRY(850, JSWAT_JSVARFLOAT | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_parseFloat),
+  JSWSYMPTR_ENTRY(861, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_parseInt),
+  JSWSYMPTR_ENTRY(870, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)gen_jswrap_peek16),
+  JSWSYMPTR_ENTRY(877, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)gen_jswrap_peek32),
+  JSWSYMPTR_ENTRY(884, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)gen_jswrap_peek8),
+  JSWSYMPTR_ENTRY(890, JSWAT_VOID | (JSWAT_PIN << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)jswrap_io_pinMode),
+  JSWSYMPTR_ENTRY(898, JSWAT_VOID | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_poke16),
+  JSWSYMPTR_ENTRY(905, JSWAT_VOID | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_poke32),
+  JSWSYMPTR_ENTRY(912, JSWAT_VOID | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_poke8),
+  JSWSYMPTR_ENTRY(918, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print),
+  JSWSYMPTR_ENTRY(924, JSWAT_JSVAR, (void*)gen_jswrap_process_process),
+  JSWSYMPTR_ENTRY(932, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_require),
+  JSWSYMPTR_ENTRY(940, JSWAT_VOID | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_interface_reset),
+  JSWSYMPTR_ENTRY(946, JSWAT_VOID, (void*)gen_jswrap_save),
+  JSWSYMPTR_ENTRY(951, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_interface_setBusyIndicator),
+  JSWSYMPTR_ENTRY(968, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*3)), (void*)jswrap_interface_setInterval),
+  JSWSYMPTR_ENTRY(980, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_interface_setSleepIndicator),
+  JSWSYMPTR_ENTRY(998, JSWAT_VOID | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_interactive_setTime),
+  JSWSYMPTR_ENTRY(1006, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*3)), (void*)jswrap_interface_setTimeout),
+  JSWSYMPTR_ENTRY(1017, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_PIN << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_interface_setWatch),
+  JSWSYMPTR_ENTRY(1026, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_io_shiftOut),
+  JSWSYMPTR_ENTRY(1035, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_trace),
+  JSWSYMPTR_ENTRY(1041, JSWAT_JSVAR, (void*)gen_jswrap_url_url)
+};
+static const unsigned char jswSymbolIndex_global = 2;
+static const JswSymPtr jswSymbols_Array_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_array_concat),
+  JSWSYMPTR_ENTRY(7, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_every),
+  JSWSYMPTR_ENTRY(13, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_array_fill),
+  JSWSYMPTR_ENTRY(18, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_filter),
+  JSWSYMPTR_ENTRY(25, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_find),
+  JSWSYMPTR_ENTRY(30, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_findIndex),
+  JSWSYMPTR_ENTRY(40, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_forEach),
+  JSWSYMPTR_ENTRY(48, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_array_includes),
+  JSWSYMPTR_ENTRY(57, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_array_indexOf),
+  JSWSYMPTR_ENTRY(65, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_join),
+  JSWSYMPTR_ENTRY(70, JSWAT_JSVAR | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_object_length),
+  JSWSYMPTR_ENTRY(77, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_map),
+  JSWSYMPTR_ENTRY(81, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)gen_jswrap_Array_pop),
+  JSWSYMPTR_ENTRY(85, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_array_push),
+  JSWSYMPTR_ENTRY(90, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_reduce),
+  JSWSYMPTR_ENTRY(97, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_array_reverse),
+  JSWSYMPTR_ENTRY(105, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_array_shift),
+  JSWSYMPTR_ENTRY(111, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_slice),
+  JSWSYMPTR_ENTRY(117, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_some),
+  JSWSYMPTR_ENTRY(122, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_sort),
+  JSWSYMPTR_ENTRY(127, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*3)), (void*)jswrap_array_splice),
+  JSWSYMPTR_ENTRY(134, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_toString),
+  JSWSYMPTR_ENTRY(143, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_array_unshift)
+};
+static const unsigned char jswSymbolIndex_Array_proto = 3;
+static const JswSymPtr jswSymbols_Array[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Array_isArray)
+};
+static const unsigned char jswSymbolIndex_Array = 4;
+static const JswSymPtr jswSymbols_ArrayBuffer_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_ArrayBuffer_byteLength)
+};
+static const unsigned char jswSymbolIndex_ArrayBuffer_proto = 5;
+static const JswSymPtr jswSymbols_ArrayBufferView_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_ArrayBufferView_buffer),
+  JSWSYMPTR_ENTRY(7, JSWAT_INT32 | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_ArrayBufferView_byteLength),
+  JSWSYMPTR_ENTRY(18, JSWAT_INT32 | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_ArrayBufferView_byteOffset),
+  JSWSYMPTR_ENTRY(29, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_array_fill),
+  JSWSYMPTR_ENTRY(34, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_filter),
+  JSWSYMPTR_ENTRY(41, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_find),
+  JSWSYMPTR_ENTRY(46, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_findIndex),
+  JSWSYMPTR_ENTRY(56, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_forEach),
+  JSWSYMPTR_ENTRY(64, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_array_includes),
+  JSWSYMPTR_ENTRY(73, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_array_indexOf),
+  JSWSYMPTR_ENTRY(81, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_array_join),
+  JSWSYMPTR_ENTRY(86, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_arraybufferview_map),
+  JSWSYMPTR_ENTRY(90, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_reduce),
+  JSWSYMPTR_ENTRY(97, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_array_reverse),
+  JSWSYMPTR_ENTRY(105, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_arraybufferview_set),
+  JSWSYMPTR_ENTRY(109, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_array_slice),
+  JSWSYMPTR_ENTRY(115, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_arraybufferview_sort),
+  JSWSYMPTR_ENTRY(120, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_arraybufferview_subarray)
+};
+static const unsigned char jswSymbolIndex_ArrayBufferView_proto = 6;
+static const JswSymPtr jswSymbols_DataView_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getFloat32),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getFloat64),
+  JSWSYMPTR_ENTRY(22, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getInt16),
+  JSWSYMPTR_ENTRY(31, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getInt32),
+  JSWSYMPTR_ENTRY(40, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getInt8),
+  JSWSYMPTR_ENTRY(48, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getUint16),
+  JSWSYMPTR_ENTRY(58, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getUint32),
+  JSWSYMPTR_ENTRY(68, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_DataView_getUint8),
+  JSWSYMPTR_ENTRY(77, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setFloat32),
+  JSWSYMPTR_ENTRY(88, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setFloat64),
+  JSWSYMPTR_ENTRY(99, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setInt16),
+  JSWSYMPTR_ENTRY(108, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setInt32),
+  JSWSYMPTR_ENTRY(117, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setInt8),
+  JSWSYMPTR_ENTRY(125, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setUint16),
+  JSWSYMPTR_ENTRY(135, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setUint32),
+  JSWSYMPTR_ENTRY(145, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)gen_jswrap_DataView_setUint8)
+};
+static const unsigned char jswSymbolIndex_DataView_proto = 7;
+static const JswSymPtr jswSymbols_Date[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVARFLOAT, (void*)jswrap_date_now),
+  JSWSYMPTR_ENTRY(4, JSWAT_JSVARFLOAT | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_date_parse)
+};
+static const unsigned char jswSymbolIndex_Date = 8;
+static const JswSymPtr jswSymbols_Date_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getDate),
+  JSWSYMPTR_ENTRY(8, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getDay),
+  JSWSYMPTR_ENTRY(15, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getFullYear),
+  JSWSYMPTR_ENTRY(27, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getHours),
+  JSWSYMPTR_ENTRY(36, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getIsDST),
+  JSWSYMPTR_ENTRY(45, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getMilliseconds),
+  JSWSYMPTR_ENTRY(61, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getMinutes),
+  JSWSYMPTR_ENTRY(72, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getMonth),
+  JSWSYMPTR_ENTRY(81, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getSeconds),
+  JSWSYMPTR_ENTRY(92, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG, (void*)jswrap_date_getTime),
+  JSWSYMPTR_ENTRY(100, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_date_getTimezoneOffset),
+  JSWSYMPTR_ENTRY(118, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_date_setDate),
+  JSWSYMPTR_ENTRY(126, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_date_setFullYear),
+  JSWSYMPTR_ENTRY(138, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)) | (JSWAT_JSVAR << (JSWAT_BITS*4)), (void*)jswrap_date_setHours),
+  JSWSYMPTR_ENTRY(147, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_date_setMilliseconds),
+  JSWSYMPTR_ENTRY(163, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_date_setMinutes),
+  JSWSYMPTR_ENTRY(174, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_date_setMonth),
+  JSWSYMPTR_ENTRY(183, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_date_setSeconds),
+  JSWSYMPTR_ENTRY(194, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_date_setTime),
+  JSWSYMPTR_ENTRY(202, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_date_toISOString),
+  JSWSYMPTR_ENTRY(214, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_date_toISOString),
+  JSWSYMPTR_ENTRY(221, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_date_toLocalISOString),
+  JSWSYMPTR_ENTRY(238, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_date_toString),
+  JSWSYMPTR_ENTRY(247, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_date_toUTCString),
+  JSWSYMPTR_ENTRY(259, JSWAT_JSVARFLOAT | JSWAT_THIS_ARG, (void*)jswrap_date_getTime)
+};
+static const unsigned char jswSymbolIndex_Date_proto = 9;
+static const JswSymPtr jswSymbols_Error_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_error_toString)
+};
+static const unsigned char jswSymbolIndex_Error_proto = 10;
+static const JswSymPtr jswSymbols_SyntaxError_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_error_toString)
+};
+static const unsigned char jswSymbolIndex_SyntaxError_proto = 11;
+static const JswSymPtr jswSymbols_TypeError_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_error_toString)
+};
+static const unsigned char jswSymbolIndex_TypeError_proto = 12;
+static const JswSymPtr jswSymbols_InternalError_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_error_toString)
+};
+static const unsigned char jswSymbolIndex_InternalError_proto = 13;
+static const JswSymPtr jswSymbols_ReferenceError_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_error_toString)
+};
+static const unsigned char jswSymbolIndex_ReferenceError_proto = 14;
+static const JswSymPtr jswSymbols_console[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print),
+  JSWSYMPTR_ENTRY(6, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print),
+  JSWSYMPTR_ENTRY(12, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print),
+  JSWSYMPTR_ENTRY(17, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print),
+  JSWSYMPTR_ENTRY(21, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_print)
+};
+static const unsigned char jswSymbolIndex_console = 15;
+static const JswSymPtr jswSymbols_JSON[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_json_parse),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_json_stringify)
+};
+static const unsigned char jswSymbolIndex_JSON = 16;
+static const JswSymPtr jswSymbols_Number[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Number_MAX_VALUE),
+  JSWSYMPTR_ENTRY(10, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Number_MIN_VALUE),
+  JSWSYMPTR_ENTRY(20, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Number_NEGATIVE_INFINITY),
+  JSWSYMPTR_ENTRY(38, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Number_NaN),
+  JSWSYMPTR_ENTRY(42, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Number_POSITIVE_INFINITY)
+};
+static const unsigned char jswSymbolIndex_Number = 17;
+static const JswSymPtr jswSymbols_Number_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_number_toFixed)
+};
+static const unsigned char jswSymbolIndex_Number_proto = 18;
+static const JswSymPtr jswSymbols_Object_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_on),
+  JSWSYMPTR_ENTRY(12, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_object_clone),
+  JSWSYMPTR_ENTRY(18, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*2)), (void*)jswrap_object_emit),
+  JSWSYMPTR_ENTRY(23, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_hasOwnProperty),
+  JSWSYMPTR_ENTRY(38, JSWAT_JSVAR | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_object_length),
+  JSWSYMPTR_ENTRY(45, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_on),
+  JSWSYMPTR_ENTRY(48, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_prependListener),
+  JSWSYMPTR_ENTRY(64, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_removeAllListeners),
+  JSWSYMPTR_ENTRY(83, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_removeListener),
+  JSWSYMPTR_ENTRY(98, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_toString),
+  JSWSYMPTR_ENTRY(107, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_object_valueOf)
+};
+static const unsigned char jswSymbolIndex_Object_proto = 19;
+static const JswSymPtr jswSymbols_Object[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_object_assign),
+  JSWSYMPTR_ENTRY(7, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_create),
+  JSWSYMPTR_ENTRY(14, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_defineProperties),
+  JSWSYMPTR_ENTRY(31, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_object_defineProperty),
+  JSWSYMPTR_ENTRY(46, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Object_entries),
+  JSWSYMPTR_ENTRY(54, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_fromEntries),
+  JSWSYMPTR_ENTRY(66, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_getOwnPropertyDescriptor),
+  JSWSYMPTR_ENTRY(91, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_getOwnPropertyDescriptors),
+  JSWSYMPTR_ENTRY(117, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Object_getOwnPropertyNames),
+  JSWSYMPTR_ENTRY(137, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_object_getPrototypeOf),
+  JSWSYMPTR_ENTRY(152, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Object_keys),
+  JSWSYMPTR_ENTRY(157, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_object_setPrototypeOf),
+  JSWSYMPTR_ENTRY(172, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Object_values)
+};
+static const unsigned char jswSymbolIndex_Object = 20;
+static const JswSymPtr jswSymbols_Function_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_function_apply_or_call),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*2)), (void*)jswrap_function_bind),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*2)), (void*)jswrap_function_apply_or_call),
+  JSWSYMPTR_ENTRY(16, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_function_replaceWith)
+};
+static const unsigned char jswSymbolIndex_Function_proto = 21;
+static const JswSymPtr jswSymbols_RegExp_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_regexp_exec),
+  JSWSYMPTR_ENTRY(5, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_regexp_test)
+};
+static const unsigned char jswSymbolIndex_RegExp_proto = 22;
+static const JswSymPtr jswSymbols_String_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_string_charAt),
+  JSWSYMPTR_ENTRY(7, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_string_charCodeAt),
+  JSWSYMPTR_ENTRY(18, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_string_concat),
+  JSWSYMPTR_ENTRY(25, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_string_endsWith),
+  JSWSYMPTR_ENTRY(34, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_String_includes),
+  JSWSYMPTR_ENTRY(43, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_String_indexOf),
+  JSWSYMPTR_ENTRY(51, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_String_lastIndexOf),
+  JSWSYMPTR_ENTRY(63, JSWAT_JSVAR | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_object_length),
+  JSWSYMPTR_ENTRY(70, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_string_match),
+  JSWSYMPTR_ENTRY(76, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_String_padEnd),
+  JSWSYMPTR_ENTRY(83, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_String_padStart),
+  JSWSYMPTR_ENTRY(92, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)gen_jswrap_String_removeAccents),
+  JSWSYMPTR_ENTRY(106, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_string_repeat),
+  JSWSYMPTR_ENTRY(113, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_string_replace),
+  JSWSYMPTR_ENTRY(121, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_string_slice),
+  JSWSYMPTR_ENTRY(127, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_string_split),
+  JSWSYMPTR_ENTRY(133, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_string_startsWith),
+  JSWSYMPTR_ENTRY(144, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_string_substr),
+  JSWSYMPTR_ENTRY(151, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_string_substring),
+  JSWSYMPTR_ENTRY(161, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)gen_jswrap_String_toLowerCase),
+  JSWSYMPTR_ENTRY(173, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)gen_jswrap_String_toUpperCase),
+  JSWSYMPTR_ENTRY(185, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_string_trim)
+};
+static const unsigned char jswSymbolIndex_String_proto = 23;
+static const JswSymPtr jswSymbols_String[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_string_fromCharCode)
+};
+static const unsigned char jswSymbolIndex_String = 24;
+static const JswSymPtr jswSymbols_Modules[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_modules_addCached),
+  JSWSYMPTR_ENTRY(10, JSWAT_JSVAR, (void*)jswrap_modules_getCached),
+  JSWSYMPTR_ENTRY(20, JSWAT_VOID, (void*)jswrap_modules_removeAllCached),
+  JSWSYMPTR_ENTRY(36, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_modules_removeCached)
+};
+static const unsigned char jswSymbolIndex_Modules = 25;
+static const JswSymPtr jswSymbols_Math[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_E),
+  JSWSYMPTR_ENTRY(2, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_LN10),
+  JSWSYMPTR_ENTRY(7, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_LN2),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_LOG10E),
+  JSWSYMPTR_ENTRY(18, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_LOG2E),
+  JSWSYMPTR_ENTRY(24, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_PI),
+  JSWSYMPTR_ENTRY(27, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_SQRT1_2),
+  JSWSYMPTR_ENTRY(35, JSWAT_JSVARFLOAT | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_Math_SQRT2),
+  JSWSYMPTR_ENTRY(41, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)fabs),
+  JSWSYMPTR_ENTRY(45, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)gen_jswrap_Math_acos),
+  JSWSYMPTR_ENTRY(50, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_asin),
+  JSWSYMPTR_ENTRY(55, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_atan),
+  JSWSYMPTR_ENTRY(60, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)jswrap_math_atan2),
+  JSWSYMPTR_ENTRY(66, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)ceil),
+  JSWSYMPTR_ENTRY(71, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*3)), (void*)jswrap_math_clip),
+  JSWSYMPTR_ENTRY(76, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_cos),
+  JSWSYMPTR_ENTRY(80, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)exp),
+  JSWSYMPTR_ENTRY(84, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)floor),
+  JSWSYMPTR_ENTRY(90, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)log),
+  JSWSYMPTR_ENTRY(94, JSWAT_JSVARFLOAT | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)gen_jswrap_Math_max),
+  JSWSYMPTR_ENTRY(98, JSWAT_JSVARFLOAT | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)gen_jswrap_Math_min),
+  JSWSYMPTR_ENTRY(102, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)jswrap_math_pow),
+  JSWSYMPTR_ENTRY(106, JSWAT_JSVARFLOAT, (void*)gen_jswrap_Math_random),
+  JSWSYMPTR_ENTRY(113, JSWAT_JSVAR | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_round),
+  JSWSYMPTR_ENTRY(119, JSWAT_INT32 | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_sign),
+  JSWSYMPTR_ENTRY(124, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_sin),
+  JSWSYMPTR_ENTRY(128, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_math_sqrt),
+  JSWSYMPTR_ENTRY(133, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)gen_jswrap_Math_tan),
+  JSWSYMPTR_ENTRY(137, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)wrapAround)
+};
+static const unsigned char jswSymbolIndex_Math = 26;
+static const JswSymPtr jswSymbols_E[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_CRC32),
+  JSWSYMPTR_ENTRY(6, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)jswrap_espruino_FFT),
+  JSWSYMPTR_ENTRY(10, JSWAT_JSVAR | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_espruino_HSBtoRGB),
+  JSWSYMPTR_ENTRY(19, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_asUTF8),
+  JSWSYMPTR_ENTRY(26, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*2)), (void*)jswrap_espruino_asm),
+  JSWSYMPTR_ENTRY(30, JSWAT_JSVARFLOAT | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*3)), (void*)jswrap_espruino_clip),
+  JSWSYMPTR_ENTRY(35, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_compiledC),
+  JSWSYMPTR_ENTRY(45, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_PIN << (JSWAT_BITS*2)), (void*)jswrap_E_connectSDCard),
+  JSWSYMPTR_ENTRY(59, JSWAT_JSVARFLOAT | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_espruino_convolve),
+  JSWSYMPTR_ENTRY(68, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_espruino_decodeUTF8),
+  JSWSYMPTR_ENTRY(79, JSWAT_VOID, (void*)jsvDefragment),
+  JSWSYMPTR_ENTRY(86, JSWAT_VOID, (void*)jswrap_e_dumpFragmentation),
+  JSWSYMPTR_ENTRY(104, JSWAT_VOID, (void*)jswrap_espruino_dumpFreeList),
+  JSWSYMPTR_ENTRY(117, JSWAT_VOID, (void*)jswrap_espruino_dumpLockedVars),
+  JSWSYMPTR_ENTRY(132, JSWAT_JSVAR, (void*)jswrap_e_dumpStr),
+  JSWSYMPTR_ENTRY(140, JSWAT_VOID, (void*)jswrap_espruino_dumpTimers),
+  JSWSYMPTR_ENTRY(151, JSWAT_VOID, (void*)jswrap_e_dumpVariables),
+  JSWSYMPTR_ENTRY(165, JSWAT_VOID | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_espruino_enableWatchdog),
+  JSWSYMPTR_ENTRY(180, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_fromUTF8),
+  JSWSYMPTR_ENTRY(189, JSWAT_INT32 | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_espruino_getAddressOf),
+  JSWSYMPTR_ENTRY(202, JSWAT_JSVARFLOAT, (void*)gen_jswrap_E_getAnalogVRef),
+  JSWSYMPTR_ENTRY(216, JSWAT_JSVAR, (void*)jswrap_espruino_getConsole),
+  JSWSYMPTR_ENTRY(227, JSWAT_JSVAR, (void*)jswrap_espruino_getErrorFlags),
+  JSWSYMPTR_ENTRY(241, JSWAT_JSVAR, (void*)jsfGetFlags),
+  JSWSYMPTR_ENTRY(250, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_espruino_getSizeOf),
+  JSWSYMPTR_ENTRY(260, JSWAT_JSVAR, (void*)jswrap_espruino_getStats),
+  JSWSYMPTR_ENTRY(269, JSWAT_JSVARFLOAT, (void*)jswrap_espruino_getTemperature),
+  JSWSYMPTR_ENTRY(284, JSWAT_INT32, (void*)jshGetRandomNumber),
+  JSWSYMPTR_ENTRY(291, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_isUTF8),
+  JSWSYMPTR_ENTRY(298, JSWAT_VOID, (void*)jswrap_espruino_kickWatchdog),
+  JSWSYMPTR_ENTRY(311, JSWAT_VOID, (void*)jswrap_espruino_lockConsole),
+  JSWSYMPTR_ENTRY(323, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_BOOL << (JSWAT_BITS*3)), (void*)jswrap_espruino_lookupNoCase),
+  JSWSYMPTR_ENTRY(336, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_espruino_mapInPlace),
+  JSWSYMPTR_ENTRY(347, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_espruino_memoryArea),
+  JSWSYMPTR_ENTRY(358, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_espruino_memoryMap),
+  JSWSYMPTR_ENTRY(368, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_espruino_nativeCall),
+  JSWSYMPTR_ENTRY(379, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_E_openFile),
+  JSWSYMPTR_ENTRY(388, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(393, JSWAT_VOID, (void*)jswrap_espruino_reboot),
+  JSWSYMPTR_ENTRY(400, JSWAT_INT32 | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_espruino_reverseByte),
+  JSWSYMPTR_ENTRY(412, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_espruino_setBootCode),
+  JSWSYMPTR_ENTRY(424, JSWAT_INT32 | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_setClock),
+  JSWSYMPTR_ENTRY(433, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_espruino_setConsole),
+  JSWSYMPTR_ENTRY(444, JSWAT_VOID | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_espruino_setDST),
+  JSWSYMPTR_ENTRY(451, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jsfSetFlags),
+  JSWSYMPTR_ENTRY(460, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_setPassword),
+  JSWSYMPTR_ENTRY(472, JSWAT_VOID | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)), (void*)jswrap_espruino_setTimeZone),
+  JSWSYMPTR_ENTRY(484, JSWAT_VOID | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)srand),
+  JSWSYMPTR_ENTRY(490, JSWAT_VOID, (void*)jswrap_espruino_stopEventPropagation),
+  JSWSYMPTR_ENTRY(511, JSWAT_JSVARFLOAT | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_sum),
+  JSWSYMPTR_ENTRY(515, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_toArrayBuffer),
+  JSWSYMPTR_ENTRY(529, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_espruino_toFlatString),
+  JSWSYMPTR_ENTRY(542, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_espruino_toJS),
+  JSWSYMPTR_ENTRY(547, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_espruino_toString),
+  JSWSYMPTR_ENTRY(556, JSWAT_JSVAR | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_espruino_toUint8Array),
+  JSWSYMPTR_ENTRY(569, JSWAT_VOID, (void*)jswrap_E_unmountSD),
+  JSWSYMPTR_ENTRY(579, JSWAT_JSVARFLOAT | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)), (void*)jswrap_espruino_variance)
+};
+static const unsigned char jswSymbolIndex_E = 27;
+static const JswSymPtr jswSymbols_Flash[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_flash_erasePage),
+  JSWSYMPTR_ENTRY(10, JSWAT_JSVAR, (void*)jswrap_flash_getFree),
+  JSWSYMPTR_ENTRY(18, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_flash_getPage),
+  JSWSYMPTR_ENTRY(26, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_flash_read),
+  JSWSYMPTR_ENTRY(31, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_flash_write)
+};
+static const unsigned char jswSymbolIndex_Flash = 28;
+static const JswSymPtr jswSymbols_fs[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_fs_appendFile),
+  JSWSYMPTR_ENTRY(11, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_fs_appendFileSync),
+  JSWSYMPTR_ENTRY(26, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_mkdir),
+  JSWSYMPTR_ENTRY(32, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_mkdir),
+  JSWSYMPTR_ENTRY(42, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(47, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_readFile),
+  JSWSYMPTR_ENTRY(56, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_readFile),
+  JSWSYMPTR_ENTRY(69, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_readdir),
+  JSWSYMPTR_ENTRY(77, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_readdir),
+  JSWSYMPTR_ENTRY(89, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_stat),
+  JSWSYMPTR_ENTRY(98, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_unlink),
+  JSWSYMPTR_ENTRY(105, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_fs_unlink),
+  JSWSYMPTR_ENTRY(116, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_fs_writeFile),
+  JSWSYMPTR_ENTRY(126, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_fs_writeFileSync)
+};
+static const unsigned char jswSymbolIndex_fs = 29;
+static const JswSymPtr jswSymbols_process[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_process_env),
+  JSWSYMPTR_ENTRY(4, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_process_memory),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_process_version)
+};
+static const unsigned char jswSymbolIndex_process = 30;
+static const JswSymPtr jswSymbols_OneWire_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_onewire_read),
+  JSWSYMPTR_ENTRY(5, JSWAT_BOOL | JSWAT_THIS_ARG, (void*)jswrap_onewire_reset),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_onewire_search),
+  JSWSYMPTR_ENTRY(18, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_onewire_select),
+  JSWSYMPTR_ENTRY(25, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_onewire_skip),
+  JSWSYMPTR_ENTRY(30, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_onewire_write)
+};
+static const unsigned char jswSymbolIndex_OneWire_proto = 31;
+static const JswSymPtr jswSymbols_Promise[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_promise_all),
+  JSWSYMPTR_ENTRY(4, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_promise_reject),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_promise_resolve)
+};
+static const unsigned char jswSymbolIndex_Promise = 32;
+static const JswSymPtr jswSymbols_Promise_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_promise_catch),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_promise_then)
+};
+static const unsigned char jswSymbolIndex_Promise_proto = 33;
+static const JswSymPtr jswSymbols_Serial[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)gen_jswrap_Serial_find)
+};
+static const unsigned char jswSymbolIndex_Serial = 34;
+static const JswSymPtr jswSymbols_Serial_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_stream_available),
+  JSWSYMPTR_ENTRY(10, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_serial_flush),
+  JSWSYMPTR_ENTRY(16, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_serial_inject),
+  JSWSYMPTR_ENTRY(23, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(28, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_serial_print),
+  JSWSYMPTR_ENTRY(34, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_serial_println),
+  JSWSYMPTR_ENTRY(42, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_stream_read),
+  JSWSYMPTR_ENTRY(47, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_serial_setConsole),
+  JSWSYMPTR_ENTRY(58, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_serial_setup),
+  JSWSYMPTR_ENTRY(64, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_serial_unsetup),
+  JSWSYMPTR_ENTRY(72, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_serial_write)
+};
+static const unsigned char jswSymbolIndex_Serial_proto = 35;
+static const JswSymPtr jswSymbols_Storage[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_storage_compact),
+  JSWSYMPTR_ENTRY(8, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_storage_erase),
+  JSWSYMPTR_ENTRY(14, JSWAT_VOID, (void*)jswrap_storage_eraseAll),
+  JSWSYMPTR_ENTRY(23, JSWAT_INT32 | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_storage_getFree),
+  JSWSYMPTR_ENTRY(31, JSWAT_JSVAR | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_storage_getStats),
+  JSWSYMPTR_ENTRY(40, JSWAT_INT32 | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_storage_hash),
+  JSWSYMPTR_ENTRY(45, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_storage_list),
+  JSWSYMPTR_ENTRY(50, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_storage_open),
+  JSWSYMPTR_ENTRY(55, JSWAT_VOID, (void*)jswrap_storage_optimise),
+  JSWSYMPTR_ENTRY(64, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_storage_read),
+  JSWSYMPTR_ENTRY(69, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_storage_readArrayBuffer),
+  JSWSYMPTR_ENTRY(85, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_storage_readJSON),
+  JSWSYMPTR_ENTRY(94, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_storage_write),
+  JSWSYMPTR_ENTRY(100, JSWAT_BOOL | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_storage_writeJSON)
+};
+static const unsigned char jswSymbolIndex_Storage = 36;
+static const JswSymPtr jswSymbols_StorageFile_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_storagefile_erase),
+  JSWSYMPTR_ENTRY(6, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_storagefile_getLength),
+  JSWSYMPTR_ENTRY(16, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(21, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_storagefile_read),
+  JSWSYMPTR_ENTRY(26, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_storagefile_readLine),
+  JSWSYMPTR_ENTRY(35, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_storagefile_readLines),
+  JSWSYMPTR_ENTRY(45, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_storagefile_seek),
+  JSWSYMPTR_ENTRY(50, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_storagefile_write)
+};
+static const unsigned char jswSymbolIndex_StorageFile_proto = 37;
+static const JswSymPtr jswSymbols_SPI[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)gen_jswrap_SPI_find)
+};
+static const unsigned char jswSymbolIndex_SPI = 38;
+static const JswSymPtr jswSymbols_SPI_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_PIN << (JSWAT_BITS*2)), (void*)jswrap_spi_send),
+  JSWSYMPTR_ENTRY(5, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_PIN << (JSWAT_BITS*4)), (void*)jswrap_spi_send4bit),
+  JSWSYMPTR_ENTRY(14, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_PIN << (JSWAT_BITS*4)), (void*)jswrap_spi_send8bit),
+  JSWSYMPTR_ENTRY(23, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_spi_setup),
+  JSWSYMPTR_ENTRY(29, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*1)), (void*)jswrap_spi_write)
+};
+static const unsigned char jswSymbolIndex_SPI_proto = 39;
+static const JswSymPtr jswSymbols_I2C[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_PIN << (JSWAT_BITS*1)), (void*)gen_jswrap_I2C_find)
+};
+static const unsigned char jswSymbolIndex_I2C = 40;
+static const JswSymPtr jswSymbols_I2C_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_i2c_readFrom),
+  JSWSYMPTR_ENTRY(9, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_i2c_readReg),
+  JSWSYMPTR_ENTRY(17, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_i2c_setup),
+  JSWSYMPTR_ENTRY(23, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*2)), (void*)jswrap_i2c_writeTo)
+};
+static const unsigned char jswSymbolIndex_I2C_proto = 41;
+static const JswSymPtr jswSymbols_Waveform_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_PIN << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_waveform_startInput),
+  JSWSYMPTR_ENTRY(11, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_PIN << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_waveform_startOutput),
+  JSWSYMPTR_ENTRY(23, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_waveform_stop)
+};
+static const unsigned char jswSymbolIndex_Waveform_proto = 42;
+static const JswSymPtr jswSymbols_heatshrink[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_heatshrink_compress),
+  JSWSYMPTR_ENTRY(9, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_heatshrink_decompress)
+};
+static const unsigned char jswSymbolIndex_heatshrink = 43;
+static const JswSymPtr jswSymbols_File_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG, (void*)gen_jswrap_File_close),
+  JSWSYMPTR_ENTRY(6, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_file_read),
+  JSWSYMPTR_ENTRY(16, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)gen_jswrap_File_seek),
+  JSWSYMPTR_ENTRY(21, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)gen_jswrap_File_skip),
+  JSWSYMPTR_ENTRY(26, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_file_write)
+};
+static const unsigned char jswSymbolIndex_File_proto = 44;
+static const JswSymPtr jswSymbols_Graphics_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_graphics_asBMP),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_asImage),
+  JSWSYMPTR_ENTRY(14, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_graphics_asURL),
+  JSWSYMPTR_ENTRY(20, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_graphics_blendColor),
+  JSWSYMPTR_ENTRY(31, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_blit),
+  JSWSYMPTR_ENTRY(36, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_graphics_clear),
+  JSWSYMPTR_ENTRY(42, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_clearRect),
+  JSWSYMPTR_ENTRY(52, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_graphics_drawCircle),
+  JSWSYMPTR_ENTRY(63, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_graphics_drawCircleAA),
+  JSWSYMPTR_ENTRY(76, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawEllipse),
+  JSWSYMPTR_ENTRY(88, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_JSVAR << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawImage),
+  JSWSYMPTR_ENTRY(98, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_graphics_drawImages),
+  JSWSYMPTR_ENTRY(109, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawLine),
+  JSWSYMPTR_ENTRY(118, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVARFLOAT << (JSWAT_BITS*1)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*2)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*3)) | (JSWAT_JSVARFLOAT << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawLineAA),
+  JSWSYMPTR_ENTRY(129, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_Graphics_drawPoly),
+  JSWSYMPTR_ENTRY(138, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)gen_jswrap_Graphics_drawPolyAA),
+  JSWSYMPTR_ENTRY(149, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawRect),
+  JSWSYMPTR_ENTRY(158, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_BOOL << (JSWAT_BITS*4)), (void*)jswrap_graphics_drawString),
+  JSWSYMPTR_ENTRY(169, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_graphics_dump),
+  JSWSYMPTR_ENTRY(174, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_graphics_fillCircle),
+  JSWSYMPTR_ENTRY(185, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_fillEllipse),
+  JSWSYMPTR_ENTRY(197, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Graphics_fillPoly),
+  JSWSYMPTR_ENTRY(206, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_Graphics_fillPolyAA),
+  JSWSYMPTR_ENTRY(217, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_fillRect),
+  JSWSYMPTR_ENTRY(226, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_graphics_floodFill),
+  JSWSYMPTR_ENTRY(236, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_graphics_getBPP),
+  JSWSYMPTR_ENTRY(243, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)gen_jswrap_Graphics_getBgColor),
+  JSWSYMPTR_ENTRY(254, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)gen_jswrap_Graphics_getColor),
+  JSWSYMPTR_ENTRY(263, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_graphics_getFont),
+  JSWSYMPTR_ENTRY(271, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_graphics_getFontHeight),
+  JSWSYMPTR_ENTRY(285, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_graphics_getFonts),
+  JSWSYMPTR_ENTRY(294, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)gen_jswrap_Graphics_getHeight),
+  JSWSYMPTR_ENTRY(304, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_BOOL << (JSWAT_BITS*1)), (void*)jswrap_graphics_getModified),
+  JSWSYMPTR_ENTRY(316, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_getPixel),
+  JSWSYMPTR_ENTRY(325, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_graphics_getVectorFontPolys),
+  JSWSYMPTR_ENTRY(344, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)gen_jswrap_Graphics_getWidth),
+  JSWSYMPTR_ENTRY(353, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_imageMetrics),
+  JSWSYMPTR_ENTRY(366, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_lineTo),
+  JSWSYMPTR_ENTRY(373, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_moveTo),
+  JSWSYMPTR_ENTRY(380, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_graphics_quadraticBezier),
+  JSWSYMPTR_ENTRY(396, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_graphics_reset),
+  JSWSYMPTR_ENTRY(402, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_scroll),
+  JSWSYMPTR_ENTRY(409, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)gen_jswrap_Graphics_setBgColor),
+  JSWSYMPTR_ENTRY(420, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_setClipRect),
+  JSWSYMPTR_ENTRY(432, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)gen_jswrap_Graphics_setColor),
+  JSWSYMPTR_ENTRY(441, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_setFont),
+  JSWSYMPTR_ENTRY(449, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)), (void*)jswrap_graphics_setFontAlign),
+  JSWSYMPTR_ENTRY(462, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)gen_jswrap_Graphics_setFontBitmap),
+  JSWSYMPTR_ENTRY(476, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)) | (JSWAT_INT32 << (JSWAT_BITS*4)), (void*)jswrap_graphics_setFontCustom),
+  JSWSYMPTR_ENTRY(490, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_setFontPBF),
+  JSWSYMPTR_ENTRY(501, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)gen_jswrap_Graphics_setFontVector),
+  JSWSYMPTR_ENTRY(515, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_graphics_setPixel),
+  JSWSYMPTR_ENTRY(524, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_graphics_setRotation),
+  JSWSYMPTR_ENTRY(536, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_setTheme),
+  JSWSYMPTR_ENTRY(545, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_stringMetrics),
+  JSWSYMPTR_ENTRY(559, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_stringWidth),
+  JSWSYMPTR_ENTRY(571, JSWAT_JSVAR | JSWAT_THIS_ARG | JSWAT_EXECUTE_IMMEDIATELY, (void*)jswrap_graphics_theme),
+  JSWSYMPTR_ENTRY(577, JSWAT_INT32 | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_graphics_toColor),
+  JSWSYMPTR_ENTRY(585, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_graphics_transformVertices),
+  JSWSYMPTR_ENTRY(603, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)), (void*)jswrap_graphics_wrapString)
+};
+static const unsigned char jswSymbolIndex_Graphics_proto = 45;
+static const JswSymPtr jswSymbols_Graphics[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_JSVAR << (JSWAT_BITS*4)), (void*)jswrap_graphics_createArrayBuffer),
+  JSWSYMPTR_ENTRY(18, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_INT32 << (JSWAT_BITS*2)) | (JSWAT_INT32 << (JSWAT_BITS*3)) | (JSWAT_JSVAR << (JSWAT_BITS*4)), (void*)jswrap_graphics_createCallback),
+  JSWSYMPTR_ENTRY(33, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_graphics_createImage),
+  JSWSYMPTR_ENTRY(45, JSWAT_JSVAR, (void*)jswrap_graphics_getInstance)
+};
+static const unsigned char jswSymbolIndex_Graphics = 46;
+static const JswSymPtr jswSymbols_url[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_BOOL << (JSWAT_BITS*2)), (void*)jswrap_url_parse)
+};
+static const unsigned char jswSymbolIndex_url = 47;
+static const JswSymPtr jswSymbols_Socket[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_Socket = 48;
+static const JswSymPtr jswSymbols_Socket_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_stream_available),
+  JSWSYMPTR_ENTRY(10, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_net_socket_end),
+  JSWSYMPTR_ENTRY(14, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(19, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_stream_read),
+  JSWSYMPTR_ENTRY(24, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_net_socket_write)
+};
+static const unsigned char jswSymbolIndex_Socket_proto = 49;
+static const JswSymPtr jswSymbols_net[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_net_connect),
+  JSWSYMPTR_ENTRY(8, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_net_createServer)
+};
+static const unsigned char jswSymbolIndex_net = 50;
+static const JswSymPtr jswSymbols_dgram[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_dgram_createSocket)
+};
+static const unsigned char jswSymbolIndex_dgram = 51;
+static const JswSymPtr jswSymbols_dgramSocket_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_dgram_addMembership),
+  JSWSYMPTR_ENTRY(14, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_dgramSocket_bind),
+  JSWSYMPTR_ENTRY(19, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_dgram_close),
+  JSWSYMPTR_ENTRY(25, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)) | (JSWAT_ARGUMENT_ARRAY << (JSWAT_BITS*4)), (void*)jswrap_dgram_socket_send)
+};
+static const unsigned char jswSymbolIndex_dgramSocket_proto = 52;
+static const JswSymPtr jswSymbols_dgramSocket[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_dgramSocket = 53;
+static const JswSymPtr jswSymbols_tls[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_tls_connect)
+};
+static const unsigned char jswSymbolIndex_tls = 54;
+static const JswSymPtr jswSymbols_Server_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_net_server_close),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)gen_jswrap_Server_listen)
+};
+static const unsigned char jswSymbolIndex_Server_proto = 55;
+static const JswSymPtr jswSymbols_httpSRq[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_httpSRq = 56;
+static const JswSymPtr jswSymbols_httpSRq_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_stream_available),
+  JSWSYMPTR_ENTRY(10, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(15, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_stream_read)
+};
+static const unsigned char jswSymbolIndex_httpSRq_proto = 57;
+static const JswSymPtr jswSymbols_httpSRs[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_httpSRs = 58;
+static const JswSymPtr jswSymbols_httpCRq[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_httpCRq = 59;
+static const JswSymPtr jswSymbols_httpCRs[] FLASH_SECT = {
+  
+};
+static const unsigned char jswSymbolIndex_httpCRs = 60;
+static const JswSymPtr jswSymbols_httpCRs_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_INT32 | JSWAT_THIS_ARG, (void*)jswrap_stream_available),
+  JSWSYMPTR_ENTRY(10, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_pipe),
+  JSWSYMPTR_ENTRY(15, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)jswrap_stream_read)
+};
+static const unsigned char jswSymbolIndex_httpCRs_proto = 61;
+static const JswSymPtr jswSymbols_http[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_http_createServer),
+  JSWSYMPTR_ENTRY(13, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_http_get),
+  JSWSYMPTR_ENTRY(17, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)gen_jswrap_http_request)
+};
+static const unsigned char jswSymbolIndex_http = 62;
+static const JswSymPtr jswSymbols_httpSrv_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_net_server_close),
+  JSWSYMPTR_ENTRY(6, JSWAT_JSVAR | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)), (void*)gen_jswrap_httpSrv_listen)
+};
+static const unsigned char jswSymbolIndex_httpSrv_proto = 63;
+static const JswSymPtr jswSymbols_httpSRs_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_httpSRs_end),
+  JSWSYMPTR_ENTRY(4, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_httpSRs_setHeader),
+  JSWSYMPTR_ENTRY(14, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_httpSRs_write),
+  JSWSYMPTR_ENTRY(20, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_httpSRs_writeHead)
+};
+static const unsigned char jswSymbolIndex_httpSRs_proto = 64;
+static const JswSymPtr jswSymbols_httpCRq_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_net_socket_end),
+  JSWSYMPTR_ENTRY(4, JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_net_socket_write)
+};
+static const unsigned char jswSymbolIndex_httpCRq_proto = 65;
+static const JswSymPtr jswSymbols_NetworkJS[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_networkjs_create)
+};
+static const unsigned char jswSymbolIndex_NetworkJS = 66;
+static const JswSymPtr jswSymbols_TelnetServer[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)jswrap_telnet_setOptions)
+};
+static const unsigned char jswSymbolIndex_TelnetServer = 67;
+static const JswSymPtr jswSymbols_crypto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_EXECUTE_IMMEDIATELY, (void*)gen_jswrap_crypto_AES),
+  JSWSYMPTR_ENTRY(4, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_crypto_PBKDF2),
+  JSWSYMPTR_ENTRY(11, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_crypto_SHA1),
+  JSWSYMPTR_ENTRY(16, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_crypto_SHA224),
+  JSWSYMPTR_ENTRY(23, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_crypto_SHA256),
+  JSWSYMPTR_ENTRY(30, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_crypto_SHA384),
+  JSWSYMPTR_ENTRY(37, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)), (void*)gen_jswrap_crypto_SHA512)
+};
+static const unsigned char jswSymbolIndex_crypto = 68;
+static const JswSymPtr jswSymbols_AES[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_crypto_AES_decrypt),
+  JSWSYMPTR_ENTRY(8, JSWAT_JSVAR | (JSWAT_JSVAR << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)), (void*)jswrap_crypto_AES_encrypt)
+};
+static const unsigned char jswSymbolIndex_AES = 69;
+static const JswSymPtr jswSymbols_tensorflow[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | (JSWAT_INT32 << (JSWAT_BITS*1)) | (JSWAT_JSVAR << (JSWAT_BITS*2)), (void*)jswrap_tensorflow_create)
+};
+static const unsigned char jswSymbolIndex_tensorflow = 70;
+static const JswSymPtr jswSymbols_TFMicroInterpreter_proto[] FLASH_SECT = {
+  JSWSYMPTR_ENTRY(0, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_tfmicrointerpreter_getInput),
+  JSWSYMPTR_ENTRY(9, JSWAT_JSVAR | JSWAT_THIS_ARG, (void*)jswrap_tfmicrointerpreter_getOutput),
+  JSWSYMPTR_ENTRY(19, JSWAT_VOID | JSWAT_THIS_ARG, (void*)jswrap_tfmicrointerpreter_invoke)
+};
+static const unsigned char jswSymbolIndex_TFMicroInterpreter_proto = 71;
+
+
+FLASH_STR(jswSymbols_Pin_str, "");
+FLASH_STR(jswSymbols_Pin_proto_str, "analog\0getInfo\0getMode\0mode\0pulse\0pwm\0read\0reset\0set\0toggle\0write\0writeAtTime\0");
+FLASH_STR(jswSymbols_global_str, "AES\0Array\0ArrayBuffer\0ArrayBufferView\0Boolean\0DataView\0Date\0E\0Error\0File\0Float32Array\0Float64Array\0Function\0Graphics\0HIGH\0I2C\0I2C1\0I2C2\0I2C3\0Infinity\0Int16Array\0Int32Array\0Int8Array\0InternalError\0JSON\0LOW\0LoopbackA\0LoopbackB\0Math\0Modules\0NaN\0Number\0Object\0OneWire\0Pin\0Promise\0ReferenceError\0RegExp\0SPI\0SPI1\0SPI2\0SPI3\0Serial\0Serial1\0Serial2\0Serial3\0Serial4\0Serial5\0Serial6\0Server\0Socket\0StorageFile\0String\0SyntaxError\0TFMicroInterpreter\0Telnet\0TypeError\0USB\0Uint16Array\0Uint24Array\0Uint32Array\0Uint8Array\0Uint8ClampedArray\0Waveform\0analogRead\0analogWrite\0arguments\0atob\0btoa\0changeInterval\0clearInterval\0clearTimeout\0clearWatch\0console\0decodeURIComponent\0dgramSocket\0digitalPulse\0digitalRead\0digitalWrite\0dump\0echo\0edit\0encodeURIComponent\0eval\0getPinMode\0getSerial\0getTime\0global\0globalThis\0httpCRq\0httpCRs\0httpSRq\0httpSRs\0httpSrv\0isFinite\0isNaN\0load\0parseFloat\0parseInt\0peek16\0peek32\0peek8\0pinMode\0poke16\0poke32\0poke8\0print\0process\0require\0reset\0save\0setBusyIndicator\0setInterval\0setSleepIndicator\0setTime\0setTimeout\0setWatch\0shiftOut\0trace\0url\0");
+FLASH_STR(jswSymbols_Array_proto_str, "concat\0every\0fill\0filter\0find\0findIndex\0forEach\0includes\0indexOf\0join\0length\0map\0pop\0push\0reduce\0reverse\0shift\0slice\0some\0sort\0splice\0toString\0unshift\0");
+FLASH_STR(jswSymbols_Array_str, "isArray\0");
+FLASH_STR(jswSymbols_ArrayBuffer_proto_str, "byteLength\0");
+FLASH_STR(jswSymbols_ArrayBufferView_proto_str, "buffer\0byteLength\0byteOffset\0fill\0filter\0find\0findIndex\0forEach\0includes\0indexOf\0join\0map\0reduce\0reverse\0set\0slice\0sort\0subarray\0");
+FLASH_STR(jswSymbols_DataView_proto_str, "getFloat32\0getFloat64\0getInt16\0getInt32\0getInt8\0getUint16\0getUint32\0getUint8\0setFloat32\0setFloat64\0setInt16\0setInt32\0setInt8\0setUint16\0setUint32\0setUint8\0");
+FLASH_STR(jswSymbols_Date_str, "now\0parse\0");
+FLASH_STR(jswSymbols_Date_proto_str, "getDate\0getDay\0getFullYear\0getHours\0getIsDST\0getMilliseconds\0getMinutes\0getMonth\0getSeconds\0getTime\0getTimezoneOffset\0setDate\0setFullYear\0setHours\0setMilliseconds\0setMinutes\0setMonth\0setSeconds\0setTime\0toISOString\0toJSON\0toLocalISOString\0toString\0toUTCString\0valueOf\0");
+FLASH_STR(jswSymbols_Error_proto_str, "toString\0");
+FLASH_STR(jswSymbols_SyntaxError_proto_str, "toString\0");
+FLASH_STR(jswSymbols_TypeError_proto_str, "toString\0");
+FLASH_STR(jswSymbols_InternalError_proto_str, "toString\0");
+FLASH_STR(jswSymbols_ReferenceError_proto_str, "toString\0");
+FLASH_STR(jswSymbols_console_str, "debug\0error\0info\0log\0warn\0");
+FLASH_STR(jswSymbols_JSON_str, "parse\0stringify\0");
+FLASH_STR(jswSymbols_Number_str, "MAX_VALUE\0MIN_VALUE\0NEGATIVE_INFINITY\0NaN\0POSITIVE_INFINITY\0");
+FLASH_STR(jswSymbols_Number_proto_str, "toFixed\0");
+FLASH_STR(jswSymbols_Object_proto_str, "addListener\0clone\0emit\0hasOwnProperty\0length\0on\0prependListener\0removeAllListeners\0removeListener\0toString\0valueOf\0");
+FLASH_STR(jswSymbols_Object_str, "assign\0create\0defineProperties\0defineProperty\0entries\0fromEntries\0getOwnPropertyDescriptor\0getOwnPropertyDescriptors\0getOwnPropertyNames\0getPrototypeOf\0keys\0setPrototypeOf\0values\0");
+FLASH_STR(jswSymbols_Function_proto_str, "apply\0bind\0call\0replaceWith\0");
+FLASH_STR(jswSymbols_RegExp_proto_str, "exec\0test\0");
+FLASH_STR(jswSymbols_String_proto_str, "charAt\0charCodeAt\0concat\0endsWith\0includes\0indexOf\0lastIndexOf\0length\0match\0padEnd\0padStart\0removeAccents\0repeat\0replace\0slice\0split\0startsWith\0substr\0substring\0toLowerCase\0toUpperCase\0trim\0");
+FLASH_STR(jswSymbols_String_str, "fromCharCode\0");
+FLASH_STR(jswSymbols_Modules_str, "addCached\0getCached\0removeAllCached\0removeCached\0");
+FLASH_STR(jswSymbols_Math_str, "E\0LN10\0LN2\0LOG10E\0LOG2E\0PI\0SQRT1_2\0SQRT2\0abs\0acos\0asin\0atan\0atan2\0ceil\0clip\0cos\0exp\0floor\0log\0max\0min\0pow\0random\0round\0sign\0sin\0sqrt\0tan\0wrap\0");
+FLASH_STR(jswSymbols_E_str, "CRC32\0FFT\0HSBtoRGB\0asUTF8\0asm\0clip\0compiledC\0connectSDCard\0convolve\0decodeUTF8\0defrag\0dumpFragmentation\0dumpFreeList\0dumpLockedVars\0dumpStr\0dumpTimers\0dumpVariables\0enableWatchdog\0fromUTF8\0getAddressOf\0getAnalogVRef\0getConsole\0getErrorFlags\0getFlags\0getSizeOf\0getStats\0getTemperature\0hwRand\0isUTF8\0kickWatchdog\0lockConsole\0lookupNoCase\0mapInPlace\0memoryArea\0memoryMap\0nativeCall\0openFile\0pipe\0reboot\0reverseByte\0setBootCode\0setClock\0setConsole\0setDST\0setFlags\0setPassword\0setTimeZone\0srand\0stopEventPropagation\0sum\0toArrayBuffer\0toFlatString\0toJS\0toString\0toUint8Array\0unmountSD\0variance\0");
+FLASH_STR(jswSymbols_Flash_str, "erasePage\0getFree\0getPage\0read\0write\0");
+FLASH_STR(jswSymbols_fs_str, "appendFile\0appendFileSync\0mkdir\0mkdirSync\0pipe\0readFile\0readFileSync\0readdir\0readdirSync\0statSync\0unlink\0unlinkSync\0writeFile\0writeFileSync\0");
+FLASH_STR(jswSymbols_process_str, "env\0memory\0version\0");
+FLASH_STR(jswSymbols_OneWire_proto_str, "read\0reset\0search\0select\0skip\0write\0");
+FLASH_STR(jswSymbols_Promise_str, "all\0reject\0resolve\0");
+FLASH_STR(jswSymbols_Promise_proto_str, "catch\0then\0");
+FLASH_STR(jswSymbols_Serial_str, "find\0");
+FLASH_STR(jswSymbols_Serial_proto_str, "available\0flush\0inject\0pipe\0print\0println\0read\0setConsole\0setup\0unsetup\0write\0");
+FLASH_STR(jswSymbols_Storage_str, "compact\0erase\0eraseAll\0getFree\0getStats\0hash\0list\0open\0optimise\0read\0readArrayBuffer\0readJSON\0write\0writeJSON\0");
+FLASH_STR(jswSymbols_StorageFile_proto_str, "erase\0getLength\0pipe\0read\0readLine\0readLines\0seek\0write\0");
+FLASH_STR(jswSymbols_SPI_str, "find\0");
+FLASH_STR(jswSymbols_SPI_proto_str, "send\0send4bit\0send8bit\0setup\0write\0");
+FLASH_STR(jswSymbols_I2C_str, "find\0");
+FLASH_STR(jswSymbols_I2C_proto_str, "readFrom\0readReg\0setup\0writeTo\0");
+FLASH_STR(jswSymbols_Waveform_proto_str, "startInput\0startOutput\0stop\0");
+FLASH_STR(jswSymbols_heatshrink_str, "compress\0decompress\0");
+FLASH_STR(jswSymbols_File_proto_str, "close\0pipe\0read\0seek\0skip\0write\0");
+FLASH_STR(jswSymbols_Graphics_proto_str, "asBMP\0asImage\0asURL\0blendColor\0blit\0clear\0clearRect\0drawCircle\0drawCircleAA\0drawEllipse\0drawImage\0drawImages\0drawLine\0drawLineAA\0drawPoly\0drawPolyAA\0drawRect\0drawString\0dump\0fillCircle\0fillEllipse\0fillPoly\0fillPolyAA\0fillRect\0floodFill\0getBPP\0getBgColor\0getColor\0getFont\0getFontHeight\0getFonts\0getHeight\0getModified\0getPixel\0getVectorFontPolys\0getWidth\0imageMetrics\0lineTo\0moveTo\0quadraticBezier\0reset\0scroll\0setBgColor\0setClipRect\0setColor\0setFont\0setFontAlign\0setFontBitmap\0setFontCustom\0setFontPBF\0setFontVector\0setPixel\0setRotation\0setTheme\0stringMetrics\0stringWidth\0theme\0toColor\0transformVertices\0wrapString\0");
+FLASH_STR(jswSymbols_Graphics_str, "createArrayBuffer\0createCallback\0createImage\0getInstance\0");
+FLASH_STR(jswSymbols_url_str, "parse\0");
+FLASH_STR(jswSymbols_Socket_str, "");
+FLASH_STR(jswSymbols_Socket_proto_str, "available\0end\0pipe\0read\0write\0");
+FLASH_STR(jswSymbols_net_str, "connect\0createServer\0");
+FLASH_STR(jswSymbols_dgram_str, "createSocket\0");
+FLASH_STR(jswSymbols_dgramSocket_proto_str, "addMembership\0bind\0close\0send\0");
+FLASH_STR(jswSymbols_dgramSocket_str, "");
+FLASH_STR(jswSymbols_tls_str, "connect\0");
+FLASH_STR(jswSymbols_Server_proto_str, "close\0listen\0");
+FLASH_STR(jswSymbols_httpSRq_str, "");
+FLASH_STR(jswSymbols_httpSRq_proto_str, "available\0pipe\0read\0");
+FLASH_STR(jswSymbols_httpSRs_str, "");
+FLASH_STR(jswSymbols_httpCRq_str, "");
+FLASH_STR(jswSymbols_httpCRs_str, "");
+FLASH_STR(jswSymbols_httpCRs_proto_str, "available\0pipe\0read\0");
+FLASH_STR(jswSymbols_http_str, "createServer\0get\0request\0");
+FLASH_STR(jswSymbols_httpSrv_proto_str, "close\0listen\0");
+FLASH_STR(jswSymbols_httpSRs_proto_str, "end\0setHeader\0write\0writeHead\0");
+FLASH_STR(jswSymbols_httpCRq_proto_str, "end\0write\0");
+FLASH_STR(jswSymbols_NetworkJS_str, "create\0");
+FLASH_STR(jswSymbols_TelnetServer_str, "setOptions\0");
+FLASH_STR(jswSymbols_crypto_str, "AES\0PBKDF2\0SHA1\0SHA224\0SHA256\0SHA384\0SHA512\0");
+FLASH_STR(jswSymbols_AES_str, "decrypt\0encrypt\0");
+FLASH_STR(jswSymbols_tensorflow_str, "create\0");
+FLASH_STR(jswSymbols_TFMicroInterpreter_proto_str, "getInput\0getOutput\0invoke\0");
+
+const JswSymList jswSymbolTables[] FLASH_SECT = {
+  {jswSymbols_Pin, jswSymbols_Pin_str, 0},
+  {jswSymbols_Pin_proto, jswSymbols_Pin_proto_str, 12},
+  {jswSymbols_global, jswSymbols_global_str, 120},
+  {jswSymbols_Array_proto, jswSymbols_Array_proto_str, 23},
+  {jswSymbols_Array, jswSymbols_Array_str, 1},
+  {jswSymbols_ArrayBuffer_proto, jswSymbols_ArrayBuffer_proto_str, 1},
+  {jswSymbols_ArrayBufferView_proto, jswSymbols_ArrayBufferView_proto_str, 18},
+  {jswSymbols_DataView_proto, jswSymbols_DataView_proto_str, 16},
+  {jswSymbols_Date, jswSymbols_Date_str, 2},
+  {jswSymbols_Date_proto, jswSymbols_Date_proto_str, 25},
+  {jswSymbols_Error_proto, jswSymbols_Error_proto_str, 1},
+  {jswSymbols_SyntaxError_proto, jswSymbols_SyntaxError_proto_str, 1},
+  {jswSymbols_TypeError_proto, jswSymbols_TypeError_proto_str, 1},
+  {jswSymbols_InternalError_proto, jswSymbols_InternalError_proto_str, 1},
+  {jswSymbols_ReferenceError_proto, jswSymbols_ReferenceError_proto_str, 1},
+  {jswSymbols_console, jswSymbols_console_str, 5},
+  {jswSymbols_JSON, jswSymbols_JSON_str, 2},
+  {jswSymbols_Number, jswSymbols_Number_str, 5},
+  {jswSymbols_Number_proto, jswSymbols_Number_proto_str, 1},
+  {jswSymbols_Object_proto, jswSymbols_Object_proto_str, 11},
+  {jswSymbols_Object, jswSymbols_Object_str, 13},
+  {jswSymbols_Function_proto, jswSymbols_Function_proto_str, 4},
+  {jswSymbols_RegExp_proto, jswSymbols_RegExp_proto_str, 2},
+  {jswSymbols_String_proto, jswSymbols_String_proto_str, 22},
+  {jswSymbols_String, jswSymbols_String_str, 1},
+  {jswSymbols_Modules, jswSymbols_Modules_str, 4},
+  {jswSymbols_Math, jswSymbols_Math_str, 29},
+  {jswSymbols_E, jswSymbols_E_str, 57},
+  {jswSymbols_Flash, jswSymbols_Flash_str, 5},
+  {jswSymbols_fs, jswSymbols_fs_str, 14},
+  {jswSymbols_process, jswSymbols_process_str, 3},
+  {jswSymbols_OneWire_proto, jswSymbols_OneWire_proto_str, 6},
+  {jswSymbols_Promise, jswSymbols_Promise_str, 3},
+  {jswSymbols_Promise_proto, jswSymbols_Promise_proto_str, 2},
+  {jswSymbols_Serial, jswSymbols_Serial_str, 1},
+  {jswSymbols_Serial_proto, jswSymbols_Serial_proto_str, 11},
+  {jswSymbols_Storage, jswSymbols_Storage_str, 14},
+  {jswSymbols_StorageFile_proto, jswSymbols_StorageFile_proto_str, 8},
+  {jswSymbols_SPI, jswSymbols_SPI_str, 1},
+  {jswSymbols_SPI_proto, jswSymbols_SPI_proto_str, 5},
+  {jswSymbols_I2C, jswSymbols_I2C_str, 1},
+  {jswSymbols_I2C_proto, jswSymbols_I2C_proto_str, 4},
+  {jswSymbols_Waveform_proto, jswSymbols_Waveform_proto_str, 3},
+  {jswSymbols_heatshrink, jswSymbols_heatshrink_str, 2},
+  {jswSymbols_File_proto, jswSymbols_File_proto_str, 6},
+  {jswSymbols_Graphics_proto, jswSymbols_Graphics_proto_str, 60},
+  {jswSymbols_Graphics, jswSymbols_Graphics_str, 4},
+  {jswSymbols_url, jswSymbols_url_str, 1},
+  {jswSymbols_Socket, jswSymbols_Socket_str, 0},
+  {jswSymbols_Socket_proto, jswSymbols_Socket_proto_str, 5},
+  {jswSymbols_net, jswSymbols_net_str, 2},
+  {jswSymbols_dgram, jswSymbols_dgram_str, 1},
+  {jswSymbols_dgramSocket_proto, jswSymbols_dgramSocket_proto_str, 4},
+  {jswSymbols_dgramSocket, jswSymbols_dgramSocket_str, 0},
+  {jswSymbols_tls, jswSymbols_tls_str, 1},
+  {jswSymbols_Server_proto, jswSymbols_Server_proto_str, 2},
+  {jswSymbols_httpSRq, jswSymbols_httpSRq_str, 0},
+  {jswSymbols_httpSRq_proto, jswSymbols_httpSRq_proto_str, 3},
+  {jswSymbols_httpSRs, jswSymbols_httpSRs_str, 0},
+  {jswSymbols_httpCRq, jswSymbols_httpCRq_str, 0},
+  {jswSymbols_httpCRs, jswSymbols_httpCRs_str, 0},
+  {jswSymbols_httpCRs_proto, jswSymbols_httpCRs_proto_str, 3},
+  {jswSymbols_http, jswSymbols_http_str, 3},
+  {jswSymbols_httpSrv_proto, jswSymbols_httpSrv_proto_str, 2},
+  {jswSymbols_httpSRs_proto, jswSymbols_httpSRs_proto_str, 4},
+  {jswSymbols_httpCRq_proto, jswSymbols_httpCRq_proto_str, 2},
+  {jswSymbols_NetworkJS, jswSymbols_NetworkJS_str, 1},
+  {jswSymbols_TelnetServer, jswSymbols_TelnetServer_str, 1},
+  {jswSymbols_crypto, jswSymbols_crypto_str, 7},
+  {jswSymbols_AES, jswSymbols_AES_str, 2},
+  {jswSymbols_tensorflow, jswSymbols_tensorflow_str, 1},
+  {jswSymbols_TFMicroInterpreter_proto, jswSymbols_TFMicroInterpreter_proto_str, 3},
+};
+
+
+const JswSymList *jswGetSymbolListForConstructorProto(JsVar *constructor) {
+  void *constructorPtr = constructor->varData.native.ptr;
+  if (constructorPtr==(void*)jswrap_dataview_constructor) return &jswSymbolTables[jswSymbolIndex_DataView_proto];
+  if (constructorPtr==(void*)jswrap_date_constructor) return &jswSymbolTables[jswSymbolIndex_Date_proto];
+  if (constructorPtr==(void*)jswrap_error_constructor) return &jswSymbolTables[jswSymbolIndex_Error_proto];
+  if (constructorPtr==(void*)jswrap_syntaxerror_constructor) return &jswSymbolTables[jswSymbolIndex_SyntaxError_proto];
+  if (constructorPtr==(void*)jswrap_typeerror_constructor) return &jswSymbolTables[jswSymbolIndex_TypeError_proto];
+  if (constructorPtr==(void*)jswrap_internalerror_constructor) return &jswSymbolTables[jswSymbolIndex_InternalError_proto];
+  if (constructorPtr==(void*)jswrap_referenceerror_constructor) return &jswSymbolTables[jswSymbolIndex_ReferenceError_proto];
+  if (constructorPtr==(void*)jswrap_regexp_constructor) return &jswSymbolTables[jswSymbolIndex_RegExp_proto];
+  if (constructorPtr==(void*)jswrap_onewire_constructor) return &jswSymbolTables[jswSymbolIndex_OneWire_proto];
+  if (constructorPtr==(void*)jswrap_promise_constructor) return &jswSymbolTables[jswSymbolIndex_Promise_proto];
+  if (constructorPtr==(void*)jswrap_serial_constructor) return &jswSymbolTables[jswSymbolIndex_Serial_proto];
+  if (constructorPtr==(void*)gen_jswrap_StorageFile_StorageFile) return &jswSymbolTables[jswSymbolIndex_StorageFile_proto];
+  if (constructorPtr==(void*)jswrap_spi_constructor) return &jswSymbolTables[jswSymbolIndex_SPI_proto];
+  if (constructorPtr==(void*)jswrap_i2c_constructor) return &jswSymbolTables[jswSymbolIndex_I2C_proto];
+  if (constructorPtr==(void*)jswrap_waveform_constructor) return &jswSymbolTables[jswSymbolIndex_Waveform_proto];
+  if (constructorPtr==(void*)gen_jswrap_File_File) return &jswSymbolTables[jswSymbolIndex_File_proto];
+  if (constructorPtr==(void*)gen_jswrap_Graphics_Graphics) return &jswSymbolTables[jswSymbolIndex_Graphics_proto];
+  if (constructorPtr==(void*)gen_jswrap_Socket_Socket) return &jswSymbolTables[jswSymbolIndex_Socket_proto];
+  if (constructorPtr==(void*)gen_jswrap_dgramSocket_dgramSocket) return &jswSymbolTables[jswSymbolIndex_dgramSocket_proto];
+  if (constructorPtr==(void*)gen_jswrap_Server_Server) return &jswSymbolTables[jswSymbolIndex_Server_proto];
+  if (constructorPtr==(void*)gen_jswrap_httpSRq_httpSRq) return &jswSymbolTables[jswSymbolIndex_httpSRq_proto];
+  if (constructorPtr==(void*)gen_jswrap_httpCRs_httpCRs) return &jswSymbolTables[jswSymbolIndex_httpCRs_proto];
+  if (constructorPtr==(void*)gen_jswrap_httpSrv_httpSrv) return &jswSymbolTables[jswSymbolIndex_httpSrv_proto];
+  if (constructorPtr==(void*)gen_jswrap_httpSRs_httpSRs) return &jswSymbolTables[jswSymbolIndex_httpSRs_proto];
+  if (constructorPtr==(void*)gen_jswrap_httpCRq_httpCRq) return &jswSymbolTables[jswSymbolIndex_httpCRq_proto];
+  if (constructorPtr==(void*)gen_jswrap_TFMicroInterpreter_TFMicroInterpreter) return &jswSymbolTables[jswSymbolIndex_TFMicroInterpreter_proto];
+  return 0;
+}
+
+
+JsVar *jswFindBuiltInFunction(JsVar *parent, const char *name) {
+  JsVar *v;
+  if (parent && !jsvIsRoot(parent)) {
+    // ------------------------------------------ INSTANCE + STATIC METHODS
+    if (jsvIsNativeFunction(parent)) {
+      const JswSymList *l = jswGetSymbolListForObject(parent);
+      if (l) {
+        v = jswBinarySearch(l, parent, name);
+        if (v) return v;
+      }
+    }
+    if (jsvIsPin(parent)) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_Pin_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsArray(parent)) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_Array_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsArrayBuffer(parent) && parent->varData.arraybuffer.type==ARRAYBUFFERVIEW_ARRAYBUFFER) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_ArrayBuffer_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsArrayBuffer(parent) && parent->varData.arraybuffer.type!=ARRAYBUFFERVIEW_ARRAYBUFFER) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_ArrayBufferView_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsNumeric(parent)) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_Number_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsFunction(parent)) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_Function_proto], parent, name);
+      if (v) return v;
+    }
+    if (jsvIsString(parent)) {
+      v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_String_proto], parent, name);
+      if (v) return v;
+    }
+    // ------------------------------------------ INSTANCE METHODS WE MUST CHECK CONSTRUCTOR FOR
+    JsVar *proto = jsvIsObject(parent)?jsvSkipNameAndUnLock(jsvFindChildFromString(parent, JSPARSE_INHERITS_VAR)):0;
+    JsVar *constructor = jsvIsObject(proto)?jsvSkipNameAndUnLock(jsvFindChildFromString(proto, JSPARSE_CONSTRUCTOR_VAR)):0;
+    jsvUnLock(proto);
+    if (constructor && jsvIsNativeFunction(constructor)) {
+      const JswSymList *l = jswGetSymbolListForConstructorProto(constructor);
+      jsvUnLock(constructor);
+      if (l) {
+        v = jswBinarySearch(l, parent, name);
+        if (v) return v;
+      }
+    } else {
+      jsvUnLock(constructor);
+    }
+    // ------------------------------------------ METHODS ON OBJECT
+    v = jswBinarySearch(&jswSymbolTables[jswSymbolIndex_Object_proto], parent, name);
+    if (v) return v;
+  } else { /* if (!parent) */
+    // ------------------------------------------ FUNCTIONS
+    #ifndef ESPR_EMBED
+    // Handle pin names - eg LED1 or D5 (this is hardcoded in build_jsfunctions.py)
+    Pin pin = jshGetPinFromString(name);
+    if (pin != PIN_UNDEFINED) 
+      return jsvNewFromPin(pin);
+    #endif
+    return jswBinarySearch(&jswSymbolTables[jswSymbolIndex_global], parent, name);
+  }
+  return 0;
+}
+
+
+const JswSymList *jswGetSymbolListForObject(JsVar *parent) {
+  if (jsvIsNativeFunction(parent)) {
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_pin_constructor) return &jswSymbolTables[jswSymbolIndex_Pin];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_array_constructor) return &jswSymbolTables[jswSymbolIndex_Array];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_date_constructor) return &jswSymbolTables[jswSymbolIndex_Date];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_console_console) return &jswSymbolTables[jswSymbolIndex_console];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_JSON_JSON) return &jswSymbolTables[jswSymbolIndex_JSON];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_number_constructor) return &jswSymbolTables[jswSymbolIndex_Number];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_object_constructor) return &jswSymbolTables[jswSymbolIndex_Object];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_string_constructor) return &jswSymbolTables[jswSymbolIndex_String];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Modules_Modules) return &jswSymbolTables[jswSymbolIndex_Modules];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Math_Math) return &jswSymbolTables[jswSymbolIndex_Math];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_E_E) return &jswSymbolTables[jswSymbolIndex_E];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Flash_Flash) return &jswSymbolTables[jswSymbolIndex_Flash];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_fs_fs) return &jswSymbolTables[jswSymbolIndex_fs];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_process_process) return &jswSymbolTables[jswSymbolIndex_process];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_promise_constructor) return &jswSymbolTables[jswSymbolIndex_Promise];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_serial_constructor) return &jswSymbolTables[jswSymbolIndex_Serial];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Storage_Storage) return &jswSymbolTables[jswSymbolIndex_Storage];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_spi_constructor) return &jswSymbolTables[jswSymbolIndex_SPI];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_i2c_constructor) return &jswSymbolTables[jswSymbolIndex_I2C];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_heatshrink_heatshrink) return &jswSymbolTables[jswSymbolIndex_heatshrink];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Graphics_Graphics) return &jswSymbolTables[jswSymbolIndex_Graphics];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_url_url) return &jswSymbolTables[jswSymbolIndex_url];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_Socket_Socket) return &jswSymbolTables[jswSymbolIndex_Socket];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_net_net) return &jswSymbolTables[jswSymbolIndex_net];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_dgram_dgram) return &jswSymbolTables[jswSymbolIndex_dgram];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_dgramSocket_dgramSocket) return &jswSymbolTables[jswSymbolIndex_dgramSocket];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_tls_tls) return &jswSymbolTables[jswSymbolIndex_tls];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_httpSRq_httpSRq) return &jswSymbolTables[jswSymbolIndex_httpSRq];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_httpSRs_httpSRs) return &jswSymbolTables[jswSymbolIndex_httpSRs];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_httpCRq_httpCRq) return &jswSymbolTables[jswSymbolIndex_httpCRq];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_httpCRs_httpCRs) return &jswSymbolTables[jswSymbolIndex_httpCRs];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_http_http) return &jswSymbolTables[jswSymbolIndex_http];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_NetworkJS_NetworkJS) return &jswSymbolTables[jswSymbolIndex_NetworkJS];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_TelnetServer_TelnetServer) return &jswSymbolTables[jswSymbolIndex_TelnetServer];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_crypto_crypto) return &jswSymbolTables[jswSymbolIndex_crypto];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_AES_AES) return &jswSymbolTables[jswSymbolIndex_AES];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_tensorflow_tensorflow) return &jswSymbolTables[jswSymbolIndex_tensorflow];
+  }
+  if (parent==execInfo.root) return &jswSymbolTables[jswSymbolIndex_global];
+  return 0;
+}
+
+
+const JswSymList *jswGetSymbolListForObjectProto(JsVar *parent) {
+  if (jsvIsNativeFunction(parent)) {
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_pin_constructor) return &jswSymbolTables[jswSymbolIndex_Pin_proto];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_array_constructor) return &jswSymbolTables[jswSymbolIndex_Array_proto];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_arraybuffer_constructor) return &jswSymbolTables[jswSymbolIndex_ArrayBuffer_proto];
+    if ((void*)parent->varData.native.ptr==(void*)gen_jswrap_ArrayBufferView_ArrayBufferView) return &jswSymbolTables[jswSymbolIndex_ArrayBufferView_proto];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_number_constructor) return &jswSymbolTables[jswSymbolIndex_Number_proto];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_function_constructor) return &jswSymbolTables[jswSymbolIndex_Function_proto];
+    if ((void*)parent->varData.native.ptr==(void*)jswrap_string_constructor) return &jswSymbolTables[jswSymbolIndex_String_proto];
+  }
+  JsVar *constructor = jsvIsObject(parent)?jsvSkipNameAndUnLock(jsvFindChildFromString(parent, JSPARSE_CONSTRUCTOR_VAR)):0;
+  if (constructor && jsvIsNativeFunction(constructor)) {
+    const JswSymList *l = jswGetSymbolListForConstructorProto(constructor);
+    jsvUnLock(constructor);
+    if (l) return l;
+  }
+  if (jsvIsPin(parent)) return &jswSymbolTables[jswSymbolIndex_Pin_proto];
+  if (jsvIsArray(parent)) return &jswSymbolTables[jswSymbolIndex_Array_proto];
+  if (jsvIsArrayBuffer(parent) && parent->varData.arraybuffer.type==ARRAYBUFFERVIEW_ARRAYBUFFER) return &jswSymbolTables[jswSymbolIndex_ArrayBuffer_proto];
+  if (jsvIsArrayBuffer(parent) && parent->varData.arraybuffer.type!=ARRAYBUFFERVIEW_ARRAYBUFFER) return &jswSymbolTables[jswSymbolIndex_ArrayBufferView_proto];
+  if (jsvIsNumeric(parent)) return &jswSymbolTables[jswSymbolIndex_Number_proto];
+  if (jsvIsFunction(parent)) return &jswSymbolTables[jswSymbolIndex_Function_proto];
+  if (jsvIsString(parent)) return &jswSymbolTables[jswSymbolIndex_String_proto];
+  return &jswSymbolTables[jswSymbolIndex_Object_proto];
+}
+
+
+bool jswIsBuiltInObject(const char *name) {
+  const char *objNames = "Pin\0Array\0ArrayBuffer\0ArrayBufferView\0Uint8Array\0Uint8ClampedArray\0Int8Array\0Uint16Array\0Int16Array\0Uint24Array\0Uint32Array\0Int32Array\0Float32Array\0Float64Array\0DataView\0Date\0Error\0SyntaxError\0TypeError\0InternalError\0ReferenceError\0Function\0console\0JSON\0Number\0Object\0Boolean\0RegExp\0String\0Modules\0Math\0E\0process\0OneWire\0Promise\0Serial\0StorageFile\0SPI\0I2C\0Waveform\0File\0Graphics\0url\0Server\0Socket\0dgramSocket\0httpSrv\0httpSRq\0httpSRs\0httpCRq\0httpCRs\0AES\0TFMicroInterpreter\0";
+  const char *s = objNames;
+  while (*s) {
+    if (strcmp(s, name)==0) return true;
+    s+=strlen(s)+1;
+  }
+  return false;
+}
+
+
+void *jswGetBuiltInLibrary(const char *name) {
+  if (strcmp(name, "Flash")==0) return (void*)gen_jswrap_Flash_Flash;
+  if (strcmp(name, "Storage")==0) return (void*)gen_jswrap_Storage_Storage;
+  if (strcmp(name, "heatshrink")==0) return (void*)gen_jswrap_heatshrink_heatshrink;
+  if (strcmp(name, "fs")==0) return (void*)gen_jswrap_fs_fs;
+  if (strcmp(name, "net")==0) return (void*)gen_jswrap_net_net;
+  if (strcmp(name, "dgram")==0) return (void*)gen_jswrap_dgram_dgram;
+  if (strcmp(name, "tls")==0) return (void*)gen_jswrap_tls_tls;
+  if (strcmp(name, "http")==0) return (void*)gen_jswrap_http_http;
+  if (strcmp(name, "NetworkJS")==0) return (void*)gen_jswrap_NetworkJS_NetworkJS;
+  if (strcmp(name, "TelnetServer")==0) return (void*)gen_jswrap_TelnetServer_TelnetServer;
+  if (strcmp(name, "crypto")==0) return (void*)gen_jswrap_crypto_crypto;
+  if (strcmp(name, "tensorflow")==0) return (void*)gen_jswrap_tensorflow_tensorflow;
+  return 0;
+}
+
+
+/** Given a variable, return the basic object name of it */
+const char *jswGetBasicObjectName(JsVar *var) {
+  if (jsvIsArrayBuffer(var)) {
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_ARRAYBUFFER) return "ArrayBuffer";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_UINT8) return "Uint8Array";
+    if (var->varData.arraybuffer.type==(ARRAYBUFFERVIEW_UINT8|ARRAYBUFFERVIEW_CLAMPED)) return "Uint8ClampedArray";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_INT8) return "Int8Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_UINT16) return "Uint16Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_INT16) return "Int16Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_UINT24) return "Uint24Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_UINT32) return "Uint32Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_INT32) return "Int32Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_FLOAT32) return "Float32Array";
+    if (var->varData.arraybuffer.type==ARRAYBUFFERVIEW_FLOAT64) return "Float64Array";
+  }
+  if (jsvIsPin(var)) return "Pin";
+  if (jsvIsArray(var)) return "Array";
+  if (jsvIsNumeric(var)) return "Number";
+  if (jsvIsObject(var)) return "Object";
+  if (jsvIsFunction(var)) return "Function";
+  if (jsvIsString(var)) return "String";
+  return 0;
+}
+
+
+/** Given the name of a Basic Object, eg, Uint8Array, String, etc. Return the prototype object's name - or 0. */
+const char *jswGetBasicObjectPrototypeName(const char *objectName) {
+  if (!strcmp(objectName, "Uint8Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Uint8ClampedArray")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Int8Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Uint16Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Int16Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Uint24Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Uint32Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Int32Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Float32Array")) return "ArrayBufferView";
+  if (!strcmp(objectName, "Float64Array")) return "ArrayBufferView";
+  return strcmp(objectName,"Object") ? "Object" : 0;
+}
+
+
+/** Tasks to run on Idle. Returns true if either one of the tasks returned true (eg. they're doing something and want to avoid sleeping) */
+bool jswIdle() {
+  bool wasBusy = false;
+  if (jswrap_pipe_idle()) wasBusy = true;
+  if (jswrap_serial_idle()) wasBusy = true;
+  if (jswrap_waveform_idle()) wasBusy = true;
+  if (jswrap_graphics_idle()) wasBusy = true;
+  if (jswrap_net_idle()) wasBusy = true;
+  if (jswrap_telnet_idle()) wasBusy = true;
+  return wasBusy;
+}
+
+
+/** Tasks to run on Hardware Initialisation (called once at boot time, after jshInit, before jsvInit/etc) */
+void jswHWInit() {
+}
+
+
+/** Tasks to run on Initialisation (eg boot/load/reset/after save/etc) */
+void jswInit() {
+  jswrap_graphics_init();
+  jswrap_net_init();
+  jswrap_telnet_init();
+}
+
+
+/** Tasks to run on Deinitialisation (eg before save/reset/etc) */
+void jswKill() {
+  jswrap_pipe_kill();
+  jswrap_waveform_kill();
+  jswrap_file_kill();
+  jswrap_net_kill();
+  jswrap_telnet_kill();
+}
+/** Tasks to run when a character event is received */
+bool jswOnCharEvent(IOEventFlags channel, char charData) {
+  NOT_USED(channel);
+  NOT_USED(charData);
+  return false;
+}
+/** If we have a built-in module with the given name, return the module's contents - or 0 */
+const char *jswGetBuiltInJSLibrary(const char *name) {
+  NOT_USED(name);
+  return 0;
+}
+
+
+const char *jswGetBuiltInLibraryNames() {
+  return "Flash,Storage,heatshrink,fs,net,dgram,tls,http,NetworkJS,TelnetServer,crypto,tensorflow";
+}
+
+
@@ -0,0 +1,116 @@
+
+// Automatically generated header file for LINUX
+// Generated by scripts/build_platform_config.py
+
+#ifndef _PLATFORM_CONFIG_H
+#define _PLATFORM_CONFIG_H
+
+
+#define PC_BOARD_ID "LINUX"
+#define PC_BOARD_CHIP "LINUX"
+#define PC_BOARD_CHIP_FAMILY "LINUX"
+
+#define LINKER_END_VAR _end
+#define LINKER_ETEXT_VAR _etext
+
+// SYSTICK is the counter that counts up and that we use as the real-time clock
+// The smaller this is, the longer we spend in interrupts, but also the more we can sleep!
+#define SYSTICK_RANGE 0x1000000 // the Maximum (it is a 24 bit counter) - on Olimexino this is about 0.6 sec
+#define SYSTICKS_BEFORE_USB_DISCONNECT 2
+
+#define DEFAULT_BUSY_PIN_INDICATOR (Pin)-1 // no indicator
+#define DEFAULT_SLEEP_PIN_INDICATOR (Pin)-1 // no indicator
+
+
+#define RAM_TOTAL (0*1024)
+#define FLASH_TOTAL (256*1024)
+
+#define RESIZABLE_JSVARS // Allocate variables in blocks using malloc - slow, and linux-only
+#define FLASH_START                     0x10000000
+#define FLASH_PAGE_SIZE                 1024
+#define FLASH_SAVED_CODE_START            (FLASH_START + FLASH_TOTAL - FLASH_SAVED_CODE_LENGTH)
+#define FLASH_SAVED_CODE_LENGTH           262144
+
+#define CLOCK_SPEED_MHZ                      -1
+#define ESPR_USART_COUNT                     6
+#define ESPR_SPI_COUNT                       3
+#define ESPR_I2C_COUNT                       3
+#define ESPR_ADC_COUNT                       0
+#define ESPR_DAC_COUNT                       0
+#define ESPR_EXTI_COUNT                      16
+
+#define DEFAULT_CONSOLE_DEVICE              EV_USBSERIAL
+
+#define IOBUFFERMASK 255 // (max 65535) amount of items in event buffer - events take 5 bytes each
+#define TXBUFFERMASK 255 // (max 255) amount of items in the transmit buffer - 2 bytes each
+#define UTILTIMERTASK_TASKS (16) // Must be power of 2 - and max 256
+
+// When to send the message that the IO buffer is getting full
+#define IOBUFFER_XOFF ((TXBUFFERMASK)*6/8)
+// When to send the message that we can start receiving again
+#define IOBUFFER_XON ((TXBUFFERMASK)*3/8)
+
+
+// definition to avoid compilation when Pin/platform config is not defined
+#define IS_PIN_USED_INTERNALLY(PIN) ((false))
+#define IS_PIN_A_LED(PIN) ((false))
+#ifndef IS_PIN_A_BUTTON
+#define IS_PIN_A_BUTTON(PIN) ((false))
+#endif
+
+#ifndef ESPR_DEFINES_ON_COMMANDLINE
+// The Makefile calls the compiler with ESPR_DEFINES_ON_COMMANDLINE defined so this
+// is ignored and all these defines go on the command line and apply to every file
+// whether or not platform_config was included. However if you're viewing a file in
+// a code editor like VS Code it'll parse this and should then highlight the correct
+// code based on your build
+	#define GIT_COMMIT 6283053
+	#define SYSFS_GPIO_DIR "/sys/class/gpio"
+	#define LINUX
+	#define ESPR_UNICODE_SUPPORT 1
+	#define ESPR_FUNCTION_TOKEN_CACHE 1
+	#define ESPR_PROPERTY_CACHE 1
+	#define ESPR_PROPERTY_INDEX 1
+	#define ESPR_SCOPE_SLOTS 1
+	#define ESPR_GC_INCREMENTAL 1
+	#define ESPR_FREE_RUN_INDEX 1
+	#define ESPR_STRING_TAIL_CACHE 1
+	#define ESPR_TIMER_HEAP 1
+	#define ESPR_WATCH_INDEX 1
+	#define ESPR_LINUX_EVENT_WAIT 1
+	#define ESPR_SOCKET_RECV_QUEUE 1
+	#define ESPR_HTTP_KEEP_ALIVE 1
+	#define ESPR_HTTP_STREAMING 1
+	#define ESPR_STORAGE_HASH_INDEX 1
+	#define ESPR_USE_STORAGE_CACHE 32
+	#define ESPR_STORAGE_IDLE_COMPACT 1
+	#define ESPR_STORAGEFILE_DIRECTORY 1
+	#define ESPR_STORAGEFILE_READ_BUFFER 1
+	#define ESPR_STORAGE_COMPRESS 1
+	#define ESPR_SAVE_DELTA 1
+	#define USE_FONT_6X8
+	#define GRAPHICS_PALETTED_IMAGES
+	#define GRAPHICS_ANTIALIAS
+	#define ESPR_PBF_FONTS
+	#define SPIFLASH_BASE 0
+	#define SPIFLASH_LENGTH FLASH_SAVED_CODE_LENGTH
+	#define USE_DEBUGGER
+	#define USE_TAB_COMPLETE
+	#define USE_HEATSHRINK
+	#define USE_FILESYSTEM
+	#define USE_GRAPHICS
+	#define USE_NET
+	#define USE_NETWORK_JS
+	#define USE_TELNET
+	#define USE_CRYPTO
+	#define USE_SHA256
+	#define USE_SHA512
+	#define USE_TLS
+	#define USE_AES
+	#define USE_TENSORFLOW 1
+	#define LINUX
+	#define USB
+#endif
+
+#endif // _PLATFORM_CONFIG_H
+
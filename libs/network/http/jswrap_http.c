@@ -382,6 +382,11 @@ here](/Internet#http-post)
 **Note:** if TLS/HTTPS is enabled, options can have `ca`, `key` and `cert`
 fields. See `tls.connect` for more information about these and how to use them.
 
+**Note:** On builds with `ESPR_HTTP_KEEP_ALIVE` (eg. Linux), `keepAlive:true` can be
+added to `options`. The connection is then put in a pool when the response has been
+received (if the server agrees), and is reused by the next request to the same host and
+port. Idle connections are closed after 5 seconds.
+
 */
 
 /*JSON{
@@ -493,7 +498,7 @@ The default contents are:
   "params" : [
     ["data","JsVar","A string containing data to send"]
   ],
-  "return" : ["bool","For node.js compatibility, returns the boolean false. When the send buffer is empty, a `drain` event will be sent"]
+  "return" : ["bool","`false` if you should wait for the `drain` event (sent when the send buffer is empty) before writing more. On most builds this is always `false`, for node.js compatibility"]
 }
 This function writes the `data` argument as a string. Data that is passed in
 (including arrays) will be converted to a string with the normal JavaScript
@@ -502,7 +507,7 @@ This function writes the `data` argument as a string. Data that is passed in
 */
 bool jswrap_httpSRs_write(JsVar *parent, JsVar *data) {
   serverResponseWrite(parent, data);
-  return false;
+  return socketWriteHasSpace(parent);
 }
 
 /*JSON{
@@ -517,8 +522,7 @@ bool jswrap_httpSRs_write(JsVar *parent, JsVar *data) {
 See `Socket.write` for more information about the data argument
 */
 void jswrap_httpSRs_end(JsVar *parent, JsVar *data) {
-  if (!jsvIsUndefined(data)) jswrap_httpSRs_write(parent, data);
-  serverResponseEnd(parent);
+  serverResponseEnd(parent, data);
 }
 
 
@@ -574,7 +578,7 @@ void jswrap_httpSRs_setHeader(JsVar *parent, JsVar *name, JsVar *value) {
   "params" : [
     ["data","JsVar","A string containing data to send"]
   ],
-  "return" : ["bool","For node.js compatibility, returns the boolean false. When the send buffer is empty, a `drain` event will be sent"]
+  "return" : ["bool","`false` if you should wait for the `drain` event (sent when the send buffer is empty) before writing more. On most builds this is always `false`, for node.js compatibility"]
 }
 This function writes the `data` argument as a string. Data that is passed in
 (including arrays) will be converted to a string with the normal JavaScript
@@ -730,7 +730,7 @@ void jswrap_net_server_close(JsVar *parent) {
   "params" : [
     ["data","JsVar","A string containing data to send"]
   ],
-  "return" : ["bool","For node.js compatibility, returns the boolean false. When the send buffer is empty, a `drain` event will be sent"]
+  "return" : ["bool","`false` if you should wait for the `drain` event (sent when the send buffer is empty) before writing more. On most builds this is always `false`, for node.js compatibility"]
 }
 This function writes the `data` argument as a string. Data that is passed in
 (including arrays) will be converted to a string with the normal JavaScript
@@ -760,7 +760,7 @@ bool jswrap_net_socket_write(JsVar *parent, JsVar *data) {
   if (!networkGetFromVarIfOnline(&net)) return false;
   clientRequestWrite(&net, parent, data, NULL, 0);
   networkFree(&net);
-  return false;
+  return socketWriteHasSpace(parent);
 }
 
 /*JSON{
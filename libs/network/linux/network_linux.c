@@ -13,6 +13,7 @@
  */
 #include "network.h"
 #include "network_linux.h"
+#include "jshardwareLinux.h"
 
 #include <string.h> // for memset
 
@@ -58,11 +59,92 @@ void net_linux_gethostbyname(JsNetwork *net, char * hostName, uint32_t* out_ip_a
     *out_ip_addr = *(uint32_t*)*host_addr_p->h_addr_list;
 }
 
+#ifdef ESPR_LINUX_EVENT_WAIT
+#include <sys/epoll.h>
+#include <stdlib.h>
+
+#define NET_LINUX_MAX_READY 64 ///< how many ready sockets we find out about per idle
+
+/* All our sockets are in an epoll set. Each idle we ask it which sockets are
+ * ready and note them in a bitmap, so socketserver only needs to recv/accept
+ * on those, rather than making a syscall for every socket. */
+static int netEpollFd = -1; ///< epoll set containing all our sockets
+static int netSocketCount; ///< how many sockets are in netEpollFd
+static unsigned char *netReadyBits; ///< bitmap of sockets that were ready as of the last idle
+static int netReadyBitsSize; ///< size of netReadyBits in bytes
+static int netReady[NET_LINUX_MAX_READY]; ///< sockets set in netReadyBits (so we can clear them)
+static int netReadyCount;
+
+static void net_linux_watch(int sckt) {
+  if (netEpollFd<0) netEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = sckt;
+  if (epoll_ctl(netEpollFd, EPOLL_CTL_ADD, sckt, &ev)==0)
+    netSocketCount++;
+  jshLinuxWaitAdd(sckt); // wake from sleep when there's data
+}
+
+static void net_linux_unwatch(int sckt) {
+  jshLinuxWaitRemove(sckt);
+  if (netEpollFd>=0 && epoll_ctl(netEpollFd, EPOLL_CTL_DEL, sckt, NULL)==0)
+    netSocketCount--;
+  if (sckt < netReadyBitsSize*8)
+    netReadyBits[sckt>>3] &= (unsigned char)~(1<<(sckt&7));
+}
+
+/// Stop (or restart) reporting the socket as ready, because socketserver isn't reading from it
+static void net_linux_pauserecv(JsNetwork *net, int sckt, bool paused) {
+  NOT_USED(net);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = paused ? 0 : (EPOLLIN | EPOLLRDHUP);
+  ev.data.fd = sckt;
+  if (netEpollFd>=0) epoll_ctl(netEpollFd, EPOLL_CTL_MOD, sckt, &ev);
+  jshLinuxWaitPause(sckt, paused);
+  if (paused && sckt < netReadyBitsSize*8)
+    netReadyBits[sckt>>3] &= (unsigned char)~(1<<(sckt&7));
+}
+
 /// Called on idle. Do any checks required for this device
 void net_linux_idle(JsNetwork *net) {
   NOT_USED(net);
+  int i;
+  for (i=0;i<netReadyCount;i++)
+    if (netReady[i] < netReadyBitsSize*8)
+      netReadyBits[netReady[i]>>3] = 0;
+  netReadyCount = 0;
+  if (netEpollFd<0 || !netSocketCount) return;
+  struct epoll_event events[NET_LINUX_MAX_READY];
+  int n = epoll_wait(netEpollFd, events, NET_LINUX_MAX_READY, 0);
+  for (i=0;i<n;i++) {
+    int sckt = events[i].data.fd;
+    if (sckt >= netReadyBitsSize*8) {
+      int newSize = ((sckt>>3)+64) & ~63;
+      unsigned char *bits = realloc(netReadyBits, (size_t)newSize);
+      if (!bits) continue;
+      memset(&bits[netReadyBitsSize], 0, (size_t)(newSize-netReadyBitsSize));
+      netReadyBits = bits;
+      netReadyBitsSize = newSize;
+    }
+    netReadyBits[sckt>>3] |= (unsigned char)(1<<(sckt&7));
+    netReady[netReadyCount++] = sckt;
+  }
 }
 
+/// Did the socket have data waiting (or a connection to accept, or close) as of the last idle?
+bool net_linux_isready(JsNetwork *net, int sckt) {
+  NOT_USED(net);
+  return sckt>=0 && sckt < netReadyBitsSize*8 && (netReadyBits[sckt>>3] & (1<<(sckt&7)));
+}
+#else
+/// Called on idle. Do any checks required for this device
+void net_linux_idle(JsNetwork *net) {
+  NOT_USED(net);
+}
+#endif
+
 /// Call just before returning to idle loop. This checks for errors and tries to recover. Returns true if no errors.
 bool net_linux_checkError(JsNetwork *net) {
   NOT_USED(net);
@@ -198,6 +280,11 @@ int net_linux_createsocket(JsNetwork *net, SocketType socketType, uint32_t host,
   if (setsockopt(sckt,SOL_SOCKET,SO_NOSIGPIPE,(const char *)&optval,sizeof(optval))<0)
     jsWarn("setsockopt(SO_NOSIGPIPE) failed\n");
 #endif
+#ifdef ESPR_LINUX_EVENT_WAIT
+  if (!host) // so accept doesn't block if the connection went away after it was reported
+    fcntl(sckt, F_SETFL, fcntl(sckt, F_GETFL) | O_NONBLOCK);
+  net_linux_watch(sckt);
+#endif
 
   return sckt;
 }
@@ -205,12 +292,21 @@ int net_linux_createsocket(JsNetwork *net, SocketType socketType, uint32_t host,
 /// destroys the given socket
 void net_linux_closesocket(JsNetwork *net, int sckt) {
   NOT_USED(net);
+#ifdef ESPR_LINUX_EVENT_WAIT
+  net_linux_unwatch(sckt);
+#endif
   closesocket(sckt);
 }
 
 /// If the given server socket can accept a connection, return it (or return < 0)
 int net_linux_accept(JsNetwork *net, int sckt) {
   NOT_USED(net);
+#ifdef ESPR_LINUX_EVENT_WAIT
+  // socketserver has already checked net_linux_isready, and server sockets are non-blocking
+  int theClient = accept(sckt,0,0);
+  if (theClient>=0) net_linux_watch(theClient);
+  return theClient;
+#else
   // TODO: look for unreffed servers?
   fd_set s;
   FD_ZERO(&s);
@@ -226,6 +322,7 @@ int net_linux_accept(JsNetwork *net, int sckt) {
     return theClient;
   }
   return -1;
+#endif
 }
 
 /// Receive data if possible. returns nBytes on success, 0 on no data, or -1 on failure
@@ -234,6 +331,12 @@ int net_linux_recv(JsNetwork *net, SocketType socketType, int sckt, void *buf, s
   struct sockaddr_in fromAddr;
   int fromAddrLen = sizeof(fromAddr);
   int num = 0;
+#ifdef ESPR_LINUX_EVENT_WAIT
+  // Don't check with select - socketserver only calls us if net_linux_isready, so just don't block
+  int flags = MSG_DONTWAIT;
+  int n = 1;
+#else
+  int flags = 0;
   fd_set s;
   FD_ZERO(&s);
   FD_SET(sckt,&s);
@@ -242,6 +345,7 @@ int net_linux_recv(JsNetwork *net, SocketType socketType, int sckt, void *buf, s
   timeout.tv_sec = 0;
   timeout.tv_usec = 0;
   int n = select(sckt+1,&s,NULL,NULL,&timeout);
+#endif
   if (n==SOCKET_ERROR) {
     // we probably disconnected
     return -1;
@@ -249,7 +353,8 @@ int net_linux_recv(JsNetwork *net, SocketType socketType, int sckt, void *buf, s
     // receive data
     if (socketType & ST_UDP) {
       JsNetUDPPacketHeader *header = (JsNetUDPPacketHeader*)buf;
-      num = (int)recvfrom(sckt,buf+sizeof(JsNetUDPPacketHeader),len-sizeof(JsNetUDPPacketHeader),0,(struct sockaddr *)&fromAddr,(socklen_t*)&fromAddrLen);
+      num = (int)recvfrom(sckt,buf+sizeof(JsNetUDPPacketHeader),len-sizeof(JsNetUDPPacketHeader),flags,(struct sockaddr *)&fromAddr,(socklen_t*)&fromAddrLen);
+      if (num<0) return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
       *(in_addr_t*)&header->host = fromAddr.sin_addr.s_addr;
       header->port = ntohs(fromAddr.sin_port);
       header->length = (uint16_t)num;
@@ -258,7 +363,8 @@ int net_linux_recv(JsNetwork *net, SocketType socketType, int sckt, void *buf, s
       if (num==0) return -1; // select says data, but recv says 0 means connection is closed
       num += sizeof(JsNetUDPPacketHeader);
     } else {
-      num = (int)recvfrom(sckt,buf,len,0,(struct sockaddr *)&fromAddr,(socklen_t*)&fromAddrLen);
+      num = (int)recvfrom(sckt,buf,len,flags,(struct sockaddr *)&fromAddr,(socklen_t*)&fromAddrLen);
+      if (num<0) return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
       if (num==0) return -1; // select says data, but recv says 0 means connection is closed
     }
   }
@@ -269,6 +375,13 @@ int net_linux_recv(JsNetwork *net, SocketType socketType, int sckt, void *buf, s
 /// Send data if possible. returns nBytes on success, 0 on no data, or -1 on failure
 int net_linux_send(JsNetwork *net, SocketType socketType, int sckt, const void *buf, size_t len) {
   NOT_USED(net);
+#ifdef ESPR_LINUX_EVENT_WAIT
+  // Don't check with select - just don't block, and report 'not ready' if the socket is full
+  int flags = MSG_DONTWAIT;
+  int n = 0;
+  if (sckt>=0) {
+#else
+  int flags = 0;
   fd_set writefds;
   FD_ZERO(&writefds);
   FD_SET(sckt, &writefds);
@@ -280,7 +393,7 @@ int net_linux_send(JsNetwork *net, SocketType socketType, int sckt, const void *
      // we probably disconnected so just get rid of this
     return -1;
   } else if (FD_ISSET(sckt, &writefds)) {
-    int flags = 0;
+#endif
 #if !defined(SO_NOSIGPIPE) && defined(MSG_NOSIGNAL)
     flags |= MSG_NOSIGNAL;
 #endif
@@ -293,9 +406,15 @@ int net_linux_send(JsNetwork *net, SocketType socketType, int sckt, const void *
 
       DBG("Send %d %x:%d", len - sizeof(JsNetUDPPacketHeader), header->host, header->port);
       n = (int)sendto(sckt, buf + sizeof(JsNetUDPPacketHeader), header->length, flags, (struct sockaddr *)&sin, sizeof(sockaddr_in));
+#ifdef ESPR_LINUX_EVENT_WAIT
+      if (n<0) return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
+#endif
       n += sizeof(JsNetUDPPacketHeader);
     } else {
       n = (int)send(sckt, buf, len, flags);
+#ifdef ESPR_LINUX_EVENT_WAIT
+      if (n<0) return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
+#endif
     }
     return n;
   } else
@@ -311,5 +430,9 @@ void netSetCallbacks_linux(JsNetwork *net) {
   net->gethostbyname = net_linux_gethostbyname;
   net->recv = net_linux_recv;
   net->send = net_linux_send;
+#ifdef ESPR_LINUX_EVENT_WAIT
+  net->isReady = net_linux_isready;
+  net->pauseRecv = net_linux_pauserecv;
+#endif
   net->chunkSize = 536;
 }
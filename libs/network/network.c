@@ -232,6 +232,9 @@ bool networkGetFromVar(JsNetwork *net) {
   // structure.
   jsvGetStringChars(net->networkVar,0,(char *)&net->data, sizeof(JsNetworkData));
 
+  // Optional callbacks
+  net->isReady = 0;
+  net->pauseRecv = 0;
   // Now we know which kind of network we are working with, invoke the corresponding initialization
   // function to set the callbacks for this network tyoe.
   switch (net->data.type) {
@@ -706,6 +709,24 @@ void netGetHostByName(JsNetwork *net, char * hostName, uint32_t* out_ip_addr) {
   net->gethostbyname(net, hostName, out_ip_addr);
 }
 
+bool netIsReady(JsNetwork *net, SocketType socketType, int sckt) {
+  return netNeedsPolling(net, socketType) || net->isReady(net, sckt);
+}
+
+bool netNeedsPolling(JsNetwork *net, SocketType socketType) {
+#ifdef USE_TLS
+  // mbedtls may have data buffered, or a handshake to continue
+  if (socketType & ST_TLS) return true;
+#else
+  NOT_USED(socketType);
+#endif
+  return !net->isReady;
+}
+
+void netPauseRecv(JsNetwork *net, int sckt, bool paused) {
+  if (net->pauseRecv) net->pauseRecv(net, sckt, paused);
+}
+
 int netRecv(JsNetwork *net, SocketType socketType, int sckt, void *buf, size_t len) {
 #ifdef USE_TLS
   if (socketType & ST_TLS) {
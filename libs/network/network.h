@@ -84,6 +84,13 @@ typedef struct JsNetwork {
   int (*recv)(struct JsNetwork *net, SocketType socketType, int sckt, void *buf, size_t len);
   /// Send data if possible. returns nBytes on success, 0 on no data, or -1 on failure
   int (*send)(struct JsNetwork *net, SocketType socketType, int sckt, const void *buf, size_t len);
+  /** Optional (may be 0). Return true if the socket has data (or a connection) waiting, or has closed,
+   * as of the last call to idle. If set, sockets that aren't ready aren't polled with recv/accept,
+   * and the device must be woken from sleep when a socket becomes ready */
+  bool (*isReady)(struct JsNetwork *net, int sckt);
+  /** Optional (may be 0). We've stopped calling recv on this socket because too much data is
+   * waiting to be processed (or have started again) - so don't report it as ready or wake for it */
+  void (*pauseRecv)(struct JsNetwork *net, int sckt, bool paused);
 } PACKED_FLAGS JsNetwork;
 
 /// Header applied to all UDP packets when they are received
@@ -133,6 +140,14 @@ int netAccept(JsNetwork *net, int sckt);
 
 void netGetHostByName(JsNetwork *net, char * hostName, uint32_t* out_ip_addr);
 
+/** Could there be data to receive on this socket (or a connection to accept)? If false,
+ * there's no need to call netRecv/netAccept */
+bool netIsReady(JsNetwork *net, SocketType socketType, int sckt);
+/** Does this socket need checking on every idle pass (rather than the network waking
+ * us up when it's ready)? */
+bool netNeedsPolling(JsNetwork *net, SocketType socketType);
+/// We've stopped (or restarted) calling netRecv on this socket because its data isn't being processed
+void netPauseRecv(JsNetwork *net, int sckt, bool paused);
 int netRecv(JsNetwork *net, SocketType socketType, int sckt, void *buf, size_t len);
 int netSend(JsNetwork *net, SocketType socketType, int sckt, const void *buf, size_t len);
 
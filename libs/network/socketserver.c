@@ -37,6 +37,25 @@
 #define HTTP_NAME_CLOSENOW "clsNow"  // boolean: gotta close
 #define HTTP_NAME_CONNECTED "conn"     // boolean: we are connected
 #define HTTP_NAME_CLOSE "cls"        // close after sending
+#define HTTP_NAME_HEADER_SCAN "hdrIdx" // index of the first header line we haven't parsed yet
+#define HTTP_NAME_CONNECTION_CLOSE "cClose" // boolean: other end sent 'Connection: close'
+#ifdef ESPR_SOCKET_RECV_QUEUE
+#define HTTP_NAME_RECEIVE_QUEUE "qRcv" // array of received strings the reader hasn't taken yet
+#define HTTP_NAME_RECEIVE_QUEUED "cQue" // how many bytes are in HTTP_NAME_RECEIVE_QUEUE
+#ifndef SOCKET_RECV_HIGH_WATER_MARK
+/// Once this many bytes are queued for a socket, stop receiving from it until the reader takes some
+#define SOCKET_RECV_HIGH_WATER_MARK 4096
+#endif
+#endif
+#ifdef ESPR_HTTP_STREAMING
+#define HTTP_NAME_CHUNK_STATE "cSt"    // HttpChunkState: where we are in decoding a chunked body
+#define HTTP_NAME_CHUNK_LEFT "cLeft"   // bytes left in the current chunk (or its size so far, while reading that)
+#define HTTP_NAME_CHUNK_OUT "cOut"     // server response: the client can take chunked data, so use that if there's no length
+#ifndef SOCKET_SEND_HIGH_WATER_MARK
+/// Once this many bytes are waiting to be sent, write() returns false so the caller waits for 'drain'
+#define SOCKET_SEND_HIGH_WATER_MARK 2048
+#endif
+#endif
 #define HTTP_NAME_ON_CONNECT JS_EVENT_PREFIX"connect"
 #define HTTP_NAME_ON_CLOSE JS_EVENT_PREFIX"close"
 #define HTTP_NAME_ON_END JS_EVENT_PREFIX"end"
@@ -49,6 +68,25 @@
 #define HTTP_ARRAY_HTTP_SERVERS "HttpS"
 #define HTTP_ARRAY_HTTP_SERVER_CONNECTIONS "HttpSC"
 
+#ifdef ESPR_HTTP_KEEP_ALIVE
+#define HTTP_NAME_KEEP_ALIVE "kA"        // boolean: keep the connection open once this request/response is done
+#define HTTP_NAME_KEEP_ALIVE_EXPIRY "kAExp" // time (ms) at which an idle kept-alive connection will be closed
+#define HTTP_NAME_BODY_LEFT "bLeft"      // server: bytes of the request body still to arrive - anything after is the next request
+#define HTTP_NAME_NEXT_DATA "dNext"      // server: data received for the next (pipelined) request
+#define HTTP_NAME_POOL_KEY "key"         // client: identifies the host/port so idle connections to it can be reused
+#define HTTP_NAME_STATUS_CODE "code"     // server: status code given to writeHead, if sending the headers was put off until end()
+#define HTTP_ARRAY_HTTP_POOL "HttpP"     // idle client connections that can be reused
+
+#ifndef HTTP_KEEP_ALIVE_TIMEOUT
+/// How long (in ms) an idle kept-alive connection is left open for
+#define HTTP_KEEP_ALIVE_TIMEOUT 5000
+#endif
+#ifndef HTTP_POOL_SIZE
+/// The maximum number of idle client connections we keep open for reuse
+#define HTTP_POOL_SIZE 8
+#endif
+#endif
+
 #ifdef ESP8266
 // esp8266 debugging, need to remove this eventually
 extern int os_printf_plus(const char *format, ...)  __attribute__((format(printf, 1, 2)));
@@ -90,100 +128,122 @@ static void httpAppendHeaders(JsVar *string, JsVar *headerObject) {
   // free headers
 }
 
-// httpParseHeaders(&receiveData, reqVar, true) // server
-// httpParseHeaders(&receiveData, resVar, false) // client
+/* Parse one complete line of the HTTP header (lineEnd excludes the "\r\n"). If we
+ * don't have a headers object yet, this is the request/status line. */
+static void httpParseHeaderLine(JsVar *receiveData, JsVar **vHeaders, JsVar *objectForData, bool isServer, size_t lineStart, size_t lineEnd) {
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, receiveData, lineStart);
+  size_t i = lineStart;
+  if (!*vHeaders) {
+    // 'GET /url HTTP/1.1' or 'HTTP/1.1 200 OK'
+    size_t firstSpace = lineEnd, secondSpace = lineEnd;
+    while (i<lineEnd && secondSpace==lineEnd) {
+      if (jsvStringIteratorGetCharAndNext(&it)==' ') {
+        if (firstSpace==lineEnd) firstSpace = i;
+        else secondSpace = i;
+      }
+      i++;
+    }
+    jsvStringIteratorFree(&it);
+    size_t afterFirst = (firstSpace<lineEnd) ? firstSpace+1 : lineEnd;
+    size_t afterSecond = (secondSpace<lineEnd) ? secondSpace+1 : lineEnd;
+    if (isServer) {
+      jsvObjectSetChildAndUnLock(objectForData, "method", jsvNewFromStringVar(receiveData, lineStart, firstSpace-lineStart));
+      jsvObjectSetChildAndUnLock(objectForData, "url", jsvNewFromStringVar(receiveData, afterFirst, secondSpace-afterFirst));
+#if defined(ESPR_HTTP_KEEP_ALIVE) || defined(ESPR_HTTP_STREAMING)
+      size_t versionStart = afterSecond+5; // skip 'HTTP/'
+      if (versionStart<lineEnd)
+        jsvObjectSetChildAndUnLock(objectForData, "httpVersion", jsvNewFromStringVar(receiveData, versionStart, lineEnd-versionStart));
+#endif
+    } else {
+      size_t versionStart = lineStart+5; // skip 'HTTP/'
+      if (versionStart>firstSpace) versionStart = firstSpace;
+      jsvObjectSetChildAndUnLock(objectForData, "httpVersion", jsvNewFromStringVar(receiveData, versionStart, firstSpace-versionStart));
+      jsvObjectSetChildAndUnLock(objectForData, "statusCode", jsvNewFromStringVar(receiveData, afterFirst, secondSpace-afterFirst));
+      jsvObjectSetChildAndUnLock(objectForData, "statusMessage", jsvNewFromStringVar(receiveData, afterSecond, lineEnd-afterSecond));
+    }
+    *vHeaders = jsvNewObject();
+    if (*vHeaders) jsvObjectSetChild(objectForData, HTTP_NAME_HEADERS, *vHeaders);
+    return;
+  }
+  // 'Key: Value'
+  size_t colonPos = lineEnd;
+  while (i<lineEnd && colonPos==lineEnd) {
+    if (jsvStringIteratorGetCharAndNext(&it)==':') colonPos = i;
+    i++;
+  }
+  size_t valueStart = i;
+  while (valueStart<lineEnd && isWhitespace(jsvStringIteratorGetCharAndNext(&it))) // ignore whitespace after :
+    valueStart++;
+  jsvStringIteratorFree(&it);
+  if (colonPos==lineStart || colonPos>=lineEnd || valueStart>=lineEnd)
+    return; // no key or no value - ignore it
+  JsVar *hVal = jsvNewFromStringVar(receiveData, valueStart, lineEnd-valueStart);
+  JsVar *hKey = jsvNewFromStringVar(receiveData, lineStart, colonPos-lineStart);
+  if (!hVal || !hKey) {
+    jsvUnLock2(hKey, hVal);
+    return;
+  }
+  // Pick out the headers we need ourselves now, rather than searching for them later
+  size_t keyLen = colonPos-lineStart;
+  if (keyLen==14 && jsvIsStringIEqualAndUnLock(jsvLockAgain(hKey), "Content-Length")) {
+    jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_RECEIVE_COUNT, jsvNewFromInteger(jsvGetInteger(hVal)));
+  } else if (keyLen==17 && jsvIsStringIEqualAndUnLock(jsvLockAgain(hKey), "Transfer-Encoding")) {
+    if (compareTransferEncodingAndUnlock(jsvLockAgain(hVal), "chunked"))
+      jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_CHUNKED, jsvNewFromBool(true));
+  } else if (keyLen==10 && jsvIsStringIEqualAndUnLock(jsvLockAgain(hKey), "Connection")) {
+    if (jsvIsStringIEqualAndUnLock(jsvLockAgain(hVal), "close"))
+      jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_CONNECTION_CLOSE, jsvNewFromBool(true));
+  }
+  hKey = jsvMakeIntoVariableName(hKey, hVal);
+  jsvAddName(*vHeaders, hKey);
+  jsvUnLock2(hKey, hVal);
+}
+
+/* Parse HTTP headers as they arrive. Each complete line is parsed once, and the
+ * index of the first incomplete line is stored in HTTP_NAME_HEADER_SCAN so that
+ * next time we only look at the data that's new. Returns true (and strips the
+ * headers from receiveData) once the blank line at the end of the headers has arrived.
+ *
+ * httpParseHeaders(&receiveData, reqVar, true) // server
+ * httpParseHeaders(&receiveData, resVar, false) // client */
 bool httpParseHeaders(JsVar **receiveData, JsVar *objectForData, bool isServer) {
-  // find /r/n/r/n
-  int newlineIdx = 0;
-  int strIdx = 0;
-  int headerEnd = -1;
+  size_t lineStart = (size_t)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(objectForData, HTTP_NAME_HEADER_SCAN));
+  JsVar *vHeaders = jsvObjectGetChildIfExists(objectForData, HTTP_NAME_HEADERS);
+  size_t idx = lineStart;
+  size_t headerEnd = 0;
+  char lastCh = 0;
   JsvStringIterator it;
-  jsvStringIteratorNew(&it, *receiveData, 0);
+  jsvStringIteratorNew(&it, *receiveData, lineStart);
   while (jsvStringIteratorHasChar(&it)) {
     char ch = jsvStringIteratorGetCharAndNext(&it);
-    if (ch == '\r') {
-      if (newlineIdx==0) newlineIdx=1;
-      else if (newlineIdx==2) newlineIdx=3;
-    } else if (ch == '\n') {
-      if (newlineIdx==1) newlineIdx=2;
-      else if (newlineIdx==3) {
-        headerEnd = strIdx+1;
+    idx++;
+    if (ch == '\n') {
+      size_t lineEnd = idx-1;
+      if (lastCh=='\r' && lineEnd>lineStart) lineEnd--;
+      if (lineEnd>lineStart) {
+        httpParseHeaderLine(*receiveData, &vHeaders, objectForData, isServer, lineStart, lineEnd);
+      } else if (vHeaders) { // empty line after the headers - we're done
+        headerEnd = idx;
         break;
-      }
-    } else newlineIdx=0;
-    strIdx++;
+      } // else ignore empty lines before the request/status line
+      lineStart = idx;
+    }
+    lastCh = ch;
   }
   jsvStringIteratorFree(&it);
-  // skip if we have no header
-  if (headerEnd<0) return false;
-  // Now parse the header
-  JsVar *vHeaders = jsvNewObject();
-  if (!vHeaders) return true;
-  jsvUnLock(jsvAddNamedChild(objectForData, vHeaders, HTTP_NAME_HEADERS));
-  strIdx = 0;
-  int firstSpace = -1;
-  int secondSpace = -1;
-  int firstEOL = -1;
-  int lineNumber = 0;
-  int lastLineStart = 0;
-  int colonPos = 0;
-  int valueStart = 0;
-  //jsiConsolePrintStringVar(receiveData);
-  jsvStringIteratorNew(&it, *receiveData, 0);
-    while (jsvStringIteratorHasChar(&it)) {
-      char ch = jsvStringIteratorGetCharAndNext(&it);
-      if (ch==' ' || ch=='\r') {
-        if (firstSpace<0) firstSpace = strIdx;
-        else if (secondSpace<0) secondSpace = strIdx;
-      }
-      if (ch == ':' && colonPos<0) colonPos = strIdx;
-      else if (colonPos>0 && !valueStart && !isWhitespace(ch)) valueStart = strIdx; // ignore whitespace after :
-      if (ch == '\r') {
-        if (firstEOL<0) firstEOL=strIdx;
-        if (lineNumber>0 && colonPos>lastLineStart && valueStart>lastLineStart && lastLineStart<strIdx) {
-          JsVar *hVal = jsvNewFromEmptyString();
-          if (hVal)
-            jsvAppendStringVar(hVal, *receiveData, (size_t)valueStart, (size_t)(strIdx-valueStart));
-          JsVar *hKey = jsvNewFromEmptyString();
-          if (hKey) {
-            hKey = jsvMakeIntoVariableName(hKey, hVal);
-            jsvAppendStringVar(hKey, *receiveData, (size_t)lastLineStart, (size_t)(colonPos-lastLineStart));
-            jsvAddName(vHeaders, hKey);
-            jsvUnLock(hKey);
-          }
-          jsvUnLock(hVal);
-        }
-        lineNumber++;
-        colonPos=-1;
-        valueStart = 0;
-      }
-      if (ch == '\r' || ch == '\n') {
-        lastLineStart = strIdx+1;
-      }
-      strIdx++;
-    }
-    jsvStringIteratorFree(&it);
-  // flag the req/response if Transfer-Encoding:chunked was set
-  JsVarInt contentToReceive;
-  if (compareTransferEncodingAndUnlock(jsvObjectGetChildI(vHeaders, "Transfer-Encoding"), "chunked")) {
-    jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_CHUNKED, jsvNewFromBool(true));
-    contentToReceive = 1;
-  } else {
-    contentToReceive = jsvGetIntegerAndUnLock(jsvObjectGetChildI(vHeaders,"Content-Length"));
+  if (!headerEnd) {
+    jsvUnLock(vHeaders);
+    jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_HEADER_SCAN, jsvNewFromInteger((JsVarInt)lineStart));
+    return false;
   }
-  jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_RECEIVE_COUNT, jsvNewFromInteger(contentToReceive));
   jsvUnLock(vHeaders);
-  // try and pull out methods/etc
-  if (isServer) {
-    jsvObjectSetChildAndUnLock(objectForData, "method", jsvNewFromStringVar(*receiveData, 0, (size_t)firstSpace));
-    jsvObjectSetChildAndUnLock(objectForData, "url", jsvNewFromStringVar(*receiveData, (size_t)(firstSpace+1), (size_t)(secondSpace-(firstSpace+1))));
-  } else {
-    jsvObjectSetChildAndUnLock(objectForData, "httpVersion", jsvNewFromStringVar(*receiveData, 5, (size_t)firstSpace-5));
-    jsvObjectSetChildAndUnLock(objectForData, "statusCode", jsvNewFromStringVar(*receiveData, (size_t)(firstSpace+1), (size_t)(secondSpace-(firstSpace+1))));
-    jsvObjectSetChildAndUnLock(objectForData, "statusMessage", jsvNewFromStringVar(*receiveData, (size_t)(secondSpace+1), (size_t)(firstEOL-(secondSpace+1))));
-  }
+  jsvObjectRemoveChild(objectForData, HTTP_NAME_HEADER_SCAN);
+  // if Transfer-Encoding:chunked was set we don't know the length, otherwise use Content-Length (or 0)
+  if (jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(objectForData, HTTP_NAME_CHUNKED)))
+    jsvObjectSetChildAndUnLock(objectForData, HTTP_NAME_RECEIVE_COUNT, jsvNewFromInteger(1));
   // strip out the header
-  JsVar *afterHeaders = jsvNewFromStringVar(*receiveData, (size_t)headerEnd, JSVAPPENDSTRINGVAR_MAXLENGTH);
+  JsVar *afterHeaders = jsvNewFromStringVar(*receiveData, headerEnd, JSVAPPENDSTRINGVAR_MAXLENGTH);
   jsvUnLock(*receiveData);
   *receiveData = afterHeaders;
   return true;
@@ -204,6 +264,111 @@ size_t httpStringGet(JsVar *v, char *str, size_t len) {
   return len-l;
 }
 
+#ifdef ESPR_HTTP_STREAMING
+typedef enum {
+  HTTP_CHUNK_SIZE,         ///< reading the (hex) size of the next chunk
+  HTTP_CHUNK_EXTENSION,    ///< skipping the rest of the size line
+  HTTP_CHUNK_DATA,         ///< passing on the chunk's data
+  HTTP_CHUNK_DATA_END,     ///< skipping the CRLF after the chunk's data
+  HTTP_CHUNK_TRAILER,      ///< at the start of a line after the last chunk - an empty one ends the body
+  HTTP_CHUNK_TRAILER_LINE, ///< skipping a trailer line
+  HTTP_CHUNK_DONE,         ///< we have the whole body
+  HTTP_CHUNK_ERROR         ///< the body was badly formed - the connection should be closed
+} HttpChunkState;
+
+#define HTTP_CHUNK_MAX_SIZE 0xFFFFFFF ///< Chunk sizes have at most 7 hex digits, so they can't overflow
+
+/* Decode part of a chunked body in place (the result is never longer). State is kept in
+ * the reader, so the body can be split anywhere - it's never gathered up in one place.
+ * Returns the length of the decoded data. */
+static size_t httpChunkDecode(JsVar *reader, char *buf, size_t len) {
+  HttpChunkState state = (HttpChunkState)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(reader, HTTP_NAME_CHUNK_STATE));
+  JsVarInt left = jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(reader, HTTP_NAME_CHUNK_LEFT));
+  size_t i = 0, o = 0;
+  while (i<len && state<HTTP_CHUNK_DONE) {
+    if (state==HTTP_CHUNK_DATA) {
+      size_t n = len-i;
+      if ((JsVarInt)n > left) n = (size_t)left;
+      memmove(&buf[o], &buf[i], n);
+      i += n;
+      o += n;
+      left -= (JsVarInt)n;
+      if (!left) state = HTTP_CHUNK_DATA_END;
+      continue;
+    }
+    char ch = buf[i++];
+    int digit = chtod(ch);
+    if (state==HTTP_CHUNK_SIZE && digit>=0 && digit<16) {
+      if (left > HTTP_CHUNK_MAX_SIZE>>4) state = HTTP_CHUNK_ERROR;
+      else left = left*16 + digit;
+    } else if (ch=='\n') {
+      if (state==HTTP_CHUNK_SIZE || state==HTTP_CHUNK_EXTENSION)
+        state = left ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+      else if (state==HTTP_CHUNK_TRAILER)
+        state = HTTP_CHUNK_DONE;
+      else if (state==HTTP_CHUNK_TRAILER_LINE)
+        state = HTTP_CHUNK_TRAILER;
+      else // HTTP_CHUNK_DATA_END
+        state = HTTP_CHUNK_SIZE;
+    } else if (state==HTTP_CHUNK_SIZE) {
+      state = HTTP_CHUNK_EXTENSION; // ';' for an extension, or '\r'
+    } else if (state==HTTP_CHUNK_TRAILER && ch!='\r') {
+      state = HTTP_CHUNK_TRAILER_LINE;
+    }
+  }
+  jsvObjectSetChildAndUnLock(reader, HTTP_NAME_CHUNK_STATE, jsvNewFromInteger((JsVarInt)state));
+  jsvObjectSetChildAndUnLock(reader, HTTP_NAME_CHUNK_LEFT, jsvNewFromInteger(left));
+  if (state==HTTP_CHUNK_DONE) // no more to receive
+    jsvObjectSetChildAndUnLock(reader, HTTP_NAME_RECEIVE_COUNT, jsvNewFromInteger(0));
+  return o;
+}
+
+/// Did httpChunkDecode find a badly formed body? If so the connection should be closed
+static bool httpChunkDecodeFailed(JsVar *reader) {
+  return jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(reader, HTTP_NAME_CHUNK_STATE))==HTTP_CHUNK_ERROR;
+}
+
+/// Is the reader receiving a chunked body (so received data should go through httpChunkDecode)?
+static bool httpIsChunkDecoding(JsVar *reader) {
+  return jsvObjectGetBoolChild(reader, HTTP_NAME_HAD_HEADERS) && jsvObjectGetBoolChild(reader, HTTP_NAME_CHUNKED);
+}
+
+/// If the client can take it, make the response chunked (it has no length). Returns true if it is chunked
+static bool httpServerUseChunked(JsVar *res, JsVar *headers, int statusCode) {
+  JsVar *encoding = jsvObjectGetChildI(headers, "Transfer-Encoding");
+  if (encoding) return compareTransferEncodingAndUnlock(encoding, "chunked");
+  // these responses never have a body
+  if (statusCode<200 || statusCode==204 || statusCode==304) return false;
+  if (!jsvObjectGetBoolChild(res, HTTP_NAME_CHUNK_OUT)) return false;
+  jsvObjectSetChildAndUnLock(headers, "Transfer-Encoding", jsvNewFromString("chunked"));
+  return true;
+}
+
+/// Note on the response whether the client can take chunked data (HTTP/1.1, and not a HEAD request)
+static void httpServerAllowChunked(JsVar *req, JsVar *res) {
+  JsVar *version = jsvObjectGetChildIfExists(req, "httpVersion");
+  JsVar *method = jsvObjectGetChildIfExists(req, "method");
+  if (jsvIsString(version) && jsvIsStringEqual(version, "1.1") &&
+      !(jsvIsString(method) && jsvIsStringEqual(method, "HEAD")))
+    jsvObjectSetChildAndUnLock(res, HTTP_NAME_CHUNK_OUT, jsvNewFromBool(true));
+  jsvUnLock2(version, method);
+}
+
+/// Decode the part of a chunked body that arrived along with the headers
+static void httpChunkDecodeVar(JsVar *reader, JsVar **data) {
+  JsVar *decoded = jsvNewFromEmptyString();
+  if (!decoded) return;
+  char buf[64];
+  size_t len = *data ? jsvGetStringLength(*data) : 0;
+  for (size_t i=0; i<len; i+=sizeof(buf)) {
+    size_t l = jsvGetStringChars(*data, i, buf, sizeof(buf));
+    jsvAppendStringBuf(decoded, buf, httpChunkDecode(reader, buf, l));
+  }
+  jsvUnLock(*data);
+  *data = decoded;
+}
+#endif
+
 // -----------------------------
 
 static JsVar *socketGetArray(const char *name, bool create) {
@@ -235,6 +400,19 @@ bool _socketConnectionOpen(JsVar *connection) {
            jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection, HTTP_NAME_CLOSE)));
 }
 
+bool socketWriteHasSpace(JsVar *connection) {
+#ifdef ESPR_HTTP_STREAMING
+  JsVar *sendData = jsvObjectGetChildIfExists(connection, HTTP_NAME_SEND_DATA);
+  bool hasSpace = (!sendData || jsvGetStringLength(sendData) < SOCKET_SEND_HIGH_WATER_MARK) &&
+                  _socketConnectionOpen(connection);
+  jsvUnLock(sendData);
+  return hasSpace;
+#else
+  NOT_USED(connection);
+  return false; // always wait for 'drain'
+#endif
+}
+
 // -----------------------------
 
 NO_INLINE static void _socketCloseAllConnectionsFor(JsNetwork *net, char *name) {
@@ -258,6 +436,9 @@ NO_INLINE static void _socketCloseAllConnections(JsNetwork *net) {
   _socketCloseAllConnectionsFor(net, HTTP_ARRAY_HTTP_SERVER_CONNECTIONS);
   _socketCloseAllConnectionsFor(net, HTTP_ARRAY_HTTP_CLIENT_CONNECTIONS);
   _socketCloseAllConnectionsFor(net, HTTP_ARRAY_HTTP_SERVERS);
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  _socketCloseAllConnectionsFor(net, HTTP_ARRAY_HTTP_POOL);
+#endif
 }
 
 // returns 0 on success and a (negative) error number on failure
@@ -312,11 +493,15 @@ void socketPushReceiveData(JsVar *reader, JsVar **receiveData, bool isHttp, bool
 
   JsVar *nextChunk = 0;
   JsVar *partialChunk = 0;
+  size_t countReceived = 0;
 
   // Keep track of how much we received (so we can close once we have it)
   if (isHttp) {
     size_t len = (size_t)jsvGetStringLength(*receiveData);
     if (jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(reader, HTTP_NAME_CHUNKED))) {
+#ifdef ESPR_HTTP_STREAMING
+      // already decoded by httpChunkDecode as it arrived, which also clears RECEIVE_COUNT at the end
+#else
       // check for incomplete chunk, at least "0\r\n\r\n"
       if (len < 5) return; // incomplete, wait for more data
 
@@ -360,11 +545,9 @@ void socketPushReceiveData(JsVar *reader, JsVar **receiveData, bool isHttp, bool
       jsvAppendStringVar(chunkData, *receiveData, startIdx, (size_t)chunkLen);
       jsvUnLock(*receiveData);
       *receiveData = chunkData;
+#endif
     } else {
-      jsvObjectSetChildAndUnLock(reader, HTTP_NAME_RECEIVE_COUNT,
-        jsvNewFromInteger(
-          jsvGetIntegerAndUnLock(jsvObjectGetChild(reader, HTTP_NAME_RECEIVE_COUNT, JSV_INTEGER)) - (JsVarInt)len)
-        );
+      countReceived = len; // once the reader has taken it (we may be called again if not)
     }
   }
 
@@ -373,6 +556,12 @@ void socketPushReceiveData(JsVar *reader, JsVar **receiveData, bool isHttp, bool
     jsvUnLock2(nextChunk, partialChunk);
     return;
   }
+  if (countReceived) {
+    jsvObjectSetChildAndUnLock(reader, HTTP_NAME_RECEIVE_COUNT,
+      jsvNewFromInteger(
+        jsvGetIntegerAndUnLock(jsvObjectGetChild(reader, HTTP_NAME_RECEIVE_COUNT, JSV_INTEGER)) - (JsVarInt)countReceived)
+      );
+  }
 
   // clear received data
   jsvUnLock(*receiveData);
@@ -383,6 +572,211 @@ void socketPushReceiveData(JsVar *reader, JsVar **receiveData, bool isHttp, bool
   }
 }
 
+#ifdef ESPR_SOCKET_RECV_QUEUE
+/* Data the reader can take as-is (plain sockets, and HTTP bodies that aren't chunked) is
+ * passed on one recv at a time. If the reader won't take it (no 'data' listener and the
+ * stream buffer is full) it's queued as a list of separate strings rather than appended
+ * to one big one, and once SOCKET_RECV_HIGH_WATER_MARK bytes are queued we stop calling
+ * recv, so the other end has to wait until the reader catches up. */
+static bool socketCanQueueReceived(JsVar *reader, SocketType socketType) {
+  if ((socketType&ST_TYPE_MASK)==ST_UDP) return false;
+  if ((socketType&ST_TYPE_MASK)!=ST_HTTP) return true;
+#ifdef ESPR_HTTP_STREAMING
+  return jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(reader,HTTP_NAME_HAD_HEADERS)); // chunked data is decoded before it's queued
+#else
+  return jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(reader,HTTP_NAME_HAD_HEADERS)) &&
+         !jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(reader,HTTP_NAME_CHUNKED));
+#endif
+}
+
+static JsVarInt socketGetQueued(JsVar *connection) {
+  return jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(connection, HTTP_NAME_RECEIVE_QUEUED));
+}
+
+/// Is the receive queue too full for us to call recv?
+static bool socketRecvPaused(JsVar *connection) {
+  return socketGetQueued(connection) >= SOCKET_RECV_HIGH_WATER_MARK;
+}
+
+/// Update the number of bytes queued, and tell the network if we've stopped/started receiving
+static void socketSetQueued(JsNetwork *net, JsVar *connection, int sckt, JsVarInt oldQueued, JsVarInt queued) {
+  if (queued) jsvObjectSetChildAndUnLock(connection, HTTP_NAME_RECEIVE_QUEUED, jsvNewFromInteger(queued));
+  else jsvObjectRemoveChild(connection, HTTP_NAME_RECEIVE_QUEUED);
+  bool wasPaused = oldQueued >= SOCKET_RECV_HIGH_WATER_MARK;
+  bool paused = queued >= SOCKET_RECV_HIGH_WATER_MARK;
+  if (paused != wasPaused && sckt>=0)
+    netPauseRecv(net, sckt, paused);
+}
+
+/// Pass on as much of the receive queue as the reader will take. Returns true if anything was passed on
+static bool socketDrainReceiveQueue(JsNetwork *net, JsVar *connection, JsVar *reader, int sckt, bool isHttp, bool force) {
+  JsVar *queue = jsvObjectGetChildIfExists(connection, HTTP_NAME_RECEIVE_QUEUE);
+  if (!queue) return false;
+  JsVarInt oldQueued = socketGetQueued(connection);
+  JsVarInt queued = oldQueued;
+  while (!jsvArrayIsEmpty(queue)) {
+    JsVar *chunkName = jsvLock(jsvGetFirstChild(queue));
+    JsVar *chunk = jsvSkipName(chunkName);
+    size_t len = jsvGetStringLength(chunk);
+    socketPushReceiveData(reader, &chunk, isHttp, force);
+    bool accepted = !chunk; // socketPushReceiveData clears it when the reader takes it
+    jsvUnLock(chunk);
+    if (!accepted) {
+      jsvUnLock(chunkName);
+      break;
+    }
+    jsvRemoveChildAndUnLock(queue, chunkName);
+    queued -= (JsVarInt)len;
+  }
+  if (jsvArrayIsEmpty(queue)) {
+    jsvObjectRemoveChild(connection, HTTP_NAME_RECEIVE_QUEUE);
+    queued = 0;
+  }
+  jsvUnLock(queue);
+  if (queued == oldQueued) return false;
+  socketSetQueued(net, connection, sckt, oldQueued, queued);
+  return true;
+}
+
+/// Pass newly received data to the reader, or add it to the receive queue if the reader won't take it
+static void socketQueueReceived(JsNetwork *net, JsVar *connection, JsVar *reader, int sckt, bool isHttp, const char *buf, size_t len) {
+  JsVar *chunk = jsvNewStringOfLength((unsigned int)len, buf);
+  if (!chunk) return; // out of memory
+  JsVar *queue = jsvObjectGetChildIfExists(connection, HTTP_NAME_RECEIVE_QUEUE);
+  // anything left over from before we could queue (eg. after HTTP headers) must go first
+  JsVar *receiveData = jsvObjectGetChildIfExists(connection, HTTP_NAME_RECEIVE_DATA);
+  if (receiveData) {
+    jsvObjectRemoveChild(connection, HTTP_NAME_RECEIVE_DATA);
+    if (!jsvIsString(receiveData) || jsvIsEmptyString(receiveData)) {
+      jsvUnLock(receiveData);
+      receiveData = 0;
+    }
+  }
+  if (!queue && !receiveData) {
+    // nothing waiting - try and pass the data straight on
+    socketPushReceiveData(reader, &chunk, isHttp, false);
+    if (!chunk) return;
+  }
+  if (!queue) queue = jsvObjectGetChild(connection, HTTP_NAME_RECEIVE_QUEUE, JSV_ARRAY);
+  JsVarInt oldQueued = socketGetQueued(connection);
+  JsVarInt queued = oldQueued + (JsVarInt)len;
+  if (queue) {
+    if (receiveData) {
+      jsvArrayPush(queue, receiveData);
+      queued += (JsVarInt)jsvGetStringLength(receiveData);
+    }
+    jsvArrayPush(queue, chunk);
+  }
+  jsvUnLock3(queue, chunk, receiveData);
+  socketSetQueued(net, connection, sckt, oldQueued, queued);
+  if (receiveData) socketDrainReceiveQueue(net, connection, reader, sckt, isHttp, false);
+}
+#endif
+
+#ifdef ESPR_HTTP_KEEP_ALIVE
+/* HTTP/1.1 connections are kept open after a request if both ends agree and the length of
+ * the body is known. On the server, the socket is then given a new request/response pair
+ * and anything received after the end of a request's body (a pipelined request) is saved
+ * for it. Idle client connections go in a pool (HTTP_ARRAY_HTTP_POOL) and are reused by
+ * requests to the same host/port with `keepAlive:true` in their options. Either way, idle
+ * connections get closed after HTTP_KEEP_ALIVE_TIMEOUT. */
+static JsVarFloat httpGetTime() {
+  return jshGetMillisecondsFromTime(jshGetSystemTime());
+}
+
+/// Make sure the idle loop runs at the given time (in ms) to close idle connections
+static void httpKeepAliveWakeAt(JsVarFloat time) {
+  jsiWakeAt(jshGetTimeFromMilliseconds(time));
+}
+
+/// An idle connection has been kept open - set when it should be closed
+static void httpSetKeepAliveExpiry(JsVar *obj) {
+  JsVarFloat expiry = httpGetTime() + HTTP_KEEP_ALIVE_TIMEOUT;
+  jsvObjectSetChildAndUnLock(obj, HTTP_NAME_KEEP_ALIVE_EXPIRY, jsvNewFromFloat(expiry));
+  httpKeepAliveWakeAt(expiry);
+}
+
+/// Has this idle connection been open too long?
+static bool httpKeepAliveExpired(JsVar *obj) {
+  JsVarFloat expiry = jsvGetFloatAndUnLock(jsvObjectGetChildIfExists(obj, HTTP_NAME_KEEP_ALIVE_EXPIRY));
+  if (httpGetTime() >= expiry) return true;
+  httpKeepAliveWakeAt(expiry);
+  return false;
+}
+
+/// Does the other end want the connection kept open after this request/response? (reader is the req or res)
+static bool httpWantsKeepAlive(JsVar *reader) {
+  if (jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(reader, HTTP_NAME_CONNECTION_CLOSE))) return false;
+  JsVar *version = jsvObjectGetChildIfExists(reader, "httpVersion");
+  bool http11 = jsvIsString(version) && jsvIsStringEqual(version, "1.1");
+  jsvUnLock(version);
+  return http11;
+}
+
+/// Save data for the next (pipelined) request on this server connection
+static void httpServerAddNextData(JsVar *req, JsVar *data, const char *buf, size_t len) {
+  JsVar *next = jsvObjectGetChildIfExists(req, HTTP_NAME_NEXT_DATA);
+  if (!next) {
+    next = jsvNewFromEmptyString();
+    jsvObjectSetChild(req, HTTP_NAME_NEXT_DATA, next);
+  }
+  if (next) {
+    if (data) jsvAppendStringVarComplete(next, data);
+    if (buf) jsvAppendStringBuf(next, buf, len);
+  }
+  jsvUnLock(next);
+}
+
+/* The headers of a request have just been parsed. If the connection can be kept open
+ * afterwards, note that on the response and split off anything in receiveData that comes
+ * after the body, as it's the start of the next request. We don't know where chunked bodies
+ * end until we get there, so connections with those are just closed afterwards. */
+static void httpServerStartBody(JsVar *req, JsVar *res, JsVar **receiveData) {
+  if (!httpWantsKeepAlive(req) || jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(req, HTTP_NAME_CHUNKED)))
+    return;
+  jsvObjectSetChildAndUnLock(res, HTTP_NAME_KEEP_ALIVE, jsvNewFromBool(true));
+  size_t bodyLeft = (size_t)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(req, HTTP_NAME_RECEIVE_COUNT));
+  size_t len = *receiveData ? jsvGetStringLength(*receiveData) : 0;
+  if (len > bodyLeft) {
+    JsVar *next = jsvNewFromStringVar(*receiveData, bodyLeft, JSVAPPENDSTRINGVAR_MAXLENGTH);
+    httpServerAddNextData(req, next, 0, 0);
+    jsvUnLock(next);
+    JsVar *body = jsvNewFromStringVar(*receiveData, 0, bodyLeft);
+    jsvUnLock(*receiveData);
+    *receiveData = body;
+    len = bodyLeft;
+  }
+  jsvObjectSetChildAndUnLock(req, HTTP_NAME_BODY_LEFT, jsvNewFromInteger((JsVarInt)(bodyLeft-len)));
+}
+
+/* Data has been received on a server connection. Returns how much of it is for the current
+ * request - anything after the end of the body is saved for the next request */
+static size_t httpServerTakeBody(JsVar *req, const char *buf, size_t len) {
+  JsVar *bodyLeftVar = jsvObjectGetChildIfExists(req, HTTP_NAME_BODY_LEFT);
+  if (!bodyLeftVar) return len; // still reading headers, or not keeping the connection open
+  size_t bodyLeft = (size_t)jsvGetIntegerAndUnLock(bodyLeftVar);
+  if (len > bodyLeft) {
+    httpServerAddNextData(req, 0, &buf[bodyLeft], len-bodyLeft);
+    len = bodyLeft;
+  }
+  jsvObjectSetChildAndUnLock(req, HTTP_NAME_BODY_LEFT, jsvNewFromInteger((JsVarInt)(bodyLeft-len)));
+  return len;
+}
+
+/* Is this server connection waiting for another request after a kept-alive one? If so return
+ * true if it should be closed - because the other end closed it or it has been idle too long */
+static bool httpServerKeepAliveIdle(JsVar *req, int num) {
+  JsVar *expiry = jsvObjectGetChildIfExists(req, HTTP_NAME_KEEP_ALIVE_EXPIRY);
+  if (!expiry) return false;
+  jsvUnLock(expiry);
+  if (num > 0) { // a new request is arriving
+    jsvObjectRemoveChild(req, HTTP_NAME_KEEP_ALIVE_EXPIRY);
+    return false;
+  }
+  return num < 0 || httpKeepAliveExpired(req);
+}
+#endif
+
 void socketReceivedUDP(JsVar *connection, JsVar **receiveData) {
   // Get the header
   size_t len = jsvGetStringLength(*receiveData);
@@ -424,6 +818,14 @@ void socketReceived(JsVar *connection, JsVar *socket, SocketType socketType, JsV
       hadHeaders = true;
     } else if (httpParseHeaders(receiveData, reader, isServer)) {
       hadHeaders = true;
+#ifdef ESPR_HTTP_STREAMING
+      if (jsvObjectGetBoolChild(reader, HTTP_NAME_CHUNKED))
+        httpChunkDecodeVar(reader, receiveData);
+      if (isServer) httpServerAllowChunked(connection, socket);
+#endif
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      if (isServer) httpServerStartBody(connection, socket, receiveData);
+#endif
 
       // on connect only when just parsed the HTTP headers
       if (isServer) {
@@ -486,17 +888,163 @@ static bool fireErrorEvent(int error, JsVar *obj1, JsVar *obj2) {
 
 // -----------------------------
 
+/// Create a new request/response pair for a connection to an HTTP server. Returns the request
+static JsVar *httpServerNewConnection(JsVar *server, int sckt) {
+  JsVar *req = jspNewObject(0, "httpSRq");
+  JsVar *res = jspNewObject(0, "httpSRs");
+  if (res && req) { // out of memory?
+    socketSetType(req, ST_HTTP);
+    JsVar *arr = socketGetArray(HTTP_ARRAY_HTTP_SERVER_CONNECTIONS, true);
+    if (arr) {
+      jsvArrayPush(arr, req);
+      jsvUnLock(arr);
+    }
+    jsvObjectSetChild(req, HTTP_NAME_RESPONSE_VAR, res);
+    jsvObjectSetChild(req, HTTP_NAME_SERVER_VAR, server);
+    jsvObjectSetChildAndUnLock(req, HTTP_NAME_SOCKET, jsvNewFromInteger(sckt+1));
+    jsvObjectSetChildAndUnLock(res, HTTP_NAME_SOCKET, jsvNewFromInteger(sckt+1));
+#ifndef ESPR_HTTP_KEEP_ALIVE // otherwise serverResponseWriteHead decides
+    // Auto-add connection close header (in HTTP/1.0 this seemed implicit, now it must be explicit)
+    // This can always be overwritten with setHeader or writeHead
+    JsVar *name = jsvNewFromString("Connection");
+    JsVar *value = jsvNewFromString("close");
+    serverResponseSetHeader(res, name, value);
+    jsvUnLock2(name, value);
+#endif
+  } else {
+    jsvUnLock(req);
+    req = 0;
+  }
+  jsvUnLock(res);
+  return req;
+}
+
+#ifdef ESPR_HTTP_KEEP_ALIVE
+/* The response to a kept-alive request has been sent. Rather than closing the socket, detach
+ * it from this request/response and give it a new pair for the next request. Returns false
+ * if that wasn't possible, in which case the socket should be closed as normal. */
+static bool httpServerKeepAlive(JsVar *req, JsVar *res, int sckt) {
+  JsVar *server = jsvObjectGetChildIfExists(req, HTTP_NAME_SERVER_VAR);
+  JsVar *newReq = httpServerNewConnection(server, sckt);
+  jsvUnLock(server);
+  if (!newReq) return false;
+  jsvObjectRemoveChild(req, HTTP_NAME_SOCKET);
+  jsvObjectRemoveChild(res, HTTP_NAME_SOCKET);
+  httpSetKeepAliveExpiry(newReq);
+  JsVar *nextData = jsvObjectGetChildIfExists(req, HTTP_NAME_NEXT_DATA);
+  if (nextData) { // we've already received (the start of) the next request - httpServerReceivePipelined handles it
+    jsvObjectSetChildAndUnLock(newReq, HTTP_NAME_NEXT_DATA, nextData);
+    jsvObjectRemoveChild(newReq, HTTP_NAME_KEEP_ALIVE_EXPIRY);
+  }
+  jsvUnLock(newReq);
+  return true;
+}
+
+/* If the start of this request arrived along with the previous one, handle it as if it had just
+ * been received. Returns true if there was some. */
+static bool httpServerReceivePipelined(JsVar *req, JsVar *res) {
+  if (jsvObjectGetBoolChild(req, HTTP_NAME_HAD_HEADERS)) return false; // any dNext is for the request after
+  JsVar *data = jsvObjectGetChildIfExists(req, HTTP_NAME_NEXT_DATA);
+  if (!data) return false;
+  jsvObjectRemoveChild(req, HTTP_NAME_NEXT_DATA);
+  socketReceived(req, res, ST_HTTP, &data, true);
+  jsvObjectSetChildAndUnLock(req, HTTP_NAME_RECEIVE_DATA, data);
+  return true;
+}
+
+/// Get the key used to find idle connections in the pool that go to the same place
+static JsVar *httpPoolKey(SocketType socketType, uint32_t host_addr, unsigned short port) {
+  return jsvVarPrintf("%d:%x:%d", socketType, host_addr, port);
+}
+
+/// Take an idle connection for the given key out of the pool, or return -1 if there isn't one
+static int httpPoolTake(JsVar *key) {
+  JsVar *pool = socketGetArray(HTTP_ARRAY_HTTP_POOL, false);
+  if (!pool) return -1;
+  int sckt = -1;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, pool);
+  while (sckt<0 && jsvObjectIteratorHasValue(&it)) {
+    JsVar *entry = jsvObjectIteratorGetValue(&it);
+    JsVar *entryKey = jsvObjectGetChildIfExists(entry, HTTP_NAME_POOL_KEY);
+    if (jsvIsBasicVarEqual(entryKey, key)) {
+      sckt = (int)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(entry, HTTP_NAME_SOCKET))-1;
+      jsvObjectIteratorRemoveAndGotoNext(&it, pool);
+    } else
+      jsvObjectIteratorNext(&it);
+    jsvUnLock2(entryKey, entry);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(pool);
+  return sckt;
+}
+
+/* A response to a client request has been received in full. If both ends want to keep the
+ * connection open, put the socket in the pool (and detach it from the request) rather than
+ * closing it. */
+static void httpClientKeepAlive(JsVar *req, JsVar *res, int sckt) {
+  JsVar *key = jsvObjectGetChildIfExists(req, HTTP_NAME_POOL_KEY);
+  if (!key) return; // no keepAlive in options
+  bool lengthKnown = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(res, HTTP_NAME_CHUNKED));
+  if (!lengthKnown) {
+    JsVar *headers = jsvObjectGetChildIfExists(res, HTTP_NAME_HEADERS);
+    JsVar *contentLength = jsvIsObject(headers) ? jsvObjectGetChildI(headers, "Content-Length") : 0;
+    lengthKnown = contentLength!=0;
+    jsvUnLock2(contentLength, headers);
+  }
+  JsVar *pool = socketGetArray(HTTP_ARRAY_HTTP_POOL, true);
+  JsVar *entry = 0;
+  if (lengthKnown && httpWantsKeepAlive(res) && pool && jsvGetArrayLength(pool) < HTTP_POOL_SIZE)
+    entry = jsvNewObject();
+  if (entry) {
+    socketSetType(entry, socketGetType(req));
+    jsvObjectSetChild(entry, HTTP_NAME_POOL_KEY, key);
+    jsvObjectSetChildAndUnLock(entry, HTTP_NAME_SOCKET, jsvNewFromInteger(sckt+1));
+    httpSetKeepAliveExpiry(entry);
+    jsvArrayPush(pool, entry);
+    jsvObjectRemoveChild(req, HTTP_NAME_SOCKET); // so _socketConnectionKill doesn't close it
+  }
+  jsvUnLock3(entry, pool, key);
+}
+
+/// Close any idle pooled connections that the other end closed, or that have been idle too long
+static bool httpPoolIdle(JsNetwork *net) {
+  JsVar *pool = socketGetArray(HTTP_ARRAY_HTTP_POOL, false);
+  if (!pool) return false;
+  bool wasBusy = false;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, pool);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *entry = jsvObjectIteratorGetValue(&it);
+    SocketType socketType = socketGetType(entry);
+    int sckt = (int)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(entry, HTTP_NAME_SOCKET))-1;
+    char buf[16];
+    // nothing should arrive on an idle connection - if anything does (or it closes), it's no use
+    int num = netIsReady(net, socketType, sckt) ? netRecv(net, socketType, sckt, buf, sizeof(buf)) : 0;
+    if (num!=0 || httpKeepAliveExpired(entry)) {
+      netCloseSocket(net, socketType, sckt);
+      jsvObjectIteratorRemoveAndGotoNext(&it, pool);
+      wasBusy = true;
+    } else
+      jsvObjectIteratorNext(&it);
+    jsvUnLock(entry);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(pool);
+  return wasBusy;
+}
+#endif
+
 bool socketServerConnectionsIdle(JsNetwork *net) {
   char *buf = alloca((size_t)net->chunkSize); // allocate on stack
 
   JsVar *arr = socketGetArray(HTTP_ARRAY_HTTP_SERVER_CONNECTIONS,false);
   if (!arr) return false;
 
-  bool hadSockets = false;
+  bool wasBusy = false; // did we do anything, or do we need to poll again?
   JsvObjectIterator it;
   jsvObjectIteratorNew(&it, arr);
   while (jsvObjectIteratorHasValue(&it)) {
-    hadSockets = true;
     // Get connection, socket, and socket type
     // For normal sockets, socket==connection, but for HTTP we split it into a request and a response
     JsVar *connection = jsvObjectIteratorGetValue(&it);
@@ -507,29 +1055,69 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
     int sckt = (int)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(connection,HTTP_NAME_SOCKET))-1; // so -1 if undefined
     bool closeConnectionNow = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection, HTTP_NAME_CLOSENOW));
     int error = 0;
+#ifdef ESPR_HTTP_STREAMING
+    // a badly formed body was received last time around (so 'request' callbacks have been called)
+    if (isHttp && httpChunkDecodeFailed(connection)) {
+      closeConnectionNow = true;
+      error = SOCKET_ERR_PROTOCOL;
+    }
+#endif
+#ifdef ESPR_HTTP_KEEP_ALIVE
+    bool keepAlive = false; // should we keep the socket open for another request rather than closing?
+    bool pipelined = false; // did we handle data that arrived with the previous request?
+#endif
+    if (netNeedsPolling(net, socketType)) wasBusy = true;
 
     if (!closeConnectionNow) {
-      int num = netRecv(net, socketType, sckt, buf, (size_t)net->chunkSize);
+      bool recvPaused = false;
+#ifdef ESPR_SOCKET_RECV_QUEUE
+      if (socketDrainReceiveQueue(net, connection, connection, sckt, isHttp, false)) wasBusy = true;
+      recvPaused = socketRecvPaused(connection);
+#endif
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      if (isHttp && httpServerReceivePipelined(connection, socket)) {
+        pipelined = true;
+        wasBusy = true;
+      }
+#endif
+      // only call recv if the network thinks there may be something there
+      int num = (!recvPaused && netIsReady(net, socketType, sckt)) ? netRecv(net, socketType, sckt, buf, (size_t)net->chunkSize) : 0;
+      if (num) wasBusy = true;
       if (num<0) {
         // we probably disconnected so just get rid of this
         closeConnectionNow = true;
         error = num;
       } else {
-        if (num>0) {
+        size_t len = (size_t)num;
+#ifdef ESPR_HTTP_KEEP_ALIVE
+        if (len && isHttp) len = httpServerTakeBody(connection, buf, len);
+#endif
+#ifdef ESPR_HTTP_STREAMING
+        if (len && isHttp && httpIsChunkDecoding(connection)) len = httpChunkDecode(connection, buf, len);
+#endif
+        if (len) {
+#ifdef ESPR_SOCKET_RECV_QUEUE
+          if (socketCanQueueReceived(connection, socketType))
+            socketQueueReceived(net, connection, connection, sckt, isHttp, buf, len);
+          else
+#endif
+          {
           JsVar *receiveData = jsvObjectGetChildIfExists(connection,HTTP_NAME_RECEIVE_DATA);
           if (!receiveData) receiveData = jsvNewFromEmptyString();
           if (receiveData) {
-            jsvAppendStringBuf(receiveData, buf, (size_t)num);
+            jsvAppendStringBuf(receiveData, buf, len);
             socketReceived(connection, socket, socketType, &receiveData, true);
             jsvObjectSetChild(connection,HTTP_NAME_RECEIVE_DATA,receiveData);
             jsvUnLock(receiveData);
           }
+          }
         }
       }
 
       // send data if possible
       JsVar *sendData = jsvObjectGetChildIfExists(socket,HTTP_NAME_SEND_DATA);
       if (sendData && !jsvIsEmptyString(sendData)) {
+        wasBusy = true;
         int sent = socketSendData(net, socket, sckt, &sendData);
         // FIXME? checking for errors is a bit iffy. With the esp8266 network that returns
         // varied error codes we'd want to skip SOCKET_ERR_CLOSED and let the recv side deal
@@ -542,8 +1130,12 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
         }
         jsvObjectSetChild(socket, HTTP_NAME_SEND_DATA, sendData); // socketSendData updated sendData
       }
+      bool received = num > 0;
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      if (pipelined) received = true;
+#endif
       // only close if we want to close, have no data to send, and aren't receiving data
-      if ((!sendData || jsvIsEmptyString(sendData)) && num<=0) {
+      if ((!sendData || jsvIsEmptyString(sendData)) && !received) {
         bool reallyCloseNow = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(socket,HTTP_NAME_CLOSE));
         if (isHttp) {
           bool hadHeaders = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection,HTTP_NAME_HAD_HEADERS));
@@ -557,12 +1149,21 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
           }
         }
         closeConnectionNow = reallyCloseNow;
-      } else if (num > 0)
+#ifdef ESPR_HTTP_KEEP_ALIVE
+        keepAlive = reallyCloseNow && isHttp && num==0 && error==0 &&
+                    jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(socket,HTTP_NAME_KEEP_ALIVE));
+#endif
+      } else if (received)
         closeConnectionNow = false; // guarantee that anything received is processed
       jsvUnLock(sendData);
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      if (isHttp && httpServerKeepAliveIdle(connection, num))
+        closeConnectionNow = true;
+#endif
     }
     if (closeConnectionNow) {
       DBG("CLOSE NOW\n");
+      wasBusy = true;
 
       // send out any data that we were POSTed
       bool hadHeaders = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection,HTTP_NAME_HAD_HEADERS));
@@ -572,6 +1173,9 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
         socketPushReceiveData(connection, &receiveData, isHttp, true);
         jsvUnLock(receiveData);
       }
+#ifdef ESPR_SOCKET_RECV_QUEUE
+      socketDrainReceiveQueue(net, connection, connection, sckt, isHttp, true);
+#endif
 
       // fire error events
       bool hadError = fireErrorEvent(error, connection, socket);
@@ -586,6 +1190,10 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
       jsiQueueObjectCallbacks(socket, HTTP_NAME_ON_CLOSE, params, 1);
       jsvUnLock(params[0]);
 
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      // this leaves the socket open for the next request, so _socketConnectionKill won't close it
+      if (keepAlive) httpServerKeepAlive(connection, socket, sckt);
+#endif
       _socketConnectionKill(net, connection);
       JsVar *connectionName = jsvObjectIteratorGetKey(&it);
       jsvObjectIteratorNext(&it);
@@ -597,7 +1205,7 @@ bool socketServerConnectionsIdle(JsNetwork *net) {
   jsvObjectIteratorFree(&it);
   jsvUnLock(arr);
 
-  return hadSockets;
+  return wasBusy;
 }
 
 
@@ -607,11 +1215,10 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
   JsVar *arr = socketGetArray(HTTP_ARRAY_HTTP_CLIENT_CONNECTIONS,false);
   if (!arr) return false;
 
-  bool hadSockets = false;
+  bool wasBusy = false; // did we do anything, or do we need to poll again?
   JsvObjectIterator it;
   jsvObjectIteratorNew(&it, arr);
   while (jsvObjectIteratorHasValue(&it)) {
-    hadSockets = true;
     // Get connection, socket, and socket type
     // For normal sockets, socket==connection, but for HTTP connection is httpCRq and socket is httpCRs
     JsVar *connection = jsvObjectIteratorGetValue(&it);
@@ -623,9 +1230,21 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
 
     bool hadHeaders = false;
     int error = 0; // error code received from netXxxx functions
+#ifdef ESPR_HTTP_KEEP_ALIVE
+    bool responseDone = false; // we have the whole response, so the socket could be reused
+#endif
     bool closeConnectionNow = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection, HTTP_NAME_CLOSENOW));
+#ifdef ESPR_HTTP_STREAMING
+    // a badly formed body was received last time around (so 'response' callbacks have been called)
+    if (isHttp && httpChunkDecodeFailed(socket)) {
+      closeConnectionNow = true;
+      error = SOCKET_ERR_PROTOCOL;
+    }
+#endif
     bool alreadyConnected = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(connection, HTTP_NAME_CONNECTED));
     int sckt = (int)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(connection,HTTP_NAME_SOCKET))-1; // so -1 if undefined
+    // until we're connected we have to keep polling recv to find out when we are
+    if (!alreadyConnected || netNeedsPolling(net, socketType)) wasBusy = true;
     if (sckt>=0) {
       if (isHttp)
         hadHeaders = jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(socket,HTTP_NAME_HAD_HEADERS));
@@ -635,13 +1254,19 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
 
       /* We do this up here because we want to wait until we have been once
        * around the idle loop (=callbacks have been executed) before we run this */
-      if (hadHeaders)
+      if (hadHeaders) {
+        if (receiveData && !jsvIsEmptyString(receiveData)) wasBusy = true;
         socketPushReceiveData(socket, &receiveData, isHttp, false);
+#ifdef ESPR_SOCKET_RECV_QUEUE
+        if (socketDrainReceiveQueue(net, connection, socket, sckt, isHttp, false)) wasBusy = true;
+#endif
+      }
 
       if (!closeConnectionNow) {
         JsVar *sendData = jsvObjectGetChildIfExists(connection,HTTP_NAME_SEND_DATA);
         // send data if possible
         if (sendData && !jsvIsEmptyString(sendData)) {
+          wasBusy = true;
           // don't try to send if we're already in error state
           int num = 0;
           if (error == 0) {
@@ -670,10 +1295,22 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
               jsiQueueObjectCallbacks(socket, HTTP_NAME_ON_END, NULL, 0);
               DBG("onEnd %d (%d) %d\n", contentToReceive, closeConnectionNow, hadHeaders);
             }
+#ifdef ESPR_HTTP_KEEP_ALIVE
+            responseDone = closeConnectionNow;
+#endif
           }
         }
         // Now read data if possible (and we have space for it)
-        int num = netRecv(net, socketType, sckt, buf, (size_t)net->chunkSize);
+        bool recvPaused = false;
+#ifdef ESPR_SOCKET_RECV_QUEUE
+        recvPaused = alreadyConnected && socketRecvPaused(connection);
+#endif
+        int num = (!recvPaused && (!alreadyConnected || netIsReady(net, socketType, sckt))) ?
+                  netRecv(net, socketType, sckt, buf, (size_t)net->chunkSize) : 0;
+#ifdef ESPR_HTTP_KEEP_ALIVE
+        if (num) responseDone = false; // more data, or closed
+#endif
+        if (num) wasBusy = true;
         if (!alreadyConnected && num == SOCKET_ERR_NO_CONN) {
           ; // ignore... it's just telling us we're not connected yet
         } else if (num < 0) {
@@ -699,7 +1336,21 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
             if (!sendData || (int)jsvGetStringLength(sendData) == 0)
               jsiQueueObjectCallbacks(connection, HTTP_NAME_ON_DRAIN, &connection, 1);
           }
+#ifdef ESPR_HTTP_STREAMING
+          if (num > 0 && isHttp && httpIsChunkDecoding(socket)) // 0 if it was all chunk headers
+            num = (int)httpChunkDecode(socket, buf, (size_t)num);
+#endif
           // got data add it to our receive buffer
+#ifdef ESPR_SOCKET_RECV_QUEUE
+          if (num > 0 && socketCanQueueReceived(socket, socketType)) {
+            // socketQueueReceived moves anything that's left in receiveData into the queue
+            if (receiveData) jsvObjectSetChild(connection, HTTP_NAME_RECEIVE_DATA, receiveData);
+            else jsvObjectRemoveChild(connection, HTTP_NAME_RECEIVE_DATA);
+            jsvUnLock(receiveData);
+            receiveData = 0;
+            socketQueueReceived(net, connection, socket, sckt, isHttp, buf, (size_t)num);
+          } else
+#endif
           if (num > 0) {
             if (!receiveData)
               receiveData = jsvNewFromEmptyString();
@@ -716,8 +1367,12 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
 
     if (closeConnectionNow) {
       DBG("close now\n");
+      wasBusy = true;
 
       socketPushReceiveData(socket, &receiveData, isHttp, true);
+#ifdef ESPR_SOCKET_RECV_QUEUE
+      socketDrainReceiveQueue(net, connection, socket, sckt, isHttp, true);
+#endif
       if (!receiveData || jsvIsEmptyString(receiveData)) {
         // If we had data to send but the socket closed, this is an error
         JsVar *sendData = jsvObjectGetChildIfExists(connection,HTTP_NAME_SEND_DATA);
@@ -725,6 +1380,10 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
           error = SOCKET_ERR_UNSENT_DATA;
         jsvUnLock(sendData);
 
+#ifdef ESPR_HTTP_KEEP_ALIVE
+        // if the socket can be reused this puts it in the pool, so _socketConnectionKill won't close it
+        if (responseDone && !error) httpClientKeepAlive(connection, socket, sckt);
+#endif
         _socketConnectionKill(net, connection);
         JsVar *connectionName = jsvObjectIteratorGetKey(&it);
         jsvObjectIteratorNext(&it);
@@ -756,7 +1415,7 @@ bool socketClientConnectionsIdle(JsNetwork *net) {
   }
   jsvUnLock(arr);
 
-  return hadSockets;
+  return wasBusy;
 }
 
 
@@ -766,46 +1425,27 @@ bool socketIdle(JsNetwork *net) {
     _socketCloseAllConnections(net);
     return false;
   }
-  bool hadSockets = false;
+  bool wasBusy = false; // did we do anything, or do we need to poll again?
   JsVar *arr = socketGetArray(HTTP_ARRAY_HTTP_SERVERS,false);
   if (arr) {
     JsvObjectIterator it;
     jsvObjectIteratorNew(&it, arr);
     while (jsvObjectIteratorHasValue(&it)) {
-      hadSockets = true;
-
       JsVar *server = jsvObjectIteratorGetValue(&it);
       SocketType socketType = socketGetType(server);
+      if (netNeedsPolling(net, socketType)) wasBusy = true;
 
       int theClient = -1;
       // Check for new connections
       if ((socketType&ST_TYPE_MASK)!=ST_UDP) {
           int sckt = (int)jsvGetIntegerAndUnLock(jsvObjectGetChildIfExists(server,HTTP_NAME_SOCKET))-1; // so -1 if undefined
-          theClient = netAccept(net, sckt);
+          if (netIsReady(net, socketType, sckt))
+            theClient = netAccept(net, sckt);
       }
       if (theClient >= 0) { // We have a new connection
+        wasBusy = true;
         if ((socketType&ST_TYPE_MASK) == ST_HTTP) {
-          JsVar *req = jspNewObject(0, "httpSRq");
-          JsVar *res = jspNewObject(0, "httpSRs");
-          if (res && req) { // out of memory?
-            socketSetType(req, ST_HTTP);
-            JsVar *arr = socketGetArray(HTTP_ARRAY_HTTP_SERVER_CONNECTIONS, true);
-            if (arr) {
-              jsvArrayPush(arr, req);
-              jsvUnLock(arr);
-            }
-            jsvObjectSetChild(req, HTTP_NAME_RESPONSE_VAR, res);
-            jsvObjectSetChild(req, HTTP_NAME_SERVER_VAR, server);
-            jsvObjectSetChildAndUnLock(req, HTTP_NAME_SOCKET, jsvNewFromInteger(theClient+1));
-            jsvObjectSetChildAndUnLock(res, HTTP_NAME_SOCKET, jsvNewFromInteger(theClient+1));
-            // Auto-add connection close header (in HTTP/1.0 this seemed implicit, now it must be explicit)
-            // This can always be overwritten with setHeader or writeHead
-            JsVar *name = jsvNewFromString("Connection");
-            JsVar *value = jsvNewFromString("close");
-            serverResponseSetHeader(res, name, value);
-            jsvUnLock2(name, value);
-          }
-          jsvUnLock2(req, res);
+          jsvUnLock(httpServerNewConnection(server, theClient));
         } else {
           // Normal sockets
           JsVar *sock = jspNewObject(0, "Socket");
@@ -830,10 +1470,13 @@ bool socketIdle(JsNetwork *net) {
     jsvUnLock(arr);
   }
 
-  if (socketServerConnectionsIdle(net)) hadSockets = true;
-  if (socketClientConnectionsIdle(net)) hadSockets = true;
+  if (socketServerConnectionsIdle(net)) wasBusy = true;
+  if (socketClientConnectionsIdle(net)) wasBusy = true;
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  if (httpPoolIdle(net)) wasBusy = true;
+#endif
   netCheckError(net);
-  return hadSockets;
+  return wasBusy;
 }
 
 // -----------------------------
@@ -949,7 +1592,11 @@ void clientRequestWrite(JsNetwork *net, JsVar *httpClientReqVar, JsVar *data, Js
       // We're an HTTP client - make a header
       JsVar *method = jsvObjectGetChildIfExists(options, "method");
       JsVar *path = jsvObjectGetChildIfExists(options, "path");
-      sendData = jsvVarPrintf("%v %v HTTP/1.1\r\nUser-Agent: Espruino "JS_VERSION"\r\nConnection: close\r\n", method, path);
+      const char *connectionHeader = "close";
+#ifdef ESPR_HTTP_KEEP_ALIVE
+      if (jsvObjectGetBoolChild(options, "keepAlive")) connectionHeader = "keep-alive";
+#endif
+      sendData = jsvVarPrintf("%v %v HTTP/1.1\r\nUser-Agent: Espruino "JS_VERSION"\r\nConnection: %s\r\n", method, path, connectionHeader);
       jsvUnLock2(method, path);
       JsVar *headers = jsvObjectGetChildIfExists(options, HTTP_NAME_HEADERS);
       bool hasHostHeader = false;
@@ -963,6 +1610,14 @@ void clientRequestWrite(JsNetwork *net, JsVar *httpClientReqVar, JsVar *data, Js
           jsvObjectSetChildAndUnLock(httpClientReqVar, HTTP_NAME_CHUNKED, jsvNewFromBool(true));
         }
       }
+#ifdef ESPR_HTTP_STREAMING
+      // sending a body without saying how long it is? Send it chunked so the server knows where it ends
+      if (data && !jsvObjectGetBoolChild(httpClientReqVar, HTTP_NAME_CHUNKED) &&
+          !(jsvIsObject(headers) && jsvGetBoolAndUnLock(jsvObjectGetChildI(headers, "Content-Length")))) {
+        jsvAppendString(sendData, "Transfer-Encoding: chunked\r\n");
+        jsvObjectSetChildAndUnLock(httpClientReqVar, HTTP_NAME_CHUNKED, jsvNewFromBool(true));
+      }
+#endif
       jsvUnLock(headers);
       if (!hasHostHeader) {
         JsVar *host = jsvObjectGetChildIfExists(options, "host");
@@ -1057,7 +1712,17 @@ void clientRequestConnect(JsNetwork *net, JsVar *httpClientReqVar) {
     if (port==0) port = 80;
   }
 
-  int sckt =  netCreateSocket(net, socketType, host_addr, port, options);
+  int sckt = -1;
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  // reuse an idle connection to the same place if we can
+  if ((socketType&ST_TYPE_MASK) == ST_HTTP && jsvObjectGetBoolChild(options, "keepAlive")) {
+    JsVar *key = httpPoolKey(socketType, host_addr, port);
+    sckt = httpPoolTake(key);
+    jsvObjectSetChildAndUnLock(httpClientReqVar, HTTP_NAME_POOL_KEY, key);
+  }
+  if (sckt<0)
+#endif
+  sckt = netCreateSocket(net, socketType, host_addr, port, options);
   if (sckt<0) {
     jsExceptionHere(JSET_INTERNALERROR, "Unable to create socket");
     // As this is already in the list of connections, an error will be thrown on idle anyway
@@ -1106,7 +1771,9 @@ void serverResponseSetHeader(JsVar *httpServerResponseVar, JsVar *name, JsVar *v
 }
 
 
-void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar *explicitHeaders) {
+/* If canDefer, writeHead was called by the user. On a keep-alive connection with no length
+ * given we then wait before sending the headers, as end() may be able to add a Content-Length */
+static void httpServerWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar *explicitHeaders, bool canDefer) {
   DBG("serverResponseWriteHead %d\n", statusCode);
   if (!jsvIsUndefined(explicitHeaders) && !jsvIsObject(explicitHeaders)) {
     jsError("Headers sent to writeHead should be an object");
@@ -1114,6 +1781,16 @@ void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar
   }
 
   JsVar *sendData = jsvObjectGetChildIfExists(httpServerResponseVar, HTTP_NAME_SEND_DATA);
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  JsVar *deferredCode = jsvObjectGetChildIfExists(httpServerResponseVar, HTTP_NAME_STATUS_CODE);
+  if (deferredCode && canDefer) {
+    jsvUnLock(sendData);
+    sendData = deferredCode;
+  } else if (deferredCode) {
+    statusCode = jsvGetIntegerAndUnLock(deferredCode);
+    jsvObjectRemoveChild(httpServerResponseVar, HTTP_NAME_STATUS_CODE);
+  }
+#endif
   if (sendData) {
     // If sendData!=0 then we were already called
     jsError("Headers have already been sent");
@@ -1126,6 +1803,32 @@ void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar
   if (jsvIsObject(implicitHeaders)) jsvObjectAppendAll(headers, implicitHeaders);
   jsvUnLock(implicitHeaders);
   if (jsvIsObject(explicitHeaders)) jsvObjectAppendAll(headers, explicitHeaders);
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  if (headers) {
+    /* We can only keep the connection open if the client asked, and it'll know where
+     * the response ends. If the Connection header was set by hand we honour it. */
+    bool lengthKnown = jsvGetBoolAndUnLock(jsvObjectGetChildI(headers, "Content-Length")) ||
+                       compareTransferEncodingAndUnlock(jsvObjectGetChildI(headers, "Transfer-Encoding"), "chunked");
+    JsVar *connection = jsvObjectGetChildI(headers, "Connection");
+    if (canDefer && !lengthKnown && !connection && jsvObjectGetBoolChild(httpServerResponseVar, HTTP_NAME_KEEP_ALIVE)) {
+      jsvObjectSetChildAndUnLock(httpServerResponseVar, HTTP_NAME_HEADERS, headers);
+      jsvObjectSetChildAndUnLock(httpServerResponseVar, HTTP_NAME_STATUS_CODE, jsvNewFromInteger(statusCode));
+      return;
+    }
+#ifdef ESPR_HTTP_STREAMING
+    if (!lengthKnown) lengthKnown = httpServerUseChunked(httpServerResponseVar, headers, statusCode);
+#endif
+    bool keepAlive = jsvObjectGetBoolChild(httpServerResponseVar, HTTP_NAME_KEEP_ALIVE) && lengthKnown;
+    if (connection) {
+      if (!jsvIsStringIEqualAndUnLock(connection, "keep-alive")) keepAlive = false;
+    } else
+      jsvObjectSetChildAndUnLock(headers, "Connection", jsvNewFromString(keepAlive ? "keep-alive" : "close"));
+    if (!keepAlive) jsvObjectRemoveChild(httpServerResponseVar, HTTP_NAME_KEEP_ALIVE);
+  }
+#elif defined(ESPR_HTTP_STREAMING)
+  if (headers && !jsvGetBoolAndUnLock(jsvObjectGetChildI(headers, "Content-Length")))
+    httpServerUseChunked(httpServerResponseVar, headers, statusCode);
+#endif
 
 
   sendData = jsvVarPrintf("HTTP/1.1 %d OK\r\nServer: Espruino "JS_VERSION"\r\n", statusCode);
@@ -1142,6 +1845,10 @@ void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar
   jsvObjectSetChildAndUnLock(httpServerResponseVar, HTTP_NAME_SEND_DATA, sendData);
 }
 
+void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar *explicitHeaders) {
+  httpServerWriteHead(httpServerResponseVar, statusCode, explicitHeaders, true);
+}
+
 
 void serverResponseWrite(JsVar *httpServerResponseVar, JsVar *data) {
   if (!_socketConnectionOpen(httpServerResponseVar)) {
@@ -1153,7 +1860,7 @@ void serverResponseWrite(JsVar *httpServerResponseVar, JsVar *data) {
   if (!sendData) {
     // There was no sent data, which means we haven't written headers yet.
     // Do that now with default values
-    serverResponseWriteHead(httpServerResponseVar, 200, 0);
+    httpServerWriteHead(httpServerResponseVar, 200, 0, false);
     // sendData should now have been set
     sendData = jsvObjectGetChildIfExists(httpServerResponseVar, HTTP_NAME_SEND_DATA);
   }
@@ -1175,7 +1882,20 @@ void serverResponseWrite(JsVar *httpServerResponseVar, JsVar *data) {
   jsvUnLock(sendData);
 }
 
-void serverResponseEnd(JsVar *httpServerResponseVar) {
+void serverResponseEnd(JsVar *httpServerResponseVar, JsVar *data) {
+#ifdef ESPR_HTTP_KEEP_ALIVE
+  JsVar *sendData = jsvObjectGetChildIfExists(httpServerResponseVar, HTTP_NAME_SEND_DATA);
+  if (!sendData) {
+    // Headers not sent yet, so we know the whole length - which allows the connection to be kept alive
+    JsVar *s = jsvIsUndefined(data) ? 0 : jsvAsString(data);
+    JsVar *name = jsvNewFromString("Content-Length");
+    JsVar *value = jsvNewFromInteger((JsVarInt)(s ? jsvGetStringLength(s) : 0));
+    serverResponseSetHeader(httpServerResponseVar, name, value);
+    jsvUnLock3(s, name, value);
+  }
+  jsvUnLock(sendData);
+#endif
+  if (!jsvIsUndefined(data)) serverResponseWrite(httpServerResponseVar, data);
   JsVar *finalData = 0;
   if (jsvGetBoolAndUnLock(jsvObjectGetChildIfExists(httpServerResponseVar, HTTP_NAME_CHUNKED))) {
     // If we were asked to send 'chunked' data, we need to finish up
@@ -22,6 +22,7 @@
 // -----------------------------
 void socketInit();
 void socketKill(JsNetwork *net);
+/// Handle sockets. Returns true if anything happened (or sockets need polling again), false if we can sleep
 bool socketIdle(JsNetwork *net);
 
 // -----------------------------
@@ -38,6 +39,10 @@ void clientRequestEnd(JsNetwork *net, JsVar *httpClientReqVar);
 void serverResponseSetHeader(JsVar *parent, JsVar *name, JsVar *value); // for HTTP
 void serverResponseWriteHead(JsVar *httpServerResponseVar, int statusCode, JsVar *headers); // for HTTP
 void serverResponseWrite(JsVar *httpServerResponseVar, JsVar *data);
-void serverResponseEnd(JsVar *httpServerResponseVar);
+void serverResponseEnd(JsVar *httpServerResponseVar, JsVar *data);
+
+/** After a write, should the caller carry on writing (true) or wait for the 'drain' event?
+ * Always false unless ESPR_HTTP_STREAMING is set. */
+bool socketWriteHasSpace(JsVar *connection);
 
 #endif // SOCKETSERVER_H
@@ -27,10 +27,13 @@ typedef enum {
 #ifdef ESPR_JIT
   JSF_JIT_DEBUG           = 1<<4, ///< When JIT enabled,
 #endif
+#ifdef ESPR_SAVE_DELTA
+  JSF_SAVE_DELTA          = 1<<5, ///< save() splits the saved state into regions, and only writes the ones that changed since the last save
+#endif
 } PACKED_FLAGS JsFlags;
 
 
-#define JSFLAG_NAMES "deepSleep\0unsafeFlash\0unsyncFiles\0pretokenise\0jitDebug\0"
+#define JSFLAG_NAMES "deepSleep\0unsafeFlash\0unsyncFiles\0pretokenise\0jitDebug\0saveDelta\0"
 // NOTE: \0 also added by compiler - two \0's are required!
 
 extern volatile JsFlags jsFlags;
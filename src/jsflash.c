@@ -15,6 +15,7 @@
 #include "jshardware.h"
 #include "jsvariterator.h"
 #include "jsinteractive.h"
+#include "jsflags.h"
 #include "jswrap_string.h" //jswrap_string_match
 #include "jswrap_espruino.h" //jswrap_espruino_CRC
 
@@ -22,6 +23,8 @@
 #define SAVED_CODE_BOOTCODE ".bootcde" // bootcode that doesn't run after reset
 #ifndef ESPR_NO_VARIMAGE
 #define SAVED_CODE_VARIMAGE ".varimg" // Image of all JsVars written to flash
+#else
+#undef ESPR_SAVE_DELTA // no image to save
 #endif
 
 #define JSF_START_ADDRESS FLASH_SAVED_CODE_START
@@ -57,6 +60,64 @@ uint32_t jsfFilenameTableBank1Addr = 0; // address of DATA in the table, NOT THE
 uint32_t jsfFilenameTableBank1Size = 0; // size of table in bytes
 #endif
 
+#ifdef ESPR_STORAGE_HASH_INDEX
+/* A hash index of the files in Bank 1, written after compaction. The file's data is:
+
+  uint32_t slots, logSize
+  JsfHashIndexEntry table[slots] // open addressing (linear probing) on hash & (slots-1)
+  JsfHashIndexEntry log[logSize] // left erased, and appended to as files are created afterwards
+
+Every entry is checked against the real file header, so replaced files are ignored. If the
+log is full, files may have been created that aren't in the index so we fall back to a scan. */
+#define JSF_HASH_INDEX_NAME "[HASH_INDEX]"
+#define JSF_HASH_INDEX_MIN_FILES 32 // don't bother creating an index with fewer files than this
+#define JSF_HASH_INDEX_UNSET 0xFFFFFFFF // hash of an erased entry
+#define JSF_HASH_INDEX_UNKNOWN 0xFFFFFFFF // returned when the index can't tell if a file exists
+#define JSF_HASH_INDEX_CHUNK 8 // how many log entries do we read at once?
+typedef struct {
+  uint32_t hash; ///< jsfHashName of the filename
+  uint32_t offset; ///< address of the file's header minus JSF_START_ADDRESS
+} JsfHashIndexEntry;
+
+uint32_t jsfHashIndexAddr = 0; // address of DATA in the index, NOT THE HEADER (or 0 if no index)
+uint32_t jsfHashIndexSlots = 0; // entries in the table (a power of 2)
+uint32_t jsfHashIndexLogSize = 0; // entries in the log
+uint32_t jsfHashIndexLogUsed = 0; // entries in the log that have been written
+bool jsfHashIndexChecked = false; // have we looked for an index in Storage yet?
+bool jsfHashIndexBuilding = false; // set while we create the index file, so it doesn't add itself
+#endif
+
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+uint32_t jsfCompactBank = 0; // start of the bank being compacted from the idle loop (or 0 if not compacting)
+uint32_t jsfCompactWriteAddr = 0; // where the next file we keep gets moved to
+uint32_t jsfCompactPageSize = 0; // size of pages in the bank being compacted
+uint32_t jsfCompactSeq = 0; // sequence number of the last journal record written
+bool jsfCompactNoJournal = false; // are files in the journal's space, so we're rewriting pages without it?
+bool jsfCompactCheck = true; // has Storage changed since we last checked if it needed compacting?
+uint32_t jsfCompactBytesMoved = 0; // bytes of files moved by idle compaction
+uint32_t jsfCompactPagesWritten = 0; // pages rewritten or erased by idle compaction
+JsSysTime jsfCompactTime = 0; // time spent on idle compaction
+uint32_t jsfCompactMoveFrom = 0; // header address of a file being moved over several steps (or 0)
+uint32_t jsfCompactMoveTo = 0; // where it's being moved to
+uint32_t jsfCompactMoveSize = 0; // its size, including the header
+uint32_t jsfCompactMoveNext = 0; // the next page to write, or if relocating, how many bytes have been copied
+bool jsfCompactMoveRelocate = false; // is it being copied into free space (rather than moved down)?
+JsfFileHeader jsfCompactMoveHeader; // its header, so we can tell if it's been erased or replaced
+uint32_t jsfCompactRelocatedAddr = 0; // where we last copied a file into free space, so we don't do it again
+uint32_t jsfCompactTruncateEnd = 0; // when all files have been moved, the end of the space we're still erasing (or 0)
+#endif
+
+#if defined(ESPR_STORAGE_HASH_INDEX) || ESPR_USE_STORAGE_CACHE
+/// Hash a filename (FNV-1a) for the hash index and cache
+static uint32_t jsfHashName(JsfFileName name) {
+  uint32_t hash = 2166136261u;
+  for (size_t i=0;i<sizeof(name.c) && name.c[i];i++)
+    hash = (hash ^ (unsigned char)name.c[i]) * 16777619u;
+  if (hash==0xFFFFFFFF) hash--; // erased hash index entries are all 0xFF
+  return hash;
+}
+#endif
+
 #if ESPR_USE_STORAGE_CACHE
 /* Filename lookups can take over 1ms per file even on a reasonably empty SPI Flash memory,
 so we can have a cache of the most used file *addresses* in RAM. The data is still in
@@ -64,69 +125,124 @@ flash but not having to do the search really helps us.
 
 To use this, add '-DESPR_USE_STORAGE_CACHE=32' or some other number to the BOARD.py file
 
-TODO: we could potentially have some scoring system such that the most used files
-like settings.js are never ever taken out of the cache. Right now reading
-ESPR_USE_STORAGE_CACHE different files will flush out the cache.
+The cache is split into sets of JSF_CACHE_WAYS entries, and a file can only go in the set
+picked by the hash of its name - so we only ever check JSF_CACHE_WAYS entries. Each entry
+counts how often it has been used. A file only replaces an entry that hasn't been used
+since it was added - otherwise the counts in the set are reduced instead. This means that
+reading lots of different files once can't flush out files like settings.json that are
+used all the time.
+
+We also cache files that don't exist, and fill empty entries with the files we come across
+when listing or compacting.
 */
+#define JSF_CACHE_WAYS 4
+#define JSF_CACHE_SETS ((ESPR_USE_STORAGE_CACHE+JSF_CACHE_WAYS-1)/JSF_CACHE_WAYS)
 typedef struct {
-  uint32_t addr; ///< Address as returned by jsfFindFile
+  uint32_t addr; ///< Address as returned by jsfFindFile (0 if the file doesn't exist)
   JsfFileHeader header; ///< The file header
+  uint8_t uses; ///< How many times has this been used (reduced when other files want the space)
+  bool used; ///< Is this entry used?
 } JsfCacheEntry;
 
-JsfCacheEntry jsfCache[ESPR_USE_STORAGE_CACHE];
-uint8_t jsfCacheEntries = 0;
+JsfCacheEntry jsfCache[JSF_CACHE_SETS][JSF_CACHE_WAYS];
+uint32_t jsfCacheHits = 0;
+uint32_t jsfCacheMisses = 0;
 
 static void jsfCacheClear() {
-  jsfCacheEntries = 0;
+  memset(jsfCache, 0, sizeof(jsfCache));
 }
+
+/// Return the set of entries the given file can be in
+static JsfCacheEntry *jsfCacheGetSet(JsfFileName name) {
+  return jsfCache[jsfHashName(name) % JSF_CACHE_SETS];
+}
+
+/// Return the entry for the given file, or 0
+static JsfCacheEntry *jsfCacheGetEntry(JsfCacheEntry *set, JsfFileName name) {
+  for (int i=0;i<JSF_CACHE_WAYS;i++)
+    if (set[i].used && jsfIsNameEqual(set[i].header.name, name))
+      return &set[i];
+  return 0;
+}
+
+/// A file has been erased (or is about to be rewritten)
 static void jsfCacheClearFile(JsfFileName name) {
-  for (int i=0;i<jsfCacheEntries;i++) {
-    if (!jsfIsNameEqual(jsfCache[i].header.name, name))
-      continue;
-    // if found, shift subsequent files forward over this one
-    for (;i<jsfCacheEntries-1;i++)
-      jsfCache[i] = jsfCache[i+1];
-    // reduce amount of entries
-    jsfCacheEntries--;
-    return;
-  }
+  JsfCacheEntry *entry = jsfCacheGetEntry(jsfCacheGetSet(name), name);
+  if (!entry) return;
+#ifdef JSF_BANK2_START_ADDRESS
+  entry->used = false; // a file with the same name could be in the other bank
+#else
+  entry->addr = 0; // keep the entry (and its uses) as the file is likely to be written again
+#endif
 }
 
 // Find an item in the cache - returns JSF_CACHE_NOT_FOUND on failure as it's handy to know about files that don't exist too
 static uint32_t jsfCacheFind(JsfFileName name, JsfFileHeader *returnedHeader) {
-  for (int i=0;i<jsfCacheEntries;i++)
-    if (jsfIsNameEqual(jsfCache[i].header.name, name)) {
-      JsfCacheEntry curr = jsfCache[i];
-      if (i) { // if not at front, put to front
-        // shift others forward
-        for (int j=i-1;j>=0;j--)
-          jsfCache[j+1] = jsfCache[j];
-        // put at front
-        jsfCache[0].header = curr.header;
-        jsfCache[0].addr = curr.addr;
+  JsfCacheEntry *entry = jsfCacheGetEntry(jsfCacheGetSet(name), name);
+  if (!entry) {
+    jsfCacheMisses++;
+    return JSF_CACHE_NOT_FOUND;
+  }
+  jsfCacheHits++;
+  if (entry->uses<255) entry->uses++;
+  if (returnedHeader)
+    *returnedHeader = entry->header;
+  return entry->addr;
+}
+
+/* Put a file in the cache (addr=0 if it doesn't exist). If the file is already there it's updated.
+If there's no free entry, this only replaces an entry with no uses */
+static void jsfCachePut(JsfFileHeader *header, uint32_t addr) {
+  JsfCacheEntry *set = jsfCacheGetSet(header->name);
+  JsfCacheEntry *entry = jsfCacheGetEntry(set, header->name);
+  if (!entry) {
+    for (int i=0;i<JSF_CACHE_WAYS;i++)
+      if (!set[i].used || !entry || set[i].uses<entry->uses) {
+        entry = &set[i];
+        if (!entry->used) break;
       }
-      if (returnedHeader)
-        *returnedHeader = curr.header;
-      return curr.addr;
+    if (entry->used && entry->uses) {
+      // everything in this set has been used - age them so a new file can get in eventually
+      for (int i=0;i<JSF_CACHE_WAYS;i++)
+        set[i].uses--;
+      return;
+    }
+    entry->used = true;
+    entry->uses = 0;
+  }
+  entry->header = *header;
+  entry->addr = addr;
+}
+
+/// Put a file we came across in the cache, but only if there's an empty entry for it
+static void jsfCacheFill(JsfFileHeader *header, uint32_t addr) {
+  JsfCacheEntry *set = jsfCacheGetSet(header->name);
+  if (jsfCacheGetEntry(set, header->name)) return;
+  for (int i=0;i<JSF_CACHE_WAYS;i++)
+    if (!set[i].used) {
+      set[i].used = true;
+      set[i].uses = 0;
+      set[i].header = *header;
+      set[i].addr = addr;
+      return;
     }
-
-  return JSF_CACHE_NOT_FOUND;
 }
-static void jsfCachePut(JsfFileHeader *header, uint32_t addr) {
-  // TODO: ListFiles could lazily fill the list with all
-  // files it finds at the end...
-  if (jsfCacheEntries<ESPR_USE_STORAGE_CACHE)
-    jsfCacheEntries++;
-  for (int i=jsfCacheEntries-2;i>=0;i--)
-    jsfCache[i+1] = jsfCache[i];
-  jsfCache[0].header = *header;
-  jsfCache[0].addr = addr;
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+/// A file has been moved by compaction - if it's in the cache, update it
+static void jsfCacheMoved(JsfFileName name, uint32_t oldAddr, uint32_t newAddr) {
+  JsfCacheEntry *entry = jsfCacheGetEntry(jsfCacheGetSet(name), name);
+  if (entry && entry->addr==oldAddr) entry->addr = newAddr;
 }
+#endif
 #else // no cache, just stub with code that does nothing
 static void jsfCacheClear() {}
 static void jsfCacheClearFile(JsfFileName name) {}
 static uint32_t jsfCacheFind(JsfFileName name, JsfFileHeader *header) { return JSF_CACHE_NOT_FOUND; }
 static void jsfCachePut(JsfFileHeader *header, uint32_t addr) { }
+static void jsfCacheFill(JsfFileHeader *header, uint32_t addr) { }
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+static void jsfCacheMoved(JsfFileName name, uint32_t oldAddr, uint32_t newAddr) { }
+#endif
 #endif
 
 // ------------------------------------------------------------------------------------------------
@@ -139,6 +255,14 @@ static uint32_t jsfCreateFile(JsfFileName name, uint32_t size, JsfFileFlags flag
 #ifdef ESPR_STORAGE_FILENAME_TABLE
 static uint32_t jsfBankCreateFileTable(uint32_t startAddr);
 #endif
+#ifdef ESPR_STORAGE_HASH_INDEX
+static void jsfHashIndexForget();
+static void jsfHashIndexCreate(uint32_t reserve);
+#endif
+#ifdef ESPR_STORAGE_COMPRESS
+static bool jsfIsCompressedFile(JsfFileHeader *header);
+static JsVar *jsfReadCompressedFile(uint32_t addr, JsfFileHeader *header, int offset, int length);
+#endif
 
 /// Aligns a block, pushing it along in memory until it reaches the required alignment
 static uint32_t jsfAlignAddress(uint32_t addr) {
@@ -193,7 +317,10 @@ type of file like FILENAME_TABLE that shouldn't be listed
 or kept when compacting */
 static bool jsfIsRealFile(JsfFileHeader *header) {
   return (header->name.firstChars != 0) // if not replaced
-#ifdef ESPR_STORAGE_FILENAME_TABLE
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+         && (header->name.firstChars != 0xFFFFFFFF) // a copy being made by idle compaction
+#endif
+#if defined(ESPR_STORAGE_FILENAME_TABLE) || defined(ESPR_STORAGE_HASH_INDEX)
          && !(jsfGetFileFlags(header) & JSFF_FILENAME_TABLE)
 #endif
          ;
@@ -272,6 +399,16 @@ bool jsfEraseAll() {
   jsfFilenameTableBank1Addr = 0;
   jsfFilenameTableBank1Size = 0;
 #endif
+#ifdef ESPR_STORAGE_HASH_INDEX
+  jsfHashIndexForget();
+  jsfHashIndexChecked = true; // Storage is empty, so there's no index
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsfCompactBank = 0; // the journal is erased along with everything else
+  jsfCompactMoveFrom = 0;
+  jsfCompactRelocatedAddr = 0;
+  jsfCompactTruncateEnd = 0;
+#endif
 #ifdef JSF_BANK2_START_ADDRESS
   if (!jshFlashErasePages(JSF_BANK2_START_ADDRESS, JSF_BANK2_END_ADDRESS-JSF_BANK2_START_ADDRESS)) return false;
 #endif
@@ -286,6 +423,9 @@ static void jsfEraseFileInternal(uint32_t addr, JsfFileHeader *header, bool crea
   addr += (uint32_t)((char*)&header->name.firstChars - (char*)header);
   header->name.firstChars = 0;
   jshFlashWrite(&header->name.firstChars,addr,(uint32_t)sizeof(header->name.firstChars));
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsfCompactCheck = true;
+#endif
 
 #ifdef ESPR_STORAGE_FILENAME_TABLE
   if (createFilenameTable && addr>=JSF_START_ADDRESS && addr<JSF_END_ADDRESS) { // if was erasing in Bank 1
@@ -301,6 +441,11 @@ static void jsfEraseFileInternal(uint32_t addr, JsfFileHeader *header, bool crea
       jsfBankCreateFileTable(JSF_START_ADDRESS);
   }
 #endif
+#ifdef ESPR_STORAGE_HASH_INDEX
+  // If the hash index's log is full, files we create won't be in it - so make a new one
+  if (createFilenameTable && jsfHashIndexAddr && jsfHashIndexLogUsed>=jsfHashIndexLogSize)
+    jsfHashIndexCreate(0);
+#endif
 }
 
 bool jsfEraseFile(JsfFileName name) {
@@ -416,6 +561,18 @@ JsfStorageStats jsfGetStorageStats(uint32_t addr, bool allPages) {
     if (header.name.firstChars != 0) { // if not replaced
       stats.fileBytes += fileSize;
       stats.fileCount++;
+#ifdef ESPR_STORAGE_COMPRESS
+      if (jsfGetFileFlags(&header)&JSFF_COMPRESSED) {
+        JsfFileHeader fullHeader;
+        jsfGetFileHeader(addr, &fullHeader, true);
+        if (jsfIsCompressedFile(&fullHeader)) {
+          uint32_t uncompressedSize;
+          jshFlashRead(&uncompressedSize, addr+(uint32_t)sizeof(JsfFileHeader), sizeof(uncompressedSize));
+          stats.compressedBytes += jsfGetFileSize(&header);
+          stats.uncompressedBytes += uncompressedSize;
+        }
+      }
+#endif
     } else { // replaced
       stats.trashBytes += fileSize;
       stats.trashCount++;
@@ -428,11 +585,210 @@ JsfStorageStats jsfGetStorageStats(uint32_t addr, bool allPages) {
   uint32_t pageEndAddr = allPages ? jsfGetBankEndAddress(startAddr) : jsfGetAddressOfNextPage(startAddr);
   stats.total = pageEndAddr - startAddr;
   stats.free = pageEndAddr - lastAddr;
+#if ESPR_USE_STORAGE_CACHE
+  stats.cacheHits = jsfCacheHits;
+  stats.cacheMisses = jsfCacheMisses;
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  stats.compacting = jsfCompactBank && jsfGetBankEndAddress(jsfCompactBank)==jsfGetBankEndAddress(startAddr);
+  stats.compactBytes = jsfCompactBytesMoved;
+  stats.compactPages = jsfCompactPagesWritten;
+  stats.compactTime = (uint32_t)jshGetMillisecondsFromTime(jsfCompactTime);
+#endif
   return stats;
 }
 
+#ifdef ESPR_STORAGE_HASH_INDEX
+static void jsfHashIndexForget() {
+  jsfHashIndexAddr = 0;
+  jsfHashIndexSlots = 0;
+  jsfHashIndexLogSize = 0;
+  jsfHashIndexLogUsed = 0;
+}
+
+/// If the file at addr (with full header) is a valid hash index, start using it
+static void jsfHashIndexLoad(uint32_t addr, JsfFileHeader *header) {
+  if (!(jsfGetFileFlags(header) & JSFF_FILENAME_TABLE) ||
+      !jsfIsNameEqual(header->name, jsfNameFromString(JSF_HASH_INDEX_NAME)))
+    return;
+  uint32_t dataAddr = addr + (uint32_t)sizeof(JsfFileHeader);
+  uint32_t sizes[2];
+  jshFlashRead(sizes, dataAddr, sizeof(sizes));
+  uint32_t slots = sizes[0], logSize = sizes[1];
+  // sizes are written last, so they're unset if we lost power while creating the index
+  if (!slots || (slots & (slots-1)) || slots>JSF_MAX_FILES*4 || logSize>JSF_MAX_FILES ||
+      jsfGetFileSize(header) != sizeof(sizes) + (slots+logSize)*(uint32_t)sizeof(JsfHashIndexEntry))
+    return;
+  jsfHashIndexAddr = dataAddr;
+  jsfHashIndexSlots = slots;
+  jsfHashIndexLogSize = logSize;
+  // Now count how much of the log has been used
+  JsfHashIndexEntry entries[JSF_HASH_INDEX_CHUNK];
+  uint32_t logAddr = dataAddr + (uint32_t)sizeof(sizes) + slots*(uint32_t)sizeof(JsfHashIndexEntry);
+  uint32_t used = 0;
+  while (used < logSize) {
+    uint32_t n = logSize-used;
+    if (n > JSF_HASH_INDEX_CHUNK) n = JSF_HASH_INDEX_CHUNK;
+    jshFlashRead(entries, logAddr + used*(uint32_t)sizeof(JsfHashIndexEntry), n*(uint32_t)sizeof(JsfHashIndexEntry));
+    uint32_t i = 0;
+    while (i<n && entries[i].hash!=JSF_HASH_INDEX_UNSET) i++;
+    used += i;
+    if (i<n) break;
+  }
+  jsfHashIndexLogUsed = used;
+}
+
+/// If we haven't found out whether there's a hash index in Storage yet, look for it
+static void jsfHashIndexCheck() {
+  if (jsfHashIndexChecked) return;
+  jsfHashIndexChecked = true;
+  jsfHashIndexForget();
+  JsfFileHeader header;
+  uint32_t addr = JSF_START_ADDRESS;
+  if (jsfGetFileHeader(addr, &header, false)) do {
+    if (jsfGetFileFlags(&header) & JSFF_FILENAME_TABLE) {
+      jsfGetFileHeader(addr, &header, true); // get all data from header
+      jsfHashIndexLoad(addr, &header);
+    }
+  } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL|GNFH_READ_ONLY_FILENAME_START));
+}
+
+/// Does the index entry point to the file with the given name? If so, fill in header
+static bool jsfHashIndexIsFile(JsfHashIndexEntry *entry, JsfFileName name, JsfFileHeader *header) {
+  return (entry->offset < JSF_END_ADDRESS-JSF_START_ADDRESS) &&
+         jsfGetFileHeader(JSF_START_ADDRESS + entry->offset, header, true) && // read the real header
+         jsfIsNameEqual(header->name, name); // replaced files have firstChars==0 so won't match
+}
+
+/** Find a file in Bank 1 using the hash index. Return the address of data start, 0 if the
+ * file definitely doesn't exist, or JSF_HASH_INDEX_UNKNOWN if we need to search for it */
+static uint32_t jsfHashIndexFind(JsfFileName name, JsfFileHeader *returnedHeader) {
+  jsfHashIndexCheck();
+  if (!jsfHashIndexAddr) return JSF_HASH_INDEX_UNKNOWN;
+  uint32_t hash = jsfHashName(name);
+  JsfHashIndexEntry entries[JSF_HASH_INDEX_CHUNK];
+  JsfFileHeader header;
+  // Look in the table first
+  uint32_t tableAddr = jsfHashIndexAddr + 2*(uint32_t)sizeof(uint32_t);
+  uint32_t mask = jsfHashIndexSlots-1;
+  uint32_t slot = hash & mask;
+  for (uint32_t n=0;n<jsfHashIndexSlots;n++) {
+    jshFlashRead(entries, tableAddr + slot*(uint32_t)sizeof(JsfHashIndexEntry), sizeof(JsfHashIndexEntry));
+    if (entries[0].hash==JSF_HASH_INDEX_UNSET) break; // end of the entries for this hash
+    if (entries[0].hash==hash && jsfHashIndexIsFile(&entries[0], name, &header)) {
+      if (returnedHeader) *returnedHeader = header;
+      return JSF_START_ADDRESS + entries[0].offset + (uint32_t)sizeof(JsfFileHeader);
+    }
+    slot = (slot+1) & mask;
+  }
+  // Now look in the log of files created since, newest first
+  uint32_t logAddr = tableAddr + jsfHashIndexSlots*(uint32_t)sizeof(JsfHashIndexEntry);
+  uint32_t used = jsfHashIndexLogUsed;
+  while (used) {
+    uint32_t n = used;
+    if (n > JSF_HASH_INDEX_CHUNK) n = JSF_HASH_INDEX_CHUNK;
+    used -= n;
+    jshFlashRead(entries, logAddr + used*(uint32_t)sizeof(JsfHashIndexEntry), n*(uint32_t)sizeof(JsfHashIndexEntry));
+    while (n--) {
+      if (entries[n].hash==hash && jsfHashIndexIsFile(&entries[n], name, &header)) {
+        if (returnedHeader) *returnedHeader = header;
+        return JSF_START_ADDRESS + entries[n].offset + (uint32_t)sizeof(JsfFileHeader);
+      }
+    }
+  }
+  // If the log filled up, files may have been created that we don't know about
+  return (jsfHashIndexLogUsed < jsfHashIndexLogSize) ? 0 : JSF_HASH_INDEX_UNKNOWN;
+}
+
+/// A file is about to be created with its header at addr - add it to the hash index's log
+static void jsfHashIndexAdd(uint32_t addr, JsfFileName name) {
+  if (jsfHashIndexBuilding || addr<JSF_START_ADDRESS || addr>=JSF_END_ADDRESS) return;
+  jsfHashIndexCheck();
+  if (!jsfHashIndexAddr || jsfHashIndexLogUsed>=jsfHashIndexLogSize) return;
+  JsfHashIndexEntry entry;
+  entry.hash = jsfHashName(name);
+  entry.offset = addr - JSF_START_ADDRESS;
+  uint32_t logAddr = jsfHashIndexAddr + 2*(uint32_t)sizeof(uint32_t) +
+                     (jsfHashIndexSlots+jsfHashIndexLogUsed)*(uint32_t)sizeof(JsfHashIndexEntry);
+  jshFlashWrite(&entry, logAddr, sizeof(JsfHashIndexEntry));
+  jsfHashIndexLogUsed++;
+}
+
+/** Remove any old hash index and create a new one for all files in Bank 1. This is only
+ * done if there are enough files, and if it leaves 'reserve' bytes free afterwards */
+static void jsfHashIndexCreate(uint32_t reserve) {
+  if (jsfHashIndexBuilding) return;
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  if (jsfCompactBank) return; // files are being moved - the index is created when they're done
+#endif
+  jsfHashIndexCheck();
+  JsfFileHeader header;
+  uint32_t addr;
+  if (jsfHashIndexAddr) {
+    addr = jsfHashIndexAddr;
+    jsfHashIndexForget();
+    // compaction may already have removed it
+    if (jsfGetFileHeader(addr - (uint32_t)sizeof(JsfFileHeader), &header, true) &&
+        jsfIsNameEqual(header.name, jsfNameFromString(JSF_HASH_INDEX_NAME)))
+      jsfEraseFileInternal(addr, &header, false);
+  }
+  // first count files
+  uint32_t fileCount = 0;
+  addr = JSF_START_ADDRESS;
+  if (jsfGetFileHeader(addr, &header, false)) do {
+    if (header.name.firstChars != 0) fileCount++;
+  } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL|GNFH_READ_ONLY_FILENAME_START));
+  if (fileCount < JSF_HASH_INDEX_MIN_FILES) return;
+  uint32_t slots = 16;
+  while (slots < fileCount*2) slots <<= 1; // keep the table at most half full
+  uint32_t logSize = slots / 4;
+  uint32_t indexSize = 2*(uint32_t)sizeof(uint32_t) + (slots+logSize)*(uint32_t)sizeof(JsfHashIndexEntry);
+  // Don't use up the space we just freed, or we'll only have to compact again
+  if (jsfGetStorageStats(JSF_START_ADDRESS, true).free < indexSize*2 + reserve) return;
+  jsDebug(DBG_INFO,"jsfHashIndexCreate - %d files, %d slots\n", fileCount, slots);
+  jsfHashIndexBuilding = true;
+  uint32_t indexAddr = jsfCreateFile(jsfNameFromString("C:" JSF_HASH_INDEX_NAME), indexSize, JSFF_FILENAME_TABLE, &header);
+  jsfHashIndexBuilding = false;
+  if (!indexAddr) return; // couldn't create file
+  // Now rescan files and write each into the first free slot for its hash
+  uint32_t tableAddr = indexAddr + 2*(uint32_t)sizeof(uint32_t);
+  uint32_t mask = slots-1;
+  addr = JSF_START_ADDRESS;
+  if (jsfGetFileHeader(addr, &header, true)) do {
+    if (header.name.firstChars != 0 && addr+(uint32_t)sizeof(JsfFileHeader) != indexAddr) {
+      JsfHashIndexEntry entry, slotEntry;
+      entry.hash = jsfHashName(header.name);
+      entry.offset = addr - JSF_START_ADDRESS;
+      uint32_t slot = entry.hash & mask;
+      jshFlashRead(&slotEntry, tableAddr + slot*(uint32_t)sizeof(JsfHashIndexEntry), sizeof(JsfHashIndexEntry));
+      while (slotEntry.hash != JSF_HASH_INDEX_UNSET) {
+        slot = (slot+1) & mask;
+        jshFlashRead(&slotEntry, tableAddr + slot*(uint32_t)sizeof(JsfHashIndexEntry), sizeof(JsfHashIndexEntry));
+      }
+      jshFlashWrite(&entry, tableAddr + slot*(uint32_t)sizeof(JsfHashIndexEntry), sizeof(JsfHashIndexEntry));
+    }
+  } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL));
+  // Write the sizes last - the index isn't valid until we do
+  uint32_t sizes[2] = { slots, logSize };
+  jshFlashWrite(sizes, indexAddr, sizeof(sizes));
+  jsfHashIndexAddr = indexAddr;
+  jsfHashIndexSlots = slots;
+  jsfHashIndexLogSize = logSize;
+  jsfHashIndexLogUsed = 0;
+}
+#endif
+
 #ifndef SAVE_ON_FLASH
 
+/// A file has moved in flash - update any JsVars that point to it (which use the memory-mapped address if there is one)
+static void jsfUpdateMemoryAddress(uint32_t oldAddr, uint32_t length, uint32_t newAddr) {
+  size_t oldMappedAddr = jshFlashGetMemMapAddress(oldAddr);
+  if (oldMappedAddr)
+    jsvUpdateMemoryAddress(oldMappedAddr, length, jshFlashGetMemMapAddress(newAddr));
+  else
+    jsvUpdateMemoryAddress(oldAddr, length, newAddr);
+}
+
 // Copy one memory buffer to another *circular buffer*
 static void memcpy_circular(char *dst, uint32_t *dstIndex, uint32_t dstSize, char *src, size_t len) {
   while (len--) {
@@ -505,7 +861,8 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
       // Rewrite file position for any JsVars that used this file *if* the file changed position
       uint32_t newAddress = writeAddress+swapBufferUsed;
       if (addr != newAddress)
-        jsvUpdateMemoryAddress(addr, sizeof(JsfFileHeader) + jsfGetFileSize(&header), newAddress);
+        jsfUpdateMemoryAddress(addr, (uint32_t)sizeof(JsfFileHeader) + jsfGetFileSize(&header), newAddress);
+      jsfCacheFill(&header, newAddress+(uint32_t)sizeof(JsfFileHeader));
       // Copy the file into the circular buffer, one bit at a time.
       // Write the header
       memcpy_circular(swapBuffer, &swapBufferHead, swapBufferSize, (char*)&header, sizeof(JsfFileHeader));
@@ -523,6 +880,7 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
           s = swapBufferTail-swapBufferHead;
         if (s==0) {
           jsDebug(DBG_INFO,"compact> error - no space left!\n");
+          jsfCacheClear(); // we may have cached addresses we didn't move files to
           return false;
         }
         if (s>alignedSize) s=alignedSize;
@@ -627,14 +985,676 @@ bool jsfBankCompact(uint32_t startAddress, bool showMessage) {
   return false;
 }
 
-// Try and compact saved data so it'll fit in Flash again - return true if some free space was created
-bool jsfCompact(bool showMessage) {
+#if defined(ESPR_STORAGE_IDLE_COMPACT) || defined(ESPR_SAVE_DELTA)
+/// CRC32 (the same as E.CRC32)
+static uint32_t jsfCRC32(uint32_t crc, const unsigned char *data, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *(data++);
+    for (int t=0;t<8;t++)
+      crc = (crc>>1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+#endif
+
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+/* Idle compaction. When Storage is getting full and has trash in it, we compact a few pages
+at a time from the idle loop rather than waiting until a file won't fit and then blocking
+for seconds. Files are moved down one at a time over the first trash, and after each one we
+write a trash header (with no name) covering the space up to where the file used to end, so
+Storage is always valid between steps.
+
+Pages are rewritten via a journal in the last pages of the bank. Each record holds a copy of
+what the page should contain, and is written (with a CRC) before the page is erased. If we
+lose power, jsfCompactRecover writes the page again at boot and finishes moving the file.
+Records are written one after the other, so journal pages are only erased once they're full.
+
+When Storage is nearly full, files can extend into the journal's pages. Rather than leave
+compaction to the blocking jsfCompact when the next file won't fit, we carry on a few pages at a
+time without the journal. Pages are then rewritten in place as jsfCompact does (so losing power
+part way through a page is no safer than it is there), and files are never copied into free space.
+
+A file that spans more pages than we rewrite in one step is moved over several steps:
+ * If it doesn't overlap where it's going, we put a trash header at the new address covering
+   everything up to the file, and copy the file in under it a few pages at a time. The last
+   step writes the end of the file (and the trash after it), and then the real header.
+ * If not, we copy it into the free space after the last file with its name unset (so it's
+   not a file yet), then write the name and erase the old copy. It's moved down again later.
+Files can be written between steps, so before writing the header we copy over anything that
+has been written to the old copy since (Storage only ever writes to erased flash). */
+#define JSF_COMPACT_MAGIC 0x4AFFFFFF // bottom 24 bits set, so a record can't look like a file header
+#define JSF_COMPACT_JOURNAL_PAGES 4 // pages at the end of the bank used for the journal
+#define JSF_COMPACT_PAGES_PER_IDLE 4 // how many pages do we try and rewrite each time we're idle?
+#define JSF_COMPACT_FREE_PERCENT 25 // only start compacting when less than this much Storage is free
+
+typedef struct {
+  uint32_t magic; ///< JSF_COMPACT_MAGIC
+  uint32_t seq; ///< incremented for each record - the valid record with the highest seq is the latest
+  uint32_t from, to, size; ///< the file being moved (header addresses, size including header) - from==0 if only rewriting a page
+  uint32_t page, pageLen; ///< the page this record rewrites - pageLen==0 if we're copying a file into free space
+  uint32_t padding;
+  uint32_t crc, padding2; ///< CRC32 of everything above, and the page image
+  uint32_t done, padding3; ///< set to 0 once the page has been rewritten
+} JsfCompactJournal;
+
+static uint32_t jsfFindFreeSpace(uint32_t bankStartAddress, uint32_t requiredSize);
+
+/// Get the address of the journal for a bank and the size of each record (with its page image). Return false if we can't compact this bank while idle
+static bool jsfCompactGetJournal(uint32_t bank, uint32_t *journalAddr, uint32_t *recordSize) {
+  uint32_t endAddr = jsfGetBankEndAddress(bank);
+  uint32_t pageAddr, pageLen, firstPageLen;
+  // we need all pages the same size so a page image always fits in a record
+  if (!jshFlashGetPage(bank, &pageAddr, &firstPageLen) ||
+      !jshFlashGetPage(endAddr-1, &pageAddr, &pageLen) ||
+      pageLen!=firstPageLen)
+    return false;
+  *recordSize = jsfAlignAddress((uint32_t)sizeof(JsfCompactJournal)+pageLen);
+  *journalAddr = endAddr - JSF_COMPACT_JOURNAL_PAGES*pageLen;
+  // we need at least 3 records, so making space for a new one never erases the latest
+  if (JSF_COMPACT_JOURNAL_PAGES*pageLen < 3*(*recordSize) || endAddr-bank < 4*JSF_COMPACT_JOURNAL_PAGES*pageLen)
+    return false;
+  return true;
+}
+
+/// Get the address of the journal record with the given sequence number - they go round the journal in turn
+static uint32_t jsfCompactGetRecordAddr(uint32_t journalAddr, uint32_t recordSize, uint32_t seq) {
+  uint32_t records = (jsfGetBankEndAddress(journalAddr)-journalAddr) / recordSize;
+  return journalAddr + (seq%records)*recordSize;
+}
+
+/// Erase any pages between addr and addr+len that aren't already erased
+static void jsfCompactErase(uint32_t addr, uint32_t len) {
+  uint32_t endAddr = addr+len;
+  uint32_t pageAddr, pageLen;
+  while (addr<endAddr && jshFlashGetPage(addr, &pageAddr, &pageLen)) {
+    if (!jsfIsErased(pageAddr, pageLen))
+      jshFlashErasePage(pageAddr);
+    addr = pageAddr+pageLen;
+  }
+}
+
+/// Erase the journal. The latest record goes last, so if we lose power we're left with it
+static void jsfCompactEraseJournal(uint32_t bank) {
+  uint32_t journalAddr, recordSize;
+  if (!jsfCompactGetJournal(bank, &journalAddr, &recordSize)) return;
+  uint32_t endAddr = jsfGetBankEndAddress(bank);
+  uint32_t latestAddr = jsfCompactGetRecordAddr(journalAddr, recordSize, jsfCompactSeq);
+  uint32_t addr = journalAddr, pageAddr, pageLen;
+  while (addr<endAddr && jshFlashGetPage(addr, &pageAddr, &pageLen)) {
+    if ((pageAddr+pageLen<=latestAddr || pageAddr>=latestAddr+recordSize) && !jsfIsErased(pageAddr, pageLen))
+      jshFlashErasePage(pageAddr);
+    addr = pageAddr+pageLen;
+  }
+  jsfCompactErase(latestAddr, recordSize);
+}
+
+/// Read a journal record, and return true if it's valid. The page image follows it
+static bool jsfCompactReadJournal(uint32_t recordAddr, uint32_t recordSize, JsfCompactJournal *journal) {
+  jshFlashRead(journal, recordAddr, sizeof(JsfCompactJournal));
+  if (journal->magic!=JSF_COMPACT_MAGIC ||
+      journal->pageLen > recordSize-(uint32_t)sizeof(JsfCompactJournal))
+    return false;
+  uint32_t crc = jsfCRC32(0, (unsigned char*)journal, (uint32_t)((char*)&journal->crc - (char*)journal));
+  unsigned char buf[128];
+  uint32_t imageAddr = recordAddr+(uint32_t)sizeof(JsfCompactJournal);
+  for (uint32_t i=0;i<journal->pageLen;i+=(uint32_t)sizeof(buf)) {
+    uint32_t l = journal->pageLen-i;
+    if (l>sizeof(buf)) l=sizeof(buf);
+    jshFlashRead(buf, imageAddr+i, l);
+    crc = jsfCRC32(crc, buf, l);
+  }
+  return crc==journal->crc;
+}
+
+/// Write a journal record (with the image of the page it rewrites, if pageLen!=0). Returns its address, or 0
+static uint32_t jsfCompactWriteJournal(uint32_t bank, uint32_t from, uint32_t to, uint32_t size, uint32_t page, unsigned char *image, uint32_t pageLen) {
+  uint32_t journalAddr, recordSize;
+  if (!jsfCompactGetJournal(bank, &journalAddr, &recordSize)) return 0;
+  JsfCompactJournal journal;
+  memset(&journal, 0xFF, sizeof(journal));
+  journal.magic = JSF_COMPACT_MAGIC;
+  journal.seq = ++jsfCompactSeq;
+  journal.from = from;
+  journal.to = to;
+  journal.size = size;
+  journal.page = page;
+  journal.pageLen = pageLen;
+  uint32_t crcOffset = (uint32_t)((char*)&journal.crc - (char*)&journal);
+  uint32_t doneOffset = (uint32_t)((char*)&journal.done - (char*)&journal);
+  journal.crc = jsfCRC32(jsfCRC32(0, (unsigned char*)&journal, crcOffset), image, pageLen);
+  /* Records usually go into space that's still erased, and we only erase a page once we've got
+  to it. The previous record may end in this record's first page, so we leave that page alone
+  unless this record's part of it isn't erased (which never happens). */
+  uint32_t recordAddr = jsfCompactGetRecordAddr(journalAddr, recordSize, journal.seq);
+  uint32_t addr = recordAddr, pageAddr, l;
+  while (addr<recordAddr+recordSize && jshFlashGetPage(addr, &pageAddr, &l)) {
+    if (pageAddr<recordAddr ? !jsfIsErased(recordAddr, pageAddr+l-recordAddr) : !jsfIsErased(pageAddr, l))
+      jshFlashErasePage(pageAddr);
+    addr = pageAddr+l;
+  }
+  if (pageLen) jshFlashWrite(image, recordAddr+(uint32_t)sizeof(JsfCompactJournal), pageLen);
+  jshFlashWrite(&journal, recordAddr, crcOffset);
+  jshFlashWrite(&journal.crc, recordAddr+crcOffset, doneOffset-crcOffset); // now the record is valid
+  return recordAddr;
+}
+
+/// Mark a journal record as done (once the page has been rewritten)
+static void jsfCompactJournalDone(uint32_t recordAddr) {
+  JsfCompactJournal journal;
+  uint32_t doneOffset = (uint32_t)((char*)&journal.done - (char*)&journal);
+  journal.done = 0;
+  journal.padding3 = 0;
+  jshFlashWrite(&journal.done, recordAddr+doneOffset, (uint32_t)sizeof(JsfCompactJournal)-doneOffset);
+}
+
+/** Rewrite a page with the given image. If 'journal' is set it's written to the journal first so we
+ * can finish if we lose power - this is only not needed when the whole page is inside trash */
+static void jsfCompactWritePage(uint32_t bank, uint32_t from, uint32_t to, uint32_t size, uint32_t page, unsigned char *image, uint32_t pageLen, bool journal) {
+  uint32_t recordAddr = 0;
+  if (journal && !jsfCompactNoJournal) {
+    recordAddr = jsfCompactWriteJournal(bank, from, to, size, page, image, pageLen);
+    if (!recordAddr) return;
+  }
+  // Now rewrite the page itself (jshFlashErasePages would stop if Ctrl-C had been pressed)
+  jshFlashErasePage(page);
+  jshFlashWrite(image, page, pageLen);
+  if (recordAddr) jsfCompactJournalDone(recordAddr);
+  jsfCompactPagesWritten++;
+  jshKickWatchDog();
+  jshKickSoftWatchDog();
+}
+
+/// Get the header for trash at addr that covers everything up to endAddr
+static void jsfCompactGetTrashHeader(JsfFileHeader *trash, uint32_t addr, uint32_t endAddr) {
+  memset(trash, 0, sizeof(JsfFileHeader));
+  // the flag means the size is never 0, even if there's no space between the header and endAddr
+  trash->size = (endAddr-addr-(uint32_t)sizeof(JsfFileHeader)) | ((uint32_t)JSFF_FILENAME_TABLE<<24);
+}
+
+/// Copy whatever part of the 'len' bytes at 'addr' are in the page at pageAddr into its image, from 'data' (or flash at srcAddr if data==0)
+static void jsfCompactCopyToImage(unsigned char *image, uint32_t pageAddr, uint32_t pageLen, uint32_t addr, uint32_t len, unsigned char *data, uint32_t srcAddr) {
+  uint32_t s = (addr>pageAddr) ? addr : pageAddr;
+  uint32_t e = (addr+len<pageAddr+pageLen) ? addr+len : pageAddr+pageLen;
+  if (s>=e) return;
+  if (data) memcpy(&image[s-pageAddr], &data[s-addr], e-s);
+  else jshFlashRead(&image[s-pageAddr], srcAddr+(s-addr), e-s);
+}
+
+/** Get what the page at pageAddr should contain once the file at 'from' ('size' bytes including
+ * header) is at 'to'. If 'header' is set it goes in place of the file's header, and if 'withTrash'
+ * is set the file is followed by trash covering the space up to where the file used to end */
+static void jsfCompactGetImage(unsigned char *image, uint32_t pageAddr, uint32_t pageLen, uint32_t from, uint32_t to, uint32_t size, JsfFileHeader *header, bool withTrash) {
+  uint32_t endAddr = to+size+(withTrash ? (uint32_t)sizeof(JsfFileHeader) : 0);
+  if (pageAddr<to || pageAddr+pageLen>endAddr)
+    jshFlashRead(image, pageAddr, pageLen); // keep whatever else is in the page
+  jsfCompactCopyToImage(image, pageAddr, pageLen, to, size, 0, from);
+  if (header)
+    jsfCompactCopyToImage(image, pageAddr, pageLen, to, (uint32_t)sizeof(JsfFileHeader), (unsigned char*)header, 0);
+  if (withTrash) {
+    JsfFileHeader trash;
+    jsfCompactGetTrashHeader(&trash, to+size, from+size);
+    jsfCompactCopyToImage(image, pageAddr, pageLen, to+size, (uint32_t)sizeof(JsfFileHeader), (unsigned char*)&trash, 0);
+  }
+}
+
+/// How many pages do the bytes from addr up to endAddr cover?
+static uint32_t jsfCompactCountPages(uint32_t addr, uint32_t endAddr) {
+  uint32_t pageAddr, pageLen, pages = 0;
+  while (addr<endAddr && jshFlashGetPage(addr, &pageAddr, &pageLen)) {
+    addr = pageAddr+pageLen;
+    pages++;
+  }
+  return pages;
+}
+
+/** Move the file with its header at 'from' ('size' bytes including header) down to 'to', rewriting
+ * pages from the one containing 'page' onwards. After the file we write a trash header covering
+ * the space up to where the file used to end. Return the number of pages written */
+static uint32_t jsfCompactMoveFile(uint32_t bank, uint32_t from, uint32_t to, uint32_t size, uint32_t page, unsigned char *image) {
+  uint32_t endAddr = to+size+(uint32_t)sizeof(JsfFileHeader);
+  uint32_t pages = 0;
+  uint32_t pageAddr, pageLen;
+  while (page<endAddr && jshFlashGetPage(page, &pageAddr, &pageLen)) {
+    // the part of the file that goes in this page - its old location is always after this page
+    jsfCompactGetImage(image, pageAddr, pageLen, from, to, size, NULL, true);
+    jsfCompactWritePage(bank, from, to, size, pageAddr, image, pageLen, true);
+    page = pageAddr+pageLen;
+    pages++;
+  }
+  return pages;
+}
+
+/// A file has been moved from 'from' to 'to' - update anything that pointed to it
+static void jsfCompactMoved(JsfFileHeader *header, uint32_t from, uint32_t to) {
+  jsfUpdateMemoryAddress(from, (uint32_t)sizeof(JsfFileHeader) + jsfGetFileSize(header), to);
+  jsfCacheMoved(header->name, from+(uint32_t)sizeof(JsfFileHeader), to+(uint32_t)sizeof(JsfFileHeader));
+  jsfCompactBytesMoved += jsfAlignAddress(jsfGetFileSize(header)) + (uint32_t)sizeof(JsfFileHeader);
+}
+
+/** Bytes of a file we're moving over several steps may have been written since we copied them.
+ * Copy any in [from+start, from+end) that differ to [to+start, to+end), and return false if we
+ * can't (because that part of the copy isn't erased) */
+static bool jsfCompactMoveSync(uint32_t from, uint32_t to, uint32_t start, uint32_t end) {
+  unsigned char src[64], dst[64];
+  for (uint32_t i=start;i<end;i+=(uint32_t)sizeof(src)) {
+    uint32_t l = end-i;
+    if (l>sizeof(src)) l=sizeof(src);
+    jshFlashRead(src, from+i, l);
+    jshFlashRead(dst, to+i, l);
+    if (!memcmp(src, dst, l)) continue;
+    for (uint32_t j=0;j<l;j+=JSF_ALIGNMENT) {
+      if (!memcmp(&src[j], &dst[j], JSF_ALIGNMENT)) continue;
+      for (uint32_t k=0;k<JSF_ALIGNMENT;k++)
+        if (dst[j+k]!=0xFF) return false;
+      jshFlashWrite(&src[j], to+i+j, JSF_ALIGNMENT);
+    }
+  }
+  return true;
+}
+
+/// Stop moving a file over several steps. If we were copying it into free space, the copy becomes trash
+static void jsfCompactMoveCancel() {
+  if (!jsfCompactMoveFrom) return;
+  JsfFileHeader header;
+  if (jsfCompactMoveRelocate && jsfGetFileHeader(jsfCompactMoveTo, &header, false))
+    jsfEraseFileInternal(jsfCompactMoveTo+(uint32_t)sizeof(JsfFileHeader), &header, false);
+  jsfCompactMoveFrom = 0;
+}
+
+/** Start moving a file that spans more pages than we rewrite in one step. Returns false if it
+ * can't be moved, and should be left where it is */
+static bool jsfCompactMoveStart(uint32_t bank, uint32_t from, uint32_t to, uint32_t size, JsfFileHeader *header) {
+  uint32_t pageAddr, pageLen, journalAddr, recordSize;
+  if (!jshFlashGetPage(to, &pageAddr, &pageLen) ||
+      !jsfCompactGetJournal(bank, &journalAddr, &recordSize))
+    return false;
+  /* If the header will span two pages and the name starts in the second, the page with the size
+  in gets written first - so what's there now must already be trash */
+  uint32_t firstChars = 0;
+  if (to+(uint32_t)sizeof(header->size) >= pageAddr+pageLen)
+    jshFlashRead(&firstChars, to+(uint32_t)sizeof(header->size), (uint32_t)sizeof(firstChars));
+  if (to+size+(uint32_t)sizeof(JsfFileHeader) <= from && // it doesn't overlap where it's going
+      firstChars==0) {
+    jsfCompactMoveRelocate = false;
+    jsfCompactMoveNext = pageAddr;
+  } else {
+    // The size and name are written separately, so they can't be in the same flash word
+    if (jsfCompactNoJournal || JSF_ALIGNMENT>sizeof(uint32_t) || from==jsfCompactRelocatedAddr) return false;
+    to = jsfFindFreeSpace(bank, size);
+    if (!to || to<from+size || to+size>journalAddr || !jsfIsErased(to, size)) return false;
+    // if we lose power before it's finished, jsfCompactRecover makes the copy into trash
+    jsfCompactWriteJournal(bank, from, to, size, 0, NULL, 0);
+    jshFlashWrite(&header->size, to, (uint32_t)sizeof(header->size));
+    jsfCompactMoveRelocate = true;
+    jsfCompactMoveNext = (uint32_t)sizeof(JsfFileHeader);
+  }
+  jsfCompactMoveFrom = from;
+  jsfCompactMoveTo = to;
+  jsfCompactMoveSize = size;
+  jsfCompactMoveHeader = *header;
+  return true;
+}
+
+/** Write the name of a file that has been copied into free space (the first word last, as that's
+ * what makes it a file) and erase the old copy */
+static void jsfCompactRelocateFinish(uint32_t from, uint32_t to, JsfFileHeader *header) {
+  uint32_t nameAddr = to + (uint32_t)((char*)&header->name - (char*)header);
+  jshFlashWrite(&header->name.c[sizeof(header->name.firstChars)], nameAddr+(uint32_t)sizeof(header->name.firstChars),
+                (uint32_t)(sizeof(header->name)-sizeof(header->name.firstChars)));
+  jshFlashWrite(&header->name.firstChars, nameAddr, (uint32_t)sizeof(header->name.firstChars));
+  JsfFileHeader oldHeader = *header;
+  jsfEraseFileInternal(from+(uint32_t)sizeof(JsfFileHeader), &oldHeader, false);
+}
+
+/** Carry on moving the file we started moving with jsfCompactMoveStart, writing at most maxPages
+ * pages. Returns the number of pages written */
+static uint32_t jsfCompactMoveStep(uint32_t bank, unsigned char *image, uint32_t maxPages) {
+  uint32_t from = jsfCompactMoveFrom, to = jsfCompactMoveTo, size = jsfCompactMoveSize;
+  uint32_t pages = 0, pageAddr, pageLen;
+  JsfFileHeader header;
+  // if the file was erased or replaced since the last step there's nothing to move
+  if (!jsfGetFileHeader(from, &header, true) || memcmp(&header, &jsfCompactMoveHeader, sizeof(header))) {
+    jsfCompactMoveCancel();
+    return 0;
+  }
+  if (jsfCompactMoveRelocate) {
+    while (jsfCompactMoveNext<size && pages<maxPages) {
+      uint32_t l = size-jsfCompactMoveNext;
+      if (l>jsfCompactPageSize) l=jsfCompactPageSize;
+      jshFlashRead(image, from+jsfCompactMoveNext, l);
+      jshFlashWrite(image, to+jsfCompactMoveNext, l);
+      jsfCompactMoveNext += l;
+      jsfCompactPagesWritten++;
+      pages++;
+      jshKickWatchDog();
+      jshKickSoftWatchDog();
+    }
+    if (jsfCompactMoveNext<size) return pages;
+    if (!jsfCompactMoveSync(from, to, (uint32_t)sizeof(JsfFileHeader), size)) {
+      jsfCompactMoveCancel();
+      return pages;
+    }
+    jsfCompactRelocateFinish(from, to, &header);
+    jsfCompactMoved(&header, from, to);
+    jsfCompactRelocatedAddr = to;
+    jsfCompactMoveFrom = 0;
+    return pages;
+  }
+  // Copy the file in under the trash header a page at a time, up to the page its end goes in
+  uint32_t endAddr = to+size, endPage, headerEnd, namePage;
+  uint32_t nameAddr = to+(uint32_t)sizeof(header.size);
+  if (!jshFlashGetPage(endAddr, &endPage, &pageLen) ||
+      !jshFlashGetPage(nameAddr, &namePage, &pageLen) ||
+      !jshFlashGetPage(to+(uint32_t)sizeof(JsfFileHeader)-1, &headerEnd, &pageLen)) {
+    jsfCompactMoveCancel();
+    return 0;
+  }
+  headerEnd += pageLen;
+  JsfFileHeader trash;
+  jsfCompactGetTrashHeader(&trash, to, from);
+  while (jsfCompactMoveNext<endPage && pages<maxPages && jshFlashGetPage(jsfCompactMoveNext, &pageAddr, &pageLen)) {
+    // only the page(s) with the header in have anything but trash in
+    bool isHeader = pageAddr<headerEnd;
+    jsfCompactGetImage(image, pageAddr, pageLen, from, to, size, isHeader ? &trash : NULL, false);
+    jsfCompactWritePage(bank, 0, 0, 0, pageAddr, image, pageLen, isHeader);
+    jsfCompactMoveNext = pageAddr+pageLen;
+    pages++;
+  }
+  uint32_t endPages = jsfCompactCountPages(endPage, endAddr+(uint32_t)sizeof(JsfFileHeader));
+  uint32_t headerPages = jsfCompactCountPages(to, headerEnd);
+  if (jsfCompactMoveNext<endPage || pages+endPages+headerPages>maxPages) return pages; // finish next time
+  // anything written to the file since we copied it has to be copied too
+  if (!jsfCompactMoveSync(from, to, headerEnd-to, endPage-to)) {
+    jsfCompactMoveCancel();
+    return pages;
+  }
+  // Now write the end of the file (and the trash after it), then the real header
+  uint32_t page = endPage;
+  while (page<endAddr+(uint32_t)sizeof(JsfFileHeader) && jshFlashGetPage(page, &pageAddr, &pageLen)) {
+    jsfCompactGetImage(image, pageAddr, pageLen, from, to, size, NULL, true);
+    jsfCompactWritePage(bank, 0, 0, 0, pageAddr, image, pageLen, true);
+    page = pageAddr+pageLen;
+    pages++;
+  }
+  // the page with the start of the name in goes last, as that's what makes it a file
+  page = to;
+  while (page<headerEnd && jshFlashGetPage(page, &pageAddr, &pageLen)) {
+    if (pageAddr!=namePage) {
+      jsfCompactGetImage(image, pageAddr, pageLen, from, to, size, NULL, true);
+      jsfCompactWritePage(bank, 0, 0, 0, pageAddr, image, pageLen, true);
+      pages++;
+    }
+    page = pageAddr+pageLen;
+  }
+  jshFlashGetPage(namePage, &pageAddr, &pageLen);
+  jsfCompactGetImage(image, pageAddr, pageLen, from, to, size, NULL, true);
+  jsfCompactWritePage(bank, 0, 0, 0, pageAddr, image, pageLen, true);
+  pages++;
+  jsfCompactMoved(&header, from, to);
+  jsfCompactWriteAddr = to+size;
+  jsfCompactMoveFrom = 0;
+  return pages;
+}
+
+/** Starting from the header (or erased space at the end of a page) at addr, find the next file
+ * that should be kept. Returns 0 if there isn't one, and sets endAddr to the end of the last
+ * file we skipped over */
+static uint32_t jsfCompactFindLive(uint32_t addr, JsfFileHeader *header, uint32_t *endAddr) {
+  *endAddr = addr;
+  if (!jsfGetFileHeader(addr, header, true)) {
+    // files may continue on the next page
+    addr = jsfGetAddressOfNextPage(addr);
+    if (!addr || !jsfGetFileHeader(addr, header, true)) return 0;
+  }
+  while (!jsfIsRealFile(header)) {
+    *endAddr = addr + (uint32_t)sizeof(JsfFileHeader) + jsfAlignAddress(jsfGetFileSize(header));
+    if (!jsfGetNextFileHeader(&addr, header, GNFH_GET_ALL)) return 0;
+  }
+  return addr;
+}
+
+/** There are no more files to move - erase everything between 'to' and jsfCompactTruncateEnd, at most
+ * maxPages pages at a time. Returns the number of pages written, and sets jsfCompactTruncateEnd=0 when done */
+static uint32_t jsfCompactTruncate(uint32_t bank, uint32_t to, unsigned char *image, uint32_t maxPages) {
+  uint32_t pageAddr, pageLen, firstPageAddr, firstPageLen, pages = 0;
+  if (!jshFlashGetPage(to, &firstPageAddr, &firstPageLen)) {
+    jsfCompactTruncateEnd = 0;
+    return 0;
+  }
+  /* Erase whole pages from the end backwards, so there's never a blank page in the middle of Storage
+  and it's valid between steps (there's still trash at 'to' until we're done) */
+  while (jsfCompactTruncateEnd > firstPageAddr+firstPageLen && jshFlashGetPage(jsfCompactTruncateEnd-1, &pageAddr, &pageLen)) {
+    if (!jsfIsErased(pageAddr, pageLen)) {
+      if (pages>=maxPages) return pages;
+      jshFlashErasePage(pageAddr);
+      jsfCompactPagesWritten++;
+      pages++;
+    }
+    jsfCompactTruncateEnd = pageAddr;
+  }
+  if (!jsfIsErased(to, firstPageAddr+firstPageLen-to)) {
+    if (pages>=maxPages) return pages;
+    if (to==firstPageAddr) {
+      jshFlashErasePage(firstPageAddr);
+      jsfCompactPagesWritten++;
+    } else { // keep the files at the start of the page
+      jshFlashRead(image, firstPageAddr, firstPageLen);
+      memset(&image[to-firstPageAddr], 0xFF, firstPageAddr+firstPageLen-to);
+      jsfCompactWritePage(bank, 0, 0, 0, firstPageAddr, image, firstPageLen, true);
+    }
+    pages++;
+  }
+  jsfCompactTruncateEnd = 0;
+  return pages;
+}
+
+/// Stop compacting from the idle loop - Storage is always valid between steps so this is safe
+static void jsfCompactIdleStop() {
+  if (!jsfCompactBank) return;
+  jsfCompactMoveCancel();
+  if (!jsfCompactNoJournal) jsfCompactEraseJournal(jsfCompactBank);
+  jsfCompactBank = 0;
+  jsfCompactRelocatedAddr = 0;
+  jsfCompactTruncateEnd = 0;
+}
+
+/** A file is about to be written at addr - stop compacting if it would overwrite the journal, or if
+ * we're erasing the end of Storage (the file would be after the space we were about to erase).
+ * We start again without the journal next time we're idle */
+static void jsfCompactReserveSpace(uint32_t addr, uint32_t size) {
+  uint32_t journalAddr, recordSize;
+  if (jsfCompactBank && jsfGetBankEndAddress(addr)==jsfGetBankEndAddress(jsfCompactBank) &&
+      (jsfCompactTruncateEnd ||
+       (!jsfCompactNoJournal && jsfCompactGetJournal(jsfCompactBank, &journalAddr, &recordSize) && addr+size > journalAddr)))
+    jsfCompactIdleStop();
+}
+
+/// If the bank is getting full and has enough trash to be worth it, get ready to compact it while idle
+static bool jsfCompactIdleStart(uint32_t bank) {
+  uint32_t journalAddr, recordSize, pageAddr, pageLen;
+  if (!jsfCompactGetJournal(bank, &journalAddr, &recordSize) ||
+      !jshFlashGetPage(bank, &pageAddr, &pageLen))
+    return false;
+  JsfStorageStats stats = jsfGetStorageStats(bank, true);
+  if (stats.trashBytes < pageLen ||
+      stats.free*100 >= stats.total*JSF_COMPACT_FREE_PERCENT)
+    return false;
+  // if files are in the journal's space we compact without it, otherwise it must be empty
+  bool noJournal = jsfGetBankEndAddress(bank)-stats.free > journalAddr;
+  if (!noJournal && !jsfIsErased(journalAddr, jsfGetBankEndAddress(bank)-journalAddr))
+    return false;
+  jsDebug(DBG_INFO,"Idle compaction of 0x%08x%s\n", bank, noJournal?" (no journal)":"");
+  // Filename tables and indexes would point to the wrong places once files move, so remove them
+  JsfFileHeader header;
+  uint32_t addr = bank;
+  if (jsfGetFileHeader(addr, &header, false)) do {
+    if (header.name.firstChars!=0 && (jsfGetFileFlags(&header) & JSFF_FILENAME_TABLE))
+      jsfEraseFileInternal(addr+(uint32_t)sizeof(JsfFileHeader), &header, false);
+  } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL|GNFH_READ_ONLY_FILENAME_START));
+  if (bank==JSF_START_ADDRESS) {
+#ifdef ESPR_STORAGE_FILENAME_TABLE
+    jsfFilenameTableBank1Addr = 0;
+    jsfFilenameTableBank1Size = 0;
+#endif
+#ifdef ESPR_STORAGE_HASH_INDEX
+    jsfHashIndexForget();
+    jsfHashIndexChecked = true;
+#endif
+  }
+  // We move files down over the first file that isn't being kept
+  addr = bank;
+  if (jsfGetFileHeader(addr, &header, false))
+    while (jsfIsRealFile(&header) &&
+           jsfGetNextFileHeader(&addr, &header, GNFH_GET_EMPTY|GNFH_READ_ONLY_FILENAME_START));
+  if (!addr) return false;
+  jsfCompactBank = bank;
+  jsfCompactNoJournal = noJournal;
+  jsfCompactWriteAddr = addr;
+  jsfCompactPageSize = pageLen;
+  return true;
+}
+
+/** Called when idle. If we're compacting Storage, move a few more pages of files. If not (and
+ * canStart is set), check whether Storage needs compacting. Returns true if we did anything */
+bool jsfCompactIdle(bool canStart) {
+  if (!jsfCompactBank) {
+    if (!canStart || !jsfCompactCheck) return false;
+    jsfCompactCheck = false;
+    if (!jsfCompactIdleStart(JSF_START_ADDRESS)
+#ifdef JSF_BANK2_START_ADDRESS
+        && !jsfCompactIdleStart(JSF_BANK2_START_ADDRESS)
+#endif
+        ) return false;
+  }
+  JsSysTime startTime = jshGetSystemTime();
+  JsVar *buf = 0;
+  unsigned char *image;
+  if (jsfCompactPageSize+256 < jsuGetFreeStack()) {
+    image = alloca(jsfCompactPageSize);
+  } else {
+    buf = jsvNewFlatStringOfLength(jsfCompactPageSize);
+    if (!buf) return false; // try again later
+    image = (unsigned char*)jsvGetFlatStringPointer(buf);
+  }
+  uint32_t bank = jsfCompactBank;
+  uint32_t pages = 0;
+  while (jsfCompactBank && pages<JSF_COMPACT_PAGES_PER_IDLE) {
+    if (jsfCompactMoveFrom) { // we're part way through moving a big file
+      uint32_t n = jsfCompactMoveStep(bank, image, JSF_COMPACT_PAGES_PER_IDLE-pages);
+      if (!n && jsfCompactMoveFrom) break; // not enough pages left this time
+      pages += n;
+      continue;
+    }
+    JsfFileHeader header;
+    uint32_t to = jsfCompactWriteAddr, endAddr;
+    uint32_t from = jsfCompactFindLive(to, &header, &endAddr);
+    if (!from) { // no more files to move - erase what's left
+      if (!jsfCompactTruncateEnd) jsfCompactTruncateEnd = endAddr;
+      pages += jsfCompactTruncate(bank, to, image, JSF_COMPACT_PAGES_PER_IDLE-pages);
+      if (jsfCompactTruncateEnd) break; // carry on next time
+      jsfCompactIdleStop();
+      jsDebug(DBG_INFO,"Idle compaction complete\n");
+#ifdef ESPR_STORAGE_HASH_INDEX
+      if (bank==JSF_START_ADDRESS) jsfHashIndexCreate(0);
+#endif
+      break;
+    }
+    uint32_t size = jsfAlignAddress(jsfGetFileSize(&header)) + (uint32_t)sizeof(JsfFileHeader);
+    if (from-to < (uint32_t)sizeof(JsfFileHeader)) {
+      // already in place (or there's no room for a trash header after it) - leave it where it is
+      jsfCompactWriteAddr = from+size;
+      continue;
+    }
+    uint32_t movePages = jsfCompactCountPages(to, to+size+(uint32_t)sizeof(JsfFileHeader));
+    if (movePages > JSF_COMPACT_PAGES_PER_IDLE) { // too big to move in one step
+      if (!jsfCompactMoveStart(bank, from, to, size, &header))
+        jsfCompactWriteAddr = from+size; // leave it where it is
+      continue;
+    }
+    if (pages+movePages > JSF_COMPACT_PAGES_PER_IDLE) break; // move it next time
+    pages += jsfCompactMoveFile(bank, from, to, size, to, image);
+    jsfCompactMoved(&header, from, to);
+    jsfCompactWriteAddr = to+size;
+  }
+  jsvUnLock(buf);
+  jsfCompactTime += jshGetSystemTime()-startTime;
+  return true;
+}
+
+static void jsfCompactRecoverBank(uint32_t bank) {
+  uint32_t journalAddr, recordSize, pageAddr, pageLen;
+  if (!jsfCompactGetJournal(bank, &journalAddr, &recordSize) ||
+      !jshFlashGetPage(bank, &pageAddr, &pageLen))
+    return;
+  // find the latest valid record
+  JsfCompactJournal journal, latest;
+  uint32_t latestAddr = 0;
+  uint32_t endAddr = jsfGetBankEndAddress(bank);
+  for (uint32_t recordAddr=journalAddr;recordAddr+recordSize<=endAddr;recordAddr+=recordSize) {
+    if (jsfCompactReadJournal(recordAddr, recordSize, &journal) &&
+        (!latestAddr || journal.seq>latest.seq)) {
+      latest = journal;
+      latestAddr = recordAddr;
+    }
+  }
+  if (!latestAddr) return;
+  jsiConsolePrintf("Finishing Storage compaction...\n");
+  jsfCompactSeq = latest.seq;
+  JsVar *buf = 0;
+  unsigned char *image;
+  if (pageLen+256 < jsuGetFreeStack()) {
+    image = alloca(pageLen);
+  } else {
+    buf = jsvNewFlatStringOfLength(pageLen);
+    if (!buf) return;
+    image = (unsigned char*)jsvGetFlatStringPointer(buf);
+  }
+  if (latest.pageLen) {
+    if (latest.done!=0) { // we may have lost power while rewriting the page - do it again
+      jshFlashRead(image, latestAddr+(uint32_t)sizeof(JsfCompactJournal), latest.pageLen);
+      jshFlashErasePage(latest.page);
+      jshFlashWrite(image, latest.page, latest.pageLen);
+    }
+    // finish moving the file (the parts of it that haven't been moved yet are still in place)
+    if (latest.from)
+      jsfCompactMoveFile(bank, latest.from, latest.to, latest.size, latest.page+latest.pageLen, image);
+  } else if (latest.from) { // we were copying a file into free space
+    JsfFileHeader header, oldHeader;
+    if (jsfGetFileHeader(latest.to, &header, true)) {
+      if (header.name.firstChars==0xFFFFFFFF) { // we hadn't finished - the copy is trash
+        jsfEraseFileInternal(latest.to+(uint32_t)sizeof(JsfFileHeader), &header, false);
+      } else if (jsfGetFileHeader(latest.from, &oldHeader, true) && jsfIsRealFile(&oldHeader) &&
+                 jsfIsNameEqual(header.name, oldHeader.name)) { // we had, but the old copy is still there
+        jsfEraseFileInternal(latest.from+(uint32_t)sizeof(JsfFileHeader), &oldHeader, false);
+      }
+    }
+  }
+  jsvUnLock(buf);
+  jsfCompactEraseJournal(bank);
+}
+
+/// If we lost power while compacting from the idle loop, finish what we were doing. Call at boot before checking Storage
+void jsfCompactRecover() {
+  jsfCompactRecoverBank(JSF_START_ADDRESS);
+#ifdef JSF_BANK2_START_ADDRESS
+  jsfCompactRecoverBank(JSF_BANK2_START_ADDRESS);
+#endif
+}
+#endif // ESPR_STORAGE_IDLE_COMPACT
+
+/* Try and compact saved data so it'll fit in Flash again - return true if some free space was created.
+ 'reserve' is how much space we want free afterwards (for the file we're about to create) */
+static bool jsfCompactWithReserve(bool showMessage, uint32_t reserve) {
 #ifdef BANGLEJS
   JsVarInt jswrap_banglejs_getBattery();
   if (jswrap_banglejs_getBattery() < 10) {
     jsiConsolePrintf("Less than 10 percent battery remaining - cannot compact\n");
     return false;
   }
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsfCompactIdleStop(); // Storage is valid between steps, so we can just compact everything now
 #endif
   jsfCacheClear();
 #ifdef ESPR_STORAGE_FILENAME_TABLE
@@ -642,12 +1662,22 @@ bool jsfCompact(bool showMessage) {
   jsfFilenameTableBank1Size = 0;
 #endif
   bool compacted = jsfBankCompact(JSF_START_ADDRESS, showMessage);
+#ifdef ESPR_STORAGE_HASH_INDEX
+  // Files have moved so any index is now wrong (if we didn't have one, now's a good time to make it)
+  if (compacted || !jsfHashIndexAddr)
+    jsfHashIndexCreate(reserve);
+#endif
 #ifdef JSF_BANK2_START_ADDRESS
   compacted |= jsfBankCompact(JSF_BANK2_START_ADDRESS, showMessage);
 #endif
   return compacted;
 }
 
+// Try and compact saved data so it'll fit in Flash again - return true if some free space was created
+bool jsfCompact(bool showMessage) {
+  return jsfCompactWithReserve(showMessage, 0);
+}
+
 /* If we have a filename like "C:foo", take the 'C:' bit
  * off it and return the drive. If explicitOnly==false,
  * we also return the drive name if we think a file should
@@ -690,6 +1720,40 @@ void jsfGetDriveBankAddress(char drive, uint32_t *bankStartAddr, uint32_t *bankE
   *bankEndAddr=JSF_DEFAULT_END_ADDRESS;
 }
 /// Create a new 'file' in the memory store - DOES NOT remove existing files with same name. Return the address of data start, or 0 on error
+/// Find the first hole in the bank with at least requiredSize bytes free (including the header), or 0
+static uint32_t jsfFindFreeSpace(uint32_t bankStartAddress, uint32_t requiredSize) {
+  uint32_t addr = bankStartAddress;
+  JsfFileHeader header;
+  do {
+    if (jsfGetFileHeader(addr, &header, false)) do {
+    } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_EMPTY));
+    // If not enough space, skip to next page
+    if (jsfGetSpaceLeftInPage(addr)<requiredSize)
+      addr = jsfGetAddressOfNextPage(addr);
+    else // if enough space, we can write a file!
+      return addr;
+  } while (addr);
+  return 0;
+}
+
+/// Write the header for a file at addr (which must be empty) - returns the address of the file's data
+static uint32_t jsfWriteFileHeader(uint32_t addr, JsfFileName name, uint32_t size, JsfFileFlags flags, JsfFileHeader *returnedHeader) {
+  JsfFileHeader header;
+  header.size = size | (flags<<24);
+  header.name = name;
+#ifdef ESPR_STORAGE_HASH_INDEX
+  // add to the index before the header is written, so the index can never be missing a file
+  jsfHashIndexAdd(addr, name);
+#endif
+  jsDebug(DBG_INFO,"CreateFile write header\n");
+  jshFlashWrite(&header,addr,(uint32_t)sizeof(JsfFileHeader));
+  jsDebug(DBG_INFO,"CreateFile written header\n");
+  if (returnedHeader) *returnedHeader = header;
+  addr += (uint32_t)sizeof(JsfFileHeader); // address of actual file data
+  jsfCachePut(&header, addr);
+  return addr;
+}
+
 static uint32_t jsfCreateFile(JsfFileName name, uint32_t size, JsfFileFlags flags, JsfFileHeader *returnedHeader) {
   jsDebug(DBG_INFO,"CreateFile (%d bytes)\n", size);
   char drive = jsfStripDriveFromName(&name, false/* ensure .js/etc go in C */);
@@ -700,61 +1764,41 @@ static uint32_t jsfCreateFile(JsfFileName name, uint32_t size, JsfFileFlags flag
    * make writing files faster? */
 
   uint32_t requiredSize = jsfAlignAddress(size)+(uint32_t)sizeof(JsfFileHeader);
-  bool compacted = false;
-  uint32_t addr = 0;
-  JsfFileHeader header;
-  uint32_t freeAddr = 0;
-  while (!freeAddr) {
-    addr = bankStartAddress;
-    freeAddr = 0;
-    // Find a hole that's big enough for our file
-    do {
-      if (jsfGetFileHeader(addr, &header, false)) do {
-      } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_EMPTY));
-      // If not enough space, skip to next page
-      if (jsfGetSpaceLeftInPage(addr)<requiredSize) {
-        addr = jsfGetAddressOfNextPage(addr);
-      } else { // if enough space, we can write a file!
-        freeAddr = addr;
-      }
-    } while (addr && !freeAddr);
-    // If we don't have space, compact
-    if (!freeAddr) {
-      // check this for sanity - in future we might compact forward into other pages, and don't compact if so
-      if (!compacted) {
-        compacted = true;
-        if (!jsfCompact(true)) {
-          jsDebug(DBG_INFO,"CreateFile - Compact failed\n");
-          return 0;
-        }
-        addr = bankStartAddress; // addr->startAddr = restart
-      } else {
-        // FIXME: if we have 2 banks and there is no room in this one, what about the other bank?
-        jsDebug(DBG_INFO,"CreateFile - Not enough space\n");
-        return 0;
-      }
+  // Find a hole that's big enough for our file
+  uint32_t addr = jsfFindFreeSpace(bankStartAddress, requiredSize);
+  // If we don't have space, compact
+  if (!addr) {
+    if (!jsfCompactWithReserve(true, requiredSize)) {
+      jsDebug(DBG_INFO,"CreateFile - Compact failed\n");
+      return 0;
     }
-  };
+    // FIXME: if we have 2 banks and there is no room in this one, what about the other bank?
+    addr = jsfFindFreeSpace(bankStartAddress, requiredSize);
+    if (!addr) {
+      jsDebug(DBG_INFO,"CreateFile - Not enough space\n");
+      return 0;
+    }
+  }
   /* We used to push files forward to the nearest page boundary but now there's very little point
   doing this. While we still have to cope with it when reading storage, we now don't try and align
   new files - see https://github.com/espruino/Espruino/issues/2232 */
-  addr = freeAddr;
-  // write out the header
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsfCompactCheck = true;
+  jsfCompactReserveSpace(addr, requiredSize);
+#endif
   jsDebug(DBG_INFO,"CreateFile new 0x%08x\n", addr+(uint32_t)sizeof(JsfFileHeader));
-  header.size = size | (flags<<24);
-  header.name = name;
-  jsDebug(DBG_INFO,"CreateFile write header\n");
-  jshFlashWrite(&header,addr,(uint32_t)sizeof(JsfFileHeader));
-  jsDebug(DBG_INFO,"CreateFile written header\n");
-  if (returnedHeader) *returnedHeader = header;
-  addr += (uint32_t)sizeof(JsfFileHeader); // address of actual file data
-  jsfCachePut(&header, addr);
-  return addr;
+  return jsfWriteFileHeader(addr, name, size, flags, returnedHeader);
 }
 
 static uint32_t jsfBankFindFile(uint32_t bankAddress, uint32_t bankEndAddress, JsfFileName name, JsfFileHeader *returnedHeader) {
   uint32_t addr = bankAddress;
   JsfFileHeader header;
+#ifdef ESPR_STORAGE_HASH_INDEX
+  if (addr==JSF_START_ADDRESS) {
+    uint32_t fileAddr = jsfHashIndexFind(name, returnedHeader);
+    if (fileAddr!=JSF_HASH_INDEX_UNKNOWN) return fileAddr;
+  }
+#endif
 #ifdef ESPR_STORAGE_FILENAME_TABLE
   if (jsfFilenameTableBank1Addr && addr==JSF_START_ADDRESS) {
     #define FILENAME_TABLE_CHUNKS 8 // how many file headers do we read at once?
@@ -929,8 +1973,18 @@ static bool jsfIsBankStorageValid(uint32_t startAddr, JsfStorageTestType testFla
   unsigned char *headerPtr = (unsigned char *)&header;
 
   bool valid = jsfGetFileHeader(addr, &header, true);
+#ifdef ESPR_STORAGE_HASH_INDEX
+  bool findHashIndex = (testFlags & JSFSTT_FIND_FILENAME_TABLE) && (startAddr==JSF_START_ADDRESS);
+  if (findHashIndex) {
+    jsfHashIndexForget();
+    if (valid) jsfHashIndexLoad(addr, &header);
+  }
+#endif
   if (valid) {
     while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL)) {
+#ifdef ESPR_STORAGE_HASH_INDEX
+      if (findHashIndex) jsfHashIndexLoad(addr, &header);
+#endif
 #ifdef ESPR_STORAGE_FILENAME_TABLE
       if ((testFlags & JSFSTT_FIND_FILENAME_TABLE) &&
           (startAddr==JSF_START_ADDRESS) &&
@@ -947,6 +2001,9 @@ static bool jsfIsBankStorageValid(uint32_t startAddr, JsfStorageTestType testFla
       oldAddr = addr;
       jshKickWatchDog(); // stop watchdog reboots
     }
+#ifdef ESPR_STORAGE_HASH_INDEX
+    if (findHashIndex) jsfHashIndexChecked = true;
+#endif
     if (!addr) { // may have returned 0 just because storage is full
       // Work out roughly where the start is
       uint32_t newAddr = jsfAlignAddress(oldAddr + jsfGetFileSize(&header) + (uint32_t)sizeof(JsfFileHeader));
@@ -1010,6 +2067,10 @@ JsVar *jsfReadFile(JsfFileName name, int offset, int length) {
   JsfFileHeader header;
   uint32_t addr = jsfFindFile(name, &header);
   if (!addr) return 0;
+#ifdef ESPR_STORAGE_COMPRESS
+  if (jsfIsCompressedFile(&header))
+    return jsfReadCompressedFile(addr, &header, offset, length);
+#endif
   // clip requested read lengths
   if (offset<0) offset=0;
   int fileLen = (int)jsfGetFileSize(&header);
@@ -1031,16 +2092,17 @@ JsVar* jsvAddressToVar(size_t addr, uint32_t length) {
   }
 #endif
 #ifdef LINUX
-  // linux fakes flash with a file, so we can't just return a pointer to it!
-  uint32_t alignedSize = jsfAlignAddress((uint32_t)length);
-  char *d = (char*)malloc(alignedSize);
-  jshFlashRead(d, (size_t)addr, alignedSize);
-  JsVar *v = jsvNewStringOfLength((uint32_t)length, d);
-  free(d);
-  return v;
-#else
-  return jsvNewNativeString((char*)mappedAddr, length);
+  // linux fakes flash with a file - if that couldn't be mapped into memory we have to copy it
+  if (!mappedAddr) {
+    uint32_t alignedSize = jsfAlignAddress((uint32_t)length);
+    char *d = (char*)malloc(alignedSize);
+    jshFlashRead(d, (size_t)addr, alignedSize);
+    JsVar *v = jsvNewStringOfLength((uint32_t)length, d);
+    free(d);
+    return v;
+  }
 #endif
+  return jsvNewNativeString((char*)mappedAddr, length);
 }
 
 bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt offset, JsVarInt _size) {
@@ -1060,6 +2122,12 @@ bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt of
   // Lookup file
   JsfFileHeader header;
   uint32_t addr = jsfFindFile(name, &header);
+#ifdef ESPR_STORAGE_COMPRESS
+  if (addr && offset && jsfIsCompressedFile(&header)) {
+    jsExceptionHere(JSET_ERROR, "Can't write part of a compressed file");
+    return false;
+  }
+#endif
 #ifdef JSF_BANK2_START_ADDRESS
   if (!addr && name.c[1]==':'){
     // if not found where it should be, try another bank to not end with two files
@@ -1111,6 +2179,7 @@ bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt of
 }
 
 static void jsfBankListFilesHandleFile(JsVar *files, uint32_t addr, JsfFileHeader *header, JsVar *regex, JsfFileFlags containing, JsfFileFlags notContaining, uint32_t *hash) {
+  jsfCacheFill(header, addr+(uint32_t)sizeof(JsfFileHeader));
   JsfFileFlags flags = jsfGetFileFlags(header);
   if (notContaining&flags) return;
   if (containing && !(containing&flags)) return;
@@ -1237,22 +2306,30 @@ typedef struct {
   uint32_t bufferCnt;        // where are we in the buffer?
 } jsfcbData;
 // cbdata = struct jsfcbData
-void jsfSaveToFlash_writecb(unsigned char ch, uint32_t *cbdata) {
+static void jsfWriteStream_writecb(unsigned char ch, uint32_t *cbdata) {
   jsfcbData *data = (jsfcbData*)cbdata;
   data->buffer[data->bufferCnt++] = ch;
   if (data->bufferCnt>=(uint32_t)sizeof(data->buffer)) {
-    jshFlashWrite(data->buffer, data->address, data->bufferCnt);
+    // if we run out of space, carry on so we know how much we'd have needed
+    if (data->address+data->bufferCnt <= data->endAddress)
+      jshFlashWrite(data->buffer, data->address, data->bufferCnt);
     data->address += data->bufferCnt;
     data->bufferCnt = 0;
-    if ((data->address&1023)==0) jsiConsolePrint(".");
   }
 }
+// cbdata = struct jsfcbData
+void jsfSaveToFlash_writecb(unsigned char ch, uint32_t *cbdata) {
+  jsfcbData *data = (jsfcbData*)cbdata;
+  jsfWriteStream_writecb(ch, cbdata);
+  if (data->bufferCnt==0 && (data->address&1023)==0) jsiConsolePrint(".");
+}
 void jsfSaveToFlash_finish(jsfcbData *data) {
   // pad to alignment
   while (data->bufferCnt & (JSF_ALIGNMENT-1))
     data->buffer[data->bufferCnt++] = 0xFF;
   // write
-  jshFlashWrite(data->buffer, data->address, data->bufferCnt);
+  if (data->address+data->bufferCnt <= jsfAlignAddress(data->endAddress))
+    jshFlashWrite(data->buffer, data->address, data->bufferCnt);
 }
 
 // cbdata = struct jsfcbData
@@ -1271,6 +2348,286 @@ int jsfLoadFromFlash_readcb(uint32_t *cbdata) {
   return data->buffer[data->bufferCnt++];
 }
 
+#if !defined(ESPR_NO_VARIMAGE) || defined(ESPR_STORAGE_COMPRESS)
+/// The most heatshrink could output for len bytes of input (it adds a bit for each byte that doesn't compress)
+#define JSF_COMPRESSED_MAX_SIZE(len) ((len)+(len)/8+64)
+
+/// Write a header over 'size' bytes of data at addr+sizeof(JsfFileHeader) that makes them trash
+static void jsfWriteTrashHeader(uint32_t addr, uint32_t size) {
+  JsfFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.size = size;
+  jshFlashWrite(&header, addr, (uint32_t)sizeof(JsfFileHeader));
+}
+
+/** Compress len bytes at ptr into a new file (starting with 'prefix') in a single pass. We don't know
+ * how big the file is until we've compressed it, so the data is written into free space first and the
+ * header (with the exact size) last. The file only appears once it's complete, and no part of flash is
+ * written twice. Returns the size of the file, or 0 if it was bigger than maxSize or the free space
+ * (with the size it needed in neededSize) */
+static uint32_t jsfWriteCompressedStream(JsfFileName name, JsfFileFlags flags, unsigned char *ptr, uint32_t len, uint32_t prefix, uint32_t maxSize, void (*writecb)(unsigned char ch, uint32_t *cbdata), uint32_t *neededSize) {
+  char drive = jsfStripDriveFromName(&name, false/* ensure .js/etc go in C */);
+  jsfCacheClearFile(name);
+  uint32_t bankStartAddress,bankEndAddress;
+  jsfGetDriveBankAddress(drive,&bankStartAddress,&bankEndAddress);
+  uint32_t requiredSize = jsfAlignAddress(maxSize)+(uint32_t)sizeof(JsfFileHeader);
+  *neededSize = maxSize;
+  uint32_t addr = jsfFindFreeSpace(bankStartAddress, requiredSize);
+  if (!addr) {
+    // No hole that big - compact so the free space is all in one place, and use as much of it as we can
+    jsfCompactWithReserve(true, requiredSize);
+    addr = jsfFindFreeSpace(bankStartAddress, (uint32_t)sizeof(JsfFileHeader)+JSF_ALIGNMENT);
+    if (!addr) return 0;
+  }
+  uint32_t space = jsfGetSpaceLeftInPage(addr);
+  if (space > requiredSize) space = requiredSize;
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsfCompactCheck = true;
+  jsfCompactReserveSpace(addr, space);
+#endif
+  uint32_t dataAddr = addr+(uint32_t)sizeof(JsfFileHeader);
+  jsfcbData cbData;
+  memset(&cbData, 0, sizeof(cbData));
+  cbData.address = dataAddr;
+  cbData.endAddress = addr+space;
+  for (size_t i=0;i<sizeof(prefix);i++)
+    writecb(((unsigned char*)&prefix)[i], (uint32_t*)&cbData);
+  COMPRESS(ptr, len, writecb, (uint32_t*)&cbData);
+  uint32_t size = cbData.address+cbData.bufferCnt-dataAddr;
+  jsfSaveToFlash_finish(&cbData);
+  *neededSize = size;
+  if (dataAddr+size > cbData.endAddress) {
+    // It didn't fit - what we did write (up to the end of the space) becomes trash
+    jsfWriteTrashHeader(addr, cbData.endAddress-dataAddr);
+    return 0;
+  }
+  jsDebug(DBG_INFO,"CompressedStream 0x%08x (%d bytes to %d)\n", dataAddr, len, size);
+  jsfWriteFileHeader(addr, name, size, flags, NULL);
+  return size;
+}
+#endif
+
+#if !defined(ESPR_NO_VARIMAGE) || defined(ESPR_STORAGE_COMPRESS)
+/* If we lost power while streaming a file with jsfWriteCompressedStream there's data after the last
+ * file in a bank (or in an empty space) without a header. Make it into trash so we don't write new
+ * files over it */
+static void jsfBankRecoverStream(uint32_t bankStartAddress) {
+  JsfFileHeader header;
+  unsigned char buf[32];
+  uint32_t addr = bankStartAddress;
+  do {
+    if (jsfGetFileHeader(addr, &header, false)) do {
+    } while (jsfGetNextFileHeader(&addr, &header, GNFH_GET_EMPTY));
+    uint32_t space = jsfGetSpaceLeftInPage(addr);
+    if (space < (uint32_t)(sizeof(JsfFileHeader)+sizeof(buf))) {
+      addr = jsfGetAddressOfNextPage(addr);
+      continue;
+    }
+    uint32_t dataAddr = addr+(uint32_t)sizeof(JsfFileHeader);
+    if (!jsfIsErased(dataAddr, sizeof(buf))) {
+      // find where the data ends
+      uint32_t end = addr+space;
+      while (end > dataAddr) {
+        uint32_t l = end-dataAddr;
+        if (l>sizeof(buf)) l=sizeof(buf);
+        jshFlashRead(buf, end-l, l);
+        while (l && buf[l-1]==0xFF) { l--; end--; }
+        if (l) break;
+      }
+      jsDebug(DBG_INFO,"RecoverStream 0x%08x (%d bytes)\n", addr, end-dataAddr);
+      jsfWriteTrashHeader(addr, end-dataAddr);
+      continue; // look again after the trash
+    }
+    addr = jsfGetAddressOfNextPage(addr);
+  } while (addr);
+}
+
+void jsfRecoverStream() {
+  jsfBankRecoverStream(JSF_START_ADDRESS);
+#ifdef JSF_BANK2_START_ADDRESS
+  jsfBankRecoverStream(JSF_BANK2_START_ADDRESS);
+#endif
+}
+#endif
+
+#ifdef ESPR_SAVE_DELTA
+/* In delta mode (E.setFlags({saveDelta:1})) the RAM image is split into JSF_SAVE_DELTA_REGIONS
+regions, each compressed into its own file that starts with the CRC32 of the region. ".varimg" is
+then a JsfSaveDeltaManifest (without JSFF_COMPRESSED) with the CRC of each region. When saving,
+regions whose CRC hasn't changed since the last save aren't written again, and regions are only
+loaded if they all match the manifest.
+
+So that a save that runs out of space or loses power never damages the last good one, each region
+alternates between two files (".varimg0"/".varimg0~", ".varimg1"/".varimg1~", ...) and the manifest
+says which each region is in. Changed regions are written to the file the current manifest doesn't
+use, then the new manifest is written as ".varimg~", then it replaces ".varimg". Only after that
+are the files the old manifest used (and ".varimg~") erased. */
+#define JSF_SAVE_DELTA_REGIONS 16
+#define JSF_SAVE_DELTA_NEW_MANIFEST SAVED_CODE_VARIMAGE "~" // the new manifest while ".varimg" is replaced
+
+typedef struct {
+  uint32_t hash; ///< build hash
+  uint32_t varSize; ///< bytes of JsVars that were saved
+  uint32_t crc[JSF_SAVE_DELTA_REGIONS]; ///< CRC32 of each region
+  uint32_t alt; ///< bit i is set if region i is in its alternate ("~") file
+} JsfSaveDeltaManifest;
+
+static JsfFileName jsfSaveDeltaRegionName(int region, bool alt) {
+  JsfFileName name = jsfNameFromString(SAVED_CODE_VARIMAGE);
+  name.c[strlen(SAVED_CODE_VARIMAGE)] = "0123456789abcdef"[region];
+  if (alt) name.c[strlen(SAVED_CODE_VARIMAGE)+1] = '~';
+  return name;
+}
+
+/// Is region i in its alternate file in this manifest?
+static bool jsfSaveDeltaIsAlt(JsfSaveDeltaManifest *manifest, int region) {
+  return (manifest->alt >> region) & 1;
+}
+
+/// Find a region's file, and return its address if it was written with the CRC in the manifest
+static uint32_t jsfSaveDeltaFindRegion(JsfSaveDeltaManifest *manifest, int region, JsfFileHeader *header) {
+  uint32_t crc = manifest->crc[region];
+  uint32_t addr = jsfFindFile(jsfSaveDeltaRegionName(region, jsfSaveDeltaIsAlt(manifest, region)), header);
+  uint32_t fileCrc = ~crc;
+  if (addr) jshFlashRead(&fileCrc, addr, sizeof(fileCrc));
+  return (fileCrc==crc) ? addr : 0;
+}
+
+static void jsfSaveDeltaErase() {
+  for (int i=0;i<JSF_SAVE_DELTA_REGIONS;i++) {
+    jsfEraseFile(jsfSaveDeltaRegionName(i, false));
+    jsfEraseFile(jsfSaveDeltaRegionName(i, true));
+  }
+  jsfEraseFile(jsfNameFromString(JSF_SAVE_DELTA_NEW_MANIFEST));
+}
+
+/// Erase the files for the regions in the 'regions' bitmask - the ones the manifest uses if 'used', or the others if not
+static void jsfSaveDeltaEraseRegions(JsfSaveDeltaManifest *manifest, uint32_t regions, bool used) {
+  for (int i=0;i<JSF_SAVE_DELTA_REGIONS;i++)
+    if ((regions>>i)&1)
+      jsfEraseFile(jsfSaveDeltaRegionName(i, jsfSaveDeltaIsAlt(manifest, i)==used));
+}
+
+/// Read a manifest from the given file, or return false if it doesn't contain one
+static bool jsfSaveDeltaReadManifest(JsfFileName name, JsfSaveDeltaManifest *manifest) {
+  JsfFileHeader header;
+  uint32_t addr = jsfFindFile(name, &header);
+  if (!addr || (jsfGetFileFlags(&header)&JSFF_COMPRESSED) || jsfGetFileSize(&header)!=sizeof(JsfSaveDeltaManifest))
+    return false;
+  jshFlashRead(manifest, addr, sizeof(JsfSaveDeltaManifest));
+  return true;
+}
+
+/// Write a manifest to the given file (which must not exist), or return false if there's no space
+static bool jsfSaveDeltaWriteManifest(JsfFileName name, JsfSaveDeltaManifest *manifest) {
+  uint32_t addr = jsfCreateFile(name, (uint32_t)sizeof(JsfSaveDeltaManifest), JSFF_NONE, NULL);
+  if (!addr) return false;
+  jshFlashWrite(manifest, addr, (uint32_t)sizeof(JsfSaveDeltaManifest));
+  return true;
+}
+
+/// Save the RAM image, only writing the regions that changed since the last save
+static void jsfSaveDeltaToFlash(unsigned char *varPtr, uint32_t varSize) {
+  JsfFileName name = jsfNameFromString(SAVED_CODE_VARIMAGE);
+  JsfFileName newName = jsfNameFromString(JSF_SAVE_DELTA_NEW_MANIFEST);
+  JsfSaveDeltaManifest old, manifest;
+  memset(&old, 0, sizeof(old));
+  memset(&manifest, 0, sizeof(manifest));
+  // The last save. If we lost power while replacing its manifest, finish doing that first
+  if (!jsfFindFile(name, 0) && jsfSaveDeltaReadManifest(newName, &old) &&
+      !jsfSaveDeltaWriteManifest(name, &old)) {
+    jsiConsolePrint("ERROR: Unable to write saved code\n");
+    return;
+  }
+  bool hasOld = jsfSaveDeltaReadManifest(name, &old);
+  manifest.hash = getBuildHash();
+  manifest.varSize = varSize;
+  bool useOld = old.hash==manifest.hash && old.varSize==varSize;
+  uint32_t regionSize = (varSize+JSF_SAVE_DELTA_REGIONS-1) / JSF_SAVE_DELTA_REGIONS;
+  uint32_t written = 0, compressedSize = 0;
+  uint32_t changed = 0; ///< bitmask of regions we've written
+  JsfFileHeader header;
+  jsiConsolePrint("Writing..");
+  for (int i=0;i<JSF_SAVE_DELTA_REGIONS;i++) {
+    uint32_t start = (uint32_t)i*regionSize;
+    uint32_t len = (start<varSize) ? varSize-start : 0;
+    if (len>regionSize) len=regionSize;
+    manifest.crc[i] = jsfCRC32(0, &varPtr[start], len);
+    if (useOld && old.crc[i]==manifest.crc[i] && jsfSaveDeltaFindRegion(&old, i, &header)) {
+      if (jsfSaveDeltaIsAlt(&old, i)) manifest.alt |= 1U<<i;
+      compressedSize += jsfGetFileSize(&header);
+      continue; // unchanged
+    }
+    // write to the file the last save doesn't use (anything in it is from a save that didn't finish)
+    bool alt = hasOld && !jsfSaveDeltaIsAlt(&old, i);
+    if (alt) manifest.alt |= 1U<<i;
+    changed |= 1U<<i;
+    JsfFileName regionName = jsfSaveDeltaRegionName(i, alt);
+    jsfEraseFile(regionName);
+    uint32_t neededSize;
+    uint32_t size = jsfWriteCompressedStream(regionName, JSFF_COMPRESSED, &varPtr[start], len, manifest.crc[i], (uint32_t)sizeof(uint32_t)+JSF_COMPRESSED_MAX_SIZE(len), jsfSaveToFlash_writecb, &neededSize);
+    if (!size) {
+      jsiConsolePrintf("\nERROR: Too big to save to flash (%d vs %d bytes)\n", neededSize, jsfGetStorageStats(0,true).free);
+      jsfSaveDeltaEraseRegions(&manifest, changed, true); // leave the last save as it was
+      return;
+    }
+    compressedSize += size;
+    written++;
+  }
+  /* Write the new manifest next to the old one, then replace the old one. If we lose power after
+   * the old one is erased, the new one is loaded from newName. */
+  jsfEraseFile(newName);
+  if (!jsfSaveDeltaWriteManifest(newName, &manifest)) {
+    jsiConsolePrint("\nERROR: Unable to write saved code\n");
+    jsfSaveDeltaEraseRegions(&manifest, changed, true);
+    return;
+  }
+  jsfEraseFile(name);
+  if (jsfSaveDeltaWriteManifest(name, &manifest))
+    jsfEraseFile(newName);
+  // the files the last save used that we don't need now (and any left by saves that didn't finish)
+  jsfSaveDeltaEraseRegions(&manifest, (1U<<JSF_SAVE_DELTA_REGIONS)-1, false);
+  jsiConsolePrintf("\nCompressed %d bytes to %d (%d of %d regions written)\n", varSize, compressedSize, written, JSF_SAVE_DELTA_REGIONS);
+}
+
+/// Load the RAM image from the manifest at addr and the region files
+static void jsfLoadDeltaFromFlash(uint32_t addr, unsigned char *varPtr) {
+  JsfSaveDeltaManifest manifest;
+  jshFlashRead(&manifest, addr, sizeof(manifest));
+  if (manifest.hash != getBuildHash()) {
+    jsiConsolePrintf("Not loading saved code from different Espruino firmware.\n");
+    return;
+  }
+  uint32_t varSize = jsvGetMemoryTotal() * (unsigned int)sizeof(JsVar);
+  if (manifest.varSize != varSize) {
+    jsiConsolePrintf("Not loading saved code with different memory size.\n");
+    return;
+  }
+  // check everything is there before we overwrite any variables
+  JsfFileHeader header;
+  uint32_t compressedSize = 0;
+  for (int i=0;i<JSF_SAVE_DELTA_REGIONS;i++) {
+    if (!jsfSaveDeltaFindRegion(&manifest, i, &header)) {
+      jsiConsolePrintf("Not loading incomplete saved code.\n");
+      return;
+    }
+    compressedSize += jsfGetFileSize(&header);
+  }
+  jsiConsolePrintf("Loading %d bytes from flash...\n", compressedSize);
+  uint32_t regionSize = (varSize+JSF_SAVE_DELTA_REGIONS-1) / JSF_SAVE_DELTA_REGIONS;
+  for (int i=0;i<JSF_SAVE_DELTA_REGIONS;i++) {
+    uint32_t start = (uint32_t)i*regionSize;
+    if (start>=varSize) break;
+    addr = jsfSaveDeltaFindRegion(&manifest, i, &header);
+    jsfcbData cbData;
+    memset(&cbData, 0, sizeof(cbData));
+    cbData.address = addr+(uint32_t)sizeof(uint32_t);
+    cbData.endAddress = addr+jsfGetFileSize(&header);
+    DECOMPRESS(jsfLoadFromFlash_readcb, (uint32_t*)&cbData, &varPtr[start]);
+  }
+}
+#endif
+
 /// Save the RAM image to flash (this is the actual interpreter state)
 void jsfSaveToFlash() {
 #ifdef ESPR_NO_VARIMAGE
@@ -1279,50 +2636,43 @@ void jsfSaveToFlash() {
   unsigned int varSize = jsvGetMemoryTotal() * (unsigned int)sizeof(JsVar);
   unsigned char* varPtr = (unsigned char *)_jsvGetAddressOf(1);
 
+#ifdef ESPR_SAVE_DELTA
+  if (jsfGetFlag(JSF_SAVE_DELTA)) {
+    jsfSaveDeltaToFlash(varPtr, varSize);
+    return;
+  }
+  jsfSaveDeltaErase();
+#endif
   jsiConsolePrint("Compacting Flash...\n");
   JsfFileName name = jsfNameFromString(SAVED_CODE_VARIMAGE);
   // Ensure we get rid of any saved code we had before
   jsfEraseFile(name);
   // Try and compact, just to ensure we get the maximum amount saved
   jsfCompact(true);
-  jsiConsolePrint("Calculating Size...\n");
-  // Work out how much data this'll take, plus 4 bytes for build hash
-  uint32_t compressedSize = 4 + COMPRESS(varPtr, varSize, NULL, NULL);
-  // How much data do we have?
-  uint32_t savedCodeAddr = jsfCreateFile(name, compressedSize, JSFF_COMPRESSED, NULL);
-  if (!savedCodeAddr) {
-    jsiConsolePrintf("ERROR: Too big to save to flash (%d vs %d bytes)\n", compressedSize, jsfGetStorageStats(0,true).free);
+  jsiConsolePrint("Writing..");
+  // Compress straight into free space - the file's header is written once we're done
+  uint32_t hash = getBuildHash();
+  uint32_t compressedSize = 0;
+  uint32_t savedSize = jsfWriteCompressedStream(name, JSFF_COMPRESSED, varPtr, varSize, hash, (uint32_t)sizeof(hash)+JSF_COMPRESSED_MAX_SIZE(varSize), jsfSaveToFlash_writecb, &compressedSize);
+  if (!savedSize) {
+    jsiConsolePrintf("\nERROR: Too big to save to flash (%d vs %d bytes)\n", compressedSize, jsfGetStorageStats(0,true).free);
     jsvSoftInit();
     jspSoftInit();
     jsiConsolePrint("Deleting command history and trying again...\n");
     while (jsiFreeMoreMemory());
     jspSoftKill();
     jsvSoftKill();
-    compressedSize = 4 + COMPRESS(varPtr, varSize, NULL, NULL);
-    savedCodeAddr = jsfCreateFile(name, compressedSize, JSFF_COMPRESSED, NULL);
+    jsfCompact(true);
+    jsiConsolePrint("Writing..");
+    savedSize = jsfWriteCompressedStream(name, JSFF_COMPRESSED, varPtr, varSize, hash, (uint32_t)sizeof(hash)+JSF_COMPRESSED_MAX_SIZE(varSize), jsfSaveToFlash_writecb, &compressedSize);
   }
-  if (!savedCodeAddr) {
+  if (!savedSize) {
     if (jsfGetStorageStats(JSF_DEFAULT_START_ADDRESS, true).fileBytes)
-      jsiConsolePrint("Not enough free space to save. Try require('Storage').eraseAll()\n");
+      jsiConsolePrint("\nNot enough free space to save. Try require('Storage').eraseAll()\n");
     else
-      jsiConsolePrint("Code is too big to save to Flash.\n");
+      jsiConsolePrint("\nCode is too big to save to Flash.\n");
     return;
   }
-  // Ok, we have space!
-  // Now start writing
-  jsfcbData cbData;
-  memset(&cbData, 0, sizeof(cbData));
-  cbData.address = savedCodeAddr;
-  cbData.endAddress = jsfAlignAddress(savedCodeAddr+compressedSize);
-  jsiConsolePrint("Writing..");
-  // write the hash
-  uint32_t hash = getBuildHash();
-  int i;
-  for (i=0;i<4;i++)
-    jsfSaveToFlash_writecb(((unsigned char*)&hash)[i], (uint32_t*)&cbData);
-  // write compressed data
-  COMPRESS(varPtr, varSize, jsfSaveToFlash_writecb, (uint32_t*)&cbData);
-  jsfSaveToFlash_finish(&cbData);
   jsiConsolePrintf("\nCompressed %d bytes to %d\n", varSize, compressedSize);
 #endif
 }
@@ -1333,12 +2683,22 @@ void jsfLoadStateFromFlash() {
 #ifndef ESPR_NO_VARIMAGE
   JsfFileHeader header;
   uint32_t savedCode = jsfFindFile(jsfNameFromString(SAVED_CODE_VARIMAGE),&header);
+#ifdef ESPR_SAVE_DELTA
+  if (!savedCode) // we lost power while a delta save was replacing its manifest
+    savedCode = jsfFindFile(jsfNameFromString(JSF_SAVE_DELTA_NEW_MANIFEST),&header);
+#endif
   if (!savedCode) {
     return;
   }
 
   //  unsigned int dataSize = jsvGetMemoryTotal() * sizeof(JsVar);
   unsigned char* varPtr = (unsigned char *)_jsvGetAddressOf(1);
+#ifdef ESPR_SAVE_DELTA
+  if (!(jsfGetFileFlags(&header)&JSFF_COMPRESSED)) {
+    jsfLoadDeltaFromFlash(savedCode, varPtr);
+    return;
+  }
+#endif
 
   jsfcbData cbData;
   memset(&cbData, 0, sizeof(cbData));
@@ -1358,6 +2718,95 @@ void jsfLoadStateFromFlash() {
 #endif
 }
 
+#ifdef ESPR_STORAGE_COMPRESS
+/* Files written with Storage.write(..., {compress:true}) have JSFF_COMPRESSED set, and contain
+the uncompressed length (a uint32_t) followed by the heatshrink-compressed data. They are
+decompressed whenever they're read, so unlike normal files they aren't memory-mapped. */
+
+/// Is this a file written with jsfWriteCompressedFile? (the saved var image, and its regions in delta mode, are compressed differently)
+static bool jsfIsCompressedFile(JsfFileHeader *header) {
+#ifndef ESPR_NO_VARIMAGE
+  if (strncmp(header->name.c, SAVED_CODE_VARIMAGE, strlen(SAVED_CODE_VARIMAGE))==0)
+    return false;
+#endif
+  return (jsfGetFileFlags(header)&JSFF_COMPRESSED)!=0;
+}
+
+bool jsfWriteCompressedFile(JsfFileName name, JsVar *data) {
+  JSV_GET_AS_CHAR_ARRAY(dPtr, dLen, data);
+  if (!dPtr) {
+    jsExceptionHere(JSET_ERROR, "Can't get pointer to data to write");
+    return false;
+  }
+  uint32_t uncompressedSize = (uint32_t)dLen;
+  JsfFileHeader header;
+  uint32_t addr = jsfFindFile(name, &header);
+  if (addr) {
+    jsDebug(DBG_INFO,"jsfWriteCompressedFile remove existing file\n");
+    jsfEraseFileInternal(addr, &header, true);
+  }
+  /* Compress in a single pass. If it doesn't get any smaller, what was written becomes trash and
+   * we just write it normally */
+  uint32_t compressedSize = 0;
+  if (dLen > sizeof(uncompressedSize) &&
+      jsfWriteCompressedStream(name, JSFF_COMPRESSED, (unsigned char*)dPtr, uncompressedSize, uncompressedSize, uncompressedSize-1, jsfWriteStream_writecb, &compressedSize)) {
+    jsDebug(DBG_INFO,"jsfWriteCompressedFile %d bytes to %d\n", uncompressedSize, compressedSize);
+    return true;
+  }
+  return jsfWriteFile(name, data, JSFF_NONE, 0, 0);
+}
+
+typedef struct {
+  jsfcbData in;
+  JsvStringIterator it;
+  uint32_t skip; ///< bytes to decompress before we start outputting them
+  uint32_t remaining; ///< bytes left to output
+} JsfDecompressData;
+
+// cbdata = struct JsfDecompressData
+static int jsfReadCompressedFile_readcb(uint32_t *cbdata) {
+  JsfDecompressData *data = (JsfDecompressData*)cbdata;
+  if (!data->remaining) return -1; // we have all we need - stop decompressing
+  return jsfLoadFromFlash_readcb((uint32_t*)&data->in);
+}
+
+// cbdata = struct JsfDecompressData
+static void jsfReadCompressedFile_writecb(unsigned char ch, uint32_t *cbdata) {
+  JsfDecompressData *data = (JsfDecompressData*)cbdata;
+  if (data->skip) {
+    data->skip--;
+  } else if (data->remaining) {
+    data->remaining--;
+    jsvStringIteratorSetCharAndNext(&data->it, (char)ch);
+  }
+}
+
+/// Decompress 'length' bytes from 'offset' in the compressed file at addr into a new String
+static JsVar *jsfReadCompressedFile(uint32_t addr, JsfFileHeader *header, int offset, int length) {
+  uint32_t uncompressedSize;
+  jshFlashRead(&uncompressedSize, addr, sizeof(uncompressedSize));
+  // clip requested read lengths
+  int fileLen = (int)uncompressedSize;
+  if (offset<0) offset=0;
+  if (length<=0) length=fileLen;
+  if (offset>fileLen) offset=fileLen;
+  if (offset+length>fileLen) length=fileLen-offset;
+  if (length<=0) return jsvNewFromEmptyString();
+  JsVar *v = jsvNewStringOfLength((unsigned int)length, NULL);
+  if (!v) return 0;
+  JsfDecompressData data;
+  memset(&data, 0, sizeof(data));
+  data.in.address = addr + (uint32_t)sizeof(uncompressedSize);
+  data.in.endAddress = addr + jsfGetFileSize(header);
+  data.skip = (uint32_t)offset;
+  data.remaining = (uint32_t)length;
+  jsvStringIteratorNew(&data.it, v, 0);
+  heatshrink_decode_cb(jsfReadCompressedFile_readcb, (uint32_t*)&data, jsfReadCompressedFile_writecb, (uint32_t*)&data);
+  jsvStringIteratorFree(&data.it);
+  return v;
+}
+#endif
+
 void jsfSaveBootCodeToFlash(JsVar *code, bool runAfterReset) {
   jsfEraseFile(jsfNameFromString(SAVED_CODE_BOOTCODE));
   jsfEraseFile(jsfNameFromString(SAVED_CODE_BOOTCODE_RESET));
@@ -1419,6 +2868,9 @@ bool jsfFlashContainsCode() {
   return
 #ifndef ESPR_NO_VARIMAGE
       jsfFindFile(jsfNameFromString(SAVED_CODE_VARIMAGE),0) ||
+#endif
+#ifdef ESPR_SAVE_DELTA
+      jsfFindFile(jsfNameFromString(JSF_SAVE_DELTA_NEW_MANIFEST),0) ||
 #endif
       jsfFindFile(jsfNameFromString(SAVED_CODE_BOOTCODE),0) ||
       jsfFindFile(jsfNameFromString(SAVED_CODE_BOOTCODE_RESET),0);
@@ -1429,6 +2881,9 @@ void jsfRemoveCodeFromFlash() {
   jsiConsolePrint("Erasing saved code.");
 #ifndef ESPR_NO_VARIMAGE
   jsfEraseFile(jsfNameFromString(SAVED_CODE_VARIMAGE));
+#endif
+#ifdef ESPR_SAVE_DELTA
+  jsfSaveDeltaErase();
 #endif
   jsfEraseFile(jsfNameFromString(SAVED_CODE_BOOTCODE));
   jsfEraseFile(jsfNameFromString(SAVED_CODE_BOOTCODE_RESET));
@@ -1482,6 +2937,9 @@ void jsfResetStorage() {
 #ifdef ESPR_STORAGE_FILENAME_TABLE
 /// Create a lookup table for filenames. On success return file's address
 static uint32_t jsfBankCreateFileTable(uint32_t startAddr) {
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  if (jsfCompactBank) return 0; // files are being moved - the table would point to the wrong places
+#endif
   JsfFileHeader header;
   memset(&header,0,sizeof(JsfFileHeader));
   uint32_t fileCount = 0;
@@ -1523,3 +2981,9 @@ void jsfCreateFileTable() {
 }
 #endif
 
+#ifdef ESPR_STORAGE_HASH_INDEX
+/// Create a hash index of filenames (if there are enough files) - so files can be found without a scan
+void jsfCreateHashIndex() {
+  jsfHashIndexCreate(0);
+}
+#endif
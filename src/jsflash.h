@@ -25,6 +25,13 @@
 #define ESPR_STORAGE_FILENAME_TABLE
 #endif
 
+#if defined(ESPR_STORAGE_HASH_INDEX) && defined(SAVE_ON_FLASH)
+#undef ESPR_STORAGE_HASH_INDEX // the index is stored as a JSFF_FILENAME_TABLE file
+#endif
+#if defined(ESPR_STORAGE_IDLE_COMPACT) && defined(SAVE_ON_FLASH)
+#undef ESPR_STORAGE_IDLE_COMPACT // uses JSFF_FILENAME_TABLE for the space left behind by moved files
+#endif
+
 
 /// Simple filename used for Flash Storage. We use firstChars so we can do a quick first pass check for equality
 typedef union {
@@ -47,7 +54,7 @@ typedef enum {
   JSFF_FILENAME_TABLE = 32,        ///< A file that contains a list of JsfFileHeader structs with 'size' pointing to the file addresses at the time it was created
 #endif
   JSFF_STORAGEFILE = 64,  ///< This file is a 'storage file' created by Storage.open
-  JSFF_COMPRESSED = 128   ///< This file contains compressed data (used only for .varimg currently)
+  JSFF_COMPRESSED = 128   ///< This file contains compressed data (.varimg, or files written with Storage.write(...,{compress:true}))
 } JsfFileFlags; // these are stored in the top 8 bits of JsfFileHeader.size
 
 
@@ -76,6 +83,10 @@ JsVar* jsvAddressToVar(size_t addr, uint32_t length);
 JsVar *jsfReadFile(JsfFileName name, int offset, int length);
 /// Write a file. For simple stuff just leave offset and size as 0
 bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt offset, JsVarInt _size);
+#ifdef ESPR_STORAGE_COMPRESS
+/// Write a new file containing the data compressed with heatshrink (if it doesn't get smaller it's written normally)
+bool jsfWriteCompressedFile(JsfFileName name, JsVar *data);
+#endif
 /// Erase the given file, return true on success
 bool jsfEraseFile(JsfFileName name);
 /// Erase the entire contents of the memory store
@@ -124,6 +135,16 @@ typedef struct {
 #ifndef SAVE_ON_FLASH
   uint32_t firstPageWithErasedFiles; /// first page with files erased in it - if compacting, this is where we start from
 #endif
+#if ESPR_USE_STORAGE_CACHE
+  uint32_t cacheHits, cacheMisses; /// how many file lookups were (or weren't) answered by the cache
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  bool compacting; /// is this bank being compacted from the idle loop?
+  uint32_t compactBytes, compactPages, compactTime; /// bytes moved, pages rewritten and milliseconds spent by idle compaction
+#endif
+#ifdef ESPR_STORAGE_COMPRESS
+  uint32_t compressedBytes, uncompressedBytes; /// size of compressed files in Storage, and how big they'd be if they weren't compressed
+#endif
 } JsfStorageStats;
 /// Get info about the current filesystem
 JsfStorageStats jsfGetStorageStats(uint32_t addr, bool allPages);
@@ -156,4 +177,22 @@ void jsfResetStorage();
 void jsfCreateFileTable();
 #endif
 
+#ifdef ESPR_STORAGE_HASH_INDEX
+/// Create a hash index of filenames (if there are enough files) - so files can be found without a scan
+void jsfCreateHashIndex();
+#endif
+
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+/** Called when idle. If we're compacting Storage, move a few more pages of files. If not (and
+ * canStart is set), check whether Storage needs compacting. Returns true if we did anything */
+bool jsfCompactIdle(bool canStart);
+/// If we lost power while compacting from the idle loop, finish what we were doing. Call at boot before checking Storage
+void jsfCompactRecover();
+#endif
+
+#if !defined(ESPR_NO_VARIMAGE) || defined(ESPR_STORAGE_COMPRESS)
+/// If we lost power while writing a compressed file (eg. in save()), make what was written into trash. Call at boot before checking Storage
+void jsfRecoverStream();
+#endif
+
 #endif //JSFLASH_H_
@@ -70,6 +70,12 @@ Pin pinSleepIndicator = DEFAULT_SLEEP_PIN_INDICATOR;
 #endif
 JsiStatus jsiStatus = 0;
 JsSysTime jsiLastIdleTime;  ///< The last time we went around the idle loop - use this for timers
+#ifdef ESPR_TIMER_HEAP
+static JsSysTime jsiTimerElapsed; ///< Time passed since timers' 'time' fields were relative to jsiLastIdleTime
+static JsVarRef timerHeap = 0; ///< Flat string of JsiTimerHeapEntry (0 if we have none yet)
+static unsigned int timerHeapCount = 0; ///< How many entries in timerHeap are used
+static bool timerHeapValid = false; ///< If false, timerHeap needs rebuilding from timerArray
+#endif
 #ifndef EMBEDDED
 uint32_t jsiTimeSinceCtrlC; ///< When was Ctrl-C last pressed. We use this so we quit on desktop when we do Ctrl-C + Ctrl-C
 #endif
@@ -462,6 +468,11 @@ void jsiSoftInit(bool hasBeenReset) {
   // Load timer/watch arrays
   timerArray = _jsiInitNamedArray(JSI_TIMERS_NAME);
   watchArray = _jsiInitNamedArray(JSI_WATCHES_NAME);
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerElapsed = 0;
+  timerHeap = 0;
+  timerHeapValid = false;
+#endif
 
   // Make sure we set up lastIdleTime, as this could be used
   // when adding an interval from onInit (called below)
@@ -505,6 +516,9 @@ void jsiSoftInit(bool hasBeenReset) {
     }
     jsvObjectIteratorFree(&it);
     jsvUnLock(watchArrayPtr);
+#ifdef ESPR_WATCH_INDEX
+    jsiWatchIndexInvalidate(); // pins may now create different events
+#endif
   }
 
   // Timers are stored by time in the future now, so no need
@@ -740,6 +754,25 @@ void jsiSoftKill() {
     events=0;
   }
   if (timerArray) {
+#ifdef ESPR_TIMER_HEAP
+    // Make timer times relative to jsiLastIdleTime again, and don't save the heap
+    JsVar *timerArrayPtr = jsvLock(timerArray);
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, timerArrayPtr);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *timerPtr = jsvObjectIteratorGetValue(&it);
+      JsSysTime time = jsiTimerGetTime(timerPtr);
+      jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(time));
+      jsvUnLock(timerPtr);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(timerArrayPtr);
+    jsiTimerElapsed = 0;
+    timerHeap = 0;
+    timerHeapValid = false;
+    jsvObjectRemoveChild(execInfo.hiddenRoot, JSI_TIMER_HEAP_NAME);
+#endif
     jsvUnRefRef(timerArray);
     timerArray=0;
   }
@@ -759,6 +792,9 @@ void jsiSoftKill() {
     jsvUnRef(watchArrayPtr);
     jsvUnLock(watchArrayPtr);
     watchArray=0;
+#ifdef ESPR_WATCH_INDEX
+    jsiWatchIndexInvalidate(); // don't save it
+#endif
   }
   // Save flags if required
   if (jsFlags)
@@ -805,6 +841,12 @@ void jsiSemiInit(bool autoLoad, JsfFileName *loadedFilename) {
   if (fullTest) {
 #ifdef BANGLEJS
     jsiConsolePrintf("Checking storage...\n");
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+    jsfCompactRecover(); // finish any compaction that was interrupted by a power loss
+#endif
+#if !defined(ESPR_NO_VARIMAGE) || defined(ESPR_STORAGE_COMPRESS)
+    jsfRecoverStream(); // tidy up any file that was being written when we lost power
 #endif
     if (!jsfIsStorageValid(JSFSTT_NORMAL | JSFSTT_FIND_FILENAME_TABLE)) {
       jsiConsolePrintf("Storage is corrupt.\n");
@@ -1810,6 +1852,282 @@ JsVar *jsiSetTimeout(void (*functionPtr)(void), JsVarFloat milliseconds) {
   return idx;
 }
 
+/// If nonzero, the system time by which something asked (with jsiWakeAt) for the idle loop to run again
+static JsSysTime jsiWakeTime;
+
+void jsiWakeAt(JsSysTime time) {
+  if (!jsiWakeTime || time < jsiWakeTime) jsiWakeTime = time;
+}
+
+/// Get the time until the given timer should fire (relative to jsiLastIdleTime)
+JsSysTime jsiTimerGetTime(JsVar *timerPtr) {
+  JsSysTime time = (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+#ifdef ESPR_TIMER_HEAP
+  time -= jsiTimerElapsed;
+#endif
+  return time;
+}
+
+/// Set the time until the given timer should fire (relative to jsiLastIdleTime), before it is added with jsiTimerAdd
+void jsiTimerSetTime(JsVar *timerPtr, JsSysTime time) {
+#ifdef ESPR_TIMER_HEAP
+  time += jsiTimerElapsed;
+#endif
+  jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(time));
+}
+
+#ifdef ESPR_TIMER_HEAP
+/* Timers are kept in a binary min-heap ordered by the time they fire, so
+ * jsiIdle only has to look at the first one to see if anything needs doing.
+ * The heap is a flat string in hiddenRoot of the refs of the timers' names in
+ * timerArray (so they can be removed from it without a search), along with a
+ * copy of their 'time'. Each timer object keeps its index in the heap in a
+ * hidden JSI_TIMER_HEAP_INDEX_NAME child (the heap entry has the ref of the
+ * child's name so it can be updated as entries move), so a timer can usually
+ * be found in the heap without a search too. Rather than updating every timer's 'time' each time
+ * around the idle loop, 'time' is relative to the point when jsiTimerElapsed
+ * was 0.
+ *
+ * The heap is rebuilt from timerArray (!timerHeapValid) when vars have moved,
+ * when lots of timers were cleared at once, or after a load. */
+typedef struct {
+  JsVarRef name;  ///< the timer's name in timerArray
+  JsVarRef index; ///< the name of the timer's JSI_TIMER_HEAP_INDEX_NAME child
+  JsSysTime time; ///< the timer's 'time'
+} PACKED_FLAGS JsiTimerHeapEntry;
+
+
+static JsiTimerHeapEntry *jsiTimerHeapGetEntries(unsigned int *capacity) {
+  JsVar *heap = jsvLock(timerHeap);
+  if (capacity) *capacity = (unsigned int)(jsvGetCharactersInVar(heap) / sizeof(JsiTimerHeapEntry));
+  JsiTimerHeapEntry *entries = (JsiTimerHeapEntry*)jsvGetFlatStringPointer(heap);
+  jsvUnLock(heap); // it's referenced from hiddenRoot, and only moves in jsvDefragment (which invalidates the heap)
+  return entries;
+}
+
+/// Fill in a heap entry for the given timer (by its name in timerArray), return false if we're out of memory
+static bool jsiTimerHeapSetEntry(JsiTimerHeapEntry *entry, JsVar *timerName, JsSysTime time) {
+  JsVar *timerPtr = jsvSkipName(timerName);
+  JsVar *index = jsvIsObject(timerPtr) ? jsvFindOrAddChildFromString(timerPtr, JSI_TIMER_HEAP_INDEX_NAME) : 0;
+  jsvUnLock(timerPtr);
+  if (!index) return false;
+  entry->name = jsvGetRef(timerName);
+  entry->index = jsvGetRef(index);
+  entry->time = time;
+  jsvUnLock(index);
+  return true;
+}
+
+/// Is this heap entry for the given timer?
+static bool jsiTimerHeapIsEntryFor(JsiTimerHeapEntry *entry, JsVar *timerPtr) {
+  JsVar *timerName = jsvLock(entry->name);
+  bool found = jsvGetFirstChild(timerName) == jsvGetRef(timerPtr);
+  jsvUnLock(timerName);
+  return found;
+}
+
+/// Store the index of this heap entry in its timer - see jsiTimerHeapFind
+static void jsiTimerHeapSetIndex(JsiTimerHeapEntry *heap, unsigned int i) {
+  JsVar *index = jsvLock(heap[i].index);
+  JsVar *value = jsvNewFromInteger((JsVarInt)i);
+  jsvSetValueOfName(index, value); // if we're out of memory this is undefined, and jsiTimerHeapFind will search
+  jsvUnLock2(value, index);
+}
+
+static void jsiTimerHeapSiftUp(JsiTimerHeapEntry *heap, unsigned int i) {
+  JsiTimerHeapEntry e = heap[i];
+  while (i>0) {
+    unsigned int parent = (i-1)>>1;
+    if (heap[parent].time <= e.time) break;
+    heap[i] = heap[parent];
+    jsiTimerHeapSetIndex(heap, i);
+    i = parent;
+  }
+  heap[i] = e;
+  jsiTimerHeapSetIndex(heap, i);
+}
+
+static void jsiTimerHeapSiftDown(JsiTimerHeapEntry *heap, unsigned int count, unsigned int i) {
+  JsiTimerHeapEntry e = heap[i];
+  while (true) {
+    unsigned int child = i*2+1;
+    if (child >= count) break;
+    if (child+1 < count && heap[child+1].time < heap[child].time) child++;
+    if (e.time <= heap[child].time) break;
+    heap[i] = heap[child];
+    jsiTimerHeapSetIndex(heap, i);
+    i = child;
+  }
+  heap[i] = e;
+  jsiTimerHeapSetIndex(heap, i);
+}
+
+/// Ensure the heap has space for 'count' timers, return false if we're out of memory
+static bool jsiTimerHeapReserve(unsigned int count) {
+  unsigned int capacity = 0;
+  if (timerHeap) jsiTimerHeapGetEntries(&capacity);
+  if (count <= capacity) return true;
+  capacity = capacity ? capacity*2 : 8;
+  if (capacity < count) capacity = count;
+  JsVar *heap = jsvNewFlatStringOfLength((unsigned int)(capacity*sizeof(JsiTimerHeapEntry)));
+  if (!heap) return false; // we can manage without - it's just slower
+  if (timerHeap)
+    memcpy(jsvGetFlatStringPointer(heap), jsiTimerHeapGetEntries(0), timerHeapCount*sizeof(JsiTimerHeapEntry));
+  jsvObjectSetChild(execInfo.hiddenRoot, JSI_TIMER_HEAP_NAME, heap);
+  timerHeap = jsvGetRef(heap);
+  jsvUnLock(heap);
+  return true;
+}
+
+/// Rebuild the heap from timerArray, return false if we're out of memory
+static bool jsiTimerHeapRebuild() {
+  JsVar *timerArrayPtr = jsvLock(timerArray);
+  unsigned int count = (unsigned int)jsvGetChildren(timerArrayPtr);
+  // reuse any existing heap if we can
+  JsVar *heap = jsvObjectGetChildIfExists(execInfo.hiddenRoot, JSI_TIMER_HEAP_NAME);
+  timerHeap = jsvIsFlatString(heap) ? jsvGetRef(heap) : 0;
+  jsvUnLock(heap);
+  timerHeapCount = 0;
+  if (!jsiTimerHeapReserve(count)) {
+    timerHeapValid = false;
+    jsvUnLock(timerArrayPtr);
+    return false;
+  }
+  JsiTimerHeapEntry *entries = timerHeap ? jsiTimerHeapGetEntries(0) : 0;
+  JsVarRef childRef = jsvGetFirstChild(timerArrayPtr);
+  bool ok = true;
+  while (ok && childRef && timerHeapCount<count) {
+    JsVar *child = jsvLock(childRef);
+    JsVar *timerPtr = jsvSkipName(child);
+    JsSysTime time = (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+    if (jsiTimerHeapSetEntry(&entries[timerHeapCount], child, time))
+      timerHeapCount++;
+    else
+      ok = false; // out of memory
+    childRef = jsvGetNextSibling(child);
+    jsvUnLock2(timerPtr, child);
+  }
+  jsvUnLock(timerArrayPtr);
+  timerHeapValid = ok;
+  if (!ok) return false;
+  for (unsigned int i=0;i<timerHeapCount;i++)
+    jsiTimerHeapSetIndex(entries, i);
+  for (unsigned int i=timerHeapCount/2;i>0;i--)
+    jsiTimerHeapSiftDown(entries, timerHeapCount, i-1);
+  return true;
+}
+
+/// Add a timer (by its name in timerArray) to the heap
+static void jsiTimerHeapAdd(JsVar *timerName, JsSysTime time) {
+  if (!timerHeapValid) return; // it'll get added when we rebuild
+  if (!jsiTimerHeapReserve(timerHeapCount+1)) {
+    timerHeapValid = false; // rebuild later
+    return;
+  }
+  JsiTimerHeapEntry *entries = jsiTimerHeapGetEntries(0);
+  if (!jsiTimerHeapSetEntry(&entries[timerHeapCount], timerName, time)) {
+    timerHeapValid = false; // rebuild later
+    return;
+  }
+  jsiTimerHeapSiftUp(entries, timerHeapCount++);
+}
+
+/// Remove the timer at the given index in the heap
+static void jsiTimerHeapRemoveAt(JsiTimerHeapEntry *entries, unsigned int i) {
+  timerHeapCount--;
+  if (i == timerHeapCount) return;
+  JsSysTime time = entries[i].time;
+  entries[i] = entries[timerHeapCount];
+  if (entries[i].time < time)
+    jsiTimerHeapSiftUp(entries, i);
+  else
+    jsiTimerHeapSiftDown(entries, timerHeapCount, i);
+}
+
+/// Find the index in the heap of the given timer, or -1
+static int jsiTimerHeapFind(JsVar *timerPtr) {
+  if (!timerHeapValid || !timerHeapCount) return -1;
+  JsiTimerHeapEntry *entries = jsiTimerHeapGetEntries(0);
+  JsVar *index = jsvObjectGetChildIfExists(timerPtr, JSI_TIMER_HEAP_INDEX_NAME);
+  JsVarInt i = jsvIsInt(index) ? jsvGetInteger(index) : -1;
+  jsvUnLock(index);
+  // check it really is this timer's entry
+  if (i>=0 && i<(JsVarInt)timerHeapCount && jsiTimerHeapIsEntryFor(&entries[i], timerPtr))
+    return (int)i;
+  // the index wasn't stored (out of memory) or the timer isn't in the heap - search
+  for (unsigned int j=0;j<timerHeapCount;j++)
+    if (jsiTimerHeapIsEntryFor(&entries[j], timerPtr)) return (int)j;
+  return -1;
+}
+
+/// Remove a timer (by its name in timerArray) from the heap
+static void jsiTimerHeapRemove(JsVar *timerName) {
+  if (!timerHeapValid || !timerHeapCount) return;
+  JsVar *timerPtr = jsvSkipName(timerName);
+  int i = timerPtr ? jsiTimerHeapFind(timerPtr) : -1;
+  jsvUnLock(timerPtr);
+  if (i>=0) jsiTimerHeapRemoveAt(jsiTimerHeapGetEntries(0), (unsigned int)i);
+}
+
+/// Return the (locked) name in timerArray of the next timer to fire, or 0 if there are none
+static JsVar *jsiTimerHeapGetNext(JsSysTime *time) {
+  if (!timerHeapValid && !jsiTimerHeapRebuild()) {
+    // Out of memory - just search all timers
+    JsVar *timerArrayPtr = jsvLock(timerArray);
+    JsVarRef bestRef = 0;
+    JsVarRef childRef = jsvGetFirstChild(timerArrayPtr);
+    while (childRef) {
+      JsVar *child = jsvLock(childRef);
+      JsVar *timerPtr = jsvSkipName(child);
+      JsSysTime t = (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+      if (!bestRef || t < *time) {
+        bestRef = childRef;
+        *time = t;
+      }
+      childRef = jsvGetNextSibling(child);
+      jsvUnLock2(timerPtr, child);
+    }
+    jsvUnLock(timerArrayPtr);
+    return bestRef ? jsvLock(bestRef) : 0;
+  }
+  if (!timerHeapCount) return 0;
+  JsiTimerHeapEntry *entries = jsiTimerHeapGetEntries(0);
+  *time = entries[0].time;
+  return jsvLock(entries[0].name);
+}
+
+/// Vars may have moved or lots of timers were removed - rebuild the heap when it's next needed
+void jsiTimerHeapInvalidate() {
+  timerHeapValid = false;
+}
+#endif
+
+/// Change the time until a timer that has already been added with jsiTimerAdd should fire (relative to jsiLastIdleTime)
+void jsiTimerChangeTime(JsVar *timerPtr, JsSysTime time) {
+  jsiTimerSetTime(timerPtr, time);
+#ifdef ESPR_TIMER_HEAP
+  int i = jsiTimerHeapFind(timerPtr);
+  if (i<0) return;
+  JsiTimerHeapEntry *entries = jsiTimerHeapGetEntries(0);
+  JsSysTime oldTime = entries[i].time;
+  entries[i].time = time+jsiTimerElapsed;
+  if (entries[i].time < oldTime)
+    jsiTimerHeapSiftUp(entries, (unsigned int)i);
+  else
+    jsiTimerHeapSiftDown(entries, timerHeapCount, (unsigned int)i);
+#endif
+}
+
+/// Remove a timer from timerArray, given its name in it
+void jsiTimerRemove(JsVar *timerName) {
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerHeapRemove(timerName);
+#endif
+  JsVar *timerArrayPtr = jsvLock(timerArray);
+  jsvRemoveChild(timerArrayPtr, timerName);
+  jsvUnLock(timerArrayPtr);
+}
+
 bool jsiHasTimers() {
   if (!timerArray) return false;
   JsVar *timerArrayPtr = jsvLock(timerArray);
@@ -1826,6 +2144,137 @@ bool jsiShouldExecuteWatch(JsVar *watchPtr, bool pinIsHigh) {
       (!pinIsHigh && watchEdge<0); // falling edge
 }
 
+#ifndef SAVE_ON_FLASH
+/// Counters for pin watches - see jsiGetWatchStats
+static struct {
+  uint32_t events;        ///< pin events handled
+  uint32_t checked;       ///< watches we had to check to find which ones those events were for
+  uint32_t callbacks;     ///< watch callbacks called straight from a pin event
+  JsSysTime lastLatency;  ///< time from the last pin event to its callback being called
+  JsSysTime maxLatency;   ///< longest time from a pin event to its callback being called
+  JsSysTime totalLatency; ///< total time from pin events to their callbacks being called
+} jsiWatchStats;
+
+static void jsiWatchStatsLatency(JsSysTime latency) {
+  jsiWatchStats.callbacks++;
+  jsiWatchStats.lastLatency = latency;
+  if (latency > jsiWatchStats.maxLatency) jsiWatchStats.maxLatency = latency;
+  jsiWatchStats.totalLatency += latency;
+}
+
+JsVar *jsiGetWatchStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+  jsvObjectSetChildAndUnLock(obj, "events", jsvNewFromLongInteger(jsiWatchStats.events));
+  jsvObjectSetChildAndUnLock(obj, "checked", jsvNewFromLongInteger(jsiWatchStats.checked));
+  jsvObjectSetChildAndUnLock(obj, "callbacks", jsvNewFromLongInteger(jsiWatchStats.callbacks));
+  jsvObjectSetChildAndUnLock(obj, "lastLatency", jsvNewFromFloat(jshGetMillisecondsFromTime(jsiWatchStats.lastLatency)));
+  jsvObjectSetChildAndUnLock(obj, "maxLatency", jsvNewFromFloat(jshGetMillisecondsFromTime(jsiWatchStats.maxLatency)));
+  jsvObjectSetChildAndUnLock(obj, "totalLatency", jsvNewFromFloat(jshGetMillisecondsFromTime(jsiWatchStats.totalLatency)));
+  return obj;
+}
+#endif
+
+#ifdef ESPR_WATCH_INDEX
+/* So we don't have to check every watch when a pin changes state, watches are
+ * also kept in a hidden array indexed by EXTI (the event a pin creates), each
+ * element of which is an array of the watches that could create that event.
+ * It holds the watch objects themselves so needs no fixing up if vars move.
+ * It is dropped when watches are cleared or loaded and rebuilt when next needed. */
+
+/// Return the EXTI event that the given (watched) pin creates, or EV_NONE
+static IOEventFlags jsiGetEventForWatchedPin(Pin pin) {
+  IOEvent event;
+  for (int exti=EV_EXTI0;exti<=EV_EXTI_MAX;exti++) {
+    event.flags = (IOEventFlags)exti;
+    if (jshIsEventForPin(&event, pin)) return (IOEventFlags)exti;
+  }
+  return EV_NONE;
+}
+
+/// Add a watch to the index (if the index exists)
+static void jsiWatchIndexAdd(JsVar *index, JsVar *watchPtr) {
+  IOEventFlags exti = jsiGetEventForWatchedPin(jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin")));
+  if (exti == EV_NONE) return;
+  JsVar *watches = jsvGetArrayItem(index, exti-EV_EXTI0);
+  if (!watches) {
+    watches = jsvNewEmptyArray();
+    jsvSetArrayItem(index, exti-EV_EXTI0, watches);
+  }
+  if (watches) jsvArrayPush(watches, watchPtr);
+  jsvUnLock(watches);
+}
+
+/// Return the (locked) array of watches that could have created the given EXTI event, or 0
+static JsVar *jsiWatchIndexGetWatches(IOEventFlags exti) {
+  JsVar *index = jsvObjectGetChildIfExists(execInfo.hiddenRoot, JSI_WATCH_INDEX_NAME);
+  if (!index) {
+    index = jsvNewEmptyArray();
+    if (!index) { // out of memory - just check all watches
+      jsErrorFlags &= ~JSERR_LOW_MEMORY;
+      return jsvLock(watchArray);
+    }
+    JsVar *watchArrayPtr = jsvLock(watchArray);
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, watchArrayPtr);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *watchPtr = jsvObjectIteratorGetValue(&it);
+      jsiWatchIndexAdd(index, watchPtr);
+      jsvUnLock(watchPtr);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(watchArrayPtr);
+    jsvObjectSetChild(execInfo.hiddenRoot, JSI_WATCH_INDEX_NAME, index);
+  }
+  JsVar *watches = jsvGetArrayItem(index, exti-EV_EXTI0);
+  jsvUnLock(index);
+  return watches;
+}
+
+/// Remove a watch from the index (if the index exists). Call before its pin is unwatched
+static void jsiWatchIndexRemove(JsVar *watchPtr) {
+  JsVar *index = jsvObjectGetChildIfExists(execInfo.hiddenRoot, JSI_WATCH_INDEX_NAME);
+  if (!index) return;
+  IOEventFlags exti = jsiGetEventForWatchedPin(jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin")));
+  JsVar *watches = (exti == EV_NONE) ? 0 : jsvGetArrayItem(index, exti-EV_EXTI0);
+  JsVar *watchNamePtr = watches ? jsvGetIndexOf(watches, watchPtr, true) : 0;
+  if (watchNamePtr)
+    jsvRemoveChildAndUnLock(watches, watchNamePtr);
+  jsvUnLock2(watches, index);
+}
+
+/// Watches have been removed or pins have been re-watched, so rebuild the index when it's next needed
+void jsiWatchIndexInvalidate() {
+  jsvObjectRemoveChild(execInfo.hiddenRoot, JSI_WATCH_INDEX_NAME);
+}
+#endif
+
+/// Add a new watch, return its ID (or -1 on failure)
+JsVarInt jsiWatchAdd(JsVar *watchPtr) {
+  JsVar *watchArrayPtr = jsvLock(watchArray);
+  JsVarInt itemIndex = jsvArrayAddToEnd(watchArrayPtr, watchPtr, 1) - 1;
+  jsvUnLock(watchArrayPtr);
+#ifdef ESPR_WATCH_INDEX
+  JsVar *index = jsvObjectGetChildIfExists(execInfo.hiddenRoot, JSI_WATCH_INDEX_NAME);
+  if (index && watchPtr && itemIndex>=0) jsiWatchIndexAdd(index, watchPtr);
+  jsvUnLock(index);
+#endif
+  return itemIndex;
+}
+
+/// Remove a watch, given its name in watchArray. Call before its pin is unwatched
+void jsiWatchRemove(JsVar *watchNamePtr) {
+#ifdef ESPR_WATCH_INDEX
+  JsVar *watchPtr = jsvSkipName(watchNamePtr);
+  jsiWatchIndexRemove(watchPtr);
+  jsvUnLock(watchPtr);
+#endif
+  JsVar *watchArrayPtr = jsvLock(watchArray);
+  jsvRemoveChild(watchArrayPtr, watchNamePtr);
+  jsvUnLock(watchArrayPtr);
+}
+
 bool jsiIsWatchingPin(Pin pin) {
   if (jshGetPinShouldStayWatched(pin))
     return true;
@@ -1905,6 +2354,193 @@ void jsiHandleIOEventForConsole(IOEvent *event) {
   jsiSetBusy(BUSY_INTERACTIVE, false);
 }
 
+/** Execute a timer that is due. timerTime (<=0) is when it should have
+ * fired relative to jsiLastIdleTime. Returns true if the timer should now be
+ * removed, or false if it is an interval (and timerTime has been updated) */
+static bool jsiExecuteTimer(JsVar *timerPtr, JsSysTime *timerTime) {
+  JsVar *timerCallback = jsvObjectGetChildIfExists(timerPtr, "callback");
+  JsVar *watchPtr = jsvObjectGetChildIfExists(timerPtr, "watch"); // for debounce - may be undefined
+  bool exec = true;
+  JsVar *data = 0;
+  if (watchPtr) {
+    bool watchState = jsvObjectGetBoolChild(watchPtr, "state");
+    bool timerState = jsvObjectGetBoolChild(timerPtr, "state");
+    jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(timerState));
+    exec = false;
+    if (watchState!=timerState) {
+      // Create the 'time' variable that will be passed to the user and stored as last time
+      JsVarInt delay = jsvObjectGetIntegerChild(watchPtr, "debounce");
+      JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(jsiLastIdleTime+*timerTime-delay)/1000);
+      // If it's the right edge...
+      if (jsiShouldExecuteWatch(watchPtr, timerState)) {
+        data = jsvNewObject();
+        // if we were from a watch then we were delayed by the debounce time...
+        if (data) {
+          exec = true;
+          // if it was a watch, set the last state up
+          jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(timerState));
+          // set up the lastTime variable of data to what was in the watch
+          jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
+          // set up the watches lastTime to this one
+          jsvObjectSetChild(data, "time", timePtr); // don't unlock - use this later
+          jsvObjectSetChildAndUnLock(data, "pin", jsvObjectGetChildIfExists(watchPtr, "pin"));
+        }
+      }
+      // Update lastTime regardless of which edge we're watching
+      jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
+    }
+  }
+  bool removeTimer = false;
+  if (exec) {
+    bool execResult;
+    if (data) {
+      execResult = jsiExecuteEventCallback(0, timerCallback, 1, &data);
+    } else {
+      JsVar *argsArray = jsvObjectGetChildIfExists(timerPtr, "args");
+      execResult = jsiExecuteEventCallbackArgsArray(0, timerCallback, argsArray);
+      jsvUnLock(argsArray);
+    }
+    if (!execResult) {
+      JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
+      if (interval) { // if interval then it's setInterval not setTimeout
+        jsvUnLock(interval);
+        jsError("Ctrl-C while processing interval - removing it.");
+        jsErrorFlags |= JSERR_CALLBACK;
+        removeTimer = true;
+      }
+    }
+  }
+  jsvUnLock(data);
+  if (watchPtr) { // if we had a watch pointer, be sure to remove us from it
+    jsvObjectRemoveChild(watchPtr, "timeout");
+    // Deal with non-recurring watches
+    if (exec) {
+      bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
+      if (!watchRecurring) {
+        JsVar *watchArrayPtr = jsvLock(watchArray);
+        JsVar *watchNamePtr = jsvGetIndexOf(watchArrayPtr, watchPtr, true);
+        jsvUnLock(watchArrayPtr);
+        if (watchNamePtr) {
+          jsiWatchRemove(watchNamePtr);
+          jsvUnLock(watchNamePtr);
+        }
+        Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
+        if (!jsiIsWatchingPin(pin))
+          jshPinWatch(pin, false, JSPW_NONE);
+      }
+    }
+    jsvUnLock(watchPtr);
+  }
+  // Load interval *after* executing code, in case it has changed
+  JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
+  if (!removeTimer && interval)
+    *timerTime = *timerTime + jsvGetLongInteger(interval);
+  else
+    removeTimer = true;
+  jsvUnLock2(timerCallback,interval);
+  return removeTimer;
+}
+
+/** Handle a pin event for the given watch. Returns true if the watch has
+ * been executed and isn't recurring, so should now be removed */
+static bool jsiExecuteWatch(IOEvent *event, JsVar *watchPtr, Pin pin) {
+  bool removeWatch = false;
+  /** Work out event time. Events time is only stored in 32 bits, so we need to
+   * use the correct 'high' 32 bits from the current time.
+   *
+   * We know that the current time is always newer than the event time, so
+   * if the bottom 32 bits of the current time is less than the bottom
+   * 32 bits of the event time, we need to subtract a full 32 bits worth
+   * from the current time.
+   */
+  JsSysTime time = jshGetSystemTime();
+  if (((unsigned int)time) < (unsigned int)event->data.time)
+    time = time - 0x100000000LL;
+  // finally, mask in the event's time
+  JsSysTime eventTime = (time & ~0xFFFFFFFFLL) | (JsSysTime)event->data.time;
+#ifndef SAVE_ON_FLASH
+  JsSysTime irqTime = eventTime;
+#endif
+
+  // Now actually process the event
+  bool pinIsHigh = (event->flags&EV_EXTI_IS_HIGH)!=0;
+
+  bool executeNow = false;
+  JsVarInt debounce = jsvObjectGetIntegerChild(watchPtr, "debounce");
+  if (debounce<=0) {
+    executeNow = true;
+  } else { // Debouncing - use timeouts to ensure we only fire at the right time
+    // store the current state of the pin
+    bool oldWatchState = jsvObjectGetBoolChild(watchPtr, "state");
+    JsVar *timeout = jsvObjectGetChildIfExists(watchPtr, "timeout");
+    if (timeout) { // if we had a timeout, update the callback time
+      JsSysTime timeoutTime = jsiLastIdleTime + jsiTimerGetTime(timeout);
+      jsiTimerChangeTime(timeout, (JsSysTime)(eventTime - jsiLastIdleTime) + debounce);
+      jsvObjectSetChildAndUnLock(timeout, "state", jsvNewFromBool(pinIsHigh));
+      if (eventTime > timeoutTime && pinIsHigh!=oldWatchState) {
+        // timeout should have fired, but we didn't get around to executing it!
+        // Do it now (with the old timeout time)
+        executeNow = true;
+        eventTime = timeoutTime - debounce;
+        jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(pinIsHigh));
+        // Remove the timeout
+        JsVar *idArr = jsvNewArray(&timeout, 1);
+        jswrap_interface_clearTimeout(idArr);
+        jsvUnLock(idArr);
+        jsvObjectRemoveChild(watchPtr, "timeout");
+      }
+    } else if (pinIsHigh!=oldWatchState) { // else create a new timeout
+      timeout = jsvNewObject();
+      if (timeout) {
+        jsvObjectSetChild(timeout, "watch", watchPtr); // no unlock
+        jsiTimerSetTime(timeout, (JsSysTime)(eventTime - jsiLastIdleTime) + debounce);
+        jsvObjectSetChildAndUnLock(timeout, "callback", jsvObjectGetChildIfExists(watchPtr, "callback"));
+        jsvObjectSetChildAndUnLock(timeout, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
+        jsvObjectSetChildAndUnLock(timeout, "pin", jsvNewFromPin(pin));
+        jsvObjectSetChildAndUnLock(timeout, "state", jsvNewFromBool(pinIsHigh));
+        // Add to timer array
+        jsiTimerAdd(timeout);
+        // Add to our watch
+        jsvObjectSetChild(watchPtr, "timeout", timeout); // no unlock
+      }
+    }
+    jsvUnLock(timeout);
+  }
+
+  // If we want to execute this watch right now...
+  if (executeNow) {
+    JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(eventTime)/1000);
+    if (jsiShouldExecuteWatch(watchPtr, pinIsHigh)) { // edge triggering
+      JsVar *watchCallback = jsvObjectGetChildIfExists(watchPtr, "callback");
+      bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
+      JsVar *data = jsvNewObject();
+      if (data) {
+        jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(pinIsHigh));
+        jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
+        // set both data.time, and watch.lastTime in one go
+        jsvObjectSetChild(data, "time", timePtr); // no unlock
+        jsvObjectSetChildAndUnLock(data, "pin", jsvNewFromPin(pin));
+        Pin dataPin = jshGetEventDataPin(IOEVENTFLAGS_GETTYPE(event->flags));
+        if (jshIsPinValid(dataPin))
+          jsvObjectSetChildAndUnLock(data, "data", jsvNewFromBool((event->flags&EV_EXTI_DATA_PIN_HIGH)!=0));
+      }
+#ifndef SAVE_ON_FLASH
+      jsiWatchStatsLatency(jshGetSystemTime() - irqTime);
+#endif
+      if (!jsiExecuteEventCallback(0, watchCallback, 1, &data) && watchRecurring) {
+        jsError("Ctrl-C while processing watch - removing it.");
+        jsErrorFlags |= JSERR_CALLBACK;
+        watchRecurring = false;
+      }
+      jsvUnLock(data);
+      removeWatch = !watchRecurring;
+      jsvUnLock(watchCallback);
+    }
+    jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
+  }
+  return removeWatch;
+}
+
 void jsiIdle() {
   // This is how many times we have been here and not done anything.
   // It will be zeroed if we do stuff later
@@ -1974,116 +2610,45 @@ void jsiIdle() {
 #endif
     } else if (DEVICE_IS_EXTI(eventType)) { // ---------------------------------------------------------------- PIN WATCH
       // we have an event... find out what it was for...
+#ifndef SAVE_ON_FLASH
+      jsiWatchStats.events++;
+#endif
+#ifdef ESPR_WATCH_INDEX
+      // Check just the watches on pins that could have caused this event
+      JsVar *watchArrayPtr = jsiWatchIndexGetWatches(eventType);
+#else
       // Check everything in our Watch array
       JsVar *watchArrayPtr = jsvLock(watchArray);
+#endif
       JsvObjectIterator it;
-      jsvObjectIteratorNew(&it, watchArrayPtr);
-      while (jsvObjectIteratorHasValue(&it)) {
+      if (watchArrayPtr) jsvObjectIteratorNew(&it, watchArrayPtr);
+      while (watchArrayPtr && jsvObjectIteratorHasValue(&it)) {
         bool hasDeletedWatch = false;
         JsVar *watchPtr = jsvObjectIteratorGetValue(&it);
         Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
-
-        if (jshIsEventForPin(&event, pin)) {
-          /** Work out event time. Events time is only stored in 32 bits, so we need to
-           * use the correct 'high' 32 bits from the current time.
-           *
-           * We know that the current time is always newer than the event time, so
-           * if the bottom 32 bits of the current time is less than the bottom
-           * 32 bits of the event time, we need to subtract a full 32 bits worth
-           * from the current time.
-           */
-          JsSysTime time = jshGetSystemTime();
-          if (((unsigned int)time) < (unsigned int)event.data.time)
-            time = time - 0x100000000LL;
-          // finally, mask in the event's time
-          JsSysTime eventTime = (time & ~0xFFFFFFFFLL) | (JsSysTime)event.data.time;
-
-          // Now actually process the event
-          bool pinIsHigh = (event.flags&EV_EXTI_IS_HIGH)!=0;
-
-          bool executeNow = false;
-          JsVarInt debounce = jsvObjectGetIntegerChild(watchPtr, "debounce");
-          if (debounce<=0) {
-            executeNow = true;
-          } else { // Debouncing - use timeouts to ensure we only fire at the right time
-            // store the current state of the pin
-            bool oldWatchState = jsvObjectGetBoolChild(watchPtr, "state");
-            JsVar *timeout = jsvObjectGetChildIfExists(watchPtr, "timeout");
-            if (timeout) { // if we had a timeout, update the callback time
-              JsSysTime timeoutTime = jsiLastIdleTime + (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timeout, "time"));
-              jsvUnLock(jsvObjectSetChild(timeout, "time", jsvNewFromLongInteger((JsSysTime)(eventTime - jsiLastIdleTime) + debounce)));
-              jsvObjectSetChildAndUnLock(timeout, "state", jsvNewFromBool(pinIsHigh));
-              if (eventTime > timeoutTime && pinIsHigh!=oldWatchState) {
-                // timeout should have fired, but we didn't get around to executing it!
-                // Do it now (with the old timeout time)
-                executeNow = true;
-                eventTime = timeoutTime - debounce;
-                jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(pinIsHigh));
-                // Remove the timeout
-                JsVar *idArr = jsvNewArray(&timeout, 1);
-                jswrap_interface_clearTimeout(idArr);
-                jsvUnLock(idArr);
-                jsvObjectRemoveChild(watchPtr, "timeout");
-              }
-            } else if (pinIsHigh!=oldWatchState) { // else create a new timeout
-              timeout = jsvNewObject();
-              if (timeout) {
-                jsvObjectSetChild(timeout, "watch", watchPtr); // no unlock
-                jsvObjectSetChildAndUnLock(timeout, "time", jsvNewFromLongInteger((JsSysTime)(eventTime - jsiLastIdleTime) + debounce));
-                jsvObjectSetChildAndUnLock(timeout, "callback", jsvObjectGetChildIfExists(watchPtr, "callback"));
-                jsvObjectSetChildAndUnLock(timeout, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
-                jsvObjectSetChildAndUnLock(timeout, "pin", jsvNewFromPin(pin));
-                jsvObjectSetChildAndUnLock(timeout, "state", jsvNewFromBool(pinIsHigh));
-                // Add to timer array
-                jsiTimerAdd(timeout);
-                // Add to our watch
-                jsvObjectSetChild(watchPtr, "timeout", timeout); // no unlock
-              }
-            }
-            jsvUnLock(timeout);
-          }
-
-          // If we want to execute this watch right now...
-          if (executeNow) {
-            JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(eventTime)/1000);
-            if (jsiShouldExecuteWatch(watchPtr, pinIsHigh)) { // edge triggering
-              JsVar *watchCallback = jsvObjectGetChildIfExists(watchPtr, "callback");
-              bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
-              JsVar *data = jsvNewObject();
-              if (data) {
-                jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(pinIsHigh));
-                jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
-                // set both data.time, and watch.lastTime in one go
-                jsvObjectSetChild(data, "time", timePtr); // no unlock
-                jsvObjectSetChildAndUnLock(data, "pin", jsvNewFromPin(pin));
-                Pin dataPin = jshGetEventDataPin(eventType);
-                if (jshIsPinValid(dataPin))
-                  jsvObjectSetChildAndUnLock(data, "data", jsvNewFromBool((event.flags&EV_EXTI_DATA_PIN_HIGH)!=0));
-              }
-              if (!jsiExecuteEventCallback(0, watchCallback, 1, &data) && watchRecurring) {
-                jsError("Ctrl-C while processing watch - removing it.");
-                jsErrorFlags |= JSERR_CALLBACK;
-                watchRecurring = false;
-              }
-              jsvUnLock(data);
-              if (!watchRecurring) {
-                // free all
-                jsvObjectIteratorRemoveAndGotoNext(&it, watchArrayPtr);
-                hasDeletedWatch = true;
-                if (!jsiIsWatchingPin(pin))
-                  jshPinWatch(pin, false, JSPW_NONE);
-              }
-              jsvUnLock(watchCallback);
-            }
-            jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
-          }
+#ifndef SAVE_ON_FLASH
+        jsiWatchStats.checked++;
+#endif
+        if (jshIsEventForPin(&event, pin) && jsiExecuteWatch(&event, watchPtr, pin)) {
+          // free all
+          jsvObjectIteratorRemoveAndGotoNext(&it, watchArrayPtr);
+          hasDeletedWatch = true;
+#ifdef ESPR_WATCH_INDEX
+          // we were iterating over the index, so remove from watchArray too
+          JsVar *allWatchesPtr = jsvLock(watchArray);
+          JsVar *watchNamePtr = jsvGetIndexOf(allWatchesPtr, watchPtr, true);
+          if (watchNamePtr)
+            jsvRemoveChildAndUnLock(allWatchesPtr, watchNamePtr);
+          jsvUnLock(allWatchesPtr);
+#endif
+          if (!jsiIsWatchingPin(pin))
+            jshPinWatch(pin, false, JSPW_NONE);
         }
-
         jsvUnLock(watchPtr);
         if (!hasDeletedWatch)
           jsvObjectIteratorNext(&it);
       }
-      jsvObjectIteratorFree(&it);
+      if (watchArrayPtr) jsvObjectIteratorFree(&it);
       jsvUnLock(watchArrayPtr);
     }
   }
@@ -2106,6 +2671,50 @@ void jsiIdle() {
     jsiTimeSinceCtrlC = 0xFFFFFFFF;
 #endif
 
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerElapsed += timePassed;
+  /* Run timers that are due in order. Only run as many as we had when we
+   * started, so an interval that is still due after running isn't run again
+   * before we go around the idle loop. */
+  int timersToRun = -1;
+  JsSysTime timerTime;
+  JsVar *timerName;
+  jsiStatus = jsiStatus & ~JSIS_TIMERS_CHANGED;
+  while ((timerName = jsiTimerHeapGetNext(&timerTime))) {
+    timerTime -= jsiTimerElapsed;
+    if (timerTime<=0 && timersToRun<0) {
+      if (timerHeapValid) {
+        timersToRun = (int)timerHeapCount;
+      } else {
+        JsVar *timerArrayPtr = jsvLock(timerArray);
+        timersToRun = jsvGetChildren(timerArrayPtr);
+        jsvUnLock(timerArrayPtr);
+      }
+    }
+    if (timerTime>0 || !timersToRun--) {
+      jsvUnLock(timerName);
+      if (timerTime < minTimeUntilNext)
+        minTimeUntilNext = timerTime>0 ? timerTime : 0;
+      break;
+    }
+    // we're now doing work
+    jsiSetBusy(BUSY_INTERACTIVE, true);
+    wasBusy = true;
+    JsVar *timerPtr = jsvSkipName(timerName);
+    jsiTimerHeapRemove(timerName);
+    bool removeTimer = jsiExecuteTimer(timerPtr, &timerTime);
+    // If the timer was cleared while running it isn't in timerArray any more
+    if (jsvGetRefs(timerName)) {
+      if (removeTimer) {
+        jsiTimerRemove(timerName);
+      } else {
+        jsiTimerSetTime(timerPtr, timerTime);
+        jsiTimerHeapAdd(timerName, timerTime+jsiTimerElapsed);
+      }
+    }
+    jsvUnLock2(timerPtr, timerName);
+  }
+#else
   JsVar *timerArrayPtr = jsvLock(timerArray);
   JsvObjectIterator it;
   // Go through all intervals and decrement time
@@ -2131,91 +2740,15 @@ void jsiIdle() {
         // we're now doing work
         jsiSetBusy(BUSY_INTERACTIVE, true);
         wasBusy = true;
-        JsVar *timerCallback = jsvObjectGetChildIfExists(timerPtr, "callback");
-        JsVar *watchPtr = jsvObjectGetChildIfExists(timerPtr, "watch"); // for debounce - may be undefined
-        bool exec = true;
-        JsVar *data = 0;
-        if (watchPtr) {
-          bool watchState = jsvObjectGetBoolChild(watchPtr, "state");
-          bool timerState = jsvObjectGetBoolChild(timerPtr, "state");
-          jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(timerState));
-          exec = false;
-          if (watchState!=timerState) {
-            // Create the 'time' variable that will be passed to the user and stored as last time
-            JsVarInt delay = jsvObjectGetIntegerChild(watchPtr, "debounce");
-            JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(jsiLastIdleTime+timerTime-delay)/1000);
-            // If it's the right edge...
-            if (jsiShouldExecuteWatch(watchPtr, timerState)) {
-              data = jsvNewObject();
-              // if we were from a watch then we were delayed by the debounce time...
-              if (data) {
-                exec = true;
-                // if it was a watch, set the last state up
-                jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(timerState));
-                // set up the lastTime variable of data to what was in the watch
-                jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
-                // set up the watches lastTime to this one
-                jsvObjectSetChild(data, "time", timePtr); // don't unlock - use this later
-                jsvObjectSetChildAndUnLock(data, "pin", jsvObjectGetChildIfExists(watchPtr, "pin"));
-              }
-            }
-            // Update lastTime regardless of which edge we're watching
-            jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
-          }
-        }
-        bool removeTimer = false;
-        if (exec) {
-          bool execResult;
-          if (data) {
-            execResult = jsiExecuteEventCallback(0, timerCallback, 1, &data);
-          } else {
-            JsVar *argsArray = jsvObjectGetChildIfExists(timerPtr, "args");
-            execResult = jsiExecuteEventCallbackArgsArray(0, timerCallback, argsArray);
-            jsvUnLock(argsArray);
-          }
-          if (!execResult) {
-            JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
-            if (interval) { // if interval then it's setInterval not setTimeout
-              jsvUnLock(interval);
-              jsError("Ctrl-C while processing interval - removing it.");
-              jsErrorFlags |= JSERR_CALLBACK;
-              removeTimer = true;
-            }
-          }
-        }
-        jsvUnLock(data);
-        if (watchPtr) { // if we had a watch pointer, be sure to remove us from it
-          jsvObjectRemoveChild(watchPtr, "timeout");
-          // Deal with non-recurring watches
-          if (exec) {
-            bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
-            if (!watchRecurring) {
-              JsVar *watchArrayPtr = jsvLock(watchArray);
-              JsVar *watchNamePtr = jsvGetIndexOf(watchArrayPtr, watchPtr, true);
-              if (watchNamePtr) {
-                jsvRemoveChildAndUnLock(watchArrayPtr, watchNamePtr);
-              }
-              jsvUnLock(watchArrayPtr);
-              Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
-              if (!jsiIsWatchingPin(pin))
-                jshPinWatch(pin, false, JSPW_NONE);
-            }
-          }
-          jsvUnLock(watchPtr);
-        }
-        // Load interval *after* executing code, in case it has changed
-        JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
-        if (!removeTimer && interval) {
-          timerTime = timerTime + jsvGetLongInteger(interval);
-          jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(timerTime));
-        } else {
+        if (jsiExecuteTimer(timerPtr, &timerTime)) {
           // free
           // Beware... may have already been removed!
           jsvObjectIteratorRemoveAndGotoNext(&it, timerArrayPtr);
           hasDeletedTimer = true;
           timerTime = -1;
+        } else {
+          jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(timerTime));
         }
-        jsvUnLock2(timerCallback,interval);
       }
       // update the time until the next timer
       if (timerTime>=0 && timerTime < minTimeUntilNext)
@@ -2228,6 +2761,7 @@ void jsiIdle() {
     jsvObjectIteratorFree(&it);
   } while (jsiStatus & JSIS_TIMERS_CHANGED);
   jsvUnLock(timerArrayPtr);
+#endif
   /* We might have left the timers loop with stuff to do because the contents of it
    * changed. It's not a big deal because it could only have changed because a timer
    * got executed - so `wasBusy` got set and we know we're going to go around the
@@ -2237,6 +2771,17 @@ void jsiIdle() {
   // Check for events that might need to be processed from other libraries
   if (jswIdle()) wasBusy = true;
 
+  // Make sure we wake up for anything that asked with jsiWakeAt
+  if (jsiWakeTime) {
+    JsSysTime timeUntilWake = jsiWakeTime - jshGetSystemTime();
+    if (timeUntilWake <= 0) { // go around again now - whatever asked will ask again if it needs to
+      jsiWakeTime = 0;
+      timeUntilWake = 0;
+    }
+    if (timeUntilWake < minTimeUntilNext)
+      minTimeUntilNext = timeUntilWake;
+  }
+
   // Just in case we got any events to do and didn't clear loopsIdling before
   if (wasBusy || !jsvArrayIsEmpty(events) )
     loopsIdling = 0;
@@ -2312,6 +2857,17 @@ void jsiIdle() {
   if (jsiStatus & JSIS_WATCHDOG_AUTO)
     jshKickWatchDog();
 
+#ifdef ESPR_GC_INCREMENTAL
+  /* Garbage collect a bit at a time, so we don't hold up events. Once a
+   * collection is started, continue it each time around the idle loop */
+  if (jsvGarbageCollectInProgress() ||
+      (loopsIdling==1 && !jsvMoreFreeVariablesThan(JS_VARS_BEFORE_IDLE_GC))) {
+    jsiSetBusy(BUSY_INTERACTIVE, true);
+    jsvGarbageCollectStep(JSV_GC_STEP_BUDGET);
+    jsiSetBusy(BUSY_INTERACTIVE, false);
+    return;
+  }
+#else
   /* if we've been around this loop, there is nothing to do, and
    * we have a spare 10ms then let's do some Garbage Collection
    * if we think we need to */
@@ -2326,6 +2882,15 @@ void jsiIdle() {
      * then we'll sleep. */
     return;
   }
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  /* If Storage is getting full of trash, compact a few pages at a time. Once
+   * started, continue each time around the idle loop */
+  jsiSetBusy(BUSY_INTERACTIVE, true);
+  bool compacted = jsfCompactIdle(loopsIdling>=1);
+  jsiSetBusy(BUSY_INTERACTIVE, false);
+  if (compacted) return;
+#endif
 
   // Go to sleep!
   if (loopsIdling>=1 && // once around the idle loop without having done any work already (just in case)
@@ -2450,7 +3015,7 @@ void jsiDumpState(vcbprintf_callback user_callback, void *user_data) {
     JsVar *timerInterval = jsvObjectGetChildIfExists(timer, "interval");
     user_callback(timerInterval ? "setInterval(" : "setTimeout(", user_data);
     jsiDumpJSON(user_callback, user_data, timerCallback, 0);
-    cbprintf(user_callback, user_data, ", %f); // %v\n", jshGetMillisecondsFromTime(timerInterval ? jsvGetLongInteger(timerInterval) : jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timer, "time"))), timerNumber);
+    cbprintf(user_callback, user_data, ", %f); // %v\n", jshGetMillisecondsFromTime(timerInterval ? jsvGetLongInteger(timerInterval) : jsiTimerGetTime(timer)), timerNumber);
     jsvUnLock3(timerInterval, timerCallback, timerNumber);
     // next
     jsvUnLock(timer);
@@ -2498,6 +3063,13 @@ void jsiDumpState(vcbprintf_callback user_callback, void *user_data) {
 JsVarInt jsiTimerAdd(JsVar *timerPtr) {
   JsVar *timerArrayPtr = jsvLock(timerArray);
   JsVarInt itemIndex = jsvArrayAddToEnd(timerArrayPtr, timerPtr, 1) - 1;
+#ifdef ESPR_TIMER_HEAP
+  if (itemIndex>=0) {
+    JsVar *timerName = jsvLock(jsvGetLastChild(timerArrayPtr));
+    jsiTimerHeapAdd(timerName, (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time")));
+    jsvUnLock(timerName);
+  }
+#endif
   jsvUnLock(timerArrayPtr);
   return itemIndex;
 }
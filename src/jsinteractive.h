@@ -18,7 +18,10 @@
 #include "jshardware.h"
 
 #define JSI_WATCHES_NAME "watches"
+#define JSI_WATCH_INDEX_NAME "wtchidx" ///< used with ESPR_WATCH_INDEX to find watches by the event their pin creates
 #define JSI_TIMERS_NAME "timers"
+#define JSI_TIMER_HEAP_NAME "tmrheap" ///< used with ESPR_TIMER_HEAP to store timers in the order they fire
+#define JSI_TIMER_HEAP_INDEX_NAME JS_HIDDEN_CHAR_STR"hpi" ///< used with ESPR_TIMER_HEAP - a timer's index in the heap
 #define JSI_DEBUG_HISTORY_NAME "dbghist"
 #define JSI_HISTORY_NAME "history"
 #define JSI_INIT_CODE_NAME "init" ///< used to temporarily store initialisation JS code for state in save()
@@ -65,6 +68,10 @@ bool jsiExecuteEventCallbackOn(const char *objectName, const char *cbName, unsig
 /// Create a timeout in JS to execute the given native function (outside of an IRQ). Returns the index
 JsVar *jsiSetTimeout(void (*functionPtr)(void), JsVarFloat milliseconds);
 
+/** Make sure the idle loop runs again by the given system time. Unlike jsiSetTimeout this isn't a JS
+ * timer, so it can't be seen or cleared from JS and it doesn't keep us running if there's nothing else to do */
+void jsiWakeAt(JsSysTime time);
+
 IOEventFlags jsiGetDeviceFromClass(JsVar *deviceClass);
 JsVar *jsiGetClassNameFromDevice(IOEventFlags device);
 
@@ -186,7 +193,22 @@ extern JsVarRef timerArray; // Linked List of timers to check and run
 extern JsVarRef watchArray; // Linked List of input watches to check and run
 
 extern JsVarInt jsiTimerAdd(JsVar *timerPtr);
+extern JsSysTime jsiTimerGetTime(JsVar *timerPtr); ///< Get the time until the timer fires (relative to jsiLastIdleTime)
+extern void jsiTimerSetTime(JsVar *timerPtr, JsSysTime time); ///< Set the time until a timer fires, before it is added with jsiTimerAdd
+extern void jsiTimerChangeTime(JsVar *timerPtr, JsSysTime time); ///< Change the time until a timer that has been added fires
+extern void jsiTimerRemove(JsVar *timerName); ///< Remove a timer, given its name in timerArray
+#ifdef ESPR_TIMER_HEAP
+extern void jsiTimerHeapInvalidate(); ///< Vars have moved or many timers were removed, so rebuild the timer heap when needed
+#endif
 extern void jsiTimersChanged(); // Flag timers changed so we can skip out of the loop if needed
+extern JsVarInt jsiWatchAdd(JsVar *watchPtr); ///< Add a new watch, return its ID (or -1 on failure)
+extern void jsiWatchRemove(JsVar *watchNamePtr); ///< Remove a watch, given its name in watchArray. Call before its pin is unwatched
+#ifdef ESPR_WATCH_INDEX
+extern void jsiWatchIndexInvalidate(); ///< Watches were removed or re-watched, so rebuild the watch index when needed
+#endif
+#ifndef SAVE_ON_FLASH
+extern JsVar *jsiGetWatchStats(); ///< Return an object containing statistics for pin watches
+#endif
 // end for jswrap_interactive/io.c ------------------------------------------------
 
 #ifdef USE_DEBUGGER
@@ -923,6 +923,10 @@ void jslInit(JsVar *var) {
   lex->tokenValue = 0;
 #ifndef ESPR_NO_LINE_NUMBERS
   lex->lineNumberOffset = 0;
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+  lex->untokenisedVar = 0;
+  lex->tokenMap = 0;
 #endif
   // set up iterator
   jsvStringIteratorNew(&lex->it, lex->sourceVar, 0);
@@ -938,6 +942,9 @@ void jslKill() {
     jsvUnLock(lex->tokenValue);
     lex->tokenValue = 0;
   }
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+  jsvUnLock2(lex->untokenisedVar, lex->tokenMap);
+#endif
   jsvUnLock(lex->sourceVar);
 }
 
@@ -1185,8 +1192,41 @@ static bool jslPreserveSpaceBetweenTokens(int lastTk, int newTk) {
   return false;
 }
 
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+/* Function code tokenised at runtime has a map from positions in the tokenised code back to
+ * the original code, so we can report errors (and copy nested functions) from the original.
+ * It's a string of (tokenised position, original position) pairs of uint32 for a token every
+ * JSLEX_TOKEN_MAP_INTERVAL bytes of tokenised code - to find any other token we lex the
+ * original code again from the entry before it. */
+#define JSLEX_TOKEN_MAP_INTERVAL 256
+#define JSLEX_TOKEN_MAP_ENTRY_SIZE (2*sizeof(uint32_t))
+
+typedef struct {
+  JsvStringIterator *it; ///< If set, write map entries here
+  size_t entries; ///< The number of entries (that would have been) written
+  size_t nextEntry; ///< The tokenised position after which we add the next entry
+  size_t offset; ///< The tokenised position of charFrom
+  size_t findPos; ///< If not SIZE_MAX, stop at the token at this tokenised position...
+  size_t foundStart, foundEnd; ///< ...and set the original position of its start and end
+} JslTokenMap;
+
+static void jslTokenMapWrite(JsvStringIterator *it, uint32_t v) {
+  for (int i=0;i<4;i++)
+    jsvStringIteratorSetCharAndNext(it, (char)(v>>(i*8)));
+}
+
+static uint32_t jslTokenMapRead(JsvStringIterator *it) {
+  uint32_t v = 0;
+  for (int i=0;i<4;i++)
+    v |= ((uint32_t)(unsigned char)jsvStringIteratorGetCharAndNext(it)) << (i*8);
+  return v;
+}
+#else
+typedef void JslTokenMap;
+#endif
+
 /// Tokenise a String - if dstit==0, just return the length (so we can preallocate a flat string)
-static size_t _jslNewTokenisedStringFromLexer(JsvStringIterator *dstit, JsVar *dstVar, JslCharPos *charFrom, size_t charTo) {
+static size_t _jslNewTokenisedStringFromLexer(JsvStringIterator *dstit, JsVar *dstVar, JslCharPos *charFrom, size_t charTo, JslTokenMap *map) {
   jslSeekToP(charFrom);
   JsvStringIterator it;
   char itch = charFrom->currCh;
@@ -1200,6 +1240,25 @@ static size_t _jslNewTokenisedStringFromLexer(JsvStringIterator *dstit, JsVar *d
       length++;
       if (dstit) jsvStringIteratorSetCharAndNext(dstit, ' ');
     }
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+    if (map) {
+      size_t pos = map->offset + length;
+      if (pos >= map->findPos) {
+        map->foundStart = lex->tokenStart;
+        map->foundEnd = jsvStringIteratorGetIndex(&lex->it)-1;
+        break;
+      }
+      // don't add an entry in the middle of `atob("...")` as we'd tokenise it differently from there
+      if (pos >= map->nextEntry && !atobChecker) {
+        if (map->it) {
+          jslTokenMapWrite(map->it, (uint32_t)pos);
+          jslTokenMapWrite(map->it, (uint32_t)lex->tokenStart);
+        }
+        map->entries++;
+        map->nextEntry = pos + JSLEX_TOKEN_MAP_INTERVAL;
+      }
+    }
+#endif
     size_t l;
     if (lex->tk==LEX_STR && ((l = jslGetTokenLength())!=0)
 #ifdef ESPR_UNICODE_SUPPORT
@@ -1288,13 +1347,13 @@ JsVar *jslNewTokenisedStringFromLexer(JslCharPos *charFrom, size_t charTo) {
   lex = &newLex;
   // work out length
   jslInit(oldLex->sourceVar);
-  size_t length = _jslNewTokenisedStringFromLexer(NULL, NULL, charFrom, charTo);
+  size_t length = _jslNewTokenisedStringFromLexer(NULL, NULL, charFrom, charTo, NULL);
   // Try and create a flat string first
   JsVar *var = jsvNewStringOfLength((unsigned int)length, NULL);
   if (var) { // if not out of memory, fill in new string
     JsvStringIterator dstit;
     jsvStringIteratorNew(&dstit, var, 0);
-    _jslNewTokenisedStringFromLexer(&dstit, var, charFrom, charTo);
+    _jslNewTokenisedStringFromLexer(&dstit, var, charFrom, charTo, NULL);
     jsvStringIteratorFree(&dstit);
   }
   // restore lex
@@ -1304,8 +1363,90 @@ JsVar *jslNewTokenisedStringFromLexer(JslCharPos *charFrom, size_t charTo) {
   return var;
 }
 
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+JsVar *jslNewTokenisedStringWithMap(JsVar *code, JsVar **mapVar) {
+  JsLex *oldLex = lex;
+  JsLex newLex;
+  lex = &newLex;
+  jslInit(code);
+  size_t codeLength = jsvGetStringLength(code);
+  JslCharPos charFrom;
+  jslCharPosNew(&charFrom, code, 0);
+  // work out the length, and how many map entries we need
+  JslTokenMap map;
+  memset(&map, 0, sizeof(map));
+  map.findPos = SIZE_MAX;
+  size_t length = _jslNewTokenisedStringFromLexer(NULL, NULL, &charFrom, codeLength, &map);
+  *mapVar = 0;
+  JsVar *var = jsvNewStringOfLength((unsigned int)length, NULL);
+  if (var) { // if not out of memory, fill in new string
+    *mapVar = jsvNewStringOfLength((unsigned int)(map.entries*JSLEX_TOKEN_MAP_ENTRY_SIZE), NULL);
+    JsvStringIterator dstit, mapit;
+    jsvStringIteratorNew(&dstit, var, 0);
+    if (*mapVar) jsvStringIteratorNew(&mapit, *mapVar, 0);
+    map.it = &mapit;
+    map.entries = 0;
+    map.nextEntry = 0;
+    _jslNewTokenisedStringFromLexer(&dstit, var, &charFrom, codeLength, *mapVar ? &map : NULL);
+    jsvStringIteratorFree(&dstit);
+    if (*mapVar) jsvStringIteratorFree(&mapit);
+  }
+  jslCharPosFree(&charFrom);
+  jslKill();
+  lex = oldLex;
+  return var;
+}
+
+size_t jslGetUntokenisedPosition(size_t tokenPos, size_t *tokenEnd) {
+  JslTokenMap map;
+  memset(&map, 0, sizeof(map));
+  map.findPos = tokenPos;
+  map.foundStart = map.foundEnd = jsvGetStringLength(lex->untokenisedVar);
+  // start from the last entry in the map before tokenPos (or the start)
+  size_t from = 0;
+  if (lex->tokenMap) {
+    JsvStringIterator it;
+    jsvStringIteratorNew(&it, lex->tokenMap, 0);
+    while (jsvStringIteratorHasChar(&it)) {
+      size_t entryPos = jslTokenMapRead(&it);
+      size_t entryFrom = jslTokenMapRead(&it);
+      if (entryPos > tokenPos) break;
+      map.offset = entryPos;
+      from = entryFrom;
+    }
+    jsvStringIteratorFree(&it);
+  }
+  // then lex the original code until we get to the token at tokenPos
+  JsLex *oldLex = lex;
+  JsLex newLex;
+  lex = &newLex;
+  jslInit(oldLex->untokenisedVar);
+  JslCharPos charFrom;
+  jslCharPosNew(&charFrom, lex->sourceVar, from);
+  _jslNewTokenisedStringFromLexer(NULL, NULL, &charFrom, map.foundStart, &map);
+  jslCharPosFree(&charFrom);
+  jslKill();
+  lex = oldLex;
+  if (tokenEnd) *tokenEnd = map.foundEnd;
+  return map.foundStart;
+}
+#endif
+
 #endif // ESPR_NO_PRETOKENISE
 
+/// Get the code that tokenPos refers to - if we're running tokenised code, update tokenPos to be in the original code
+static JsVar *jslGetSourceForPosition(size_t *tokenPos) {
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+  if (lex->untokenisedVar) {
+    *tokenPos = jslGetUntokenisedPosition(*tokenPos, NULL);
+    return lex->untokenisedVar;
+  }
+#else
+  NOT_USED(tokenPos);
+#endif
+  return lex->sourceVar;
+}
+
 JsVar *jslNewStringFromLexer(JslCharPos *charFrom, size_t charTo) {
   // Original method - just copy it verbatim
   size_t maxLength = charTo + 1 - jsvStringIteratorGetIndex(&charFrom->it);
@@ -1372,7 +1513,9 @@ JsVar *jslNewStringFromLexer(JslCharPos *charFrom, size_t charTo) {
 unsigned int jslGetLineNumber() {
   size_t line;
   size_t col;
-  jsvGetLineAndCol(lex->sourceVar, lex->tokenStart, &line, &col);
+  size_t tokenPos = lex->tokenStart;
+  JsVar *sourceVar = jslGetSourceForPosition(&tokenPos);
+  jsvGetLineAndCol(sourceVar, tokenPos, &line, &col);
   return (unsigned int)line;
 }
 
@@ -1449,7 +1592,8 @@ void jslPrintPosition(vcbprintf_callback user_callback, void *user_data, size_t
     }
   }
 #endif
-  jsvGetLineAndCol(lex->sourceVar, tokenPos, &line, &col);
+  JsVar *sourceVar = jslGetSourceForPosition(&tokenPos);
+  jsvGetLineAndCol(sourceVar, tokenPos, &line, &col);
 #ifndef ESPR_NO_LINE_NUMBERS
   if (lex->lineNumberOffset)
     line += (size_t)lex->lineNumberOffset - 1;
@@ -1459,9 +1603,10 @@ void jslPrintPosition(vcbprintf_callback user_callback, void *user_data, size_t
 
 void jslPrintTokenLineMarker(vcbprintf_callback user_callback, void *user_data, size_t tokenPos, char *prefix) {
   size_t line = 1,col = 1;
-  jsvGetLineAndCol(lex->sourceVar, tokenPos, &line, &col);
-  size_t startOfLine = jsvGetIndexFromLineAndCol(lex->sourceVar, line, 1);
-  size_t lineLength = jsvGetCharsOnLine(lex->sourceVar, line);
+  JsVar *sourceVar = jslGetSourceForPosition(&tokenPos);
+  jsvGetLineAndCol(sourceVar, tokenPos, &line, &col);
+  size_t startOfLine = jsvGetIndexFromLineAndCol(sourceVar, line, 1);
+  size_t lineLength = jsvGetCharsOnLine(sourceVar, line);
   size_t prefixLength = 0;
 
   if (prefix) {
@@ -1483,7 +1628,7 @@ void jslPrintTokenLineMarker(vcbprintf_callback user_callback, void *user_data,
   // print the string until the end of the line, or 60 chars (whichever is less)
   size_t chars = 0;
   JsvStringIterator it;
-  jsvStringIteratorNew(&it, lex->sourceVar, startOfLine);
+  jsvStringIteratorNew(&it, sourceVar, startOfLine);
   unsigned char lastch = 0;
   while (jsvStringIteratorHasChar(&it) && chars<60 && lastch!=255) {
     if (jsvStringIteratorGetChar(&it) == '\n') break;
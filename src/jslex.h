@@ -170,6 +170,10 @@ typedef struct JsLex
    */
   JsVar *sourceVar; // the actual string var
   JsvStringIterator it; // Iterator for the string
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+  JsVar *untokenisedVar; ///< If sourceVar is function code that was tokenised when first called, the original code (for error positions)
+  JsVar *tokenMap; ///< If untokenisedVar is set, a map of positions in sourceVar to positions in it (may be 0). See jslNewTokenisedStringWithMap
+#endif
 } JsLex;
 
 // The lexer
@@ -210,6 +214,14 @@ JsVar *jslNewStringFromLexer(JslCharPos *charFrom, size_t charTo);
 JsVar *jslNewTokenisedStringFromLexer(JslCharPos *charFrom, size_t charTo);
 #endif
 
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+/// Tokenise all of 'code', and also set 'map' to a map of positions in the result back to positions in 'code' (or 0 if out of memory)
+JsVar *jslNewTokenisedStringWithMap(JsVar *code, JsVar **map);
+/** If we're running tokenised function code (lex->untokenisedVar is set), return the position in the
+ * original code of the token at tokenPos, and set tokenEnd (if not 0) to the position just after it */
+size_t jslGetUntokenisedPosition(size_t tokenPos, size_t *tokenEnd);
+#endif
+
 /// Return the line number at the current character position (this isn't fast as it searches the string)
 unsigned int jslGetLineNumber();
 
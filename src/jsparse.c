@@ -83,9 +83,54 @@ void jspSetError(bool lineReported) {
 bool jspHasError() {
   return JSP_HAS_ERROR;
 }
+#ifdef ESPR_SCOPE_SLOTS
+/* Slots for identifiers in the current scope. The first time an identifier at a given
+ * lexer position is found in the topmost scope (a function's locals and arguments, a
+ * block's let/const, or the root for code outside functions) the name is remembered
+ * against that scope, so the next lookup from the same place is just an indexed access.
+ * Variables found further down the scope chain (eg. captured by a closure) always use
+ * the normal named lookup.
+ *
+ * An entry is valid until its scope is removed from the scope list (when slots for it are
+ * forgotten) or a name is removed from any scope (when jsvScopeNameRemovedEpoch changes),
+ * as the name's var may then have been freed and reused. */
+#define JSP_SCOPE_SLOTS 64 // POWER OF 2
+typedef struct {
+  uint32_t site;     ///< lexer position of the identifier
+  uint32_t nameHash; ///< hash of the identifier
+  uint32_t epoch;    ///< jsvScopeNameRemovedEpoch when filled in
+  JsVarRef scope;    ///< the scope the name was found in (0 = unused)
+  JsVarRef child;    ///< the name in 'scope'
+} JspScopeSlot;
+static JspScopeSlot jspScopeSlots[JSP_SCOPE_SLOTS];
+static uint32_t jspScopeSlotHits, jspScopeSlotMisses;
+
+/// Forget all slots in the given scope (or all slots if scope==0) as it is no longer on the scope list
+static void jspeiForgetScopeSlots(JsVarRef scope) {
+  for (int i=0;i<JSP_SCOPE_SLOTS;i++)
+    if (!scope || jspScopeSlots[i].scope==scope)
+      jspScopeSlots[i].scope = 0;
+}
+
+void jspVarsMoved() {
+  jspeiForgetScopeSlots(0);
+}
+
+JsVar *jspGetScopeSlotStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+  jsvObjectSetChildAndUnLock(obj, "hits", jsvNewFromLongInteger(jspScopeSlotHits));
+  jsvObjectSetChildAndUnLock(obj, "misses", jsvNewFromLongInteger(jspScopeSlotMisses));
+  return obj;
+}
+#endif
+
 void jspeiClearScopes() {
   jsvUnLock(execInfo.scopesVar);
   execInfo.scopesVar = 0;
+#ifdef ESPR_SCOPE_SLOTS
+  jspeiForgetScopeSlots(0);
+#endif
 }
 
 bool jspeiAddScope(JsVar *scope) {
@@ -104,7 +149,13 @@ void jspeiRemoveScope() {
     //jspSetError(false);
     return;
   }
+#ifdef ESPR_SCOPE_SLOTS
+  JsVar *scopeName = jsvArrayPop(execInfo.scopesVar);
+  jspeiForgetScopeSlots(jsvGetFirstChild(scopeName));
+  jsvUnLock(scopeName);
+#else
   jsvUnLock(jsvArrayPop(execInfo.scopesVar));
+#endif
   if (!jsvGetFirstChild(execInfo.scopesVar)) {
     jsvUnLock(execInfo.scopesVar);
     execInfo.scopesVar = 0;
@@ -125,6 +176,48 @@ JsVar *jspeiFindInScopes(const char *name) {
   }
   return jsvFindChildFromString(execInfo.root, name);
 }
+
+#ifdef ESPR_SCOPE_SLOTS
+/// jspeiFindInScopes, but using jspScopeSlots for names in the topmost scope
+static JsVar *jspeiFindInScopesCached(const char *name) {
+  uint32_t nameHash = 5381;
+  const char *n = name;
+  while (*n) nameHash = nameHash*33 + (unsigned char)*(n++);
+  size_t nameLen = (size_t)(n-name);
+  uint32_t site = lex ? ((uint32_t)jsvGetRef(lex->sourceVar)*31 + (uint32_t)lex->tokenStart) : 0;
+  JspScopeSlot *slot = &jspScopeSlots[(site ^ nameHash) & (JSP_SCOPE_SLOTS-1)];
+  // the topmost scope
+  JsVarRef scopeRef = jsvGetRef(execInfo.root);
+  if (execInfo.scopesVar && jsvGetLastChild(execInfo.scopesVar)) {
+    JsVar *scopeName = jsvLock(jsvGetLastChild(execInfo.scopesVar));
+    scopeRef = jsvGetFirstChild(scopeName);
+    jsvUnLock(scopeName);
+  }
+  if (slot->scope==scopeRef && slot->site==site && slot->nameHash==nameHash &&
+      slot->epoch==jsvScopeNameRemovedEpoch) {
+    JsVar *child = jsvLock(slot->child);
+    // check the name in case of hash collisions (all the characters are usually in the name itself)
+    if (jsvIsString(child) && (child->varData.ref.lastChild ?
+        jsvIsStringEqual(child, name) :
+        (jsvGetCharactersInVar(child)==nameLen && memcmp(child->varData.str, name, nameLen)==0))) {
+      jspScopeSlotHits++;
+      return child;
+    }
+    jsvUnLock(child);
+  }
+  jspScopeSlotMisses++;
+  JsVar *scope = jsvLock(scopeRef);
+  JsVar *child = jsvHasChildren(scope) ? jsvFindChildFromString(scope, name) : 0;
+  jsvUnLock(scope);
+  if (!child) return jspeiFindInScopes(name);
+  slot->site = site;
+  slot->nameHash = nameHash;
+  slot->epoch = jsvScopeNameRemovedEpoch;
+  slot->scope = scopeRef;
+  slot->child = jsvGetRef(child);
+  return child;
+}
+#endif
 /// Return the topmost scope (and lock it)
 JsVar *jspeiGetTopScope() {
   if (execInfo.scopesVar) {
@@ -448,6 +541,16 @@ NO_INLINE bool jspeFunctionDefinitionInternal(JsVar *funcVar, bool expressionOnl
       if (jsfGetFlag(JSF_PRETOKENISE) || forcePretokenise)
         funcCodeVar = jslNewTokenisedStringFromLexer(&funcBegin, (size_t)lastTokenEnd);
       else
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+      if (lex->untokenisedVar) {
+        /* We're running code that was tokenised on its first call - copy this function's
+         * code from the original, as we would have done if it hadn't been tokenised */
+        size_t codeStart = jslGetUntokenisedPosition(jsvStringIteratorGetIndex(&funcBegin.it) - 1, NULL);
+        size_t codeEnd;
+        jslGetUntokenisedPosition(lex->tokenLastStart, &codeEnd); // end of the last token
+        funcCodeVar = jsvNewFromStringVar(lex->untokenisedVar, codeStart, codeEnd-codeStart);
+      } else
 #endif
         funcCodeVar = jslNewStringFromLexer(&funcBegin, (size_t)lastTokenEnd);
     }
@@ -537,6 +640,41 @@ NO_INLINE bool jspeParseFunctionCallBrackets() {
  *
  * functionName is used only for error reporting - and can be 0
  */
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+/* Called the first time a function is executed. Tokenise its code (reserved words and
+ * operators become single bytes, whitespace and comments are removed) into a flat string
+ * which is stored next to the code, so subsequent calls lex that rather than re-lexing
+ * the original source. The original code is kept for toString/dump, along with a map
+ * back to it for error positions. If tokenising doesn't make the code any smaller we
+ * store an empty entry so we don't try again. As it's only there for speed, we only do
+ * it if there'll still be plenty of free memory afterwards, and jsvNewWithFlags drops
+ * it all if memory runs out.
+ * Returns the tokenised code (locked) or 0 if the original code should be used, and
+ * sets 'map' to the (locked) map, or 0. */
+static NO_INLINE JsVar *jspeFunctionTokenise(JsVar *function, JsVar *functionCode, JsVar **map) {
+  *map = 0;
+  if (!jsvIsString(functionCode) || jsvIsNativeString(functionCode) || jsvIsFlashString(functionCode))
+    return 0; // executed straight from flash to save RAM
+  size_t blocks = 1 + ((jsvGetStringLength(functionCode)+sizeof(JsVar)-1) / sizeof(JsVar));
+  if (!jsvMoreFreeVariablesThan((unsigned int)(JS_VARS_BEFORE_IDLE_GC + blocks*2)))
+    return 0; // try again next call
+  JsVar *tokens = jslNewTokenisedStringWithMap(functionCode, map);
+  if (JSP_HAS_ERROR) { // out of memory or bad code - just don't cache anything
+    jsvUnLock2(tokens, *map);
+    *map = 0;
+    return 0;
+  }
+  if (tokens && jsvGetStringLength(tokens) >= jsvGetStringLength(functionCode)) {
+    jsvUnLock2(tokens, *map); // already tokenised
+    tokens = 0;
+    *map = 0;
+  }
+  jsvUnLock(jsvAddNamedChild(function, tokens, JSPARSE_FUNCTION_TOKENS_NAME));
+  if (*map) jsvUnLock(jsvAddNamedChild(function, *map, JSPARSE_FUNCTION_TOKEN_MAP_NAME));
+  return tokens;
+}
+#endif
+
 NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *thisArg, bool isParsing, int argCount, JsVar **argPtr) {
   if (JSP_SHOULD_EXECUTE && !function) {
     if (functionName)
@@ -691,6 +829,12 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
 #ifdef ESPR_JIT
       bool functionIsJIT = false; // is functionCode actually Thumb Assembly (for JS)
 #endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+      JsVar *functionTokens = 0;
+      JsVar *functionTokenMap = 0;
+      JsVar *functionUntokenised = 0; // if we're running functionTokens, the original code
+      bool hadFunctionTokens = false; // have we already tried to tokenise this function?
+#endif
 
       /** NOTE: We expect that the function object will have:
        *
@@ -754,6 +898,10 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
           else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_CODE_NAME)) functionCode = jsvSkipName(param);
 #ifdef ESPR_JIT
           else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_JIT_CODE_NAME)) { functionCode = jsvSkipName(param); functionIsJIT = true; }
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+          else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_TOKENS_NAME)) { functionTokens = jsvSkipName(param); hadFunctionTokens = true; }
+          else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_TOKEN_MAP_NAME)) functionTokenMap = jsvSkipName(param);
 #endif
           else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_NAME_NAME)) functionInternalName = jsvSkipName(param);
           else if (jsvIsStringEqual(param, JSPARSE_FUNCTION_THIS_NAME)) {
@@ -774,6 +922,24 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
       }
       jsvObjectIteratorFree(&it);
 
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+      /* Tokenise on first call. Functions with line number info are left alone
+       * so that errors still report the correct line */
+      if (!hadFunctionTokens && functionCode
+#ifdef ESPR_JIT
+          && !functionIsJIT
+#endif
+#ifndef ESPR_NO_LINE_NUMBERS
+          && !functionLineNumber
+#endif
+          )
+        functionTokens = jspeFunctionTokenise(function, functionCode, &functionTokenMap);
+      if (functionTokens) {
+        functionUntokenised = functionCode;
+        functionCode = functionTokens;
+      }
+#endif
+
       // setup a the function's name (if a named function)
       if (functionInternalName) {
         JsVar *name = jsvMakeIntoVariableName(jsvNewFromStringVarComplete(functionInternalName), function);
@@ -841,6 +1007,12 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
             jslInit(functionCode);
 #ifndef ESPR_NO_LINE_NUMBERS
             newLex.lineNumberOffset = functionLineNumber;
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+            if (functionUntokenised) {
+              newLex.untokenisedVar = jsvLockAgain(functionUntokenised);
+              newLex.tokenMap = jsvLockAgainSafe(functionTokenMap);
+            }
 #endif
             JSP_SAVE_EXECUTE();
             // force execute without any previous state
@@ -930,8 +1102,14 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
         // Unlock scopes and restore old ones
         jsvUnLock(execInfo.scopesVar);
         execInfo.scopesVar = oldScopeVar;
+#ifdef ESPR_SCOPE_SLOTS
+        jspeiForgetScopeSlots(jsvGetRef(functionRoot)); // this call's locals are going away
+#endif
       }
       jsvUnLock2(functionCode, functionRoot);
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+      jsvUnLock2(functionUntokenised, functionTokenMap);
+#endif
     }
 
     jsvUnLock(thisVar);
@@ -952,7 +1130,11 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
 
 // Find a variable (or built-in function) based on the current scopes
 JsVar *jspGetNamedVariable(const char *tokenName) {
+#ifdef ESPR_SCOPE_SLOTS
+  JsVar *a = JSP_SHOULD_EXECUTE ? jspeiFindInScopesCached(tokenName) : 0;
+#else
   JsVar *a = JSP_SHOULD_EXECUTE ? jspeiFindInScopes(tokenName) : 0;
+#endif
   if (JSP_SHOULD_EXECUTE && !a) {
     /* Special case! We haven't found the variable, so check out
      * and see if it's one of our builtins...  */
@@ -979,10 +1161,94 @@ JsVar *jspGetNamedVariable(const char *tokenName) {
   return a;
 }
 
+#ifdef ESPR_PROPERTY_CACHE
+/* Monomorphic inline cache for property lookups that go to the prototype chain (eg.
+ * `g.setPixel` where `g.__proto__` is `Graphics.prototype`). Entries are indexed by the
+ * lexer position of the member access and remember the object and the name found in its
+ * prototype chain (or that nothing was found, so we go straight to built-ins).
+ * They are only valid while jsvObjectEpoch is unchanged. */
+#define JSP_PROPERTY_CACHE_SIZE 64 // POWER OF 2
+typedef struct {
+  uint32_t epoch;    ///< jsvObjectEpoch when this was filled in (0 = unused)
+  uint32_t nameHash; ///< hash of the property name
+  JsVarRef object;   ///< the object the property was looked up on
+  JsVarRef child;    ///< the name found in the prototype chain, or 0 if not found
+} JspPropertyCacheEntry;
+static JspPropertyCacheEntry jspPropertyCache[JSP_PROPERTY_CACHE_SIZE];
+static uint32_t jspPropertyCacheHits, jspPropertyCacheMisses;
+
+/// Can the result of jspeiFindChildFromStringInParents on this be cached? (is everything in the prototype chain an object?)
+static bool jspIsCacheablePrototypeChain(JsVar *object) {
+  if (!jsvIsObject(object)) return false; // built-in types use the basic object prototypes in root
+  JsVar *parent = jsvLockAgain(object);
+  int depth = 0;
+  while (depth++ < 16) {
+    JsVar *inheritsFrom = jsvObjectGetChildIfExists(parent, JSPARSE_INHERITS_VAR);
+    if (!inheritsFrom) inheritsFrom = jspFindPrototypeFor("Object");
+    bool isEnd = !inheritsFrom || inheritsFrom==parent;
+    jsvUnLock(parent);
+    if (isEnd) {
+      jsvUnLock(inheritsFrom);
+      return true;
+    }
+    if (!jsvIsObject(inheritsFrom)) {
+      jsvUnLock(inheritsFrom);
+      return false; // mutations of non-objects don't update jsvObjectEpoch
+    }
+    parent = inheritsFrom;
+  }
+  jsvUnLock(parent);
+  return false; // too deep (or circular)
+}
+
+/// jspeiFindChildFromStringInParents, but using jspPropertyCache
+static JsVar *jspeiFindChildFromStringInParentsCached(JsVar *object, const char *name) {
+  uint32_t nameHash = 5381;
+  const char *n = name;
+  while (*n) nameHash = nameHash*33 + (unsigned char)*(n++);
+  // index by lexer position of the member access (the token we're on now)
+  uint32_t site = lex ? ((uint32_t)jsvGetRef(lex->sourceVar)*31 + (uint32_t)lex->tokenStart) : 0;
+  JspPropertyCacheEntry *entry = &jspPropertyCache[(site ^ nameHash) & (JSP_PROPERTY_CACHE_SIZE-1)];
+  JsVarRef objectRef = jsvGetRef(object);
+  if (entry->epoch==jsvObjectEpoch && entry->object==objectRef && entry->nameHash==nameHash) {
+    JsVar *child = jsvLockSafe(entry->child);
+    if (!child || jsvIsStringEqual(child, name)) { // sanity check in case of hash collisions
+      jspPropertyCacheHits++;
+      return child;
+    }
+    jsvUnLock(child);
+  }
+  jspPropertyCacheMisses++;
+  JsVar *child = jspeiFindChildFromStringInParents(object, name);
+  /* Only cache if the lookup itself didn't change anything (it can create
+   * prototypes) and everything in the chain will update jsvObjectEpoch */
+  uint32_t epoch = jsvObjectEpoch;
+  if (jspIsCacheablePrototypeChain(object) && epoch==jsvObjectEpoch) {
+    entry->epoch = epoch;
+    entry->nameHash = nameHash;
+    entry->object = objectRef;
+    entry->child = jsvGetRef(child);
+  }
+  return child;
+}
+
+JsVar *jspGetPropertyCacheStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+  jsvObjectSetChildAndUnLock(obj, "hits", jsvNewFromLongInteger(jspPropertyCacheHits));
+  jsvObjectSetChildAndUnLock(obj, "misses", jsvNewFromLongInteger(jspPropertyCacheMisses));
+  return obj;
+}
+#endif
+
 /// Used by jspGetNamedField / jspGetVarNamedField
 static NO_INLINE JsVar *jspGetNamedFieldInParents(JsVar *object, const char* name, bool returnName) {
   // Now look in prototypes
+#ifdef ESPR_PROPERTY_CACHE
+  JsVar * child = jspeiFindChildFromStringInParentsCached(object, name);
+#else
   JsVar * child = jspeiFindChildFromStringInParents(object, name);
+#endif
 
   /* Check for builtins via separate function
    * This way we save on RAM for built-ins because everything comes out of program code */
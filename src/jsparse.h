@@ -204,6 +204,17 @@ JsVar *jspGetNamedVariable(const char *tokenName);
 JsVar *jspGetNamedField(JsVar *object, const char* name, bool returnName);
 JsVar *jspGetVarNamedField(JsVar *object, JsVar *nameVar, bool returnName);
 
+#ifdef ESPR_PROPERTY_CACHE
+/// Return an object containing hit/miss statistics for the property lookup cache
+JsVar *jspGetPropertyCacheStats();
+#endif
+#ifdef ESPR_SCOPE_SLOTS
+/// Return an object containing hit/miss statistics for identifier lookups using scope slots
+JsVar *jspGetScopeSlotStats();
+/// Vars have been moved (by jsvDefragment) so forget any refs remembered in scope slots
+void jspVarsMoved();
+#endif
+
 // These are exported for the Web IDE's compiler. See exportPtrs in jswrap_process.c
 JsVar *jspeiFindInScopes(const char *name);
 
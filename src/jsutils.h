@@ -61,6 +61,9 @@
 #ifdef SAVE_ON_FLASH_EXTREME
 #define ESPR_NO_BLUETOOTH_MESSAGES 1
 #endif
+#if defined(ESPR_FUNCTION_TOKEN_CACHE) && defined(ESPR_NO_PRETOKENISE)
+#undef ESPR_FUNCTION_TOKEN_CACHE // the token cache uses the pretokeniser
+#endif
 
 #ifndef alloca
 #define alloca(x) __builtin_alloca(x)
@@ -324,6 +327,11 @@ typedef int64_t JsSysTime;
 #define JS_VARS_BEFORE_IDLE_GC 32
 #endif
 
+/* With ESPR_GC_INCREMENTAL, how many vars the GC looks at each time around the idle loop */
+#ifndef JSV_GC_STEP_BUDGET
+#define JSV_GC_STEP_BUDGET 256
+#endif
+
 // javascript specific names
 #define JSPARSE_RETURN_VAR JS_HIDDEN_CHAR_STR"rtn" // variable name used for returning function results
 #define JSPARSE_PROTOTYPE_VAR "prototype"
@@ -338,6 +346,8 @@ typedef int64_t JsSysTime;
 #define JSPARSE_FUNCTION_THIS_NAME JS_HIDDEN_CHAR_STR"ths" // the 'this' variable - for bound functions
 #define JSPARSE_FUNCTION_NAME_NAME JS_HIDDEN_CHAR_STR"nam" // for named functions (a = function foo() { foo(); })
 #define JSPARSE_FUNCTION_LINENUMBER_NAME JS_HIDDEN_CHAR_STR"lin" // The line number offset of the function
+#define JSPARSE_FUNCTION_TOKENS_NAME JS_HIDDEN_CHAR_STR"tok" // Tokenised copy of the function's code, created on first call (ESPR_FUNCTION_TOKEN_CACHE)
+#define JSPARSE_FUNCTION_TOKEN_MAP_NAME JS_HIDDEN_CHAR_STR"tkm" // Map from positions in the tokenised code back to the function's code (ESPR_FUNCTION_TOKEN_CACHE)
 #define JS_EVENT_PREFIX "#on"
 #define JS_TIMEZONE_VAR "tz"
 #ifndef ESPR_NO_DAYLIGHT_SAVING
@@ -21,6 +21,7 @@
 #include "jswrap_object.h" // for jswrap_object_toString
 #include "jswrap_arraybuffer.h" // for jsvNewTypedArray
 #include "jswrap_dataview.h" // for jsvNewDataViewWithData
+#include "jstimer.h" // for utilTimerGetLastTask in jsvDefragment
 #if defined(ESPR_JIT) && defined(LINUX)
 #include <sys/mman.h>
 #endif
@@ -63,6 +64,12 @@ typedef enum {
 volatile bool touchedFreeList = false;
 volatile JsVarRef jsVarFirstEmpty; ///< reference of first unused variable (variables are in a linked list)
 volatile MemBusyType isMemoryBusy; ///< Are we doing garbage collection or similar, so can't access memory?
+#ifdef JSV_OBJECT_EPOCH
+uint32_t jsvObjectEpoch = 1; ///< See jsvObjectChanged
+#endif
+#ifdef ESPR_SCOPE_SLOTS
+uint32_t jsvScopeNameRemovedEpoch; ///< See jsvar.h
+#endif
 
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
@@ -76,10 +83,35 @@ JsVarRefSigned jsvGetFirstChildSigned(const JsVar *v) {
 JsVarRef jsvGetLastChild(const JsVar *v) { return v->varData.ref.lastChild; }
 JsVarRef jsvGetNextSibling(const JsVar *v) { return v->varData.ref.nextSibling; }
 JsVarRef jsvGetPrevSibling(const JsVar *v) { return v->varData.ref.prevSibling; }
-void jsvSetFirstChild(JsVar *v, JsVarRef r) { v->varData.ref.firstChild = r; }
-void jsvSetLastChild(JsVar *v, JsVarRef r) { v->varData.ref.lastChild = r; }
-void jsvSetNextSibling(JsVar *v, JsVarRef r) { v->varData.ref.nextSibling = r; }
-void jsvSetPrevSibling(JsVar *v, JsVarRef r) { v->varData.ref.prevSibling = r; }
+#ifndef JSV_GC_MARK_STACK_SIZE
+#ifdef SAVE_ON_FLASH
+#define JSV_GC_MARK_STACK_SIZE 16
+#else
+#define JSV_GC_MARK_STACK_SIZE 64 ///< How many vars can be waiting to be scanned during GC (see jsvGarbageCollectMarkRef)
+#endif
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+/// How far through an incremental garbage collection we are - see jsvGarbageCollectStep
+typedef enum {
+  JSV_GC_IDLE,      ///< no collection in progress
+  JSV_GC_FLAGGING,  ///< setting JSV_GARBAGE_COLLECT on vars that are used, from jsvGCCursor onwards
+  JSV_GC_MARKING,   ///< marking from locked vars (from jsvGCCursor onwards). References that are written must go through jsvGarbageCollectWriteBarrier
+  JSV_GC_SWEEPING,  ///< freeing vars that weren't marked, from jsvGCCursor onwards
+} JsvGCPhase;
+static JsvGCPhase jsvGCPhase = JSV_GC_IDLE;
+static JsVarRef jsvGCCursor = 0; ///< the next var the current phase of an incremental GC will look at
+static void jsvGarbageCollectForget(JsVarRef ref, size_t blocks);
+static void jsvGarbageCollectWriteBarrier(JsVarRef ref);
+#define JSV_GC_WRITE_BARRIER(ref) if (jsvGCPhase==JSV_GC_MARKING && (ref)) jsvGarbageCollectWriteBarrier(ref)
+#else
+#define JSV_GC_WRITE_BARRIER(ref)
+#endif
+void jsvSetFirstChild(JsVar *v, JsVarRef r) { JSV_GC_WRITE_BARRIER(r); v->varData.ref.firstChild = r; }
+void jsvSetLastChild(JsVar *v, JsVarRef r) { JSV_GC_WRITE_BARRIER(r); v->varData.ref.lastChild = r; }
+void jsvSetNextSibling(JsVar *v, JsVarRef r) { JSV_GC_WRITE_BARRIER(r); v->varData.ref.nextSibling = r; }
+void jsvSetPrevSibling(JsVar *v, JsVarRef r) { JSV_GC_WRITE_BARRIER(r); v->varData.ref.prevSibling = r; }
+/// Set firstChild to a value that is NOT a reference (eg. for JSV_NAME_INT_INT) - so skip any write barrier
+static void jsvSetFirstChildValue(JsVar *v, JsVarRef r) { v->varData.ref.firstChild = r; }
 
 JsVarRefCounter jsvGetRefs(JsVar *v) { return v->varData.ref.refs; }
 void jsvSetRefs(JsVar *v, JsVarRefCounter refs) { v->varData.ref.refs = refs; }
@@ -125,6 +157,9 @@ unsigned char jsvGetLocks(JsVar *v) { return (unsigned char)((v->flags>>JSV_LOCK
 #define JSV_IS_FLASH_STRING(f) false
 #endif
 #define JSV_IS_NONAPPENDABLE_STRING(f) (JSV_IS_FLAT_STRING(f) || JSV_IS_NATIVE_STRING(f) || JSV_IS_FLASH_STRING(f))
+#define JSV_HAS_STRING_EXT(f) ((JSV_IS_STRING(f) || JSV_IS_STRING_EXT(f) || JSV_IS_UNICODE_STRING(f)) && !JSV_IS_NONAPPENDABLE_STRING(f))
+#define JSV_HAS_CHILDREN(f) (JSV_IS_FUNCTION(f) || JSV_IS_OBJECT(f) || JSV_IS_ARRAY(f) || JSV_IS_ROOT(f) || JSV_IS_GETTER_OR_SETTER(f))
+#define JSV_HAS_SINGLE_CHILD(f) (JSV_IS_ARRAYBUFFER(f) || (JSV_IS_NAME(f) && !JSV_IS_NAME_WITH_VALUE(f)))
 
 bool jsvIsRoot(const JsVar *v) { if (!v) return false; char f = v->flags&JSV_VARTYPEMASK; return JSV_IS_ROOT(f); }
 bool jsvIsPin(const JsVar *v) { if (!v) return false; char f = v->flags&JSV_VARTYPEMASK; NOT_USED(f); return JSV_IS_PIN(f); } // NOT_USED(f) avoids compile warnings for some builds
@@ -199,23 +234,21 @@ bool jsvHasCharacterData(const JsVar *v) {
 
 bool jsvHasStringExt(const JsVar *v) {
   if (!v) return false;
-    char f = v->flags&JSV_VARTYPEMASK;
-  return (JSV_IS_STRING(f) || JSV_IS_STRING_EXT(f) || JSV_IS_UNICODE_STRING(f)) && !JSV_IS_NONAPPENDABLE_STRING(f);
+  char f = v->flags&JSV_VARTYPEMASK;
+  return JSV_HAS_STRING_EXT(f);
 }
 
 bool jsvHasChildren(const JsVar *v) {
   if (!v) return false;
   char f = v->flags&JSV_VARTYPEMASK;
-  return JSV_IS_FUNCTION(f) || JSV_IS_OBJECT(f) || JSV_IS_ARRAY(f) ||
-         JSV_IS_ROOT(f) || JSV_IS_GETTER_OR_SETTER(f);
+  return JSV_HAS_CHILDREN(f);
 }
 
 /// Is this variable a type that uses firstChild to point to a single Variable (ie. it doesn't have multiple children)
 bool jsvHasSingleChild(const JsVar *v) {
   if (!v) return false;
   char f = v->flags&JSV_VARTYPEMASK;
-  return JSV_IS_ARRAYBUFFER(f) ||
-      (JSV_IS_NAME(f) && !JSV_IS_NAME_WITH_VALUE(f));
+  return JSV_HAS_SINGLE_CHILD(f);
 }
 
 // ----------------------------------------------------------------------------
@@ -259,6 +292,242 @@ void jsvSetMaxVarsUsed(unsigned int size) {
 
 }
 
+#ifdef ESPR_STRING_TAIL_CACHE
+/* Appending to a string (jsvStringIteratorGotoEnd) means following its StringExts to the end,
+ * so building a string up a bit at a time is O(n^2). Instead we remember a StringExt near the
+ * end (and the index of its first character) of recently appended-to strings. StringExts are
+ * only ever added to the end of a string, and are only removed when the whole string is freed
+ * (when we forget it) so if the var is still a StringExt we can carry on from it to the end. */
+#define JSV_STRING_TAILS 8 // POWER OF 2
+typedef struct {
+  JsVarRef str;     ///< the string (0 = unused)
+  JsVarRef tail;    ///< a StringExt of 'str'
+  size_t tailIndex; ///< the index in 'str' of the first character in 'tail'
+} JsvStringTail;
+static JsvStringTail jsvStringTails[JSV_STRING_TAILS];
+
+/// Forget the tail of the given string (it's being freed or rearranged)
+static void jsvStringTailForget(JsVarRef str) {
+  JsvStringTail *t = &jsvStringTails[str & (JSV_STRING_TAILS-1)];
+  if (t->str==str) t->str = 0;
+}
+
+/// Forget the tails of all strings (vars have been freed or moved)
+static void jsvStringTailForgetAll() {
+  memset(jsvStringTails, 0, sizeof(jsvStringTails));
+}
+
+JsVar *jsvStringGetTail(JsVarRef str, size_t *tailIndex) {
+  JsvStringTail *t = &jsvStringTails[str & (JSV_STRING_TAILS-1)];
+  if (t->str!=str) return 0;
+  JsVar *tail = jsvGetAddressOf(t->tail);
+  if (!jsvIsStringExt(tail)) {
+    t->str = 0;
+    return 0;
+  }
+  *tailIndex = t->tailIndex;
+  return jsvLockAgain(tail);
+}
+
+void jsvStringSetTail(JsVarRef str, JsVar *tail, size_t tailIndex) {
+  JsvStringTail *t = &jsvStringTails[str & (JSV_STRING_TAILS-1)];
+  t->str = str;
+  t->tail = jsvGetRef(tail);
+  t->tailIndex = tailIndex;
+}
+#endif
+
+#ifdef ESPR_FREE_RUN_INDEX
+/* Runs of contiguous free vars are indexed by size so that flat strings can be allocated
+ * with a best-fit lookup rather than by scanning the free list. Runs are found whenever the
+ * free list is rebuilt in address order (by the GC's sweep or jsvCreateEmptyVarList) and
+ * when flat strings are freed. Single vars are allocated and freed without updating the
+ * index, so a run is only used after checking it's still free and linked in order - if
+ * not, it's dropped and we fall back to scanning the free list. */
+#define JSV_FREE_RUN_CLASSES 8 ///< runs of 2-3, 4-7, ... 128-255, 256+ blocks
+#define JSV_FREE_RUNS_PER_CLASS 4
+typedef struct {
+  JsVarRef pred;  ///< the free var before 'start' in the free list (0 if it's first)
+  JsVarRef start; ///< first var in the run
+  JsVarRef len;   ///< number of vars in the run (0 = unused)
+} JsvFreeRun;
+static JsvFreeRun jsvFreeRuns[JSV_FREE_RUN_CLASSES][JSV_FREE_RUNS_PER_CLASS];
+
+/// Counters for flat string allocation - see jsvGetFlatStringAllocStats
+static struct {
+  uint32_t count;   ///< flat strings allocated
+  uint32_t indexed; ///< ...of which were found using jsvFreeRuns
+  uint32_t scanned; ///< times we had to scan the free list
+  uint32_t failed;  ///< allocations that failed
+  JsSysTime time;   ///< total time spent allocating
+} jsvFlatAllocStats;
+
+static unsigned int jsvFreeRunClass(size_t len) {
+  unsigned int c = 0;
+  while (len>=4 && c<JSV_FREE_RUN_CLASSES-1) {
+    len >>= 1;
+    c++;
+  }
+  return c;
+}
+
+/// Are these two vars next to each other in memory?
+static ALWAYS_INLINE bool jsvFreeRunsAdjacent(JsVarRef a, JsVarRef b) {
+#ifdef RESIZABLE_JSVARS
+  return b==a+1 && jsvGetAddressOf(b)==jsvGetAddressOf(a)+1;
+#else
+  return b==a+1;
+#endif
+}
+
+/// Remember a run of free vars, if it's bigger than the ones we already know about
+static void jsvFreeRunsAdd(JsVarRef pred, JsVarRef start, size_t len) {
+  if (len<2) return; // single vars come from the start of the free list anyway
+  JsvFreeRun *runs = jsvFreeRuns[jsvFreeRunClass(len)];
+  JsvFreeRun *r = &runs[0];
+  // find an unused entry, or else the smallest run
+  for (int i=1;i<JSV_FREE_RUNS_PER_CLASS && r->len;i++)
+    if (!runs[i].len || runs[i].len<r->len) r = &runs[i];
+  if (r->len >= len) return;
+  r->pred = pred;
+  r->start = start;
+  r->len = (JsVarRef)len;
+}
+
+/// Re-index all runs of free vars. The free list must be in address order
+static void jsvFreeRunsRebuild() {
+  memset(jsvFreeRuns, 0, sizeof(jsvFreeRuns));
+  JsVarRef pred = 0, start = 0, last = 0;
+  size_t len = 0;
+  JsVarRef curr = jsVarFirstEmpty;
+  while (curr) {
+    if (len && jsvFreeRunsAdjacent(last, curr)) {
+      len++;
+    } else {
+      jsvFreeRunsAdd(pred, start, len);
+      pred = last;
+      start = curr;
+      len = 1;
+    }
+    last = curr;
+    curr = jsvGetNextSibling(jsvGetAddressOf(curr));
+  }
+  jsvFreeRunsAdd(pred, start, len);
+}
+
+/** Check that 'blocks' vars at the start of 'run' (after aligning for flat string data) are
+ * still free and in order in the free list, and if so remove them from it and return the
+ * first one. 'run' is updated to what's left (len=0 if the run was no good) */
+static JsVarRef jsvFreeRunsClaim(JsvFreeRun *run, size_t blocks) {
+  JsVarRef pred = run->pred;
+  JsVarRef s = run->start;
+  size_t len = run->len;
+  JsVarRef claimed = 0;
+  run->len = 0;
+  jshInterruptOff(); // to allow flat strings to be allocated/freed in an IRQ
+  // single vars are allocated from the start of the free list, so that may have eaten into this run
+  if (jsVarFirstEmpty>s && jsVarFirstEmpty<s+len) {
+    len -= (size_t)(jsVarFirstEmpty-s);
+    s = jsVarFirstEmpty;
+    pred = 0;
+  }
+  bool ok = pred ? ((jsvGetAddressOf(pred)->flags&JSV_VARTYPEMASK)==JSV_UNUSED && jsvGetNextSibling(jsvGetAddressOf(pred))==s) :
+                   jsVarFirstEmpty==s;
+  // skip forward until flat string data would be aligned on a 4 byte boundary
+  while (ok && len>=blocks && (s>=jsVarsSize || ((size_t)jsvGetAddressOf(s+1))&3)) {
+    JsVar *v = jsvGetAddressOf(s);
+    JsVarRef next = jsvGetNextSibling(v);
+    ok = (v->flags&JSV_VARTYPEMASK)==JSV_UNUSED && next && jsvFreeRunsAdjacent(s, next);
+    pred = s;
+    s = next;
+    len--;
+  }
+  ok = ok && len>=blocks;
+  // check all the blocks we need are still free and in order
+  JsVarRef last = s;
+  for (size_t i=0;ok && i<blocks;i++) {
+    JsVar *v = jsvGetAddressOf(last);
+    if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) ok = false;
+    else if (i+1<blocks) {
+      JsVarRef next = jsvGetNextSibling(v);
+      if (next && jsvFreeRunsAdjacent(last, next)) last = next;
+      else ok = false;
+    }
+  }
+  if (ok) {
+    JsVarRef nextFree = jsvGetNextSibling(jsvGetAddressOf(last));
+    if (pred) jsvSetNextSibling(jsvGetAddressOf(pred), nextFree);
+    else jsVarFirstEmpty = nextFree;
+    touchedFreeList = true;
+    claimed = s;
+    // what's left of the run
+    run->pred = pred;
+    run->start = nextFree;
+    run->len = (JsVarRef)(len-blocks);
+  }
+  jshInterruptOn();
+  return claimed;
+}
+
+/// Find the smallest known run of free vars that'll fit a flat string of 'blocks' blocks and claim it (or return 0)
+static JsVarRef jsvFreeRunsTake(size_t blocks) {
+  for (unsigned int c=jsvFreeRunClass(blocks);c<JSV_FREE_RUN_CLASSES;c++) {
+    JsvFreeRun *runs = jsvFreeRuns[c];
+    while (true) {
+      JsvFreeRun *best = 0;
+      for (int i=0;i<JSV_FREE_RUNS_PER_CLASS;i++)
+        if (runs[i].len>=blocks && (!best || runs[i].len<best->len))
+          best = &runs[i];
+      if (!best) break;
+      JsvFreeRun run = *best;
+      best->len = 0;
+      JsVarRef start = jsvFreeRunsClaim(&run, blocks);
+      if (start) {
+        jsvFreeRunsAdd(run.pred, run.start, run.len);
+        return start;
+      }
+    }
+  }
+  return 0;
+}
+
+/// Return an object containing statistics about flat string allocation
+JsVar *jsvGetFlatStringAllocStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+  jsvObjectSetChildAndUnLock(obj, "count", jsvNewFromLongInteger(jsvFlatAllocStats.count));
+  jsvObjectSetChildAndUnLock(obj, "indexed", jsvNewFromLongInteger(jsvFlatAllocStats.indexed));
+  jsvObjectSetChildAndUnLock(obj, "scanned", jsvNewFromLongInteger(jsvFlatAllocStats.scanned));
+  jsvObjectSetChildAndUnLock(obj, "failed", jsvNewFromLongInteger(jsvFlatAllocStats.failed));
+  jsvObjectSetChildAndUnLock(obj, "time", jsvNewFromFloat(jshGetMillisecondsFromTime(jsvFlatAllocStats.time)));
+  return obj;
+}
+#endif
+
+#ifndef SAVE_ON_FLASH
+/// Get the size of the biggest area of contiguous free vars, and how many separate free areas there are
+void jsvGetFreeAreas(unsigned int *largest, unsigned int *count) {
+  *largest = 0;
+  *count = 0;
+  unsigned int len = 0;
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *var = jsvGetAddressOf(i);
+    if ((var->flags&JSV_VARTYPEMASK) == JSV_UNUSED) {
+#ifdef RESIZABLE_JSVARS
+      if (len && jsvGetAddressOf(i-1)+1!=var) len = 0; // in a different block of vars
+#endif
+      if (!len) (*count)++;
+      len++;
+      if (len>*largest) *largest = len;
+    } else {
+      len = 0;
+      if (jsvIsFlatString(var))
+        i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+    }
+  }
+}
+#endif
+
 // maps the empty variables in...
 void jsvCreateEmptyVarList() {
   assert(!isMemoryBusy);
@@ -281,6 +550,15 @@ void jsvCreateEmptyVarList() {
   }
   jsvSetNextSibling(lastEmpty, 0);
   jsVarFirstEmpty = jsvGetNextSibling(&firstVar);
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunsRebuild();
+#endif
+#ifdef ESPR_STRING_TAIL_CACHE
+  jsvStringTailForgetAll(); // memory has been loaded or moved around
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCPhase = JSV_GC_IDLE; // any incremental GC was for what was in memory before
+#endif
   isMemoryBusy = MEM_NOT_BUSY;
 }
 
@@ -355,6 +633,9 @@ void jsvInit(unsigned int size) {
 #endif
 
   jsVarFirstEmpty = jsvInitJsVars(1/*first*/, jsVarsSize);
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCPhase = JSV_GC_IDLE;
+#endif
   jsvSoftInit();
 }
 
@@ -434,6 +715,9 @@ void jsvSetMemoryTotal(unsigned int jsNewVarCount) {
    * is 0 (because jsiFreeMoreMemory returned 0) so we can just assign it.  */
   assert(!jsVarFirstEmpty);
   jsVarFirstEmpty = jsvInitJsVars(oldSize+1, jsVarsSize-oldSize);
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunsRebuild();
+#endif
   // jsiConsolePrintf("Resized memory from %d blocks to %d\n", oldBlockCount, newBlockCount);
   touchedFreeList = true;
   isMemoryBusy = MEM_NOT_BUSY;
@@ -577,6 +861,61 @@ void jsvResetVariable(JsVar *v, JsVarFlags flags) {
   //};
 }
 
+#ifdef ESPR_PROPERTY_INDEX
+/// If we failed to build an index for an object, don't keep trying until it (or memory) changes
+static JsVarRef jsvPropertyIndexFailedRef = 0;
+
+/// Free the object's property index (if it has one)
+static void jsvPropertyIndexFree(JsVar *var) {
+  JsVarRef ref = jsvGetNextSibling(var);
+  if (!ref) return;
+  jsvSetNextSibling(var, 0);
+  jsvUnRefRef(ref);
+}
+
+/** Indexes only make lookups faster, so they're built only if there'll still be
+ * plenty of free memory afterwards... */
+static bool jsvPropertyIndexCanBuild(size_t byteLength) {
+  size_t blocks = 1 + ((byteLength+sizeof(JsVar)-1) / sizeof(JsVar));
+  return jsvMoreFreeVariablesThan((unsigned int)(JS_VARS_BEFORE_IDLE_GC + blocks*2));
+}
+
+/// ... and they're all dropped when we run out. Returns true if any were freed
+static bool jsvPropertyIndexFreeAll() {
+  bool freed = false;
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *var = jsvGetAddressOf(i);
+    if (jsvIsObject(var) && jsvGetNextSibling(var)) {
+      jsvPropertyIndexFree(var);
+      freed = true;
+    } else if (jsvIsFlatString(var))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+  }
+  return freed;
+}
+#endif
+
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+/** Functions' tokenised code (and the map back to their code) is only there for speed too,
+ * so drop it all when we run out. The names stay (with no value) so the functions aren't
+ * tokenised again. Returns true if any were freed */
+static bool jsvFunctionTokensFreeAll() {
+  bool freed = false;
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *var = jsvGetAddressOf(i);
+    if (jsvIsName(var) && jsvIsString(var) && !jsvIsNameWithValue(var) && jsvGetFirstChild(var) &&
+        (jsvIsStringEqual(var, JSPARSE_FUNCTION_TOKENS_NAME) || jsvIsStringEqual(var, JSPARSE_FUNCTION_TOKEN_MAP_NAME))) {
+      JsVarRef ref = jsvGetFirstChild(var);
+      jsvSetFirstChild(var, 0);
+      jsvUnRefRef(ref); // if a call is running this code it's still locked, so isn't freed until it's done
+      freed = true;
+    } else if (jsvIsFlatString(var))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+  }
+  return freed;
+}
+#endif
+
 JsVar *jsvNewWithFlags(JsVarFlags flags) {
   if (isMemoryBusy) {
     jsErrorFlags |= JSERR_MEMORY_BUSY;
@@ -604,6 +943,11 @@ JsVar *jsvNewWithFlags(JsVarFlags flags) {
     } while (!__sync_bool_compare_and_swap(&jsVarFirstEmpty, empty, next));
     assert(v->flags == JSV_UNUSED);*/
     jsvResetVariable(v, flags); // setup variable, and add one lock
+#ifdef ESPR_GC_INCREMENTAL
+    /* If an incremental GC has already flagged the vars that could be made to reference
+     * this one, it must be flagged too - vars that aren't flagged are never scanned */
+    if (jsvGCPhase==JSV_GC_FLAGGING) v->flags |= JSV_GARBAGE_COLLECT;
+#endif
     // return pointer
     return v;
   }
@@ -617,6 +961,18 @@ JsVar *jsvNewWithFlags(JsVarFlags flags) {
   if (jsvGarbageCollect()) {
     return jsvNewWithFlags(flags); // if it freed something, continue
   }
+#ifdef ESPR_PROPERTY_INDEX
+  /* Object property indexes are just there for speed, so get rid of them before
+   anything that's actually needed */
+  if (jsvPropertyIndexFreeAll()) {
+    return jsvNewWithFlags(flags);
+  }
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+  if (jsvFunctionTokensFreeAll()) {
+    return jsvNewWithFlags(flags);
+  }
+#endif
   /* we don't have memory - last hope - ask jsInteractive to try and free some it
    may have kicking around */
   if (jsiFreeMoreMemory()) {
@@ -664,6 +1020,10 @@ void jsvFreePtrStringExt(JsVar* var) {
 }
 
 ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
+#ifdef ESPR_PROPERTY_INDEX
+  // an object's nextSibling may point to its property index
+  if (jsvIsObject(var)) jsvPropertyIndexFree(var);
+#endif
   /* To be here, we're not supposed to be part of anything else. If
    * we were, we'd have been freed by jsvGarbageCollect */
   assert((!jsvGetNextSibling(var) && !jsvGetPrevSibling(var)) || // check that next/prevSibling are not set
@@ -698,6 +1058,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
     jsvUnRefRef(jsvGetLastChild(var));
     jsvSetLastChild(var, 0);
   } else if (jsvHasStringExt(var)) {
+#ifdef ESPR_STRING_TAIL_CACHE
+    jsvStringTailForget(jsvGetRef(var));
+#endif
     // Free the string without recursing
     jsvFreePtrStringExt(var);
 #ifdef CLEAR_MEMORY_ON_FREE
@@ -721,6 +1084,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
       insertAfter = insertBefore;
       insertBefore = jsvGetNextSibling(jsvGetAddressOf(insertBefore));
     }
+#ifdef ESPR_FREE_RUN_INDEX
+    size_t dataBlocks = count;
+#endif
     // free in reverse, so the free list ends up in kind of the right order
     while (count--) {
       JsVar *p = jsvGetAddressOf(i--);
@@ -734,6 +1100,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
       jsvSetNextSibling(jsvGetAddressOf(insertAfter), insertBefore);
     else
       jsVarFirstEmpty = insertBefore;
+#ifdef ESPR_FREE_RUN_INDEX
+    jsvFreeRunsAdd(insertAfter, insertBefore, dataBlocks); // the header block is freed separately
+#endif
     touchedFreeList = true;
     jshInterruptOn();
   }
@@ -742,6 +1111,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
     can be ints or strings */
 
   if (jsvHasChildren(var)) {
+#ifdef JSV_OBJECT_EPOCH
+    if (jsvIsObject(var)) jsvObjectChanged(); // its ref may be reused by another object
+#endif
     JsVarRef childref = jsvGetLastChild(var);
 #ifdef CLEAR_MEMORY_ON_FREE
     jsvSetFirstChild(var, 0);
@@ -797,6 +1169,12 @@ JsVar *jsvLock(JsVarRef ref) {
   //var->locks++;
   assert(jsvGetLocks(var) < JSV_LOCK_MAX);
   var->flags += JSV_LOCK_ONE;
+#ifdef ESPR_GC_INCREMENTAL
+  /* Locked vars are in use, but an incremental GC only checks for locked vars once - so
+   * anything locked while marking (eg. a child of a var we haven't scanned yet) must be marked */
+  if (jsvGCPhase==JSV_GC_MARKING && (var->flags & JSV_GARBAGE_COLLECT))
+    jsvGarbageCollectWriteBarrier(ref);
+#endif
 #ifdef DEBUG
   if (jsvGetLocks(var)==0) {
     jsError("Too many locks to Variable!");
@@ -927,6 +1305,18 @@ JsVarRef jsvUnRefRef(JsVarRef ref) {
   return 0;
 }
 
+/// Set up the header block of a new flat string (including one lock) in the free blocks we've found for it
+static void jsvNewFlatStringHeader(JsVar *flatString, size_t requiredBlocks, unsigned int byteLength) {
+  jsvResetVariable(flatString, JSV_FLAT_STRING);
+  flatString->varData.integer = (JsVarInt)byteLength;
+#ifdef ESPR_GC_INCREMENTAL
+  // these blocks may have been freed while waiting to be looked at by the GC
+  if (jsvGCPhase!=JSV_GC_IDLE) jsvGarbageCollectForget(jsvGetRef(flatString), requiredBlocks);
+#else
+  NOT_USED(requiredBlocks);
+#endif
+}
+
 JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
   bool firstRun = true;
   // Work out how many blocks we need. One for the header, plus some for the characters
@@ -936,7 +1326,22 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
     jsErrorFlags |= JSERR_MEMORY_BUSY;
     return 0;
   }
+#ifdef ESPR_FREE_RUN_INDEX
+  JsSysTime startTime = jshGetSystemTime();
+  jsvFlatAllocStats.count++;
+#endif
   while (true) {
+#ifdef ESPR_FREE_RUN_INDEX
+    // Try the best fitting run of free blocks that we know about first
+    JsVarRef runStart = jsvFreeRunsTake(requiredBlocks);
+    if (runStart) {
+      flatString = jsvGetAddressOf(runStart);
+      jsvNewFlatStringHeader(flatString, requiredBlocks, byteLength);
+      jsvFlatAllocStats.indexed++;
+      break;
+    }
+    jsvFlatAllocStats.scanned++;
+#endif
     /* Now try and find a contiguous set of 'requiredBlocks' blocks by
     searching the free list. This can be done as long as nobody's
     messed with the free list in the mean time (which we check for with
@@ -970,9 +1375,7 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
                 jsVarFirstEmpty = nextFree;
               }
               flatString = jsvGetAddressOf(startBlock);
-              // Set up the header block (including one lock)
-              jsvResetVariable(flatString, JSV_FLAT_STRING);
-              flatString->varData.integer = (JsVarInt)byteLength;
+              jsvNewFlatStringHeader(flatString, requiredBlocks, byteLength);
             }
             jshInterruptOn();
             // if success, break out!
@@ -1006,6 +1409,10 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
     firstRun = false;
     jsvGarbageCollect();
   };
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFlatAllocStats.time += jshGetSystemTime() - startTime;
+  if (!flatString) jsvFlatAllocStats.failed++;
+#endif
   if (!flatString) return 0;
   /* We now have the string! All that's left is to clear it */
   // clear data
@@ -1245,7 +1652,7 @@ JsVar *jsvMakeIntoVariableName(JsVar *var, JsVar *valueOrZero) {
       JsVarInt v = valueOrZero->varData.integer;
       if (v>=JSVARREF_MIN && v<=JSVARREF_MAX) {
         t = jsvIsInt(valueOrZero) ? JSV_NAME_INT_INT : JSV_NAME_INT_BOOL;
-        jsvSetFirstChild(var, (JsVarRef)v);
+        jsvSetFirstChildValue(var, (JsVarRef)v);
         valueOrZero = 0;
       }
     }
@@ -1255,6 +1662,9 @@ JsVar *jsvMakeIntoVariableName(JsVar *var, JsVar *valueOrZero) {
     var->flags = (var->flags & (JsVarFlags)~JSV_VARTYPEMASK) | JSV_NAME_UTF8_STRING;
 #endif
   } else if (JSV_IS_STRING(varType)) {
+#ifdef ESPR_STRING_TAIL_CACHE
+    jsvStringTailForget(jsvGetRef(var)); // characters may get moved along
+#endif
     if (JSV_IS_NONAPPENDABLE_STRING(varType)) {
       JsVar *name = jsvNewWithFlags(JSV_NAME_STRING_0);
       jsvAppendStringVarComplete(name, var);
@@ -1322,7 +1732,7 @@ JsVar *jsvMakeIntoVariableName(JsVar *var, JsVar *valueOrZero) {
       JsVarInt v = valueOrZero->varData.integer;
       if (v>=JSVARREF_MIN && v<=JSVARREF_MAX) {
         t = JSV_NAME_STRING_INT_0;
-        jsvSetFirstChild(var, (JsVarRef)v);
+        jsvSetFirstChildValue(var, (JsVarRef)v);
         valueOrZero = 0;
       }
     } else
@@ -2729,7 +3139,7 @@ JsVar *jsvCopyNameOnly(JsVar *src, bool linkChildren, bool keepAsName) {
   // Copy LINK of what it points to
   if (linkChildren && jsvGetFirstChild(src)) {
     if (jsvIsNameWithValue(src))
-      jsvSetFirstChild(dst, jsvGetFirstChild(src));
+      jsvSetFirstChildValue(dst, jsvGetFirstChild(src));
     else
       jsvSetFirstChild(dst, jsvRefRef(jsvGetFirstChild(src)));
   }
@@ -2767,7 +3177,7 @@ JsVar *jsvCopy(JsVar *src, bool copyChildren) {
     if (jsvGetFirstChild(src)) {
       if (jsvIsNameWithValue(src)) {
         // name_int/etc don't need references
-        jsvSetFirstChild(dst, jsvGetFirstChild(src));
+        jsvSetFirstChildValue(dst, jsvGetFirstChild(src));
       } else {
         JsVar *child = jsvLock(jsvGetFirstChild(src));
         JsVar *childCopy = jsvRef(jsvCopy(child, true));
@@ -2829,9 +3239,153 @@ JsVar *jsvCopy(JsVar *src, bool copyChildren) {
   return dst;
 }
 
+#ifdef ESPR_PROPERTY_INDEX
+/* Objects with lots of children get a hidden hash index so that finding a child
+ * doesn't mean walking the whole list. The index is a flat string referenced
+ * from the object's nextSibling (unused for objects otherwise) laid out as:
+ *
+ *   uint32_t count, used; uint16_t tags[capacity]; JsVarRef refs[capacity];
+ *
+ * Slots are found with linear probing from (hash & (capacity-1)). An empty
+ * slot has ref==0 && tag==0, a deleted one has ref==0 && tag!=0. The hash is
+ * only a filter - candidates are always checked against the real name. */
+#define JSV_PROPERTY_INDEX_MIN_CHILDREN 16 ///< Build an index when a lookup walks this many children
+#define JSV_PROPERTY_INDEX_MIN_CAPACITY 32 ///< Smallest index (POWER OF 2)
+#define JSV_PROPERTY_INDEX_HEADER (2*sizeof(uint32_t))
+
+typedef struct {
+  uint32_t *hdr; ///< hdr[0] = live entries, hdr[1] = live+deleted entries
+  size_t capacity;
+  uint16_t *tags;
+  JsVarRef *refs;
+} JsvPropertyIndex;
+
+static uint32_t jsvPropertyIndexHashStr(const char *name) {
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*name)
+    h = (h ^ (unsigned char)*(name++)) * 16777619u;
+  return h;
+}
+
+/// Hash a name (or the value used to look one up). Returns false if it can't go in the index
+static bool jsvPropertyIndexHashVar(JsVar *name, uint32_t *hash) {
+  if (jsvIsString(name)) {
+    uint32_t h = 2166136261u; // must match jsvPropertyIndexHashStr
+    JsvStringIterator it;
+    jsvStringIteratorNew(&it, name, 0);
+    while (jsvStringIteratorHasChar(&it))
+      h = (h ^ (unsigned char)jsvStringIteratorGetCharAndNext(&it)) * 16777619u;
+    jsvStringIteratorFree(&it);
+    *hash = h;
+    return true;
+  }
+  if (jsvIsIntegerish(name)) { // jsvIsBasicVarEqual compares these by varData.integer
+    *hash = ((uint32_t)name->varData.integer * 2654435761u) ^ 0x5BD1E995u;
+    return true;
+  }
+  return false;
+}
+
+static bool jsvPropertyIndexGet(JsVar *obj, JsvPropertyIndex *idx) {
+  JsVarRef ref = jsvGetNextSibling(obj);
+  if (!ref) return false;
+  JsVar *index = jsvGetAddressOf(ref);
+  idx->hdr = (uint32_t*)jsvGetFlatStringPointer(index);
+  idx->capacity = (jsvGetCharactersInVar(index) - JSV_PROPERTY_INDEX_HEADER) / (sizeof(uint16_t)+sizeof(JsVarRef));
+  idx->tags = (uint16_t*)&idx->hdr[2];
+  idx->refs = (JsVarRef*)&idx->tags[idx->capacity];
+  return true;
+}
+
+/// Add an entry - returns false if the index is too full
+static bool jsvPropertyIndexAdd(JsvPropertyIndex *idx, uint32_t hash, JsVarRef ref) {
+  if ((idx->hdr[1]+1)*4 > idx->capacity*3) return false;
+  size_t mask = idx->capacity-1;
+  size_t i = hash & mask;
+  while (idx->refs[i]) i = (i+1) & mask;
+  if (!idx->tags[i]) idx->hdr[1]++; // not reusing a deleted slot
+  idx->hdr[0]++;
+  idx->tags[i] = (uint16_t)(hash >> 16);
+  idx->refs[i] = ref;
+  return true;
+}
+
+/// Find the slot containing 'ref', or -1
+static int jsvPropertyIndexFindRef(JsvPropertyIndex *idx, uint32_t hash, JsVarRef ref) {
+  size_t mask = idx->capacity-1;
+  size_t i = hash & mask;
+  for (size_t n=0; n<idx->capacity && (idx->refs[i] || idx->tags[i]); n++) {
+    if (idx->refs[i] == ref) return (int)i;
+    i = (i+1) & mask;
+  }
+  return -1;
+}
+
+/// (Re)fill the index from the object's children. Returns false if something couldn't be indexed
+static bool jsvPropertyIndexFill(JsVar *obj) {
+  JsvPropertyIndex idx;
+  if (!jsvPropertyIndexGet(obj, &idx)) return false;
+  memset(idx.hdr, 0, JSV_PROPERTY_INDEX_HEADER + idx.capacity*(sizeof(uint16_t)+sizeof(JsVarRef)));
+  JsVarRef childref = jsvGetFirstChild(obj);
+  while (childref) {
+    JsVar *child = jsvGetAddressOf(childref);
+    uint32_t hash;
+    if (!jsvPropertyIndexHashVar(child, &hash) ||
+        !jsvPropertyIndexAdd(&idx, hash, childref))
+      return false;
+    childref = jsvGetNextSibling(child);
+  }
+  return true;
+}
+
+/// Build an index for a big object that doesn't have one yet
+static void jsvPropertyIndexBuild(JsVar *obj) {
+  if (isMemoryBusy || jsvGetRef(obj)==jsvPropertyIndexFailedRef) return;
+  size_t count = 0;
+  JsVarRef childref = jsvGetFirstChild(obj);
+  while (childref) {
+    count++;
+    childref = jsvGetNextSibling(jsvGetAddressOf(childref));
+  }
+  size_t capacity = JSV_PROPERTY_INDEX_MIN_CAPACITY;
+  while (capacity < count*2) capacity <<= 1;
+  size_t length = JSV_PROPERTY_INDEX_HEADER + capacity*(sizeof(uint16_t)+sizeof(JsVarRef));
+  if (!jsvPropertyIndexCanBuild(length)) return;
+  JsVar *index = jsvNewFlatStringOfLength((unsigned int)length);
+  if (!index) {
+    jsvPropertyIndexFailedRef = jsvGetRef(obj);
+    return;
+  }
+  jsvSetNextSibling(obj, jsvGetRef(jsvRef(index)));
+  jsvUnLock(index);
+  if (!jsvPropertyIndexFill(obj)) {
+    jsvPropertyIndexFree(obj);
+    jsvPropertyIndexFailedRef = jsvGetRef(obj);
+  }
+}
+#endif
+
+
+#ifdef ESPR_PROPERTY_INDEX
+/// Called after vars have moved (defrag) to re-point every index at the children's new refs
+static void jsvPropertyIndexRefillAll() {
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *var = jsvGetAddressOf(i);
+    if (jsvIsObject(var) && jsvGetNextSibling(var)) {
+      if (!jsvPropertyIndexFill(var))
+        jsvPropertyIndexFree(var);
+    } else if (jsvIsFlatString(var))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+  }
+}
+#endif
+
 void jsvAddName(JsVar *parent, JsVar *namedChild) {
   namedChild = jsvRef(namedChild); // ref here VERY important as adding to structure!
   assert(jsvIsName(namedChild));
+#ifdef JSV_OBJECT_EPOCH
+  if (jsvIsObject(parent) || jsvIsRoot(parent)) jsvObjectChanged();
+#endif
 
   // update array length
   if (jsvIsArray(parent) && jsvIsInt(namedChild)) {
@@ -2882,6 +3436,16 @@ void jsvAddName(JsVar *parent, JsVar *namedChild) {
     jsvSetFirstChild(parent, r);
     jsvSetLastChild(parent, r);
   }
+#ifdef ESPR_PROPERTY_INDEX
+  JsvPropertyIndex idx;
+  if (jsvIsObject(parent) && jsvPropertyIndexGet(parent, &idx)) {
+    uint32_t hash;
+    // if it's full, drop it - the next lookup will build a bigger one
+    if (!jsvPropertyIndexHashVar(namedChild, &hash) ||
+        !jsvPropertyIndexAdd(&idx, hash, jsvGetRef(namedChild)))
+      jsvPropertyIndexFree(parent);
+  }
+#endif
 }
 
 JsVar *jsvAddNamedChild(JsVar *parent, JsVar *value, const char *name) {
@@ -2912,13 +3476,19 @@ JsVar *jsvSetValueOfName(JsVar *name, JsVar *src) {
     jsvSetFirstChild(name, 0);
   } else if (jsvGetFirstChild(name))
     jsvUnRefRef(jsvGetFirstChild(name)); // free existing
+#ifdef JSV_OBJECT_EPOCH
+  // changing an object's __proto__ (or a prototype, or 'Object' itself) changes property lookups
+  if (jsvIsString(name) && (name->varData.str[0]=='_' || name->varData.str[0]=='p' || name->varData.str[0]=='O') &&
+      (jsvIsStringEqual(name, JSPARSE_INHERITS_VAR) || jsvIsStringEqual(name, JSPARSE_PROTOTYPE_VAR) || jsvIsStringEqual(name, "Object")))
+    jsvObjectChanged();
+#endif
   if (src) {
     if (jsvIsInt(name)) {
       if ((jsvIsInt(src) || jsvIsBoolean(src)) && !jsvIsPin(src)) {
         JsVarInt v = src->varData.integer;
         if (v>=JSVARREF_MIN && v<=JSVARREF_MAX) {
           name->flags = (name->flags & (JsVarFlags)~JSV_VARTYPEMASK) | (jsvIsInt(src) ? JSV_NAME_INT_INT : JSV_NAME_INT_BOOL);
-          jsvSetFirstChild(name, (JsVarRef)v);
+          jsvSetFirstChildValue(name, (JsVarRef)v);
           return name;
         }
       }
@@ -2927,7 +3497,7 @@ JsVar *jsvSetValueOfName(JsVar *name, JsVar *src) {
         JsVarInt v = src->varData.integer;
         if (v>=JSVARREF_MIN && v<=JSVARREF_MAX) {
           name->flags = (name->flags & (JsVarFlags)~JSV_VARTYPEMASK) | (JSV_NAME_STRING_INT_0 + jsvGetCharactersInVar(name));
-          jsvSetFirstChild(name, (JsVarRef)v);
+          jsvSetFirstChildValue(name, (JsVarRef)v);
           return name;
         }
       }
@@ -2939,6 +3509,16 @@ JsVar *jsvSetValueOfName(JsVar *name, JsVar *src) {
   return name;
 }
 
+/// Does the child name match? See jsvFindChildFromString
+static ALWAYS_INLINE bool jsvIsChildNamed(JsVar *child, const char *name, const char *fastCheck, bool superFastCheck, size_t charsInName) {
+  if (*(int*)fastCheck!=*(int*)child->varData.str) // speedy check of first 4 bytes
+    return false;
+  if (superFastCheck) // 4 or less chars, so if 4 chars match, there is no StringExt + length matches, then we're good without jsvIsStringEqual
+    return jsvIsString(child) && !child->varData.ref.lastChild && // integer names can match the first 4 bytes too
+           jsvGetCharactersInVar(child)==charsInName; // no extra stringexts - so it really is that small
+  return jsvIsStringEqual(child, name); // more than 4 chars so we MUST use stringequal
+}
+
 JsVar *jsvFindChildFromString(JsVar *parent, const char *name) {
   /* Pull out first 4 bytes, and ensure that everything
    * is 0 padded so that we can do a nice speedy check. */
@@ -2962,36 +3542,53 @@ JsVar *jsvFindChildFromString(JsVar *parent, const char *name) {
       }
     }
   }
+  size_t charsInName = 0;
+  if (superFastCheck) {
+    while (name[charsInName])
+      charsInName++;
+  }
 
   assert(jsvHasChildren(parent));
-  JsVarRef childref = jsvGetFirstChild(parent);
-  if (!superFastCheck) { // more than 4 chars so we MUST use stringequal
-    while (childref) {
-      // Don't Lock here, just use GetAddressOf - to try and speed up the finding
-      JsVar *child = jsvGetAddressOf(childref);
-      if (*(int*)fastCheck==*(int*)child->varData.str && // speedy check of first 4 bytes
-          jsvIsStringEqual(child, name)) {
-        // found it! unlock parent but leave child locked
-        return jsvLockAgain(child);
+#ifdef ESPR_PROPERTY_INDEX
+  JsvPropertyIndex idx;
+  bool canIndex = jsvIsObject(parent);
+  if (canIndex && jsvPropertyIndexGet(parent, &idx)) {
+    uint32_t hash = jsvPropertyIndexHashStr(name);
+    uint16_t tag = (uint16_t)(hash >> 16);
+    size_t mask = idx.capacity-1;
+    size_t i = hash & mask;
+    for (size_t n=0; n<idx.capacity && (idx.refs[i] || idx.tags[i]); n++) {
+      if (idx.refs[i] && idx.tags[i]==tag) {
+        JsVar *child = jsvGetAddressOf(idx.refs[i]);
+        if (jsvIsChildNamed(child, name, fastCheck, superFastCheck, charsInName))
+          return jsvLockAgain(child);
       }
-      childref = jsvGetNextSibling(child);
+      i = (i+1) & mask;
     }
-  } else { // 4 or less chars, so if 4 chars match, there is no StringExt + length matches, then we're good without jsvIsStringEqual
-    size_t charsInName = 0;
-    while (name[charsInName])
-      charsInName++;
-    while (childref) {
-      JsVar *child = jsvGetAddressOf(childref);
-      if (*(int*)fastCheck==*(int*)child->varData.str &&
-          !child->varData.ref.lastChild &&
-          jsvGetCharactersInVar(child)==charsInName) { // no extra stringexts - so it really is that small
-        // found it! unlock parent but leave child locked
-        return jsvLockAgain(child);
-      }
-      childref = jsvGetNextSibling(child);
+    return 0;
+  }
+  unsigned int childCount = 0;
+#endif
+  JsVarRef childref = jsvGetFirstChild(parent);
+  JsVar *found = 0;
+  while (childref) {
+    // Don't Lock here, just use GetAddressOf - to try and speed up the finding
+    JsVar *child = jsvGetAddressOf(childref);
+    if (jsvIsChildNamed(child, name, fastCheck, superFastCheck, charsInName)) {
+      // found it! unlock parent but leave child locked
+      found = jsvLockAgain(child);
+      break;
     }
+    childref = jsvGetNextSibling(child);
+#ifdef ESPR_PROPERTY_INDEX
+    childCount++;
+#endif
   }
-  return 0;
+#ifdef ESPR_PROPERTY_INDEX
+  if (canIndex && childCount>=JSV_PROPERTY_INDEX_MIN_CHILDREN)
+    jsvPropertyIndexBuild(parent);
+#endif
+  return found;
 }
 
 JsVar *jsvFindOrAddChildFromString(JsVar *parent, const char *name) {
@@ -3056,6 +3653,27 @@ JsVar *jsvAsName(JsVar *var) {
 JsVar *jsvFindChildFromVar(JsVar *parent, JsVar *childName, bool addIfNotFound) {
   JsVar *child;
   JsVarRef childref = jsvGetFirstChild(parent);
+#ifdef ESPR_PROPERTY_INDEX
+  JsvPropertyIndex idx;
+  uint32_t hash;
+  bool canIndex = jsvIsObject(parent) && jsvPropertyIndexHashVar(childName, &hash);
+  if (canIndex && jsvPropertyIndexGet(parent, &idx)) {
+    uint16_t tag = (uint16_t)(hash >> 16);
+    size_t mask = idx.capacity-1;
+    size_t i = hash & mask;
+    for (size_t n=0; n<idx.capacity && (idx.refs[i] || idx.tags[i]); n++) {
+      if (idx.refs[i] && idx.tags[i]==tag) {
+        child = jsvLock(idx.refs[i]);
+        if (jsvIsBasicVarEqual(child, childName))
+          return child;
+        jsvUnLock(child);
+      }
+      i = (i+1) & mask;
+    }
+    childref = 0; // not found - no need to search
+  }
+  unsigned int childCount = 0;
+#endif
 
   // TODO: could split this into separate loops looking for Numeric/String
 
@@ -3063,11 +3681,22 @@ JsVar *jsvFindChildFromVar(JsVar *parent, JsVar *childName, bool addIfNotFound)
     child = jsvLock(childref);
     if (jsvIsBasicVarEqual(child, childName)) {
       // found it! unlock parent but leave child locked
+#ifdef ESPR_PROPERTY_INDEX
+      if (canIndex && childCount>=JSV_PROPERTY_INDEX_MIN_CHILDREN)
+        jsvPropertyIndexBuild(parent);
+#endif
       return child;
     }
     childref = jsvGetNextSibling(child);
     jsvUnLock(child);
+#ifdef ESPR_PROPERTY_INDEX
+    childCount++;
+#endif
   }
+#ifdef ESPR_PROPERTY_INDEX
+  if (canIndex && childCount>=JSV_PROPERTY_INDEX_MIN_CHILDREN)
+    jsvPropertyIndexBuild(parent);
+#endif
 
   child = 0;
   if (addIfNotFound && childName) {
@@ -3085,6 +3714,25 @@ void jsvRemoveChild(JsVar *parent, JsVar *child) {
 #endif
   JsVarRef childref = jsvGetRef(child);
   bool wasChild = false;
+#ifdef JSV_OBJECT_EPOCH
+  if (jsvIsObject(parent) || jsvIsRoot(parent)) jsvObjectChanged();
+#endif
+#ifdef ESPR_SCOPE_SLOTS
+  if (!jsvIsArray(parent)) jsvScopeNameRemovedEpoch++;
+#endif
+#ifdef ESPR_PROPERTY_INDEX
+  JsvPropertyIndex idx;
+  uint32_t hash;
+  if (jsvIsObject(parent) && jsvPropertyIndexGet(parent, &idx) &&
+      jsvPropertyIndexHashVar(child, &hash)) {
+    int i = jsvPropertyIndexFindRef(&idx, hash, childref);
+    if (i>=0) {
+      idx.refs[i] = 0;
+      idx.tags[i] = 1; // mark as deleted
+      idx.hdr[0]--;
+    }
+  }
+#endif
   // unlink from parent
   if (jsvGetFirstChild(parent) == childref) {
     jsvSetFirstChild(parent, jsvGetNextSibling(child));
@@ -3133,6 +3781,9 @@ void jsvRemoveChildAndUnLock(JsVar *parent, JsVar *child) {
 
 void jsvRemoveAllChildren(JsVar *parent) {
   assert(jsvHasChildren(parent));
+#ifdef ESPR_PROPERTY_INDEX
+  if (jsvIsObject(parent)) jsvPropertyIndexFree(parent);
+#endif
   while (jsvGetFirstChild(parent)) {
     JsVar *v = jsvLock(jsvGetFirstChild(parent));
     jsvRemoveChildAndUnLock(parent, v);
@@ -3339,6 +3990,10 @@ static size_t _jsvCountJsVarsUsedRecursive(JsVar *v, bool resetRecursionFlag) {
     }
   } else if (jsvIsFlatString(v))
     count += jsvGetFlatStringBlocks(v);
+#ifdef ESPR_PROPERTY_INDEX
+  if (jsvIsObject(v) && jsvGetNextSibling(v)) // property index
+    count += 1 + jsvGetFlatStringBlocks(jsvGetAddressOf(jsvGetNextSibling(v)));
+#endif
   if (jsvHasCharacterData(v)) {
     JsVarRef childref = jsvGetLastChild(v);
     while (childref) {
@@ -4117,246 +4772,660 @@ void jsvTrace(JsVar *var, int indent) {
 }
 
 
-/** Recursively mark the variable. Return false if it fails due to stack. */
-static bool jsvGarbageCollectMarkUsed(JsVar *var) {
+/* Marking is 'tri-color': JSV_GARBAGE_COLLECT set means a var hasn't been reached yet (white),
+ * vars on jsvGCMarkStack have been reached but their children haven't been marked yet (grey),
+ * and everything else has been fully marked (black). If the stack overflows we just remember
+ * the lowest var that didn't fit in jsvGCMarkOverflowRef and jsvGarbageCollectRescanNext will
+ * find the children that were missed, so marking never fails for lack of execution stack or memory. */
+static JsVarRef jsvGCMarkStack[JSV_GC_MARK_STACK_SIZE];
+static unsigned int jsvGCMarkStackCount = 0;
+static JsVarRef jsvGCMarkOverflowRef = 0;
+static JsVarRef jsvGCRescanRef = 0; ///< the next var to check when finding the children that were missed (0 = not rescanning)
+#ifndef SAVE_ON_FLASH
+/// Statistics about garbage collection pauses - see jsvGarbageCollectGetStats
+static struct {
+  unsigned int collections; ///< completed garbage collections
+  unsigned int steps; ///< incremental steps (ESPR_GC_INCREMENTAL)
+  JsSysTime lastPause, maxPause, totalTime;
+} jsvGCStats;
+#endif
+
+/// Mark the var as used. If it may reference other vars (so needs scanning) return it
+static JsVar *jsvGarbageCollectMark(JsVarRef ref) {
+  if (!ref || ref>jsVarsSize) return 0;
+  JsVar *var = jsvGetAddressOf(ref);
+  if (!(var->flags & JSV_GARBAGE_COLLECT)) return 0; // already marked (or unused)
   var->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
-  JsVarRef child;
-  JsVar *childVar;
-
-  if (jsvHasStringExt(var)) {
-    // non-recursively scan strings
-    child = jsvGetLastChild(var);
-    while (child) {
-      childVar = jsvGetAddressOf(child);
-      childVar->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
-      child = jsvGetLastChild(childVar);
+  char f = var->flags&JSV_VARTYPEMASK;
+  if ((JSV_HAS_STRING_EXT(f) && var->varData.ref.lastChild) ||
+      (JSV_IS_NAME(f) && var->varData.ref.nextSibling) ||
+      ((JSV_HAS_SINGLE_CHILD(f) || JSV_HAS_CHILDREN(f)) && var->varData.ref.firstChild))
+    return var;
+  return 0; // doesn't reference anything
+}
+
+/// Queue up a var that has been marked to be scanned
+static void jsvGarbageCollectPush(JsVarRef ref) {
+  if (jsvGCMarkStackCount < JSV_GC_MARK_STACK_SIZE)
+    jsvGCMarkStack[jsvGCMarkStackCount++] = ref;
+  else if (!jsvGCMarkOverflowRef || ref<jsvGCMarkOverflowRef)
+    jsvGCMarkOverflowRef = ref;
+}
+
+/// Mark the var as used, and if it may reference other vars, queue it up to be scanned
+static void jsvGarbageCollectMarkRef(JsVarRef ref) {
+  if (jsvGarbageCollectMark(ref))
+    jsvGarbageCollectPush(ref);
+}
+
+/** Mark everything the var references, then carry on with the last thing it referenced
+ * rather than putting it on the mark stack - up to 'budget' vars. The children of an
+ * object/array/function are a linked list of names, so only the first is marked here
+ * and each name marks its next sibling before its value is scanned - which means the
+ * mark stack only grows with how deeply nested our data is. Returns the remaining budget. */
+static unsigned int jsvGarbageCollectScan(JsVar *var, unsigned int budget) {
+  while (var) {
+    if (!budget) { // out of time - scan this one later
+      jsvGarbageCollectPush(jsvGetRef(var));
+      return 0;
     }
-  }
-  // intentionally no else
-  if (jsvHasSingleChild(var)) {
-    if (jsvGetFirstChild(var)) {
-      childVar = jsvGetAddressOf(jsvGetFirstChild(var));
-      if (childVar->flags & JSV_GARBAGE_COLLECT)
-        if (!jsvGarbageCollectMarkUsed(childVar)) return false;
+    budget--;
+    char f = var->flags&JSV_VARTYPEMASK;
+    if (JSV_HAS_STRING_EXT(f)) {
+      // StringExts have no children, so just clear them
+      JsVarRef child = jsvGetLastChild(var);
+      while (child) {
+        JsVar *childVar = jsvGetAddressOf(child);
+        childVar->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+        child = jsvGetLastChild(childVar);
+      }
     }
-  } else if (jsvHasChildren(var)) {
-    if (jsuGetFreeStack() < 256) return false;
-
-    child = jsvGetFirstChild(var);
-    while (child) {
-      childVar = jsvGetAddressOf(child);
-      if (childVar->flags & JSV_GARBAGE_COLLECT)
-        if (!jsvGarbageCollectMarkUsed(childVar)) return false;
-      child = jsvGetNextSibling(childVar);
+    JsVar *next = 0;
+    // intentionally no else
+    if (JSV_HAS_CHILDREN(f)) {
+#ifdef ESPR_PROPERTY_INDEX
+      // the object's property index is a flat string, so has no children to mark
+      if (jsvIsObject(var) && jsvGetNextSibling(var))
+        jsvGetAddressOf(jsvGetNextSibling(var))->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+#endif
+      next = jsvGarbageCollectMark(jsvGetFirstChild(var));
+    } else {
+      if (JSV_IS_NAME(f))
+        jsvGarbageCollectMarkRef(jsvGetNextSibling(var));
+      if (JSV_HAS_SINGLE_CHILD(f))
+        next = jsvGarbageCollectMark(jsvGetFirstChild(var));
     }
+    var = next;
+  }
+  return budget;
+}
+
+/// Scan the var at the top of the mark stack (and what it references, up to 'budget' vars)
+static unsigned int jsvGarbageCollectScanNext(unsigned int budget) {
+  JsVar *var = jsvGetAddressOf(jsvGCMarkStack[--jsvGCMarkStackCount]);
+  if ((var->flags&JSV_VARTYPEMASK) == JSV_UNUSED) // with ESPR_GC_INCREMENTAL it may have been freed since it was marked
+    return budget ? budget-1 : 0;
+  return jsvGarbageCollectScan(var, budget);
+}
+
+/** The mark stack overflowed, so some marked vars may not have had their children marked.
+ * Scan the marked var at jsvGCRescanRef (working up from the lowest one that was missed) to
+ * find them, up to 'budget' vars. Returns the remaining budget */
+static unsigned int jsvGarbageCollectRescanNext(unsigned int budget) {
+  if (jsvGCMarkOverflowRef) {
+    // if we missed one we've already gone past, start again from there
+    if (!jsvGCRescanRef || jsvGCMarkOverflowRef<jsvGCRescanRef)
+      jsvGCRescanRef = jsvGCMarkOverflowRef;
+    jsvGCMarkOverflowRef = 0;
+  }
+  if (jsvGCRescanRef>jsVarsSize) { // done
+    jsvGCRescanRef = 0;
+    return budget-1;
+  }
+  JsVar *var = jsvGetAddressOf(jsvGCRescanRef);
+  jsvGCRescanRef++;
+  // if we have a flat string, skip that many blocks
+  if (jsvIsFlatString(var))
+    jsvGCRescanRef = (JsVarRef)(jsvGCRescanRef+jsvGetFlatStringBlocks(var));
+  if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED && !(var->flags & JSV_GARBAGE_COLLECT))
+    return jsvGarbageCollectScan(var, budget);
+  return budget-1;
+}
+
+/// Are there vars that have been marked but still need scanning?
+static bool jsvGarbageCollectMarkPending() {
+  return jsvGCMarkStackCount || jsvGCMarkOverflowRef || jsvGCRescanRef;
+}
+
+/** Scan up to 'budget' vars that have been marked but not scanned. Returns the remaining
+ * budget - if it's nonzero, marking is complete */
+static unsigned int jsvGarbageCollectDrain(unsigned int budget) {
+  while (budget) {
+    if (jsvGCMarkStackCount)
+      budget = jsvGarbageCollectScanNext(budget);
+    else if (jsvGCMarkOverflowRef || jsvGCRescanRef)
+      budget = jsvGarbageCollectRescanNext(budget);
+    else
+      break;
   }
+  return budget;
+}
 
-  return true;
+/// Clear the mark stack, ready to start marking
+static void jsvGarbageCollectMarkReset() {
+  jsvGCMarkStackCount = 0;
+  jsvGCMarkOverflowRef = 0;
+  jsvGCRescanRef = 0;
 }
 
-/** Run a garbage collection sweep - return nonzero if things have been freed */
-int jsvGarbageCollect() {
-  if (isMemoryBusy) return 0;
-  isMemoryBusy = MEMBUSY_GC;
-  JsVarRef i;
-  // Add GC flags to anything that is currently used
-  for (i=1;i<=jsVarsSize;i++)  {
-    JsVar *var = jsvGetAddressOf(i);
-    if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED) { // if it is not unused
-      var->flags |= (JsVarFlags)JSV_GARBAGE_COLLECT;
-      // if we have a flat string, skip that many blocks
-      if (jsvIsFlatString(var))
-        i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
-    }
-  }
-  /* recursively remove anything that is referenced from a var that is locked. */
-  for (i=1;i<=jsVarsSize;i++)  {
-    JsVar *var = jsvGetAddressOf(i);
-    if ((var->flags & JSV_GARBAGE_COLLECT) && // not already GC'd
-        jsvGetLocks(var)>0) { // or it is locked
-      if (!jsvGarbageCollectMarkUsed(var)) {
-        // this could fail due to stack exhausted (eg big linked list)
-        // JSV_GARBAGE_COLLECT are left set, but not a big problem as next GC will clear them
-        isMemoryBusy = MEM_NOT_BUSY;
-        return 0;
-      }
-    }
+/// Add GC flags to the var at 'i' if it is used, and return the index of the next var
+static JsVarRef jsvGarbageCollectFlag(JsVarRef i) {
+  JsVar *var = jsvGetAddressOf(i);
+  if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED) { // if it is not unused
+    var->flags |= (JsVarFlags)JSV_GARBAGE_COLLECT;
     // if we have a flat string, skip that many blocks
     if (jsvIsFlatString(var))
       i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
   }
+  return (JsVarRef)(i+1);
+}
+
+/// If the var at 'i' is locked (and so in use), mark it. Return the index of the next var
+static JsVarRef jsvGarbageCollectMarkIfLocked(JsVarRef i) {
+  JsVar *var = jsvGetAddressOf(i);
+  if ((var->flags & JSV_GARBAGE_COLLECT) && // not already marked
+      jsvGetLocks(var)>0) // and it is locked
+    jsvGarbageCollectMarkRef(i);
+  // if we have a flat string, skip that many blocks
+  if (jsvIsFlatString(var))
+    i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+  return (JsVarRef)(i+1);
+}
+
+/** The var at 'i' wasn't marked, so free it (but don't add it to the free list).
+ * Returns how many vars were freed */
+static unsigned int jsvGarbageCollectFree(JsVarRef i) {
+  JsVar *var = jsvGetAddressOf(i);
+  if (jsvIsFlatString(var)) {
+    // If we're a flat string, there are more blocks to free.
+    unsigned int count = (unsigned int)jsvGetFlatStringBlocks(var);
+    // Free the first block, and subsequent blocks
+    JsVarRef end = (JsVarRef)(i+count);
+    for (;i<=end;i++)
+      jsvGetAddressOf(i)->flags = JSV_UNUSED;
+    return count+1;
+  }
+  // otherwise just free 1 block
+  if (jsvHasSingleChild(var)) {
+    /* If this had a child that wasn't listed for GC then we need to
+     * unref it. Everything else is fine because it'll disappear anyway.
+     * We don't have to check if we should free this other variable
+     * here because we know the GC picked up it was referenced from
+     * somewhere else. */
+    JsVarRef ch = jsvGetFirstChild(var);
+    if (ch) {
+      JsVar *child = jsvGetAddressOf(ch); // not locked
+      if (child->flags!=JSV_UNUSED && // not already GC'd!
+          !(child->flags&JSV_GARBAGE_COLLECT)) // not marked for GC
+        jsvUnRef(child);
+    }
+  }
+  /* Sanity checks here. We're making sure that any variables that are
+   * linked from this one have either already been garbage collected or
+   * are marked for GC */
+  assert(!jsvHasChildren(var) || !jsvGetFirstChild(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetFirstChild(var))) ||
+      jsvGetAddressOf(jsvGetFirstChild(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetFirstChild(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvHasChildren(var) || !jsvGetLastChild(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetLastChild(var))) ||
+      jsvGetAddressOf(jsvGetLastChild(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetLastChild(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvIsName(var) || !jsvGetPrevSibling(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetPrevSibling(var))) ||
+      jsvGetAddressOf(jsvGetPrevSibling(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetPrevSibling(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvIsName(var) || !jsvGetNextSibling(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetNextSibling(var))) ||
+      jsvGetAddressOf(jsvGetNextSibling(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetNextSibling(var))->flags&JSV_GARBAGE_COLLECT));
+  // free!
+  var->flags = JSV_UNUSED;
+  return 1;
+}
+
+/// Vars have been freed by the GC, so forget anything that may refer to them
+static void jsvGarbageCollectFreed() {
+#ifdef ESPR_STRING_TAIL_CACHE
+  jsvStringTailForgetAll();
+#endif
+#ifdef JSV_OBJECT_EPOCH
+  jsvObjectChanged(); // freed vars may be reused
+#endif
+#ifdef ESPR_PROPERTY_INDEX
+  // Live vars don't move or lose children in a GC, so existing indexes stay valid
+  jsvPropertyIndexFailedRef = 0; // we might have space for an index now
+#endif
+}
+
+/// Add GC flags to anything that is currently used, and clear the mark stack
+static void jsvGarbageCollectFlagAll() {
+  jsvGarbageCollectMarkReset();
+  JsVarRef i = 1;
+  while (i<=jsVarsSize)
+    i = jsvGarbageCollectFlag(i);
+}
+
+/// Mark anything that is locked (and so in use), and everything that can be reached from it
+static void jsvGarbageCollectMarkLocked() {
+  JsVarRef i = 1;
+  while (i<=jsVarsSize) {
+    i = jsvGarbageCollectMarkIfLocked(i);
+    jsvGarbageCollectDrain(0xFFFFFFFF);
+  }
+}
+
+/** Free everything that still has JSV_GARBAGE_COLLECT set, and return how many vars were freed */
+static unsigned int jsvGarbageCollectSweep() {
   /* now sweep for things that we can GC!
    * Also update the free list - this means that every new variable that
    * gets allocated gets allocated towards the start of memory, which
    * hopefully helps compact everything towards the start. */
+  JsVarRef i;
   unsigned int freedCount = 0;
   jsVarFirstEmpty = 0;
   JsVar *lastEmpty = 0;
   for (i=1;i<=jsVarsSize;i++)  {
     JsVar *var = jsvGetAddressOf(i);
-    if (var->flags & JSV_GARBAGE_COLLECT) {
-      if (jsvIsFlatString(var)) {
-        // If we're a flat string, there are more blocks to free.
-        unsigned int count = (unsigned int)jsvGetFlatStringBlocks(var);
-        freedCount+=count;
-        // Free the first block
-        var->flags = JSV_UNUSED;
-        // add this to our free list
-        if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-        else jsVarFirstEmpty = i;
-        lastEmpty = var;
-        // free subsequent blocks
-        while (count-- > 0) {
-          i++;
-          var = jsvGetAddressOf((JsVarRef)(i));
-          var->flags = JSV_UNUSED;
-          // add this to our free list
-          if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-          else jsVarFirstEmpty = i;
-          lastEmpty = var;
-        }
-      } else {
-        // otherwise just free 1 block
-        if (jsvHasSingleChild(var)) {
-          /* If this had a child that wasn't listed for GC then we need to
-           * unref it. Everything else is fine because it'll disappear anyway.
-           * We don't have to check if we should free this other variable
-           * here because we know the GC picked up it was referenced from
-           * somewhere else. */
-          JsVarRef ch = jsvGetFirstChild(var);
-          if (ch) {
-            JsVar *child = jsvGetAddressOf(ch); // not locked
-            if (child->flags!=JSV_UNUSED && // not already GC'd!
-                !(child->flags&JSV_GARBAGE_COLLECT)) // not marked for GC
-              jsvUnRef(child);
-          }
-        }
-        /* Sanity checks here. We're making sure that any variables that are
-         * linked from this one have either already been garbage collected or
-         * are marked for GC */
-        assert(!jsvHasChildren(var) || !jsvGetFirstChild(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetFirstChild(var))) ||
-            jsvGetAddressOf(jsvGetFirstChild(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetFirstChild(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvHasChildren(var) || !jsvGetLastChild(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetLastChild(var))) ||
-            jsvGetAddressOf(jsvGetLastChild(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetLastChild(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvIsName(var) || !jsvGetPrevSibling(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetPrevSibling(var))) ||
-            jsvGetAddressOf(jsvGetPrevSibling(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetPrevSibling(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvIsName(var) || !jsvGetNextSibling(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetNextSibling(var))) ||
-            jsvGetAddressOf(jsvGetNextSibling(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetNextSibling(var))->flags&JSV_GARBAGE_COLLECT));
-        // free!
-        var->flags = JSV_UNUSED;
-        // add this to our free list
-        if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-        else jsVarFirstEmpty = i;
-        lastEmpty = var;
-        freedCount++;
-      }
-    } else if (jsvIsFlatString(var)) {
+    if (var->flags & JSV_GARBAGE_COLLECT)
+      freedCount += jsvGarbageCollectFree(i); // these are now unused, so get added to the free list below
+    if (jsvIsFlatString(var)) {
       // if we have a flat string, skip forward that many blocks
       i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
     } else if (var->flags == JSV_UNUSED) {
-      // this is already free - add it to the free list
+      // this is free - add it to the free list
       if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
       else jsVarFirstEmpty = i;
       lastEmpty = var;
     }
   }
   if (lastEmpty) jsvSetNextSibling(lastEmpty, 0);
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunsRebuild(); // the free list is in order, so now is a good time to find runs of free vars
+#endif
+  if (freedCount) jsvGarbageCollectFreed();
+  return freedCount;
+}
+
+#ifndef SAVE_ON_FLASH
+static void jsvGarbageCollectAddPause(JsSysTime time) {
+  jsvGCStats.lastPause = time;
+  if (time > jsvGCStats.maxPause) jsvGCStats.maxPause = time;
+  jsvGCStats.totalTime += time;
+}
+
+/// Return an object containing statistics about garbage collection and the time it has paused execution for
+JsVar *jsvGarbageCollectGetStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+  jsvObjectSetChildAndUnLock(obj, "collections", jsvNewFromInteger((JsVarInt)jsvGCStats.collections));
+#ifdef ESPR_GC_INCREMENTAL
+  jsvObjectSetChildAndUnLock(obj, "steps", jsvNewFromInteger((JsVarInt)jsvGCStats.steps));
+  jsvObjectSetChildAndUnLock(obj, "inProgress", jsvNewFromBool(jsvGCPhase!=JSV_GC_IDLE));
+#endif
+  jsvObjectSetChildAndUnLock(obj, "lastPause", jsvNewFromFloat(jshGetMillisecondsFromTime(jsvGCStats.lastPause)));
+  jsvObjectSetChildAndUnLock(obj, "maxPause", jsvNewFromFloat(jshGetMillisecondsFromTime(jsvGCStats.maxPause)));
+  jsvObjectSetChildAndUnLock(obj, "totalTime", jsvNewFromFloat(jshGetMillisecondsFromTime(jsvGCStats.totalTime)));
+  return obj;
+}
+#endif
+
+/** Run a garbage collection sweep - return nonzero if things have been freed */
+int jsvGarbageCollect() {
+  if (isMemoryBusy) return 0;
+  isMemoryBusy = MEMBUSY_GC;
+#ifndef SAVE_ON_FLASH
+  JsSysTime startTime = jshGetSystemTime();
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCPhase = JSV_GC_IDLE; // abandon any incremental GC - we're doing it all now
+#endif
+  jsvGarbageCollectFlagAll();
+  /* mark anything that is referenced from a var that is locked. */
+  jsvGarbageCollectMarkLocked();
+  unsigned int freedCount = jsvGarbageCollectSweep();
+#ifndef SAVE_ON_FLASH
+  jsvGCStats.collections++;
+  jsvGarbageCollectAddPause(jshGetSystemTime() - startTime);
+#endif
   isMemoryBusy = MEM_NOT_BUSY;
   return (int)freedCount;
 }
 
+#ifdef ESPR_GC_INCREMENTAL
+/** A reference to 'ref' is being written into a var (or 'ref' is being locked) and the var may
+ * already have been scanned by the incremental GC - so make sure 'ref' gets marked */
+static void jsvGarbageCollectWriteBarrier(JsVarRef ref) {
+  jsvGarbageCollectMarkRef(ref);
+}
+
+/// Vars from 'ref' onwards have just been reused for a flat string, so they mustn't be looked at
+static void jsvGarbageCollectForget(JsVarRef ref, size_t blocks) {
+  for (unsigned int i=0;i<jsvGCMarkStackCount;i++)
+    if (jsvGCMarkStack[i]>=ref && jsvGCMarkStack[i]<ref+blocks)
+      jsvGCMarkStack[i] = jsvGCMarkStack[--jsvGCMarkStackCount];
+  // don't leave any of our positions in the string's data
+  JsVarRef end = (JsVarRef)(ref+blocks);
+  if (jsvGCCursor>ref && jsvGCCursor<end) jsvGCCursor = end;
+  if (jsvGCRescanRef>ref && jsvGCRescanRef<end) jsvGCRescanRef = end;
+  if (jsvGCMarkOverflowRef>ref && jsvGCMarkOverflowRef<end) jsvGCMarkOverflowRef = end;
+}
+
+/** The unmarked var at jsvGCCursor is garbage, so free it and move on. The free list is
+ * in use, so this just adds the var to the start of it. Returns how many vars were freed */
+static unsigned int jsvGarbageCollectSweepNext() {
+  JsVarRef i = jsvGCCursor;
+  JsVar *var = jsvGetAddressOf(i);
+  if (!(var->flags & JSV_GARBAGE_COLLECT)) {
+    jsvGCCursor++;
+    // if we have a flat string, skip forward that many blocks
+    if (jsvIsFlatString(var))
+      jsvGCCursor = (JsVarRef)(jsvGCCursor+jsvGetFlatStringBlocks(var));
+    return 0;
+  }
+  unsigned int count = jsvGarbageCollectFree(i);
+  jsvGCCursor = (JsVarRef)(i+count);
+  // add to the free list in reverse, so any flat string's blocks end up in order
+  jshInterruptOff(); // to allow vars to be allocated in an IRQ
+  i = jsvGCCursor;
+  while (i-- > jsvGCCursor-count) {
+    jsvSetNextSibling(jsvGetAddressOf(i), jsVarFirstEmpty);
+    jsVarFirstEmpty = i;
+  }
+  touchedFreeList = true;
+  jshInterruptOn();
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunsAdd(0, jsVarFirstEmpty, count);
+#endif
+  return count;
+}
+
+/** Do a bounded amount of garbage collection (looking at around 'budget' vars) so that
+ * collection can be spread over several calls from the idle loop. This starts a new
+ * collection if one isn't already in progress.
+ *
+ * Each phase (flagging used vars, marking from locked vars, and sweeping) works through
+ * memory from jsvGCCursor, carrying on from there next time. While marking, writing a
+ * reference or locking a var marks it (see jsvGarbageCollectWriteBarrier) so nothing that's
+ * in use can be missed because of what happened between steps. Vars that are created
+ * while marking or sweeping aren't flagged, so will always be kept until the next collection.
+ * Returns the number of vars freed */
+int jsvGarbageCollectStep(unsigned int budget) {
+  if (isMemoryBusy) return 0;
+  isMemoryBusy = MEMBUSY_GC;
+#ifndef SAVE_ON_FLASH
+  JsSysTime startTime = jshGetSystemTime();
+#endif
+  unsigned int freedCount = 0;
+  if (jsvGCPhase==JSV_GC_IDLE) {
+    jsvGarbageCollectMarkReset();
+    jsvGCPhase = JSV_GC_FLAGGING;
+    jsvGCCursor = 1;
+  }
+  while (budget) {
+    if (jsvGCPhase==JSV_GC_MARKING && jsvGarbageCollectMarkPending()) {
+      budget = jsvGarbageCollectDrain(budget);
+    } else if (jsvGCCursor<=jsVarsSize) {
+      budget--;
+      if (jsvGCPhase==JSV_GC_FLAGGING)
+        jsvGCCursor = jsvGarbageCollectFlag(jsvGCCursor);
+      else if (jsvGCPhase==JSV_GC_MARKING)
+        jsvGCCursor = jsvGarbageCollectMarkIfLocked(jsvGCCursor);
+      else
+        freedCount += jsvGarbageCollectSweepNext();
+    } else if (jsvGCPhase==JSV_GC_FLAGGING) {
+      jsvGCPhase = JSV_GC_MARKING; // from now on jsvGarbageCollectWriteBarrier marks anything that is referenced
+      jsvGCCursor = 1;
+    } else if (jsvGCPhase==JSV_GC_MARKING) {
+      jsvGCPhase = JSV_GC_SWEEPING; // everything in use has been marked
+      jsvGCCursor = 1;
+    } else {
+      jsvGCPhase = JSV_GC_IDLE;
 #ifndef SAVE_ON_FLASH
+      jsvGCStats.collections++;
+#endif
+      break;
+    }
+  }
+  if (freedCount) jsvGarbageCollectFreed();
+#ifndef SAVE_ON_FLASH
+  jsvGCStats.steps++;
+  jsvGarbageCollectAddPause(jshGetSystemTime() - startTime);
+#endif
+  isMemoryBusy = MEM_NOT_BUSY;
+  return (int)freedCount;
+}
+
+/// Is an incremental garbage collection in progress?
+bool jsvGarbageCollectInProgress() {
+  return jsvGCPhase!=JSV_GC_IDLE;
+}
+#endif
+
+#ifndef SAVE_ON_FLASH
+/* jsvDefragment moves every var that isn't pinned down into the lowest free space, including
+ * flat strings, so that free memory ends up in one big area at the top. A var is pinned if:
+ *
+ * - It is locked. Anything holding a native pointer to a var or its data (eg. from
+ *   jsvGetFlatStringPointer) must keep it locked while the pointer is in use
+ * - It has JSV_ADDRESSED set, because its address (or its data's) has been given out, eg.
+ *   with E.getAddressOf for use with peek/poke. It stays where it is until it's freed
+ * - It is the backing string of a locked ArrayBuffer/typed array (as pointers from
+ *   jsvGetDataPointer/jsvGetArrayBufferPointer are often kept with only the view locked)
+ * - It's a buffer being read/written by a utility timer task (eg. Waveform), as these
+ *   are used from an IRQ by ref and address
+ * - It's referenced by ref from C code (timerArray/watchArray)
+ *
+ * While defragmenting, pinned vars have JSV_GARBAGE_COLLECT set (after a GC it's clear for
+ * all vars that are in use). Vars are moved in batches of the topmost JSV_DEFRAG_BATCH movable
+ * vars, each into the lowest free space before it. When a var is moved, the block it moved
+ * from is marked JSV_UNUSED with its nextSibling pointing to the new location, and isn't
+ * reused until we're done. Nothing in use can reference a free block, so at the end one pass
+ * over memory can update every reference. */
+#define JSV_DEFRAG_BATCH 256 // POWER OF 2
+
+/// Pin a var (and if it's a string, the rest of it) so jsvDefragment won't move it
+static void jsvDefragPinRef(JsVarRef ref) {
+  while (ref) {
+    JsVar *v = jsvGetAddressOf(ref);
+    v->flags |= JSV_GARBAGE_COLLECT;
+    ref = jsvHasStringExt(v) ? jsvGetLastChild(v) : 0;
+  }
+}
+
+/// utilTimerGetLastTask callback to pin the buffers used by timer tasks
+static bool jsvDefragPinTimerTask(UtilTimerTask *task, void *data) {
+  NOT_USED(data);
+  if (UET_IS_BUFFER_EVENT(task->type)) {
+    jsvDefragPinRef(task->data.buffer.currentBuffer);
+    jsvDefragPinRef(task->data.buffer.nextBuffer);
+  }
+  return false; // keep going through all tasks
+}
+
+/// Can this var be moved by jsvDefragment?
+static bool jsvDefragIsMovable(JsVar *v) {
+  return (v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED && !(v->flags&(JSV_GARBAGE_COLLECT|JSV_ADDRESSED)) && jsvGetLocks(v)==0;
+}
+
+/** Take 'blocks' contiguous free vars (aligned for a flat string if blocks>1) that are
+ * before 'before' from the free list. Returns 0 if there aren't any */
+static JsVarRef jsvDefragTakeFree(size_t blocks, JsVarRef before) {
+  JsVarRef beforeStart = 0, start = 0, prev = 0;
+  JsVar *prevVar = 0;
+  size_t count = 0;
+  JsVarRef curr = jsVarFirstEmpty;
+  while (curr && curr<before) {
+    JsVar *currVar = jsvGetAddressOf(curr);
+#ifdef RESIZABLE_JSVARS
+    if (count && currVar==prevVar+1) {
+#else
+    if (count && curr==prev+1) {
+#endif
+      count++;
+    } else {
+      // this block is not immediately after the last - restart run
+      beforeStart = prev;
+      start = curr;
+      // Check to see if the next block is aligned on a 4 byte boundary or not
+      count = (blocks==1 || (curr!=jsVarsSize && !(((size_t)jsvGetAddressOf(curr+1))&3))) ? 1 : 0;
+    }
+    if (count && count>=blocks) {
+      JsVarRef next = jsvGetNextSibling(currVar);
+      if (beforeStart) jsvSetNextSibling(jsvGetAddressOf(beforeStart), next);
+      else jsVarFirstEmpty = next;
+      return start;
+    }
+    prev = curr;
+    prevVar = currVar;
+    curr = jsvGetNextSibling(currVar);
+  }
+  return 0;
+}
+
+/// If 'ref' is to a var that has been moved, return where it's moved to
+static JsVarRef jsvDefragForward(JsVarRef ref) {
+  while (ref) {
+    JsVar *v = jsvGetAddressOf(ref);
+    if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) break;
+    ref = jsvGetNextSibling(v);
+  }
+  return ref;
+}
+
+/// Update all references to vars that have been moved
+static void jsvDefragUpdateRefs() {
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *v = jsvGetAddressOf(i);
+    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) continue;
+    if (jsvIsFlatString(v)) {
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(v)); // skip forward
+      continue;
+    }
+    if (jsvHasSingleChild(v))
+      jsvSetFirstChild(v, jsvDefragForward(jsvGetFirstChild(v)));
+    if (jsvHasStringExt(v))
+      jsvSetLastChild(v, jsvDefragForward(jsvGetLastChild(v)));
+    if (jsvHasChildren(v)) {
+      jsvSetFirstChild(v, jsvDefragForward(jsvGetFirstChild(v)));
+      jsvSetLastChild(v, jsvDefragForward(jsvGetLastChild(v)));
+#ifdef ESPR_PROPERTY_INDEX
+      if (jsvIsObject(v))
+        jsvSetNextSibling(v, jsvDefragForward(jsvGetNextSibling(v)));
+#endif
+    }
+    if (jsvIsName(v)) {
+      jsvSetNextSibling(v, jsvDefragForward(jsvGetNextSibling(v)));
+      jsvSetPrevSibling(v, jsvDefragForward(jsvGetPrevSibling(v)));
+    }
+  }
+}
+
+/** Move a batch of the topmost movable vars before 'limit' down into free space, and set
+ * 'limit' to the lowest one. Returns the number of vars looked at (if 0, we're finished) */
+static unsigned int jsvDefragBatch(JsVarRef *limit) {
+  JsVarRef defragVars[JSV_DEFRAG_BATCH];
+  memset(defragVars, 0, sizeof(defragVars));
+  unsigned int defragVarIdx = 0;
+  unsigned int count = 0;
+  // Fill defragVars with the last movable vars (only vars after the first free one can move down)
+  if (!jsVarFirstEmpty) return 0;
+  for (JsVarRef i=jsVarFirstEmpty+1;i<*limit;i++) {
+    JsVar *v = jsvGetAddressOf(i);
+    if (jsvDefragIsMovable(v)) {
+      defragVars[defragVarIdx] = i;
+      defragVarIdx = (defragVarIdx+1) & (JSV_DEFRAG_BATCH-1);
+      count++;
+    }
+    if (jsvIsFlatString(v))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(v)); // skip forward
+  }
+  if (count>JSV_DEFRAG_BATCH) count=JSV_DEFRAG_BATCH;
+  // Now move them, topmost first
+  for (unsigned int n=0;n<count;n++) {
+    defragVarIdx = (defragVarIdx-1) & (JSV_DEFRAG_BATCH-1);
+    JsVarRef fromRef = defragVars[defragVarIdx];
+    *limit = fromRef;
+    JsVar *from = jsvGetAddressOf(fromRef);
+    size_t blocks = jsvIsFlatString(from) ? 1+jsvGetFlatStringBlocks(from) : 1;
+    JsVarRef toRef = jsvDefragTakeFree(blocks, fromRef);
+    if (!toRef) continue; // there's no space below - leave it where it is
+    // relocate!
+    JsVar *to = jsvGetAddressOf(toRef);
+    memcpy((void*)to, (void*)from, blocks*sizeof(JsVar));
+    for (size_t b=0;b<blocks;b++)
+      from[b].flags = JSV_UNUSED;
+    jsvSetNextSibling(from, toRef); // so we can find where it went
+  }
+  // bump watchdog just in case it took too long
+  jshKickWatchDog();
+  jshKickSoftWatchDog();
+  return count;
+}
+
 void jsvDefragment() {
-  /* FIXME: we should surely be able to go through without `defragVars`,
-  and just work from the beginning to the end. We really need to be able
-  to move flat strings: https://github.com/espruino/Espruino/issues/1740 */
-  // garbage collect - removes cruft
-  // also puts free list in order
+  if (isMemoryBusy) return;
+  // garbage collect - removes cruft, puts free list in order and clears JSV_GARBAGE_COLLECT
   jsvGarbageCollect();
-  // Fill defragVars with defraggable variables
+#ifdef JSV_OBJECT_EPOCH
+  jsvObjectChanged(); // vars are about to move
+#endif
+  // Pin everything that we know is being used by address or by ref from C
+  utilTimerGetLastTask(jsvDefragPinTimerTask, 0, 0);
   jshInterruptOff();
-  const int DEFRAGVARS = 256; // POWER OF 2
-  JsVarRef defragVars[DEFRAGVARS];
-  memset(defragVars, 0, sizeof(defragVars));
-  int defragVarIdx = 0;
-  for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
-    JsVarRef vr = (JsVarRef)(i+1);
-    JsVar *v = _jsvGetAddressOf(vr);
+  if (timerArray) jsvDefragPinRef(timerArray);
+  if (watchArray) jsvDefragPinRef(watchArray);
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *v = jsvGetAddressOf(i);
+    if (jsvIsArrayBuffer(v) && jsvGetLocks(v)) {
+      JsVarRef backing = jsvGetFirstChild(v);
+      while (backing && jsvIsArrayBuffer(jsvGetAddressOf(backing)))
+        backing = jsvGetFirstChild(jsvGetAddressOf(backing));
+      jsvDefragPinRef(backing);
+    } else if (jsvIsFlatString(v))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(v)); // skip forward
+  }
+  // Now move everything we can, then point everything at where vars have moved to
+  JsVarRef limit = (JsVarRef)(jsVarsSize+1);
+  while (jsvDefragBatch(&limit));
+  jsvDefragUpdateRefs();
+  // Vars we moved away from are now free
+  jsvCreateEmptyVarList();
+  // Unpin
+  for (JsVarRef i=1;i<=jsVarsSize;i++) {
+    JsVar *v = jsvGetAddressOf(i);
     if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) {
-      if (jsvIsFlatString(v)) {
-        i += (unsigned int)jsvGetFlatStringBlocks(v); // skip forward
-      } else if (jsvGetLocks(v)==0) {
-        defragVars[defragVarIdx] = vr;
-        defragVarIdx = (defragVarIdx+1) & (DEFRAGVARS-1);
-        // why do we roll over and not stop?
-      }
+      v->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+      if (jsvIsFlatString(v))
+        i = (JsVarRef)(i+jsvGetFlatStringBlocks(v)); // skip forward
     }
   }
-  // Now go through defragVars defragging them
-  defragVarIdx--;
-  if (defragVarIdx<0) defragVarIdx+=DEFRAGVARS;
-  while (defragVars[defragVarIdx]) {
-    JsVarRef defragFromRef = defragVars[defragVarIdx];
-    JsVarRef defragToRef = jsVarFirstEmpty;
-    if (!defragToRef || defragFromRef<defragToRef) {
-      // we're done!
-      break;
-    }
-    // relocate!
-    JsVar *defragFrom = _jsvGetAddressOf(defragFromRef);
-    JsVar *defragTo = _jsvGetAddressOf(defragToRef);
-    jsVarFirstEmpty = jsvGetNextSibling(defragTo); // move our reference to the next in the free list
-    // copy data
-    *defragTo = *defragFrom;
-    defragFrom->flags = JSV_UNUSED;
-    // find references!
-    for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
-      JsVarRef vr = (JsVarRef)(i+1);
-      JsVar *v = _jsvGetAddressOf(vr);
-      if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) {
-        if (jsvIsFlatString(v)) {
-          i += (unsigned int)jsvGetFlatStringBlocks(v); // skip forward
-        } else {
-          if (jsvHasSingleChild(v))
-            if (jsvGetFirstChild(v)==defragFromRef)
-              jsvSetFirstChild(v,defragToRef);
-          if (jsvHasStringExt(v))
-            if (jsvGetLastChild(v)==defragFromRef)
-              jsvSetLastChild(v,defragToRef);
-          if (jsvHasChildren(v)) {
-            if (jsvGetFirstChild(v)==defragFromRef)
-              jsvSetFirstChild(v,defragToRef);
-            if (jsvGetLastChild(v)==defragFromRef)
-              jsvSetLastChild(v,defragToRef);
-          }
-          if (jsvIsName(v)) {
-            if (jsvGetNextSibling(v)==defragFromRef)
-              jsvSetNextSibling(v,defragToRef);
-            if (jsvGetPrevSibling(v)==defragFromRef)
-              jsvSetPrevSibling(v,defragToRef);
-          }
-        }
-      }
-    }
-    // zero element and move to next...
-    defragVars[defragVarIdx] = 0;
-    defragVarIdx--;
-    if (defragVarIdx<0) defragVarIdx+=DEFRAGVARS;
-    // bump watchdog just in case it took too long
-    jshKickWatchDog();
-    jshKickSoftWatchDog();
-  }
-  // rebuild free var list
-  jsvCreateEmptyVarList();
   jshInterruptOn();
+#ifdef ESPR_PROPERTY_INDEX
+  // children may have moved, so point the indexes at their new locations
+  jsvPropertyIndexRefillAll();
+  jsvPropertyIndexFailedRef = 0;
+#endif
+#ifdef ESPR_SCOPE_SLOTS
+  jspVarsMoved();
+#endif
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerHeapInvalidate();
+#endif
+}
+
+void jsvSetAddressed(JsVar *v) {
+  if (v) v->flags |= JSV_ADDRESSED;
 }
 #endif
 
@@ -4367,23 +5436,17 @@ void jsvDumpLockedVars() {
   isMemoryBusy = MEMBUSY_SYSTEM;
   JsVarRef i;
   // clear garbage collect flags
-  for (i=1;i<=jsVarsSize;i++)  {
-    JsVar *var = jsvGetAddressOf(i);
-    if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED) { // if it is not unused
-      var->flags |= (JsVarFlags)JSV_GARBAGE_COLLECT;
-      // if we have a flat string, skip that many blocks
-      if (jsvIsFlatString(var))
-        i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
-    }
-  }
+  jsvGarbageCollectFlagAll();
   // Add global
-  jsvGarbageCollectMarkUsed(execInfo.root);
+  jsvGarbageCollectMarkRef(jsvGetRef(execInfo.root));
+  jsvGarbageCollectDrain(0xFFFFFFFF);
   // Now dump any that aren't used!
   for (i=1;i<=jsVarsSize;i++)  {
     JsVar *var = jsvGetAddressOf(i);
     if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED) {
       if (var->flags & JSV_GARBAGE_COLLECT) {
-        jsvGarbageCollectMarkUsed(var);
+        jsvGarbageCollectMarkRef(i);
+        jsvGarbageCollectDrain(0xFFFFFFFF);
         jsvTrace(var, 0);
       }
       // if we have a flat string, skip that many blocks
@@ -102,6 +102,7 @@ typedef enum {
     JSV_LOCK_ONE    = JSV_IS_RECURSING<<1,
     JSV_LOCK_MASK   = JSV_LOCK_MAX * JSV_LOCK_ONE,
     JSV_LOCK_SHIFT  = GET_BIT_NUMBER(JSV_LOCK_ONE), ///< The amount of bits we must shift to get the number of locks - forced to be a constant
+    JSV_ADDRESSED   = JSV_LOCK_MASK+JSV_LOCK_ONE, ///< The address of this var (or its data) has been given out, so jsvDefragment must never move it
 
     JSV_VARIABLEINFOMASK = JSV_VARTYPEMASK | JSV_NATIVE | JSV_CONSTANT, // if we're copying a variable, this is all the stuff we want to copy
 } PACKED_FLAGS JsVarFlags; // aiming to get this in 2 bytes!
@@ -294,6 +295,14 @@ void jsvSoftKill(); ///< called when saving to flash
 JsVar *jsvFindOrCreateRoot(); ///< Find or create the ROOT variable item - used mainly if recovering from a saved state.
 unsigned int jsvGetMemoryUsage(); ///< Get number of memory records (JsVars) used
 unsigned int jsvGetMemoryTotal(); ///< Get total amount of memory records
+#ifndef SAVE_ON_FLASH
+/// Get the size of the biggest area of contiguous free memory records, and how many separate free areas there are
+void jsvGetFreeAreas(unsigned int *largest, unsigned int *count);
+#endif
+#ifdef ESPR_FREE_RUN_INDEX
+/// Return an object containing statistics about flat string allocation
+JsVar *jsvGetFlatStringAllocStats();
+#endif
 bool jsvIsMemoryFull(); ///< Get whether memory is full or not
 bool jsvMoreFreeVariablesThan(unsigned int vars); ///< Return whether there are more free variables than the parameter (faster than checking no of vars used)
 void jsvShowAllocated(); ///< Show what is still allocated, for debugging memory problems
@@ -494,7 +503,11 @@ JsVar *jsvAsFlatString(JsVar *var); ///< Create a flat string from the given var
 bool jsvIsEmptyString(JsVar *v); ///< Returns true if the string is empty - faster than jsvGetStringLength(v)==0
 size_t jsvGetStringLength(const JsVar *v); ///< Get the length of this string, IF it is a string
 size_t jsvGetFlatStringBlocks(const JsVar *v); ///< return the number of blocks used by the given flat string - EXCLUDING the first data block
-char *jsvGetFlatStringPointer(JsVar *v); ///< Get a pointer to the data in this flat string
+char *jsvGetFlatStringPointer(JsVar *v); ///< Get a pointer to the data in this flat string - the string must stay locked while this is used, as jsvDefragment can move it
+#ifdef ESPR_STRING_TAIL_CACHE
+JsVar *jsvStringGetTail(JsVarRef str, size_t *tailIndex); ///< If we know a StringExt near the end of 'str', lock and return it and set 'tailIndex' to the index of its first character
+void jsvStringSetTail(JsVarRef str, JsVar *tail, size_t tailIndex); ///< Remember a StringExt near the end of 'str' to speed up appending to it
+#endif
 JsVar *jsvGetFlatStringFromPointer(char *v); ///< Given a pointer to the first element of a flat string, return the flat string itself (DANGEROUS!)
 char *jsvGetDataPointer(JsVar *v, size_t *len); ///< If the variable points to a *flat* area of memory, return a pointer (and set length). Otherwise return 0.
 size_t jsvGetLinesInString(JsVar *v); ///<  IN A STRING get the number of lines in the string (min=1)
@@ -748,9 +761,45 @@ void jsvTrace(JsVar *var, int indent);
 
 /** Run a garbage collection sweep - return nonzero if things have been freed */
 int jsvGarbageCollect();
+#ifdef ESPR_GC_INCREMENTAL
+/** Do a bounded amount of garbage collection (looking at around 'budget' vars), starting
+ * a new collection if needed. Returns the number of vars freed */
+int jsvGarbageCollectStep(unsigned int budget);
+/// Is an incremental garbage collection in progress?
+bool jsvGarbageCollectInProgress();
+#endif
+#ifndef SAVE_ON_FLASH
+/// Return an object containing statistics about garbage collection and the time it has paused execution for
+JsVar *jsvGarbageCollectGetStats();
+#endif
 
-/** Defragement memory - this could take a while with interrupts turned off! */
+/** Defragement memory - this could take a while with interrupts turned off! Everything
+ * (including flat strings) that isn't locked or addressed is moved down into the lowest free
+ * space, so any native pointer to a var's data (eg. from jsvGetFlatStringPointer) is only valid
+ * while the var (or for ArrayBuffer data, the ArrayBuffer/typed array) stays locked. This
+ * is only ever done when asked for (E.defrag), never when an allocation fails. */
 void jsvDefragment();
+/// The address of this var (or of its data) is being given out - never let jsvDefragment move it
+void jsvSetAddressed(JsVar *v);
+
+#ifdef ESPR_PROPERTY_CACHE
+#define JSV_OBJECT_EPOCH
+#endif
+#ifdef JSV_OBJECT_EPOCH
+/** Incremented whenever the children of an object (or the root) change, a prototype
+ * link changes, or an object is freed or moved. Anything caching the result of a
+ * property lookup must be discarded if this has changed. Never 0. */
+extern uint32_t jsvObjectEpoch;
+/// Note that an object (or the prototype chain) has changed - see jsvObjectEpoch
+#define jsvObjectChanged() { if (!++jsvObjectEpoch) jsvObjectEpoch=1; }
+#endif
+
+#ifdef ESPR_SCOPE_SLOTS
+/** Incremented whenever a name is removed from anything that could be a scope (an
+ * object, a function or the root), so cached references to names in scopes can be
+ * checked. Arrays don't change it. */
+extern uint32_t jsvScopeNameRemovedEpoch;
+#endif
 
 // Dump any locked variables that aren't referenced from `global` - for debugging memory leaks
 void jsvDumpLockedVars();
@@ -406,6 +406,21 @@ void jsvStringIteratorGetPtrAndNext(JsvStringIterator *it, unsigned char **data,
 
 void jsvStringIteratorGotoEnd(JsvStringIterator *it) {
   assert(it->var);
+#ifdef ESPR_STRING_TAIL_CACHE
+  // If we're at the start of a string, skip to the end we remembered for it last time
+  JsVarRef str = 0;
+  if (it->varIndex==0 && !jsvIsStringExt(it->var) && jsvGetLastChild(it->var)) {
+    str = jsvGetRef(it->var);
+    size_t tailIndex;
+    JsVar *tail = jsvStringGetTail(str, &tailIndex);
+    if (tail) {
+      jsvUnLock(it->var);
+      it->var = tail;
+      it->varIndex = tailIndex;
+      it->charsInVar = jsvGetCharactersInVar(it->var);
+    }
+  }
+#endif
   while (jsvGetLastChild(it->var)) {
     JsVar *next = jsvLock(jsvGetLastChild(it->var));
     jsvUnLock(it->var);
@@ -413,6 +428,9 @@ void jsvStringIteratorGotoEnd(JsvStringIterator *it) {
     it->varIndex += it->charsInVar;
     it->charsInVar = jsvGetCharactersInVar(it->var);
   }
+#ifdef ESPR_STRING_TAIL_CACHE
+  if (str) jsvStringSetTail(str, it->var, it->varIndex);
+#endif
   it->ptr = &it->var->varData.str[0];
   if (it->charsInVar) it->charIdx = it->charsInVar-1;
   else it->charIdx = 0;
@@ -740,6 +740,7 @@ JsVar *jswrap_espruino_getErrorFlags() {
 type Flag =
   | "deepSleep"
   | "pretokenise"
+  | "saveDelta"
   | "unsafeFlash"
   | "unsyncFiles";
 */
@@ -757,6 +758,9 @@ code.
 * `deepSleep` - Allow deep sleep modes (also set by setDeepSleep)
 * `pretokenise` - When adding functions, pre-minify them and tokenise reserved
   words
+* `saveDelta` - (on builds that support it) `save()` splits the saved state into
+  regions in separate files, and only writes the regions that changed since the
+  last `save()`
 * `unsafeFlash` - Some platforms stop writes/erases to interpreter memory to
   stop you bricking the device accidentally - this removes that protection
 * `unsyncFiles` - When writing files, *don't* flush all data to the SD card
@@ -879,12 +883,8 @@ JsVar *jswrap_espruino_toStringX(JsVar *args, bool forceFlat) {
   unsigned int len = (unsigned int)jsvIterateCallbackCount(args);
   JsVar *str = forceFlat ? jsvNewFlatStringOfLength(len) : jsvNewStringOfLength(len, NULL);
   if (forceFlat && !str) {
-    // if we couldn't do it, try again after garbage collecting/defrag
-#ifdef SAVE_ON_FLASH
+    // if we couldn't do it, try again after garbage collecting
     jsvGarbageCollect();
-#else
-    jsvDefragment();
-#endif
     str = jsvNewFlatStringOfLength(len);
   }
   if (!str) return 0;
@@ -1540,6 +1540,13 @@ void jswrap_e_dumpVariables() {
   "generate" : "jsvDefragment"
 }
 BETA: defragment memory!
+
+Variables that are not in use by native code (including the data in `ArrayBuffer`s)
+are moved down into the lowest free area of memory, so that the free memory is
+in one big block. This can take some time, during which interrupts are disabled.
+
+Variables (and `ArrayBuffer` data) whose address has been got with `E.getAddressOf`
+are never moved, so the address stays valid for use with `peek` and `poke`.
 */
 
 /*TYPESCRIPT
@@ -1623,6 +1630,48 @@ JsVar *jswrap_espruino_getSizeOf(JsVar *v, int depth) {
   return jsvNewFromInteger((JsVarInt)jsvCountJsVarsUsed(v));
 }
 
+/*JSON{
+  "type" : "staticmethod",
+  "ifndef" : "SAVE_ON_FLASH",
+  "class" : "E",
+  "name" : "getStats",
+  "generate" : "jswrap_espruino_getStats",
+  "return" : ["JsVar","An object containing interpreter statistics"]
+}
+Return an object containing statistics about the interpreter's internal caches.
+Which fields are present depends on what is enabled in the build:
+
+* `propertyCache` : `{hits, misses}` - how often the prototype chain lookup for
+  a property access (eg. `g.setPixel`) was answered from the inline property
+  cache (only if built with `ESPR_PROPERTY_CACHE`)
+* `scopeSlots` : `{hits, misses}` - how often a variable in the current scope was
+  found from the slot remembered for that point in the code (only if built with
+  `ESPR_SCOPE_SLOTS`)
+* `gc` : `{collections, lastPause, maxPause, totalTime}` - how many garbage
+  collections have completed and how long they paused execution for (in
+  milliseconds). If built with `ESPR_GC_INCREMENTAL`, garbage collection is done
+  a little at a time from the idle loop, so this also includes `steps` (each of
+  which is a pause) and `inProgress`
+* `watches` : `{events, checked, callbacks, lastLatency, maxLatency, totalLatency}` -
+  how many pin events (from `setWatch`) were handled, how many watches had to be
+  checked to find which ones they were for, how many callbacks were called
+  without a debounce, and the time from the pin changing to those callbacks
+  being called (in milliseconds)
+ */
+JsVar *jswrap_espruino_getStats() {
+  JsVar *obj = jsvNewObject();
+  if (!obj) return 0;
+#ifdef ESPR_PROPERTY_CACHE
+  jsvObjectSetChildAndUnLock(obj, "propertyCache", jspGetPropertyCacheStats());
+#endif
+#ifdef ESPR_SCOPE_SLOTS
+  jsvObjectSetChildAndUnLock(obj, "scopeSlots", jspGetScopeSlotStats());
+#endif
+  jsvObjectSetChildAndUnLock(obj, "gc", jsvGarbageCollectGetStats());
+  jsvObjectSetChildAndUnLock(obj, "watches", jsiGetWatchStats());
+  return obj;
+}
+
 
 /*JSON{
   "type" : "staticmethod",
@@ -1648,8 +1697,16 @@ See http://www.espruino.com/Internals for more information
 JsVarInt jswrap_espruino_getAddressOf(JsVar *v, bool flatAddress) {
   if (flatAddress) {
     size_t len=0;
-    return (JsVarInt)(size_t)jsvGetDataPointer(v, &len);
+    char *ptr = jsvGetDataPointer(v, &len);
+    // the data mustn't move while the address is being used
+    if (ptr) {
+      JsVar *data = jsvIsArrayBuffer(v) ? jsvGetArrayBufferBackingString(v, NULL) : jsvLockAgain(v);
+      jsvSetAddressed(data);
+      jsvUnLock(data);
+    }
+    return (JsVarInt)(size_t)ptr;
   }
+  jsvSetAddressed(v);
   return (JsVarInt)(size_t)v;
 }
 
@@ -54,6 +54,7 @@ void jswrap_espruino_dumpFreeList();
 void jswrap_e_dumpFragmentation();
 void jswrap_e_dumpVariables();
 JsVar *jswrap_espruino_getSizeOf(JsVar *v, int depth);
+JsVar *jswrap_espruino_getStats();
 JsVarInt jswrap_espruino_getAddressOf(JsVar *v, bool flatAddress);
 void jswrap_espruino_mapInPlace(JsVar *from, JsVar *to, JsVar *map, JsVarInt bits);
 JsVar *jswrap_espruino_lookupNoCase(JsVar *haystack, JsVar *needle, bool returnKey);
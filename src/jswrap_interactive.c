@@ -182,6 +182,12 @@ starts.
 In order to stop the program saved with this command being loaded automatically,
 check out [the Troubleshooting
 guide](https://www.espruino.com/Troubleshooting#espruino-stopped-working-after-i-typed-save-)
+
+On builds with `ESPR_SAVE_DELTA`, calling `E.setFlags({saveDelta:1})` before
+`save()` splits the saved state into several files, and subsequent calls to
+`save()` only write the parts of RAM that changed since the last save. The
+last save is only replaced once the new one has been written completely, so
+if a save runs out of space (or power is lost) the last one is still loaded.
  */
 /*JSON{
   "type" : "function",
@@ -476,7 +482,7 @@ JsVar *_jswrap_interface_setTimeoutOrInterval(JsVar *func, JsVarFloat interval,
   JsVar *timerPtr = jsvNewObject();
   if (!timerPtr) return 0;
   JsSysTime intervalInt = jshGetTimeFromMilliseconds(interval);
-  jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger((jshGetSystemTime() - jsiLastIdleTime) + intervalInt));
+  jsiTimerSetTime(timerPtr, (jshGetSystemTime() - jsiLastIdleTime) + intervalInt);
   if (!isTimeout) {
     jsvObjectSetChildAndUnLock(timerPtr, "interval", jsvNewFromLongInteger(intervalInt));
   }
@@ -552,6 +558,9 @@ void _jswrap_interface_clearTimeoutOrInterval(JsVar *idVarArr, bool isTimeout) {
       jsvUnLock2(watchPtr, timerPtr);
     }
     jsvObjectIteratorFree(&it);
+#ifdef ESPR_TIMER_HEAP
+    jsiTimerHeapInvalidate();
+#endif
   } else {
     JsVar *idVar = jsvGetArrayItem(idVarArr, 0);
     if (jsvIsUndefined(idVar)) {
@@ -559,8 +568,10 @@ void _jswrap_interface_clearTimeoutOrInterval(JsVar *idVarArr, bool isTimeout) {
       jsExceptionHere(JSET_ERROR, "clear%s(undefined) not allowed. Use clear%s() instead", name, name);
     } else {
       JsVar *child = jsvIsBasic(idVar) ? jsvFindChildFromVar(timerArrayPtr, idVar, false) : 0;
-      if (child)
-        jsvRemoveChildAndUnLock(timerArrayPtr, child);
+      if (child) {
+        jsiTimerRemove(child);
+        jsvUnLock(child);
+      }
       jsvUnLock(idVar);
     }
   }
@@ -602,7 +613,7 @@ void jswrap_interface_changeInterval(JsVar *idVar, JsVarFloat interval) {
     JsVar *timer = jsvSkipNameAndUnLock(timerName);
     JsSysTime intervalInt = jshGetTimeFromMilliseconds(interval);
     jsvObjectSetChildAndUnLock(timer, "interval", jsvNewFromLongInteger(intervalInt));
-    jsvObjectSetChildAndUnLock(timer, "time", jsvNewFromLongInteger((jshGetSystemTime()-jsiLastIdleTime) + intervalInt));
+    jsiTimerChangeTime(timer, (jshGetSystemTime()-jsiLastIdleTime) + intervalInt);
     jsvUnLock(timer);
     // timerName already unlocked
     jsiTimersChanged(); // mark timers as changed
@@ -849,9 +849,8 @@ JsVar *jswrap_interface_setWatch(
     }
 
 
-    JsVar *watchArrayPtr = jsvLock(watchArray);
-    itemIndex = jsvArrayAddToEnd(watchArrayPtr, watchPtr, 1) - 1;
-    jsvUnLock2(watchArrayPtr, watchPtr);
+    itemIndex = jsiWatchAdd(watchPtr);
+    jsvUnLock(watchPtr);
 
 
   }
@@ -892,6 +891,9 @@ void jswrap_interface_clearWatch(JsVar *idVarArr) {
     // remove all items
     jsvRemoveAllChildren(watchArrayPtr);
     jsvUnLock(watchArrayPtr);
+#ifdef ESPR_WATCH_INDEX
+    jsiWatchIndexInvalidate();
+#endif
   } else {
     JsVar *idVar = jsvGetArrayItem(idVarArr, 0);
     if (jsvIsUndefined(idVar)) {
@@ -906,9 +908,8 @@ void jswrap_interface_clearWatch(JsVar *idVarArr) {
       Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
       jsvUnLock(watchPtr);
 
-      JsVar *watchArrayPtr = jsvLock(watchArray);
-      jsvRemoveChildAndUnLock(watchArrayPtr, watchNamePtr);
-      jsvUnLock(watchArrayPtr);
+      jsiWatchRemove(watchNamePtr);
+      jsvUnLock(watchNamePtr);
 
       // Now check if this pin is still being watched
       if (!jsiIsWatchingPin(pin))
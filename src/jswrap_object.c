@@ -1163,6 +1163,10 @@ void jswrap_function_replaceWith(JsVar *oldFunc, JsVar *newFunc) {
       if (jsvIsStringEqual(el, JSPARSE_FUNCTION_CODE_NAME)
 #ifdef ESPR_JIT
           || jsvIsStringEqual(el, JSPARSE_FUNCTION_JIT_CODE_NAME)
+#endif
+#ifdef ESPR_FUNCTION_TOKEN_CACHE
+          || jsvIsStringEqual(el, JSPARSE_FUNCTION_TOKENS_NAME)
+          || jsvIsStringEqual(el, JSPARSE_FUNCTION_TOKEN_MAP_NAME)
 #endif
           ) {
         // don't copy function code - just use it as-is. But we do have to
@@ -186,6 +186,14 @@ memory usage.
 * `gc` : Memory freed during the GC pass
 * `gctime` : Time taken for GC pass (in milliseconds)
 * `blocksize` : Size of a block (variable) in bytes
+* `largestFree` : The biggest area of contiguous free memory (in blocks). If
+  this is much less than `free`, memory is fragmented and `E.defrag()` may help
+  with allocating big `ArrayBuffer`s
+* `freeAreas` : How many separate areas of free memory there are
+* `flatAlloc` : (only on some builds) Statistics for allocating contiguous
+  memory (for `ArrayBuffer`s and similar): `count` allocations, of which `indexed`
+  were found from the index of free areas, `scanned` times the free list had to be
+  searched, `failed` allocations and `time` spent (in milliseconds)
 * `stackEndAddress` : (on ARM) the address (that can be used with peek/poke/etc)
   of the END of the stack. The stack grows down, so unless you do a lot of
   recursion the bytes above this can be used.
@@ -234,6 +242,15 @@ JsVar *jswrap_process_memory(JsVar *gc) {
       jsvObjectSetChildAndUnLock(obj, "gctime", jsvNewFromFloat(jshGetMillisecondsFromTime(time2-time1)));
     }
     jsvObjectSetChildAndUnLock(obj, "blocksize", jsvNewFromInteger(sizeof(JsVar)));
+#ifndef SAVE_ON_FLASH
+    unsigned int largestFree, freeAreas;
+    jsvGetFreeAreas(&largestFree, &freeAreas);
+    jsvObjectSetChildAndUnLock(obj, "largestFree", jsvNewFromInteger((JsVarInt)largestFree));
+    jsvObjectSetChildAndUnLock(obj, "freeAreas", jsvNewFromInteger((JsVarInt)freeAreas));
+#endif
+#ifdef ESPR_FREE_RUN_INDEX
+    jsvObjectSetChildAndUnLock(obj, "flatAlloc", jsvGetFlatStringAllocStats());
+#endif
 
 #ifdef ARM
     extern uint32_t LINKER_END_VAR; // end of ram used (variables) - should be 'void', but 'int' avoids warnings
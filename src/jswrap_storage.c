@@ -210,11 +210,14 @@ JsVar *jswrap_storage_readArrayBuffer(JsVar *name) {
   "params" : [
     ["name","JsVar","The filename - max 28 characters (case sensitive)"],
     ["data","JsVar","The data to write"],
-    ["offset","int","[optional] The offset within the file to write (if `0`/`undefined` a new file is created, otherwise Espruino attempts to write within an existing file if one exists)"],
+    ["offset","JsVar","[optional] The offset within the file to write (if `0`/`undefined` a new file is created, otherwise Espruino attempts to write within an existing file if one exists), or an object of options: `{compress:true}`"],
     ["size","int","[optional] The size of the file (if a file is to be created that is bigger than the data)"]
   ],
   "return" : ["bool","True on success, false on failure"],
-  "typescript" : "write(name: string | ArrayBuffer | ArrayBufferView | number[] | object, data: any, offset?: number, size?: number): boolean;"
+  "typescript" : [
+    "write(name: string | ArrayBuffer | ArrayBufferView | number[] | object, data: any, offset?: number, size?: number): boolean;",
+    "write(name: string | ArrayBuffer | ArrayBufferView | number[] | object, data: any, options: { compress?: boolean }): boolean;"
+  ]
 }
 Write/create a file in the flash storage area. This is nonvolatile and will not
 disappear when the device resets or power is lost.
@@ -252,10 +255,23 @@ This can be useful if you've got more data to write than you have RAM
 available - for instance the Web IDE uses this method to write large files into
 onboard storage.
 
+On builds that support it, `require("Storage").write("MyFile", data, {compress:true})`
+writes the file compressed with heatshrink. It can be read back with `read`/`require`/etc
+as normal, but it is decompressed into RAM each time it is read (rather than being read
+directly from flash), and you can't then write part of it with `offset`.
+`require("Storage").getStats().savedBytes` reports how much space compression saved.
+
 **Note:** This function should be used with normal files, and not `StorageFile`s
 created with `require("Storage").open(filename, ...)`
 */
-bool jswrap_storage_write(JsVar *name, JsVar *data, JsVarInt offset, JsVarInt _size) {
+bool jswrap_storage_write(JsVar *name, JsVar *data, JsVar *offsetVar, JsVarInt _size) {
+  JsVarInt offset = 0;
+  bool compress = false;
+  if (jsvIsObject(offsetVar)) {
+    compress = jsvObjectGetBoolChild(offsetVar, "compress");
+    _size = 0;
+  } else
+    offset = jsvGetInteger(offsetVar);
   JsVar *d;
   if (jsvIsObject(data)) {
     d = jswrap_json_stringify(data,0,0);
@@ -263,7 +279,16 @@ bool jswrap_storage_write(JsVar *name, JsVar *data, JsVarInt offset, JsVarInt _s
     _size = 0;
   } else
     d = jsvLockAgainSafe(data);
-  bool success = jsfWriteFile(jsfNameFromVar(name), d, JSFF_NONE, offset, _size);
+  bool success;
+#ifdef ESPR_STORAGE_COMPRESS
+  if (compress)
+    success = jsfWriteCompressedFile(jsfNameFromVar(name), d);
+  else
+#endif
+    success = jsfWriteFile(jsfNameFromVar(name), d, JSFF_NONE, offset, _size);
+#ifndef ESPR_STORAGE_COMPRESS
+  NOT_USED(compress);
+#endif
   jsvUnLock(d);
   return success;
 }
@@ -480,9 +505,20 @@ Returns:
   fileCount // How many allocated files do we have?
   trashBytes // How many bytes of trash files do we have?
   trashCount // How many trash files do we have? (can be cleared with .compact)
+  cacheHits // (if the file cache is enabled) How many file lookups were answered by the cache?
+  cacheMisses // (if the file cache is enabled) How many file lookups needed a search of Storage?
+  compacting // (if idle compaction is enabled) Is Storage being compacted a few pages at a time while idle?
+  compactBytes // (if idle compaction is enabled) How many bytes of files have been moved while idle?
+  compactPages // (if idle compaction is enabled) How many pages of flash have been rewritten while idle?
+  compactRate // (if idle compaction is enabled) How many bytes per second idle compaction moves files at
+  compressedBytes // (if compressed files are supported) How many bytes do files written with `{compress:true}` use?
+  savedBytes // (if compressed files are supported) How many bytes were saved by compressing them?
 }
 ```
 
+When Storage is over 75% full and has at least a page of trash, it is compacted
+a few pages at a time while Espruino is idle (if idle compaction is enabled).
+
 **NOTE:** `checkInternalFlash` is only useful on DICKENS devices - other devices don't use two different flash banks
  */
 JsVar *jswrap_storage_getStats(bool checkInternalFlash) {
@@ -500,6 +536,20 @@ JsVar *jswrap_storage_getStats(bool checkInternalFlash) {
   jsvObjectSetChildAndUnLock(o, "fileCount", jsvNewFromInteger((JsVarInt)stats.fileCount));
   jsvObjectSetChildAndUnLock(o, "trashBytes", jsvNewFromInteger((JsVarInt)stats.trashBytes));
   jsvObjectSetChildAndUnLock(o, "trashCount", jsvNewFromInteger((JsVarInt)stats.trashCount));
+#if ESPR_USE_STORAGE_CACHE
+  jsvObjectSetChildAndUnLock(o, "cacheHits", jsvNewFromInteger((JsVarInt)stats.cacheHits));
+  jsvObjectSetChildAndUnLock(o, "cacheMisses", jsvNewFromInteger((JsVarInt)stats.cacheMisses));
+#endif
+#ifdef ESPR_STORAGE_IDLE_COMPACT
+  jsvObjectSetChildAndUnLock(o, "compacting", jsvNewFromBool(stats.compacting));
+  jsvObjectSetChildAndUnLock(o, "compactBytes", jsvNewFromInteger((JsVarInt)stats.compactBytes));
+  jsvObjectSetChildAndUnLock(o, "compactPages", jsvNewFromInteger((JsVarInt)stats.compactPages));
+  jsvObjectSetChildAndUnLock(o, "compactRate", jsvNewFromInteger(stats.compactTime ? (JsVarInt)((uint64_t)stats.compactBytes*1000/stats.compactTime) : 0));
+#endif
+#ifdef ESPR_STORAGE_COMPRESS
+  jsvObjectSetChildAndUnLock(o, "compressedBytes", jsvNewFromInteger((JsVarInt)stats.compressedBytes));
+  jsvObjectSetChildAndUnLock(o, "savedBytes", jsvNewFromInteger((JsVarInt)stats.uncompressedBytes - (JsVarInt)stats.compressedBytes));
+#endif
   return o;
 }
 
@@ -512,13 +562,182 @@ JsVar *jswrap_storage_getStats(bool checkInternalFlash) {
 }
 Writes a lookup table for files into Bangle.js's storage. This allows any file
 stored up to that point to be accessed quickly.
+
+On builds with a hash index of filenames, this also rewrites the index (it is
+usually written when Storage is compacted).
  */
 void jswrap_storage_optimise() {
 #ifdef ESPR_STORAGE_FILENAME_TABLE
   jsfCreateFileTable();
 #endif
+#ifdef ESPR_STORAGE_HASH_INDEX
+  jsfCreateHashIndex();
+#endif
+}
+
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+/* Each StorageFile has a hidden directory - a companion file named after the StorageFile with
+"\1\xFF" appended - which gets a record of where the file ends appended to it each time the
+file is written. When we need the end of the file we check the last record against the
+chunks - if it doesn't match (eg. we lost power before it was written, or the file was
+written by something that didn't update the directory) we use the record before, or scan
+from the start as we would without a directory.
+
+Names need a spare character for this, so files with 27 character names don't get a directory. */
+#define STORAGEFILE_DIR_ENTRIES 128
+typedef struct {
+  uint32_t length; ///< length of the file in bytes
+  uint32_t position; ///< chunk<<24 | offset in chunk - the file's end
+} StorageFileDirEntry;
+
+/// Get the name of a StorageFile's directory, or return false if the name is too long to have one
+static bool jswrap_storagefile_getDirName(JsfFileName *fname, int fnamei) {
+  if (fnamei+1 >= (int)sizeof(JsfFileName)) return false;
+  fname->c[fnamei] = 1;
+  fname->c[fnamei+1] = (char)255;
+  return true;
+}
+
+/// Find the directory for a file, and return how many records it has (or 0 if no directory)
+static uint32_t jswrap_storagefile_dirFind(JsfFileName fname, int fnamei, uint32_t *dirAddr) {
+  JsfFileHeader header;
+  *dirAddr = 0;
+  if (!jswrap_storagefile_getDirName(&fname, fnamei)) return 0;
+  *dirAddr = jsfFindFile(fname, &header);
+  if (!*dirAddr) return 0;
+  // records are only appended, so find the first unwritten one with a binary search
+  uint32_t lo = 0, hi = jsfGetFileSize(&header) / (uint32_t)sizeof(StorageFileDirEntry);
+  while (lo<hi) {
+    uint32_t mid = (lo+hi)/2;
+    uint32_t position;
+    jshFlashRead(&position, *dirAddr + mid*(uint32_t)sizeof(StorageFileDirEntry) + (uint32_t)sizeof(uint32_t), sizeof(position));
+    if (position==0xFFFFFFFF) hi = mid;
+    else lo = mid+1;
+  }
+  return lo;
+}
+
+/// Does a directory record match what is in the file's chunks?
+static bool jswrap_storagefile_dirCheck(JsfFileName fname, int fnamei, StorageFileDirEntry *entry) {
+  int chunk = (int)(entry->position>>24);
+  uint32_t offset = entry->position & 0xFFFFFF;
+  if (chunk<1) return false;
+  fname.c[fnamei] = (char)chunk;
+  JsfFileHeader header;
+  uint32_t addr = jsfFindFile(fname, &header);
+  if (!addr) return false;
+  uint32_t chunkSize = jsfGetFileSize(&header);
+  // every chunk is the same size, which also lets us spot records that weren't written properly
+  if (offset>chunkSize || entry->length!=(uint32_t)(chunk-1)*chunkSize+offset) return false;
+  unsigned char ch = 0;
+  if (offset) jshFlashRead(&ch, addr+offset-1, 1);
+  return ch!=255;
+}
+#endif
+
+/** Scan forward from chunk/offset (where the file is 'length' bytes long so far) to find the end
+ * of the file. If the last chunk is full, chunk is set to the chunk after it */
+static void jswrap_storagefile_scanToEnd(JsfFileName fname, int fnamei, int *chunk, int *offset, int *length) {
+  JsfFileHeader header;
+  fname.c[fnamei] = (char)*chunk;
+  uint32_t addr = jsfFindFile(fname, &header);
+  while (addr) {
+    int fileLen = (int)jsfGetFileSize(&header);
+    unsigned char lastCh = 255;
+    jshFlashRead(&lastCh, addr+(uint32_t)fileLen-1, 1);
+    if (lastCh==255 || *chunk==255) {
+      // the end is in this chunk - find it
+      char buf[64];
+      while (*offset < fileLen) {
+        int l = fileLen - *offset;
+        if (l>(int)sizeof(buf)) l=(int)sizeof(buf);
+        jshFlashRead(buf, addr+(uint32_t)*offset, (uint32_t)l);
+        for (int i=0;i<l;i++) {
+          if (buf[i]==(char)255) {
+            *offset += i;
+            *length += i;
+            return;
+          }
+        }
+        *offset += l;
+        *length += l;
+      }
+      return;
+    }
+    // this chunk is full - try the next
+    *length += fileLen - *offset;
+    *offset = 0;
+    (*chunk)++;
+    fname.c[fnamei] = (char)*chunk;
+    addr = jsfFindFile(fname, &header);
+  }
+}
+
+/** Find the end of a file. chunk and offset are set to where data should be appended,
+ * and the length of the file is returned */
+static int jswrap_storagefile_findEnd(JsfFileName fname, int fnamei, int *chunk, int *offset) {
+  int length = 0;
+  *chunk = 1;
+  *offset = 0;
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+  uint32_t dirAddr;
+  uint32_t n = jswrap_storagefile_dirFind(fname, fnamei, &dirAddr);
+  // if the last record is bad we may have lost power while writing it, so try the one before
+  for (int tries=0; tries<2 && n; tries++) {
+    n--;
+    StorageFileDirEntry entry;
+    jshFlashRead(&entry, dirAddr + n*(uint32_t)sizeof(StorageFileDirEntry), sizeof(entry));
+    if (jswrap_storagefile_dirCheck(fname, fnamei, &entry)) {
+      *chunk = (int)(entry.position>>24);
+      *offset = (int)(entry.position & 0xFFFFFF);
+      length = (int)entry.length;
+      break;
+    }
+  }
+#endif
+  // the file may have been written to after the last record - this is quick if it wasn't
+  jswrap_storagefile_scanToEnd(fname, fnamei, chunk, offset, &length);
+  return length;
 }
 
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+/** 'written' bytes were just appended to a file at oldChunk/oldOffset, and the file now ends at
+ * chunk/offset. Add a record of this to the file's directory */
+static void jswrap_storagefile_dirAppend(JsfFileName fname, int fnamei, int oldChunk, int oldOffset, int chunk, int offset, int written) {
+  uint32_t dirAddr;
+  uint32_t n = jswrap_storagefile_dirFind(fname, fnamei, &dirAddr);
+  StorageFileDirEntry entry;
+  entry.length = 0;
+  entry.position = 0;
+  if (n) jshFlashRead(&entry, dirAddr + (n-1)*(uint32_t)sizeof(StorageFileDirEntry), sizeof(entry));
+  if (entry.position == (((uint32_t)oldChunk<<24) | (uint32_t)oldOffset)) {
+    entry.length += (uint32_t)written; // the last record was where we started writing
+  } else if (oldChunk==1 && oldOffset==0) {
+    entry.length = (uint32_t)written; // a new file
+  } else { // the directory is out of date
+    int c, o;
+    entry.length = (uint32_t)jswrap_storagefile_findEnd(fname, fnamei, &c, &o);
+    chunk = c;
+    offset = o;
+  }
+  entry.position = ((uint32_t)chunk<<24) | (uint32_t)offset;
+  if (dirAddr && n<STORAGEFILE_DIR_ENTRIES) {
+    jshFlashWrite(&entry, dirAddr + n*(uint32_t)sizeof(StorageFileDirEntry), sizeof(entry));
+  } else if (jswrap_storagefile_getDirName(&fname, fnamei)) {
+    // no directory, or it's full - start a new one (this replaces the old one)
+    uint32_t dirSize = STORAGEFILE_DIR_ENTRIES*(uint32_t)sizeof(StorageFileDirEntry);
+    // Don't use up space the file's data could go in - without a directory we just scan
+    if (jsfGetStorageStats(0, true).free < dirSize*2 + 2*(uint32_t)STORAGEFILE_CHUNKSIZE) {
+      if (dirAddr) jsfEraseFile(fname);
+      return;
+    }
+    JsVar *data = jsvNewStringOfLength(sizeof(entry), (char*)&entry);
+    if (data) jsfWriteFile(fname, data, JSFF_STORAGEFILE, 0, (int)dirSize);
+    jsvUnLock(data);
+  }
+}
+#endif
+
 /*JSON{
   "type" : "staticmethod",
   "ifndef" : "SAVE_ON_FLASH",
@@ -569,54 +788,17 @@ JsVar *jswrap_storage_open(JsVar *name, JsVar *modeVar) {
   if (mode=='w') { // write,
     if (addr) { // we had a file - erase it
       jswrap_storagefile_erase(f);
-      addr = 0;
     }
   }
-  int fileLen = addr ? (int)jsfGetFileSize(&header) : 0;
   if (mode=='a') { // append
-    // Find the last free page (eg it has 0xFF at the end)
-    unsigned char lastCh = 255;
-    if (addr) jshFlashRead(&lastCh, addr+jsfGetFileSize(&header)-1, 1);
-    while (addr && lastCh!=255 && chunk<255) {
-      chunk++;
-      fname.c[fnamei]=(char)chunk;
-      addr = jsfFindFile(fname, &header);
-      if (addr) {
-        fileLen = (int)jsfGetFileSize(&header);
-        jshFlashRead(&lastCh, addr+fileLen-1, 1);
-      } else {
-        fileLen = 0;
-      }
-    }
-    if (addr) {
-      // if we have a page, try and find the end of it
-      char buf[64];
-      bool foundEnd = false;
-      while (!foundEnd) {
-        int l = (int)fileLen - offset;
-        if (l<=0) {
-          foundEnd = true;
-          break;
-        }
-        if (l>(int)sizeof(buf)) l=(int)sizeof(buf);
-        jshFlashRead(buf, addr+(uint32_t)offset, (uint32_t)l);
-        for (int i=0;i<l;i++) {
-          if (buf[i]==(char)255) {
-            l = i;
-            foundEnd = true;
-            break;
-          }
-        }
-        offset += l;
-      }
-    }
+    jswrap_storagefile_findEnd(fname, fnamei, &chunk, &offset);
     // Now 'chunk' and offset points to the last (or a free) page
   }
   if (mode=='r') {
     // read - do nothing, we're good.
   }
 
-  DBG("Open %j Chunk %d Offset %d addr 0x%08x len %d\n",name,chunk,offset,addr,fileLen);
+  DBG("Open %j Chunk %d Offset %d\n",name,chunk,offset);
   jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(chunk));
   jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
   jsvObjectSetChildAndUnLock(f,"mode",jsvNewFromInteger(mode));
@@ -671,11 +853,174 @@ f.readLine() // undefined
 f.erase();
 ```
 
+On builds with StorageFile directories, each StorageFile also has a hidden
+directory: a companion file named after the StorageFile with `"\1\xFF"` appended
+(so `"foobar"` has its directory in `"foobar\1\xFF"`). A record of where the file
+ends is added to it each time the file is written to. This means that opening a
+file for appending and `getLength` don't have to read the whole file. Files with
+27 character names have no room for the extra characters, so don't get a directory.
+
 **Note:** `StorageFile` uses the fact that all bits of erased flash memory are 1
 to detect the end of a file. As such you should not write character code 255
 (`"\xFF"`) to these files.
 */
 
+#ifdef ESPR_STORAGEFILE_READ_BUFFER
+#ifndef STORAGEFILE_READ_BUFFER_SIZE
+#define STORAGEFILE_READ_BUFFER_SIZE 256 ///< Bytes of flash read ahead at once by StorageFile.read/readLine - a power of 2 so it divides flash pages
+#endif
+#define STORAGEFILE_BUFFER_NAME JS_HIDDEN_CHAR_STR"buf"
+
+/// What's at the start of the read-ahead buffer (a flat string), followed by the data
+typedef struct {
+  uint32_t fileAddr; ///< address of the chunk's data the buffer came from (files move when compacted)
+  uint32_t addr; ///< flash address of the first byte in the buffer
+  uint32_t len; ///< bytes in the buffer
+} StorageFileBufferHeader;
+
+/// State for reading through a StorageFile
+typedef struct {
+  JsVar *f;
+  JsfFileName fname;
+  int fnamei;
+  int chunk, offset;
+  uint32_t addr; ///< address of the current chunk's data, or 0 if the end of the file
+  int fileLen; ///< size of the current chunk
+  JsVar *bufVar; ///< the flat string with the buffer in (or 0 if we couldn't allocate one)
+  StorageFileBufferHeader *buf;
+  char stackBuf[sizeof(StorageFileBufferHeader)+32]; ///< used if we're out of memory for bufVar
+} StorageFileReader;
+
+/// Start reading from the StorageFile's current position, return false if we can't
+static bool jswrap_storagefile_readStart(JsVar *f, StorageFileReader *r) {
+  r->bufVar = 0;
+  char mode = (char)jsvObjectGetIntegerChild(f,"mode");
+  if (mode!='r') {
+    jsExceptionHere(JSET_ERROR, "Can't read in this mode");
+    return false;
+  }
+  r->f = f;
+  r->chunk = jsvObjectGetIntegerChild(f,"chunk");
+  r->offset = jsvObjectGetIntegerChild(f,"offset");
+  r->fname = jsfNameFromVarAndUnLock(jsvObjectGetChildIfExists(f,"name"));
+  r->fnamei = sizeof(r->fname)-1;
+  while (r->fnamei && r->fname.c[r->fnamei-1]==0) r->fnamei--;
+  r->fname.c[r->fnamei]=(char)r->chunk;
+  JsfFileHeader header;
+  r->addr = jsfFindFile(r->fname, &header);
+  r->fileLen = (int)jsfGetFileSize(&header);
+  r->bufVar = jsvObjectGetChildIfExists(f,STORAGEFILE_BUFFER_NAME);
+  if (!r->bufVar) {
+    r->bufVar = jsvNewFlatStringOfLength(sizeof(StorageFileBufferHeader)+STORAGEFILE_READ_BUFFER_SIZE);
+    if (r->bufVar) {
+      jsvObjectSetChild(f,STORAGEFILE_BUFFER_NAME,r->bufVar);
+      ((StorageFileBufferHeader*)jsvGetFlatStringPointer(r->bufVar))->len = 0;
+    }
+  }
+  if (r->bufVar) {
+    r->buf = (StorageFileBufferHeader*)jsvGetFlatStringPointer(r->bufVar);
+  } else {
+    r->buf = (StorageFileBufferHeader*)r->stackBuf;
+    r->buf->len = 0;
+  }
+  return r->addr!=0;
+}
+
+/// Load the buffer so it starts at the current position (or the aligned block it's in)
+static void jswrap_storagefile_readFill(StorageFileReader *r) {
+  uint32_t pos = r->addr+(uint32_t)r->offset;
+  uint32_t end = r->addr+(uint32_t)r->fileLen;
+  uint32_t bufSize = r->bufVar ? STORAGEFILE_READ_BUFFER_SIZE : (uint32_t)(sizeof(r->stackBuf)-sizeof(StorageFileBufferHeader));
+  uint32_t start = pos & ~(uint32_t)(STORAGEFILE_READ_BUFFER_SIZE-1);
+  if (start<r->addr || !r->bufVar) start = pos;
+  if (end > start+bufSize) end = start+bufSize;
+  r->buf->fileAddr = r->addr;
+  r->buf->addr = start;
+  r->buf->len = end-start;
+  jshFlashRead(&r->buf[1], start, r->buf->len);
+}
+
+/** Get a pointer to the data at the current position in the file and return how many bytes
+ * there are (not including the 0xFF at the end of the file), moving on to the next chunk if needed.
+ * Returns 0 at the end of the file. */
+static int jswrap_storagefile_readData(StorageFileReader *r, char **data) {
+  if (!r->addr) return 0;
+  if (r->offset >= r->fileLen) { // next chunk
+    r->offset = 0;
+    if (r->chunk==255) {
+      r->addr = 0; // end of file!
+    } else {
+      r->chunk++;
+      r->fname.c[r->fnamei]=(char)r->chunk;
+      JsfFileHeader header;
+      r->addr = jsfFindFile(r->fname, &header);
+      r->fileLen = (int)jsfGetFileSize(&header);
+    }
+    jsvObjectSetChildAndUnLock(r->f,"offset",jsvNewFromInteger(r->offset));
+    jsvObjectSetChildAndUnLock(r->f,"chunk",jsvNewFromInteger(r->chunk));
+    if (!r->addr) return 0;
+  }
+  uint32_t pos = r->addr+(uint32_t)r->offset;
+  StorageFileBufferHeader *b = r->buf;
+  bool fresh = false;
+  if (b->fileAddr!=r->addr || pos<b->addr || pos>=b->addr+b->len) {
+    jswrap_storagefile_readFill(r);
+    fresh = true;
+  }
+  // erased flash (0xFF) is the end of the file, but it may have been written since we buffered it
+  if (!fresh && ((char*)&b[1])[pos-b->addr]==(char)255)
+    jswrap_storagefile_readFill(r);
+  *data = (char*)&b[1] + (pos-b->addr);
+  int len = (int)(b->addr+b->len-pos);
+  char *e = memchr(*data, 255, (size_t)len);
+  if (e) len = (int)(e-*data);
+  return len;
+}
+
+/// Finish reading, and store the position we got to in the StorageFile
+static void jswrap_storagefile_readEnd(StorageFileReader *r) {
+  jsvObjectSetChildAndUnLock(r->f,"offset",jsvNewFromInteger(r->offset));
+  jsvUnLock(r->bufVar);
+}
+
+/// Read a line (or up to len bytes if len>=0) from the file, or return 0 if at the end
+static JsVar *jswrap_storagefile_readPart(StorageFileReader *r, int len) {
+  bool isReadLine = len<0;
+  JsVar *result = 0;
+  char *data;
+  int l;
+  while (len && (l = jswrap_storagefile_readData(r, &data))) {
+    if (isReadLine) {
+      char *nl = memchr(data, '\n', (size_t)l);
+      if (nl) {
+        l = (int)(nl+1-data);
+        len = 0; // done
+      }
+    } else {
+      if (l>len) l=len;
+      len -= l;
+    }
+    if (!result) { // if this is all we need, allocate it in one go (it may be a flat string we can't append to)
+      result = len ? jsvNewFromEmptyString() : jsvNewStringOfLength((unsigned int)l, data);
+      if (!result) break; // out of memory
+      if (len) jsvAppendStringBuf(result,data,(size_t)l);
+    } else jsvAppendStringBuf(result,data,(size_t)l);
+    r->offset += l;
+  }
+  return result;
+}
+
+JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
+  StorageFileReader r;
+  if (!jswrap_storagefile_readStart(f, &r)) {
+    jsvUnLock(r.bufVar);
+    return 0; // end of file/no file chunk found (or an error)
+  }
+  JsVar *result = jswrap_storagefile_readPart(&r, len);
+  jswrap_storagefile_readEnd(&r);
+  return result;
+}
+#else // !ESPR_STORAGEFILE_READ_BUFFER
 JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
   bool isReadLine = len<0;
   char mode = (char)jsvObjectGetIntegerChild(f,"mode");
@@ -752,6 +1097,7 @@ JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
   jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
   return result;
 }
+#endif // ESPR_STORAGEFILE_READ_BUFFER
 /*JSON{
   "type" : "method",
   "ifndef" : "SAVE_ON_FLASH",
@@ -784,10 +1130,75 @@ JsVar *jswrap_storagefile_read(JsVar *f, int len) {
   "return_object" : "String"
 }
 Read a line of data from the file (up to and including `"\n"`)
+
+To read many lines at once, use `readLines`.
 */
 JsVar *jswrap_storagefile_readLine(JsVar *f) {
   return jswrap_storagefile_read_internal(f,-1);
 }
+/*JSON{
+  "type" : "method",
+  "ifndef" : "SAVE_ON_FLASH",
+  "class" : "StorageFile",
+  "name" : "readLines",
+  "generate" : "jswrap_storagefile_readLines",
+  "params" : [
+    ["count","int","[optional] The maximum number of lines to read (if not specified, all the remaining lines are read)"]
+  ],
+  "return" : ["JsVar","An array of lines, or undefined if the file is already at the end"],
+  "return_object" : "Array",
+  "typescript" : "readLines(count?: number): string[] | undefined;"
+}
+Read up to `count` lines of data from the file (each up to and including `"\n"`)
+and return them in an array. This is much faster than calling `readLine`
+repeatedly, for instance when parsing a CSV log file:
+
+```
+var f = require("Storage").open("log.csv","r");
+var lines;
+while (lines = f.readLines(20))
+  lines.forEach(l => print(l.trim().split(",")));
+```
+*/
+JsVar *jswrap_storagefile_readLines(JsVar *f, int count) {
+#ifdef ESPR_STORAGEFILE_READ_BUFFER
+  StorageFileReader r;
+  if (!jswrap_storagefile_readStart(f, &r)) {
+    jsvUnLock(r.bufVar);
+    return 0;
+  }
+  JsVar *lines = 0;
+  int n = 0;
+  while (count<=0 || n<count) {
+    JsVar *line = jswrap_storagefile_readPart(&r, -1);
+    if (!line) break; // end of file
+    if (!lines) lines = jsvNewEmptyArray();
+    if (!lines) {
+      jsvUnLock(line);
+      break;
+    }
+    jsvArrayPushAndUnLock(lines, line);
+    n++;
+  }
+  jswrap_storagefile_readEnd(&r);
+  return lines;
+#else
+  JsVar *lines = 0;
+  int n = 0;
+  while (count<=0 || n<count) {
+    JsVar *line = jswrap_storagefile_read_internal(f, -1);
+    if (!line) break; // end of file (or an error)
+    if (!lines) lines = jsvNewEmptyArray();
+    if (!lines) {
+      jsvUnLock(line);
+      break;
+    }
+    jsvArrayPushAndUnLock(lines, line);
+    n++;
+  }
+  return lines;
+#endif
+}
 /*JSON{
   "type" : "method",
   "ifndef" : "SAVE_ON_FLASH",
@@ -798,8 +1209,8 @@ JsVar *jswrap_storagefile_readLine(JsVar *f) {
 }
 Return the length of the current file.
 
-This requires Espruino to read the file from scratch, which is not a fast
-operation.
+Without a directory of the file's chunks (see `StorageFile`) this requires
+Espruino to read the file from scratch, which is not a fast operation.
 */
 int jswrap_storagefile_getLength(JsVar *f) {
   // Get name and position of name digit
@@ -808,51 +1219,46 @@ int jswrap_storagefile_getLength(JsVar *f) {
   jsvUnLock(n);
   int fnamei = sizeof(fname)-1;
   while (fnamei && fname.c[fnamei-1]==0) fnamei--;
-  int chunk = 1;
-  fname.c[fnamei]=(char)chunk;
+  int chunk, offset;
+  return jswrap_storagefile_findEnd(fname, fnamei, &chunk, &offset);
+}
 
-  int length = 0; // actual length
-  int offset = 0; // offset in file
-  JsfFileHeader header;
-  uint32_t addr = jsfFindFile(fname, &header);
-  // Find the last free page
-  unsigned char lastCh = 255;
-  if (addr) jshFlashRead(&lastCh, addr+jsfGetFileSize(&header)-1, 1);
-  while (addr && lastCh!=255 && chunk<255) {
-    length += (int)jsfGetFileSize(&header);
-    chunk++;
-    fname.c[fnamei]=(char)chunk;
-    addr = jsfFindFile(fname, &header);
-    if (addr) jshFlashRead(&lastCh, addr+jsfGetFileSize(&header)-1, 1);
+/*JSON{
+  "type" : "method",
+  "ifndef" : "SAVE_ON_FLASH",
+  "class" : "StorageFile",
+  "name" : "seek",
+  "generate" : "jswrap_storagefile_seek",
+  "params" : [
+    ["position","int","The position in bytes to start reading from"]
+  ]
+}
+Move the position that the next `read`/`readLine` starts from to the given
+number of bytes from the start of the file. The file must be open for reading.
+*/
+void jswrap_storagefile_seek(JsVar *f, int position) {
+  char mode = (char)jsvObjectGetIntegerChild(f,"mode");
+  if (mode!='r') {
+    jsExceptionHere(JSET_ERROR, "Can't seek in this mode");
+    return;
   }
-  if (addr) {
-    // if we have a page, try and find the end of it
-    char buf[64];
-    bool foundEnd = false;
-    while (!foundEnd) {
-      int l = (int)jsfGetFileSize(&header) - offset;
-      if (l<=0) {
-        foundEnd = true;
-        break;
-      }
-      if (l>(int)sizeof(buf)) l=(int)sizeof(buf);
-      jshFlashRead(buf, addr+(uint32_t)offset, (uint32_t)l);
-      for (int i=0;i<l;i++) {
-        if (buf[i]==(char)255) {
-          l = i;
-          foundEnd = true;
-          break;
-        }
-      }
-      offset += l;
-    }
+  if (position<0) position=0;
+  // every chunk is the same size, so we just need the size of the first
+  JsfFileName fname = jsfNameFromVarAndUnLock(jsvObjectGetChildIfExists(f,"name"));
+  int fnamei = sizeof(fname)-1;
+  while (fnamei && fname.c[fnamei-1]==0) fnamei--;
+  fname.c[fnamei]=1;
+  JsfFileHeader header;
+  int chunkSize = jsfFindFile(fname, &header) ? (int)jsfGetFileSize(&header) : STORAGEFILE_CHUNKSIZE;
+  int chunk = 1 + position/chunkSize;
+  if (chunk>255) { // past the end of the biggest file we could have
+    chunk = 255;
+    position = 255*chunkSize;
   }
-  length += offset;
-  return length;
+  jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(chunk));
+  jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(position - (chunk-1)*chunkSize));
 }
 
-
-
 /*JSON{
   "type" : "method",
   "ifndef" : "SAVE_ON_FLASH",
@@ -892,6 +1298,9 @@ void jswrap_storagefile_write(JsVar *f, JsVar *_data) {
   JsfFileHeader header;
   uint32_t addr = jsfFindFile(fname, &header);
   int fileLen = addr ? (int)jsfGetFileSize(&header) : 0;
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+  int oldChunk = chunk, oldOffset = offset;
+#endif
 
   DBG("Write Chunk %d Offset %d addr 0x%08x\n",chunk,offset,addr);
   if (!addr) {
@@ -902,6 +1311,9 @@ void jswrap_storagefile_write(JsVar *f, JsVar *_data) {
       fileLen = (int)jsfGetFileSize(&header);
       offset = (int)len;
       jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+      jswrap_storagefile_dirAppend(fname, fnamei, oldChunk, oldOffset, chunk, offset, (int)len);
+#endif
     } else {
       DBG("Write Create Chunk FAILED\n");
       // there would already have been an exception
@@ -917,6 +1329,9 @@ void jswrap_storagefile_write(JsVar *f, JsVar *_data) {
     jswrap_flash_write(data, (int)addr+offset);
     offset += (int)len;
     jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+    jswrap_storagefile_dirAppend(fname, fnamei, oldChunk, oldOffset, chunk, offset, (int)len);
+#endif
   } else {
     DBG("Write Append Chunk and create new file\n");
     // Fill up this page, do part of old page
@@ -941,6 +1356,9 @@ void jswrap_storagefile_write(JsVar *f, JsVar *_data) {
       offset = (int)jsvGetStringLength(part);
       jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(chunk));
       jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+      jswrap_storagefile_dirAppend(fname, fnamei, oldChunk, oldOffset, chunk, offset, (int)len);
+#endif
     } else {
       // there would already have been an exception - no need to return
       // we can free data up below
@@ -975,10 +1393,17 @@ void jswrap_storagefile_erase(JsVar *f) {
     ok = jsfEraseFile(fname);
     chunk++;
   }
+#ifdef ESPR_STORAGEFILE_DIRECTORY
+  if (jswrap_storagefile_getDirName(&fname, fnamei))
+    jsfEraseFile(fname);
+#endif
   // reset everything
   jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(1));
   jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(0));
   jsvObjectSetChildAndUnLock(f,"mode",jsvNewFromInteger(0));
+#ifdef ESPR_STORAGEFILE_READ_BUFFER
+  jsvObjectRemoveChild(f,STORAGEFILE_BUFFER_NAME);
+#endif
 }
 
 
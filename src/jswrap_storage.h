@@ -22,7 +22,7 @@ void jswrap_storage_eraseAll();
 JsVar *jswrap_storage_read(JsVar *name, int offset, int length);
 JsVar *jswrap_storage_readJSON(JsVar *name, bool noExceptions);
 JsVar *jswrap_storage_readArrayBuffer(JsVar *name);
-bool jswrap_storage_write(JsVar *name, JsVar *data, JsVarInt offset, JsVarInt size);
+bool jswrap_storage_write(JsVar *name, JsVar *data, JsVar *offset, JsVarInt size);
 bool jswrap_storage_writeJSON(JsVar *name, JsVar *data);
 void jswrap_storage_erase(JsVar *name);
 void jswrap_storage_compact(bool showMessage);
@@ -36,7 +36,9 @@ void jswrap_storage_optimise();
 JsVar *jswrap_storage_open(JsVar *name, JsVar *mode);
 JsVar *jswrap_storagefile_read(JsVar *f, int len);
 JsVar *jswrap_storagefile_readLine(JsVar *f);
+JsVar *jswrap_storagefile_readLines(JsVar *f, int count);
 int jswrap_storagefile_getLength(JsVar *f);
+void jswrap_storagefile_seek(JsVar *f, int position);
 void jswrap_storagefile_write(JsVar *parent, JsVar *_data);
 void jswrap_storagefile_erase(JsVar *f);
 
@@ -22,6 +22,7 @@
  #include <sys/select.h>
  #include <termios.h>
  #include <fcntl.h>
+ #include <sys/mman.h>
 #endif//__MINGW32__
  #include <signal.h>
  #include <inttypes.h>
@@ -31,8 +32,15 @@
 #include "jsutils.h"
 #include "jsparse.h"
 #include "jsinteractive.h"
+#include "jshardwareLinux.h"
 
 #include <pthread.h>
+#ifdef ESPR_LINUX_EVENT_WAIT
+ #include <poll.h>
+ #include <sys/epoll.h>
+ #include <sys/eventfd.h>
+ #include <sys/timerfd.h>
+#endif
 
 #define FAKE_FLASH_FILENAME  "espruino.flash"
 #define FAKE_FLASH_BLOCKSIZE FLASH_PAGE_SIZE
@@ -59,6 +67,7 @@
 
 // ----------------------------------------------------------------------------
 int ioDevices[EV_DEVICE_MAX+1]; // list of open IO devices (or 0)
+static void jshFlashKill();
 JshPinState gpioState[JSH_PIN_COUNT]; // will be set to UNDEFINED if it isn't exported
 
 #ifdef SYSFS_GPIO_DIR
@@ -68,6 +77,9 @@ JshPinState gpioState[JSH_PIN_COUNT]; // will be set to UNDEFINED if it isn't ex
 
 bool gpioShouldWatch[JSH_PIN_COUNT]; // whether we should watch this pin for changes
 bool gpioLastState[JSH_PIN_COUNT]; // the last state of this pin
+#ifdef ESPR_LINUX_EVENT_WAIT
+int gpioWatchFd[JSH_PIN_COUNT]; // the pin's 'value' file (which reports edges with POLLPRI), or -1 if we have to poll the pin
+#endif
 
 
 // functions for accessing the sysfs GPIO
@@ -252,6 +264,176 @@ int getch()
 pthread_t inputThread;
 bool isInitialised;
 
+#ifdef ESPR_LINUX_EVENT_WAIT
+/* Rather than polling, both threads block until there's something to do:
+ * - The input thread polls stdin, open devices and watched GPIO (sysfs 'value'
+ *   files report edges with POLLPRI). It's woken with inputWakeFd when there's
+ *   data to transmit or the set of things it should watch has changed.
+ * - jshSleep (main thread) waits with epoll for mainWakeFd (signalled by the input
+ *   thread when it pushes events), a timerfd set for the next JS timer, and any
+ *   file descriptors (eg. sockets) added with jshLinuxWaitAdd. */
+static int inputWakeFd = -1; ///< eventfd used to wake the input thread
+static int mainWakeFd = -1; ///< eventfd used to wake the main thread from jshSleep
+static int mainTimerFd = -1; ///< timerfd that wakes the main thread when the next timer is due
+static int mainEpollFd = -1; ///< what jshSleep waits on
+static bool stdinClosed; ///< stdin hit end of file, so stop polling it
+static int waitFdCount; ///< how many file descriptors have been added with jshLinuxWaitAdd
+bool jshLinuxWaitForInput = true;
+
+static void jshWakeFdSignal(int fd) {
+  if (fd<0) return;
+  uint64_t one = 1;
+  ssize_t r;
+  do {
+    r = write(fd, &one, sizeof(one));
+  } while (r<0 && errno==EINTR);
+  // EAGAIN means the counter is about to overflow - it's non-zero, so the fd is already signalled
+  if (r<0 && errno!=EAGAIN) perror("eventfd write");
+}
+
+static void jshWakeFdClear(int fd) {
+  uint64_t count;
+  ssize_t r;
+  do {
+    r = read(fd, &count, sizeof(count));
+  } while (r<0 && errno==EINTR);
+  // EAGAIN means the counter was already zero, so there was nothing to clear
+  if (r<0 && errno!=EAGAIN) perror("eventfd read");
+}
+
+static bool jshWaitFdAdd(int fd) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(mainEpollFd, EPOLL_CTL_ADD, fd, &ev)==0;
+}
+
+void jshLinuxWaitAdd(int fd) {
+  if (jshWaitFdAdd(fd)) waitFdCount++;
+}
+
+void jshLinuxWaitRemove(int fd) {
+  if (epoll_ctl(mainEpollFd, EPOLL_CTL_DEL, fd, NULL)==0) waitFdCount--;
+}
+
+void jshLinuxWaitPause(int fd, bool paused) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = paused ? 0 : EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(mainEpollFd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool jshLinuxHasWaitFds() {
+  return waitFdCount>0;
+}
+
+void jshInputThread() {
+  // Leave signals (eg. Ctrl-C from the shell) to the main thread so they interrupt jshSleep
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  // pollfd array is [inputWakeFd, stdin, devices..., watched pins...] - entries with fd<0 are ignored by poll
+  const int FD_DEVICES = 2;
+  const int FD_PINS = FD_DEVICES+EV_DEVICE_MAX+1;
+  struct pollfd fds[FD_PINS+JSH_PIN_COUNT];
+  int i;
+
+  while (isInitialised) {
+    bool pushedEvents = false;
+    int timeout = -1; // forever
+    /* Handle the delayed Ctrl-C -> interrupt behaviour (see description by EXEC_CTRL_C's definition)  */
+    if (execInfo.execute & EXEC_CTRL_C_WAIT)
+      execInfo.execute = (execInfo.execute & ~EXEC_CTRL_C_WAIT) | EXEC_INTERRUPTED;
+    if (execInfo.execute & EXEC_CTRL_C)
+      execInfo.execute = (execInfo.execute & ~EXEC_CTRL_C) | EXEC_CTRL_C_WAIT;
+    if (execInfo.execute & EXEC_CTRL_C_MASK)
+      timeout = 50; // we need to come back to this
+    // Only read input if we have space
+    bool hasSpace = jshGetEventsUsed() < IOBUFFERMASK/2;
+    if (!hasSpace) timeout = 50; // check again when some events have been handled
+    fds[0].fd = inputWakeFd;
+    fds[1].fd = (hasSpace && !stdinClosed) ? STDIN_FILENO : -1;
+    for (i=0;i<=EV_DEVICE_MAX;i++)
+      fds[FD_DEVICES+i].fd = (hasSpace && ioDevices[i]) ? ioDevices[i] : -1;
+    for (i=0;i<JSH_PIN_COUNT;i++) {
+      fds[FD_PINS+i].fd = -1;
+#ifdef SYSFS_GPIO_DIR
+      if (gpioShouldWatch[i]) {
+        fds[FD_PINS+i].fd = gpioWatchFd[i];
+        if (gpioWatchFd[i]<0) timeout = 1; // no edge notification for this pin, so poll it
+      }
+#endif
+    }
+    for (i=0;i<FD_PINS+JSH_PIN_COUNT;i++) {
+      fds[i].events = (i>=FD_PINS) ? POLLPRI : POLLIN;
+      fds[i].revents = 0;
+    }
+
+    if (poll(fds, (nfds_t)(FD_PINS+JSH_PIN_COUNT), timeout) < 0)
+      continue; // EINTR
+
+    if (fds[0].revents)
+      jshWakeFdClear(inputWakeFd);
+    // Read from the console
+    if (fds[1].revents) {
+      char buf[64];
+      int bytes = (int)read(STDIN_FILENO, buf, sizeof(buf));
+      if (bytes==0 || (bytes<0 && (fds[1].revents & (POLLHUP|POLLERR|POLLNVAL))))
+        stdinClosed = true;
+      for (i=0;i<bytes;i++) {
+        if (buf[i]==4) exit(0); // exit on Ctrl-D
+        jshPushIOCharEvent(EV_USBSERIAL, buf[i]);
+        pushedEvents = true;
+      }
+    }
+    // Read from any open devices
+    for (i=0;i<=EV_DEVICE_MAX;i++) {
+      if (fds[FD_DEVICES+i].revents && ioDevices[i]) {
+        char buf[32];
+        // read can return -1 (EAGAIN) because O_NONBLOCK is set
+        int bytes = (int)read(ioDevices[i], buf, sizeof(buf));
+        if (bytes>0) {
+          jshPushIOCharEvents(i, buf, (unsigned int)bytes);
+          pushedEvents = true;
+        }
+      }
+    }
+    // Write any data we have
+    IOEventFlags device = jshGetDeviceToTransmit();
+    while (device != EV_NONE) {
+      char ch = (char)jshGetCharToTransmit(device);
+      if (ioDevices[device])
+        write(ioDevices[device], &ch, 1);
+      device = jshGetDeviceToTransmit();
+    }
+
+#ifdef SYSFS_GPIO_DIR
+    Pin pin;
+    for (pin=0;pin<JSH_PIN_COUNT;pin++)
+      if (gpioShouldWatch[pin] && (gpioWatchFd[pin]<0 || fds[FD_PINS+pin].revents)) {
+        bool state;
+        if (gpioWatchFd[pin]>=0) {
+          char ch = '0';
+          lseek(gpioWatchFd[pin], 0, SEEK_SET);
+          read(gpioWatchFd[pin], &ch, 1);
+          state = ch=='1';
+        } else
+          state = jshPinGetValue(pin);
+        if (state != gpioLastState[pin]) {
+          jshPushIOEvent(pinToEVEXTI(pin) | (state?EV_EXTI_IS_HIGH:0), jshGetSystemTime());
+          gpioLastState[pin] = state;
+          pushedEvents = true;
+        }
+      }
+#endif
+
+    if (pushedEvents)
+      jshWakeFdSignal(mainWakeFd);
+  }
+}
+#else
 void jshInputThread() {
   while (isInitialised) {
     bool shortSleep = false;
@@ -312,8 +494,7 @@ void jshInputThread() {
     jshDelayMicroseconds(shortSleep ? 1000 : 50000);
   }
 }
-
-
+#endif // ESPR_LINUX_EVENT_WAIT
 
 void jshInit() {
 
@@ -354,8 +535,21 @@ void jshInit() {
 #ifdef SYSFS_GPIO_DIR
   for (i=0;i<JSH_PIN_COUNT;i++) {
     gpioShouldWatch[i] = false;
+#ifdef ESPR_LINUX_EVENT_WAIT
+    gpioWatchFd[i] = -1;
+#endif
   }
 #endif
+#ifdef ESPR_LINUX_EVENT_WAIT
+  stdinClosed = false;
+  inputWakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  mainWakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  mainTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  mainEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  waitFdCount = 0;
+  jshWaitFdAdd(mainWakeFd);
+  jshWaitFdAdd(mainTimerFd);
+#endif
 
   isInitialised = true;
   int err = pthread_create(&inputThread, NULL, &jshInputThread, NULL);
@@ -372,6 +566,9 @@ void jshKill() {
 
   // Request that the input thread finishes
   isInitialised = false;
+#ifdef ESPR_LINUX_EVENT_WAIT
+  jshWakeFdSignal(inputWakeFd);
+#endif
   // wait for thread to finish
   pthread_join(inputThread, NULL);
 
@@ -388,6 +585,22 @@ void jshKill() {
     if (gpioState[i] != JSHPINSTATE_UNDEFINED)
       sysfs_write_int(SYSFS_GPIO_DIR"/unexport", i);
 #endif
+#ifdef ESPR_LINUX_EVENT_WAIT
+#ifdef SYSFS_GPIO_DIR
+  for (i=0;i<JSH_PIN_COUNT;i++)
+    if (gpioWatchFd[i]>=0) {
+      close(gpioWatchFd[i]);
+      gpioWatchFd[i] = -1;
+    }
+#endif
+  close(mainEpollFd);
+  close(mainTimerFd);
+  close(mainWakeFd);
+  close(inputWakeFd);
+  mainEpollFd = mainTimerFd = mainWakeFd = inputWakeFd = -1;
+#endif
+
+  jshFlashKill();
 }
 
 void jshIdle() {
@@ -598,6 +811,17 @@ IOEventFlags jshPinWatch(Pin pin, bool shouldWatch, JshPinWatchFlags flags) {
 #ifdef SYSFS_GPIO_DIR
         gpioShouldWatch[pin] = true;
         gpioLastState[pin] = jshPinGetValue(pin);
+#ifdef ESPR_LINUX_EVENT_WAIT
+        // ask for edge notifications - if the pin can't do them the input thread polls it
+        char path[64] = SYSFS_GPIO_DIR"/gpio";
+        itostr(pin, &path[strlen(path)], 10);
+        size_t pathLen = strlen(path);
+        strcpy(&path[pathLen], "/edge");
+        sysfs_write(path, "both");
+        strcpy(&path[pathLen], "/value");
+        if (gpioWatchFd[pin]<0)
+          gpioWatchFd[pin] = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+#endif
 #endif
 #ifdef USE_WIRINGPI
         wiringPiISR(pin, INT_EDGE_BOTH, irqEXTIs[exti-EV_EXTI0]);
@@ -609,12 +833,21 @@ IOEventFlags jshPinWatch(Pin pin, bool shouldWatch, JshPinWatchFlags flags) {
       gpioEventFlags[pin] = 0;
 #ifdef SYSFS_GPIO_DIR
       gpioShouldWatch[pin] = false;
+#ifdef ESPR_LINUX_EVENT_WAIT
+      if (gpioWatchFd[pin]>=0) {
+        close(gpioWatchFd[pin]);
+        gpioWatchFd[pin] = -1;
+      }
+#endif
 #endif
 #ifdef USE_WIRINGPI
       wiringPiISR(pin, INT_EDGE_BOTH, irqEXTIDoNothing);
 #endif
 
     }
+#ifdef ESPR_LINUX_EVENT_WAIT
+    jshWakeFdSignal(inputWakeFd); // so the input thread starts/stops watching the pin
+#endif
     return shouldWatch ? exti : EV_NONE;
   } else jsError("Invalid pin");
   return EV_NONE;
@@ -720,13 +953,19 @@ void jshUSARTSetup(IOEventFlags device, JshUSARTInfo *inf) {
   } else {
     jsError("No path defined for device");
   }
+#ifdef ESPR_LINUX_EVENT_WAIT
+  jshWakeFdSignal(inputWakeFd); // so the input thread starts reading from the device
+#endif
 }
 
 /** Kick a device into action (if required). For instance we may need
  * to set up interrupts */
 void jshUSARTKick(IOEventFlags device) {
   assert(DEVICE_IS_USART(device) || DEVICE_IS_SPI(device));
-  // all done by the idle loop
+  // all done by the input thread
+#ifdef ESPR_LINUX_EVENT_WAIT
+  jshWakeFdSignal(inputWakeFd);
+#endif
 }
 
 void jshSPISetup(IOEventFlags device, JshSPIInfo *inf) {
@@ -743,6 +982,9 @@ void jshSPISetup(IOEventFlags device, JshSPIInfo *inf) {
    } else {
      jsError("No path defined for device");
    }
+#ifdef ESPR_LINUX_EVENT_WAIT
+   jshWakeFdSignal(inputWakeFd); // so the input thread starts reading from the device
+#endif
 }
 
 /** Send data through the given SPI device (if data>=0), and return the result
@@ -783,6 +1025,30 @@ void jshI2CRead(IOEventFlags device, unsigned char address, int nBytes, unsigned
 }
 
 /// Enter simple sleep mode (can be woken up by interrupts). Returns true on success
+#ifdef ESPR_LINUX_EVENT_WAIT
+bool jshSleep(JsSysTime timeUntilWake) {
+  if (timeUntilWake < jshGetTimeFromMilliseconds(1) ||
+      (timeUntilWake==JSSYSTIME_MAX && !jshLinuxWaitForInput && !waitFdCount))
+    return true;
+  // set the timer to wake us up (or disarm it if there are no timers)
+  struct itimerspec wake;
+  memset(&wake, 0, sizeof(wake));
+  if (timeUntilWake < JSSYSTIME_MAX) {
+    JsVarFloat secs = jshGetMillisecondsFromTime(timeUntilWake)/1000;
+    if (secs > 0x7FFFFFFF) secs = 0x7FFFFFFF;
+    wake.it_value.tv_sec = (time_t)secs;
+    wake.it_value.tv_nsec = (long)((secs - (JsVarFloat)wake.it_value.tv_sec)*1000000000);
+  }
+  timerfd_settime(mainTimerFd, 0, &wake, NULL);
+  // Now wait for the timer, the input thread or a socket
+  struct epoll_event events[8];
+  int i, n = epoll_wait(mainEpollFd, events, sizeof(events)/sizeof(events[0]), -1);
+  for (i=0;i<n;i++)
+    if (events[i].data.fd==mainWakeFd || events[i].data.fd==mainTimerFd)
+      jshWakeFdClear(events[i].data.fd);
+  return true;
+}
+#else
 bool jshSleep(JsSysTime timeUntilWake) {
   bool hasWatches = false;
 #ifdef SYSFS_GPIO_DIR
@@ -801,6 +1067,7 @@ bool jshSleep(JsSysTime timeUntilWake) {
     jshDelayMicroseconds(usecs);
   return true;
 }
+#endif
 
 void jshUtilTimerDisable() {
 }
@@ -849,6 +1116,128 @@ JsVar *jshFlashGetFree() {
   return jsFreeFlash;
 }
 
+#ifndef __MINGW32__
+/* The fake flash file is kept memory-mapped for as long as we're running, so
+ * reads and writes are just memory accesses and Storage files can be returned
+ * as native strings (like on devices with memory-mapped flash). If the file
+ * doesn't exist yet we map anonymous memory filled with 0xFF, and only create
+ * the file (mapped at the same address, so pointers stay valid) when first written. */
+static unsigned char *flashMap; ///< Memory-mapped fake flash, or 0
+static int flashFile = -1; ///< File descriptor of the file backing flashMap, or -1 if it's not backed by a file yet
+
+static int jshFlashOpenFile(bool dontCreate) {
+  int f = open(FAKE_FLASH_FILENAME, O_RDWR | (dontCreate ? 0 : O_CREAT), 0644);
+  if (f<0) return -1;
+  // pad the file out to the full size of flash with 0xFF
+  off_t len = FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS;
+  off_t fileLen = lseek(f, 0, SEEK_END);
+  if (fileLen>=0 && fileLen<len) {
+    unsigned char buf[FAKE_FLASH_BLOCKSIZE];
+    memset(buf, 0xFF, sizeof(buf));
+    while (fileLen<len) {
+      size_t l = (size_t)(len-fileLen);
+      if (l>sizeof(buf)) l=sizeof(buf);
+      if (write(f, buf, l)!=(ssize_t)l) break;
+      fileLen += (off_t)l;
+    }
+  }
+  if (fileLen<len) {
+    close(f);
+    return -1;
+  }
+  return f;
+}
+
+/// Get a pointer to the fake flash, or 0 on failure. If 'create', make sure there's a file behind it
+static unsigned char *jshFlashGetMap(bool create) {
+  if (flashMap && (flashFile>=0 || !create)) return flashMap;
+  size_t len = FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS;
+  int f = jshFlashOpenFile(!create);
+  if (f>=0) {
+    // if we already had anonymous memory, copy it to the file and map the file over the top
+    if (flashMap && pwrite(f, flashMap, len, 0)!=(ssize_t)len) {
+      close(f);
+      return 0;
+    }
+    void *m = mmap(flashMap, len, PROT_READ|PROT_WRITE, MAP_SHARED|(flashMap?MAP_FIXED:0), f, 0);
+    if (m==MAP_FAILED) {
+      close(f);
+      return flashMap;
+    }
+    flashMap = (unsigned char*)m;
+    flashFile = f;
+  } else if (!flashMap && !create) {
+    void *m = mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (m==MAP_FAILED) return 0;
+    flashMap = (unsigned char*)m;
+    memset(flashMap, 0xFF, len);
+  }
+  return (flashFile>=0 || !create) ? flashMap : 0;
+}
+
+/// Write flash back to the file and unmap it
+static void jshFlashKill() {
+  if (!flashMap) return;
+  if (flashFile>=0)
+    msync(flashMap, FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS, MS_SYNC);
+  munmap(flashMap, FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS);
+  flashMap = 0;
+  if (flashFile>=0) close(flashFile);
+  flashFile = -1;
+}
+
+void jshFlashErasePage(uint32_t addr) {
+  //jsDebug(DBG_VERBOSE,"FlashErasePage 0x%08x\n", addr);
+  uint32_t startAddr, pageSize;
+  if (!jshFlashGetPage(addr, &startAddr, &pageSize)) return;
+  // if no file and we're erasing, we don't have to create one
+  unsigned char *m = jshFlashGetMap(false);
+  if (!m) return;
+  memset(&m[startAddr-FLASH_START], 0xFF, pageSize);
+}
+void jshFlashRead(void *buf, uint32_t addr, uint32_t len) {
+  //jsDebug(DBG_VERBOSE,"FlashRead 0x%08x %d\n", addr,len);
+  //assert(!(addr&(FLASH_UNITARY_WRITE_SIZE-1))); // sanity checks here to mirror real hardware
+  //assert(!(len&(FLASH_UNITARY_WRITE_SIZE-1))); // sanity checks here to mirror real hardware
+  if (addr<FLASH_START || addr+len>FLASH_START+FLASH_TOTAL) {
+    assert(0); // out of range
+    return;
+  }
+  unsigned char *m = jshFlashGetMap(false);
+  if (!m) { // no flash, so it's all 0xFF
+    memset(buf, 0xFF, len);
+    return;
+  }
+  memcpy(buf, &m[addr-FLASH_START], len);
+}
+void jshFlashWrite(void *buf, uint32_t addr, uint32_t len) {
+  //jsDebug(DBG_VERBOSE,"FlashWrite 0x%08x %d\n", addr,len);
+  uint32_t i;
+#ifndef SPIFLASH_BASE // for debug
+  assert(!(addr&(FLASH_UNITARY_WRITE_SIZE-1))); // sanity checks here to mirror real hardware
+  assert(!(len&(FLASH_UNITARY_WRITE_SIZE-1))); // sanity checks here to mirror real hardware
+#endif
+  if (addr<FLASH_START || addr+len>FLASH_START+FLASH_TOTAL) {
+    assert(0); // out of range
+    return;
+  }
+  unsigned char *m = jshFlashGetMap(true);
+  if (!m) return;
+  m += addr-FLASH_START;
+  // flash can only clear bits
+  for (i=0;i<len;i++)
+    m[i] &= ((unsigned char*)buf)[i];
+}
+
+size_t jshFlashGetMemMapAddress(size_t ptr) {
+  // unsigned, so anything below the start wraps around and is out of range too
+  if (ptr-FLASH_START < FLASH_TOTAL) {
+    unsigned char *m = jshFlashGetMap(false);
+    return m ? (size_t)&m[ptr-FLASH_START] : 0;
+  }
+  return 0; // not memory-mapped (including SPI flash)
+}
+#else // __MINGW32__
 static FILE *jshFlashOpenFile(bool dontCreate) {
   FILE *f = fopen(FAKE_FLASH_FILENAME, "r+b");
   if (!f && dontCreate) return 0;
@@ -942,11 +1331,15 @@ void jshFlashWrite(void *buf, uint32_t addr, uint32_t len) {
   fclose(f);
 }
 
-// No - we can't memory-map the flash memory under Linux (well, we could but for testing it's handy not to)
+// No - we don't memory-map the flash memory here
 size_t jshFlashGetMemMapAddress(size_t ptr) {
   return 0;
 }
 
+static void jshFlashKill() {
+}
+#endif // __MINGW32__
+
 unsigned int jshSetSystemClock(JsVar *options) {
   return 0;
 }
@@ -0,0 +1,38 @@
+/*
+ * This file is part of Espruino, a JavaScript interpreter for Microcontrollers
+ *
+ * Copyright (C) 2013 Gordon Williams <gw@pur3.co.uk>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * ----------------------------------------------------------------------------
+ * Linux-specific parts of the Hardware interface Layer
+ * ----------------------------------------------------------------------------
+ */
+#ifndef JSHARDWARE_LINUX_H_
+#define JSHARDWARE_LINUX_H_
+
+#include "jsutils.h"
+
+#if defined(ESPR_LINUX_EVENT_WAIT) && !defined(__linux__)
+#undef ESPR_LINUX_EVENT_WAIT // epoll/eventfd/timerfd are Linux only
+#endif
+
+#ifdef ESPR_LINUX_EVENT_WAIT
+/// Wake up jshSleep whenever the given file descriptor has data to read (eg. a socket)
+void jshLinuxWaitAdd(int fd);
+/// Stop waking up jshSleep for the given file descriptor - call before closing it
+void jshLinuxWaitRemove(int fd);
+/// Temporarily stop (or restart) waking up jshSleep for a file descriptor added with jshLinuxWaitAdd
+void jshLinuxWaitPause(int fd, bool paused);
+/// Have any file descriptors been added with jshLinuxWaitAdd (so events could still arrive)?
+bool jshLinuxHasWaitFds();
+/** If true (the default, for the REPL), jshSleep waits for input when there are no
+ * timers. Set to false when running a script/test, so the idle loop can return and
+ * see that there's nothing left to do (unless there are file descriptors to wait on). */
+extern bool jshLinuxWaitForInput;
+#endif
+
+#endif /* JSHARDWARE_LINUX_H_ */
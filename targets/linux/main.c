@@ -13,6 +13,7 @@
 #include "jswrap_json.h"
 
 #include "jshardware.h"
+#include "jshardwareLinux.h"
 #include "jsinteractive.h"
 #include "jswrapper.h"
 #include "jsflags.h"
@@ -170,6 +171,20 @@ static char *read_file(const char *filename) {
   return buf;
 }
 
+/// Run the idle loop until nothing is busy, there are no timers and (on Linux) no sockets are open
+static void runIdleLoop() {
+#ifdef ESPR_LINUX_EVENT_WAIT
+  jshLinuxWaitForInput = false; // return from the idle loop when there is nothing left to do
+#endif
+  bool isBusy = true;
+  while (isRunning && (jsiHasTimers() || isBusy
+#ifdef ESPR_LINUX_EVENT_WAIT
+         || jshLinuxHasWaitFds() // sockets could still give us events
+#endif
+         ))
+    isBusy = jsiLoop();
+}
+
 bool run_test(const char *filename) {
   warning("----------------------------------");
   warning("----------------------------- TEST %s", filename);
@@ -193,9 +208,7 @@ bool run_test(const char *filename) {
   jsvUnLock(jspEvaluate(buffer, false));
 
   isRunning = true;
-  bool isBusy = true;
-  while (isRunning && (jsiHasTimers() || isBusy))
-    isBusy = jsiLoop();
+  runIdleLoop();
 
   JsVar *result = jsvObjectGetChildIfExists(execInfo.root, "result");
   bool pass = jsvGetBool(result);
@@ -429,9 +442,7 @@ int main(int argc, char **argv) {
         jsvUnLock(jspEvaluate(argv[i + 1], false));
         int errCode = handleErrors();
         isRunning = !errCode;
-        bool isBusy = true;
-        while (isRunning && (jsiHasTimers() || isBusy))
-          isBusy = jsiLoop();
+        runIdleLoop();
         jsiKill();
         jsvKill();
         jshKill();
@@ -516,9 +527,7 @@ int main(int argc, char **argv) {
     int errCode = handleErrors();
     free(buffer);
     isRunning = !errCode;
-    bool isBusy = true;
-    while (isRunning && (jsiHasTimers() || isBusy))
-      isBusy = jsiLoop();
+    runIdleLoop();
     jsiKill();
     jsvKill();
     jshKill();
@@ -0,0 +1,50 @@
+// E.defrag() moves flat strings (eg. ArrayBuffer data) as well as normal vars, so
+// free memory ends up in one area that a big ArrayBuffer can be allocated in
+
+function fill(a, n) { for (var i=0;i<a.length;i++) a[i] = (i+n)&255; }
+function check(a, n) { for (var i=0;i<a.length;i++) if (a[i]!==((i+n)&255)) return false; return true; }
+var ok = true;
+
+// fill most of memory with interleaved buffers and objects
+var bufs = [], objs = [];
+while (process.memory().free > 40) {
+  var b = new Uint8Array(100);
+  fill(b, bufs.length);
+  bufs.push(b);
+  objs.push({n:objs.length, s:"str"+objs.length});
+}
+var total = process.memory().total;
+// free every other one, leaving lots of small gaps
+for (var i=0;i<bufs.length;i+=2) { bufs[i] = undefined; objs[i] = undefined; }
+var s = E.toFlatString("Hello World, this is a flat string that is quite long");
+var deep = {x:{y:{z:"deep"}}};
+// a buffer whose address we have must stay where it is
+var n = bufs.length-1;
+while ((n&3)!=3) n--; // one we keep, near the top of memory
+var addr = E.getAddressOf(bufs[n], true);
+
+E.defrag();
+if (!addr || addr!=E.getAddressOf(bufs[n], true)) ok = false;
+for (var i=1;i<bufs.length;i+=2) {
+  if (!check(bufs[i], i)) ok = false;
+  if (objs[i].n!==i || objs[i].s!=="str"+i) ok = false;
+}
+if (s!=="Hello World, this is a flat string that is quite long" || deep.x.y.z!=="deep") ok = false;
+// the free memory is now together, so this can be a flat string (it has an address)
+var big = new Uint8Array(1500);
+if (!E.getAddressOf(big, true)) ok = false;
+big = undefined;
+
+// Fragment again and defrag - the buffer we have the address of still doesn't move
+for (var i=1;i<bufs.length;i+=4) { bufs[i] = undefined; objs[i] = undefined; }
+E.defrag();
+big = new Uint8Array(1000);
+fill(big, 3);
+if (!E.getAddressOf(big, true) || !check(big, 3)) ok = false;
+for (var i=3;i<bufs.length;i+=4)
+  if (!check(bufs[i], i) || objs[i].n!==i) ok = false;
+if (addr!=E.getAddressOf(bufs[n], true)) ok = false;
+if (process.memory().total!=total) ok = false; // we didn't have to allocate more memory
+bufs = objs = big = undefined;
+
+result = ok;
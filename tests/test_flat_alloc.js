@@ -0,0 +1,36 @@
+// Flat strings (eg. ArrayBuffer data) allocated into fragmented memory (ESPR_FREE_RUN_INDEX)
+// shouldn't overlap each other or other vars
+
+var ok = true;
+function allAre(a, n) { for (var i=0;i<a.length;i++) if (a[i]!==n) return false; return true; }
+var keep = [];
+for (var i=0;i<300;i++) {
+  var b = new Uint8Array(40+(i%9)*25);
+  b.fill(i&255);
+  keep.push(b, {n:i});
+}
+// make lots of holes of different sizes
+for (var i=0;i<keep.length;i+=3) keep[i] = undefined;
+process.memory(); // GC, so the free areas are found
+var added = [];
+for (var i=0;i<200;i++) {
+  var b = new Uint8Array(30+(i%11)*20);
+  b.fill(200-i);
+  added.push(b);
+}
+for (var i=0;i<keep.length;i++) {
+  var v = keep[i];
+  if (v instanceof Uint8Array) {
+    var n = (i>>1)&255;
+    if (!allAre(v, n)) ok = false;
+  } else if (v && v.n!==i>>1) ok = false;
+}
+for (var i=0;i<added.length;i++)
+  if (!allAre(added[i], 200-i)) ok = false;
+
+var m = process.memory();
+if (!(m.largestFree<=m.free) || !(m.freeAreas>0)) ok = false;
+if (m.flatAlloc && !(m.flatAlloc.count >= m.flatAlloc.indexed)) ok = false;
+keep = added = undefined;
+
+result = ok;
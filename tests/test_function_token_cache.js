@@ -0,0 +1,50 @@
+// Functions are tokenised on their first call (if ESPR_FUNCTION_TOKEN_CACHE is set)
+// Check that calling them again still works, and that toString still shows the source
+
+function f(a, b) {
+  // a comment
+  var x = a + b;
+  if (x > 10) return "big";
+  return typeof x + " " + x;
+}
+var s = f.toString();
+var r1 = f(1, 2);
+var r2 = f(1, 2);
+var r3 = f(5, 6);
+var s2 = f.toString();
+
+var g = (a) => a*2;
+var r4 = g(2) + g(3);
+
+var h = function() { var re = /a b/g; return "a b".replace(re, "-") + - -1; };
+var r5 = h() + h();
+
+// errors report positions in the original code, and functions defined inside keep their source
+function e(a) {
+  if (a) {
+    return a.b.c; // error
+  }
+  return function(b) {
+    var c = b; // comment
+    return c;
+  };
+}
+e(0);
+var stack;
+try { e(1); } catch (err) { stack = err.stack; }
+var inner = e(0).toString();
+
+// the tokenised code is only there for speed, so it's dropped when memory runs out
+var hadTokens = h["\xFFtok"]!==undefined;
+var total = process.memory().total;
+var fill = [];
+while (process.memory().total==total) for (var i=0;i<100;i++) fill.push("x"+fill.length);
+var dropped = h["\xFFtok"]===undefined;
+fill = undefined;
+var r6 = h();
+
+result = r1=="number 3" && r2=="number 3" && r3=="big" && s==s2 &&
+         r4==10 && r5=="-1-1" &&
+         stack.indexOf("line 2 col 15\n    return a.b.c; // error\n              ^")>=0 &&
+         inner.indexOf("// comment")>=0 &&
+         (!hadTokens || dropped) && r6=="-1";
@@ -0,0 +1,26 @@
+// Garbage collection marks without recursion, so deeply nested data can't stop it working
+
+var ok = true, i, c, p, l, a, x, m, gc;
+// long linked list, with a sibling after each nested object so marking can't just follow the last child
+l = null;
+for (i=0;i<5000;i++) l = {next:l, data:{v:i}};
+// deeply nested arrays
+a = [];
+for (i=0;i<2000;i++) a = [a, i];
+// some garbage that only a GC can free
+for (i=0;i<100;i++) { x = {n:i}; x.self = x; }
+x = undefined;
+m = process.memory();
+if (!(m.gc >= 100*3)) ok = false;
+// nothing reachable should have been freed
+c = 0; p = l;
+while (p) { if (p.data.v!==4999-c) ok = false; c++; p = p.next; }
+if (c!==5000) ok = false;
+c = 0; p = a;
+while (p.length) { if (p[1]!==1999-c) ok = false; c++; p = p[0]; }
+if (c!==2000) ok = false;
+l = a = p = undefined;
+gc = E.getStats().gc;
+if (!(gc.collections>=1 && gc.maxPause>=gc.lastPause && gc.totalTime>0)) ok = false;
+
+result = ok;
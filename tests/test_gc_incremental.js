@@ -0,0 +1,37 @@
+// Incremental garbage collection works through memory a few vars at a time, while the program keeps changing what's in use
+
+var ok = true, gc, s, m, n, a = [], seen = [], i, x, t, total, checks = 0;
+for (i=0;i<200;i++) a.push({v:i});
+
+// make garbage (that only a GC can free) until the idle loop decides to collect
+function fill() {
+  m = process.memory(false);
+  n = m.free - 20;
+  m = undefined;
+  for (i=0;i<n;i+=2) { x = {}; x.self = x; }
+  x = undefined;
+}
+function swap(i) {
+  t = a[i]; a[i] = a[199-i]; a[199-i] = t;
+}
+function step() {
+  if (!checks++) return fill(); // once this code has been freed
+  // move data around while the GC is working (without using up any memory)
+  swap(checks%100);
+  if (checks<300) return;
+  clearInterval();
+  s = E.getStats().gc;
+  total = process.memory(false).total;
+  /* Flagging, marking and sweeping each look at every var, a step's worth
+   * at a time - so if steps are bounded there must have been a lot of them */
+  if (!(s.collections==gc.collections+1 && s.steps-gc.steps >= 3*total/256)) ok = false;
+  if (!(process.memory(false).free > 1000)) ok = false;
+  // nothing that's in use should have been freed
+  for (i=0;i<200;i++) seen[a[i].v] = true;
+  for (i=0;i<200;i++) if (!seen[i]) ok = false;
+  result = ok;
+}
+
+swap(0); // anything the swap needs to allocate is done now
+gc = E.getStats().gc;
+setInterval(step, 1);
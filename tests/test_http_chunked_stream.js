@@ -0,0 +1,86 @@
+// Chunked HTTP bodies - decoded however they're split up, and sent when no length is given
+
+var result = 0;
+var http = require("http");
+var net = require("net");
+
+// a chunked response split at awkward places, with a chunk extension and a trailer
+var parts = [
+  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r", "\nHel", "lo\r\n",
+  "1", "0;ext=1\r\n, chunked world!\r\n", "0\r\nX-Trailer: 1\r", "\n\r\n"
+];
+var rawServer = net.createServer(function(c) {
+  c.on('data', function() {
+    function sendNext() {
+      c.write(parts.shift());
+      if (parts.length) setTimeout(sendNext, 10);
+    }
+    sendNext();
+  });
+});
+rawServer.listen(8086);
+
+var server = http.createServer(function (req, res) {
+  var body = "";
+  req.on('data', function(data) { body += data; });
+  req.on('end', function() {
+    console.log("<", req.method, req.headers["Transfer-Encoding"], body.length);
+    res.writeHead(200);
+    res.write("Got ");
+    res.write(body.length);
+    res.end();
+  });
+});
+server.listen(8087);
+
+var decoded = "";
+http.get({host:"localhost", port:8086, path:"/"}, function(res) {
+  res.on('data', function(data) { decoded += data; });
+  res.on('close', function() {
+    console.log(">", JSON.stringify(decoded));
+    rawServer.close();
+    // a POST with no Content-Length is sent chunked, and so is the reply
+    var req = http.request({host:"localhost", port:8087, path:"/post", method:"POST"}, function(res) {
+      var d = "";
+      res.on('data', function(data) { d += data; });
+      res.on('close', function() {
+        console.log(">", res.headers["Transfer-Encoding"], JSON.stringify(d));
+        server.close();
+        badChunks(decoded=="Hello, chunked world!" && d=="Got 1000" && res.headers["Transfer-Encoding"]=="chunked");
+      });
+    });
+    for (var i=0;i<10;i++) req.write("0123456789".repeat(10));
+    req.end();
+  });
+});
+
+// chunk sizes of more than 7 hex digits are a protocol error, and the connection is closed
+function badChunks(ok) {
+  var rawBad = net.createServer(function(c) {
+    c.on('data', function() {
+      c.write("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n123456789\r\nabc");
+    });
+  });
+  rawBad.listen(8088);
+  var clientErr, serverErr;
+  var req = http.get({host:"localhost", port:8088, path:"/"}, function(res) {
+    res.on('close', function() {
+      console.log(">", clientErr);
+      rawBad.close();
+      // ...and the same for a request's body
+      var badServer = http.createServer(function (req, res) {
+        req.on('error', function(e) { serverErr = e.code; });
+      });
+      badServer.listen(8089);
+      var c = net.connect({host:"localhost", port:8089}, function() {
+        c.write("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nFFFFFFFFFF\r\n0123");
+      });
+      c.on('close', function() {
+        console.log("<", serverErr);
+        badServer.close();
+        result = ok && clientErr==-16 && serverErr==-16;
+      });
+    });
+  });
+  req.on('error', function(e) { clientErr = e.code; });
+}
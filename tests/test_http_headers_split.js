@@ -0,0 +1,35 @@
+// HTTP headers arriving in several small pieces (and with mixed-case names)
+
+var result = 0;
+var http = require("http");
+var net = require("net");
+
+var server = http.createServer(function (req, res) {
+  var body = '';
+  req.on('data', function(data) { body += data; });
+  req.on('end', function() {
+    console.log("<", req.method, req.url, req.headers, JSON.stringify(body));
+    res.writeHead(200);
+    res.end(req.method+" "+req.url+" "+req.headers['X-Check']+" "+body);
+  });
+});
+server.listen(8083);
+
+var parts = [
+  "POST /sp", "lit.html HTTP/1.1\r\nHo", "st: localhost\r", "\ncontent-LENGTH: 5\r\nX-Check:",
+  "   24\r\n", "\r", "\nhel", "lo"
+];
+var response = '';
+var client = net.connect({port: 8083}, function() {
+  client.on('data', function(data) { response += data; });
+  client.on('close', function() {
+    console.log(">", JSON.stringify(response));
+    server.close();
+    result = response.indexOf("\r\n\r\nPOST /split.html 24 hello")>0;
+  });
+  function sendNext() {
+    client.write(parts.shift());
+    if (parts.length) setTimeout(sendNext, 20);
+  }
+  sendNext();
+});
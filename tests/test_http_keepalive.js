@@ -0,0 +1,64 @@
+// HTTP/1.1 keep-alive - pipelined requests on one connection, and http.request reusing connections
+
+var result = 0;
+var http = require("http");
+var net = require("net");
+
+var server = http.createServer(function (req, res) {
+  var body = '';
+  req.on('data', function(data) { body += data; });
+  req.on('end', function() {
+    console.log("<", req.method, req.url, JSON.stringify(body));
+    res.writeHead(200, {"Content-Type":"text/plain"});
+    res.end("["+req.url+body+"]");
+  });
+});
+server.listen(8084);
+
+var pipelined = false;
+var requests = 0;
+var hadTimer = false;
+
+// a plain socket server, so we can see how many connections http.request makes
+var connections = 0;
+var rawServer = net.createServer(function(c) {
+  connections++;
+  c.on('data', function(data) {
+    var path = data.split(" ")[1];
+    c.write("HTTP/1.1 200 OK\r\nContent-Length: "+path.length+"\r\nConnection: keep-alive\r\n\r\n"+path);
+    if (path=="/g2") c.end(); // the idle connection in the pool should notice this and close
+  });
+});
+rawServer.listen(8085);
+
+function testAgent() {
+  http.get({host:"localhost", port:8085, path:"/g"+requests, keepAlive:true}, function(res) {
+    var d = "";
+    res.on('data', function(data) { d += data; });
+    res.on('close', function() {
+      console.log(">", JSON.stringify(d), connections);
+      // closing idle connections later mustn't need a JS timer
+      var timers = global["\xff"].timers;
+      if (timers && timers.length) hadTimer = true;
+      if (d=="/g"+requests && ++requests < 3) return testAgent();
+      server.close();
+      rawServer.close();
+      result = pipelined && requests==3 && connections==1 && !hadTimer;
+    });
+  });
+}
+
+// three requests in one write - the last one closes the connection
+var response = '';
+var client = net.connect({port: 8084}, function() {
+  client.on('data', function(data) { response += data; });
+  client.on('close', function() {
+    console.log(">", JSON.stringify(response));
+    var a = response.indexOf("[/a]"), b = response.indexOf("[/bhi]"), c = response.indexOf("[/c]");
+    pipelined = a>0 && b>a && c>b && response.indexOf("Connection: keep-alive")>0;
+    testAgent();
+  });
+  client.write("GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n"+
+               "POST /b HTTP/1.1\r\nHost: localhost\r\nContent-Length: 2\r\n\r\nhi"+
+               "GET /c HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+});
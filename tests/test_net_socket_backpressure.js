@@ -0,0 +1,30 @@
+// Socket receiving more than it reads - data should be queued (and receiving paused) without losing any
+
+var result = 0;
+var net = require("net");
+var SIZE = 20000;
+
+var server = net.createServer(function(c) {
+  var s = "";
+  for (var i=0;i<SIZE/10;i++) s += ("000000000"+i).substr(-9)+",";
+  c.write(s);
+});
+server.listen(4446);
+
+var received = "";
+var client = net.connect({port: 4446}, function() {
+  // no 'data' listener, so read slowly
+  var interval = setInterval(function() {
+    received += client.read(300);
+    if (received.length >= SIZE) {
+      clearInterval(interval);
+      var ok = received.length==SIZE;
+      for (var i=0;i<SIZE/10;i++)
+        if (received.substr(i*10,10)!=("000000000"+i).substr(-9)+",") ok = false;
+      console.log("Received", received.length, ok);
+      result = ok;
+      client.end();
+      server.close();
+    }
+  }, 1);
+});
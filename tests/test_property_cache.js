@@ -0,0 +1,30 @@
+// Property lookups in the prototype chain may be cached (ESPR_PROPERTY_CACHE)
+// Check the cache is invalidated when objects/prototypes change
+
+function A() {}
+A.prototype.f = function() { return 1; };
+function B() {}
+B.prototype = { f : function() { return 10; } };
+var a = new A();
+var r = [];
+function get(o) { return o.f ? o.f() : "none"; }
+
+r.push(get(a)); // 1 (from prototype)
+r.push(get(a)); // 1 (cached)
+A.prototype.f = function() { return 2; };
+r.push(get(a)); // 2 (value changed)
+a.f = function() { return 3; };
+r.push(get(a)); // 3 (own property shadows prototype)
+delete a.f;
+r.push(get(a)); // 2
+a.__proto__ = B.prototype;
+r.push(get(a)); // 10 (prototype changed)
+delete B.prototype.f;
+r.push(get(a)); // none
+Object.prototype.f = function() { return 4; };
+r.push(get(a)); // 4 (added further down the chain)
+delete Object.prototype.f;
+r.push(get(a)); // none
+for (var i=0;i<3;i++) r.push(get(new A())); // 2,2,2 - new objects each time
+
+result = r.join(",")=="1,1,2,3,2,10,none,4,none,2,2,2";
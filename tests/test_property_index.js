@@ -0,0 +1,42 @@
+// Objects with many properties get a hash index (ESPR_PROPERTY_INDEX)
+// Check lookups stay correct as the object is added to, deleted from, copied and defragmented
+
+var o = {};
+for (var i=0;i<100;i++) o["k"+i] = i;
+for (var i=0;i<100;i++) o[i] = -i; // integer keys too
+var ok = true;
+function check(obj, n) {
+  for (var i=0;i<n;i++) {
+    if (obj["k"+i]!==i) ok = false;
+    if (obj[i]!==-i) ok = false;
+    if (obj[""+i]!==-i) ok = false;
+  }
+  if (obj[n]!==undefined || "nope" in obj) ok = false;
+}
+check(o, 100);
+if (o.k100!==undefined) ok = false;
+// add lots more, so the index has to grow
+for (var i=100;i<300;i++) o["k"+i] = i;
+if (o.k0!==0 || o.k150!==150 || o.k299!==299) ok = false;
+// delete and re-add
+for (var i=0;i<300;i+=2) delete o["k"+i];
+for (var i=0;i<300;i++) if (o["k"+i]!==((i&1)?i:undefined)) ok = false;
+for (var i=0;i<300;i+=2) o["k"+i] = i;
+for (var i=0;i<300;i++) if (o["k"+i]!==i) ok = false;
+// short and long names
+o.a = 1; o.abcd = 2; o.abcde = 3; o.averylongpropertyname = 4;
+if (o.a!==1 || o.abcd!==2 || o.abcde!==3 || o.averylongpropertyname!==4 || o.abc!==undefined) ok = false;
+// copies get their own index
+var c = {};
+for (var k in o) c[k] = o[k];
+c.k1 = "x";
+if (c.k1!=="x" || o.k1!==1 || c.k299!==299) ok = false;
+// globals live in an indexed object too
+if (global.ok!==true) ok = false;
+// index survives memory being moved around
+E.defrag();
+check(o, 100);
+if (o.k299!==299 || c.k1!=="x") ok = false;
+o = c = undefined;
+
+result = ok;
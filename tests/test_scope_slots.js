@@ -0,0 +1,47 @@
+// Identifier lookups are cached per call site (ESPR_SCOPE_SLOTS)
+// Check they stay correct when scopes change underneath them
+
+var ok = true;
+var g = 1;
+function local(n) {
+  var a=1, b=2, s=0;
+  for (var i=0;i<n;i++) s += a+b+g;
+  return s;
+}
+if (local(10)!==40) ok = false;
+g = 2; // global changed
+if (local(10)!==50) ok = false;
+// shadow the global with a local in a different function using the same names
+function shadow() { var g = 100; return g; }
+if (shadow()!==100 || local(1)!==5) ok = false;
+// closures read from outer scopes
+function mk(x) { return function(y) { return x+y; }; }
+var f1 = mk(1), f2 = mk(10);
+if (f1(1)!==2 || f2(1)!==11 || f1(2)!==3) ok = false;
+// recursion - each call has its own scope
+function fact(n) { return n<=1 ? 1 : n*fact(n-1); }
+if (fact(6)!==720) ok = false;
+// let in blocks
+function blk() {
+  var r = 0, x = 1;
+  for (var i=0;i<3;i++) { let x = 10; r += x; }
+  return r + x;
+}
+if (blk()!==31 || blk()!==31) ok = false;
+// globals added and removed
+function getH() { return typeof h; }
+if (getH()!=="undefined") ok = false;
+global.h = 5;
+if (getH()!=="number") ok = false;
+delete global.h;
+if (getH()!=="undefined") ok = false;
+// eval adding a variable
+function ev() { var z = 1; eval("var z = 2"); return z; }
+if (ev()!==2) ok = false;
+// similar names
+function names() { var aZ = 1, b9 = 2; return aZ*10+b9; }
+if (names()!==12) ok = false;
+E.defrag();
+if (local(1)!==5 || f1(5)!==6) ok = false;
+
+result = ok;
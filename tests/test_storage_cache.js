@@ -0,0 +1,55 @@
+// Check the cache of Storage file addresses
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+if (s.getStats().cacheHits===undefined) {
+  result = 1; // no cache in this build
+} else {
+  function hits() { return s.getStats().cacheHits; }
+  function misses() { return s.getStats().cacheMisses; }
+  var FILES = 100;
+  for (var i=0;i<FILES;i++)
+    s.write("file"+i, "contents"+i);
+
+  // a file we use all the time stays in the cache...
+  for (var i=0;i<5;i++) s.read("settings.json"); // doesn't exist yet - that gets cached too
+  s.write("settings.json", '{"a":1}');
+  for (var i=0;i<5;i++) test(s.read("settings.json"), '{"a":1}', "settings");
+  // ... even after reading lots of other files
+  for (var i=0;i<FILES;i++) test(s.read("file"+i), "contents"+i, "read "+i);
+  var h = hits(), m = misses();
+  test(s.read("settings.json"), '{"a":1}', "settings after");
+  test(hits(), h+1, "settings hit");
+  test(misses(), m, "settings no miss");
+  // files that don't exist are cached
+  s.read("nothere");
+  h = hits();
+  test(s.read("nothere"), undefined, "missing");
+  test(hits(), h+1, "missing hit");
+  // rewriting and erasing files updates the cache
+  s.write("settings.json", '{"a":2}');
+  test(s.read("settings.json"), '{"a":2}', "rewritten");
+  s.erase("settings.json");
+  test(s.read("settings.json"), undefined, "erased");
+  s.write("settings.json", '{"a":3}');
+  test(s.read("settings.json"), '{"a":3}', "written again");
+  s.write("nothere", "now here");
+  test(s.read("nothere"), "now here", "missing file written");
+
+  // compacting moves files, and fills the cache with where they went
+  for (var i=0;i<FILES;i+=2) s.erase("file"+i);
+  s.compact();
+  h = hits();
+  for (var i=1;i<FILES;i+=2) test(s.read("file"+i), "contents"+i, "compacted "+i);
+  for (var i=0;i<FILES;i+=2) test(s.read("file"+i), undefined, "compacted erased "+i);
+  test(hits()>h, true, "compact filled cache");
+  s.eraseAll();
+  test(s.read("file1"), undefined, "eraseAll");
+  result = tests==testsPass;
+}
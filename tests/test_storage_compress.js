@@ -0,0 +1,72 @@
+// Check files written to Storage with {compress:true}
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+if (s.getStats().savedBytes===undefined) {
+  result = 1; // no compressed files in this build
+} else {
+  var code = "";
+  for (var i=0;i<100;i++) code += "exports.f"+i+" = function(n) { return n*"+i+"; };\n";
+  test(s.write("mod.js", code, {compress:true}), true, "write");
+  test(s.read("mod.js"), code, "read");
+  test(s.read("mod.js", 100, 50), code.substr(100, 50), "read offset");
+  test(s.read("mod.js", code.length-5, 100), code.substr(-5), "read past end");
+  test(s.read("mod.js", code.length+5), "", "read offset past end");
+  test(require("mod.js").f7(6), 42, "require");
+  var stats = s.getStats();
+  test(stats.savedBytes>0 && stats.compressedBytes<code.length, true, "stats");
+  test(stats.fileBytes<code.length, true, "uses less flash");
+
+  // binary data, including "\xFF" and "\0"
+  var bin = "";
+  for (var i=0;i<2000;i++) bin += String.fromCharCode((i*i)&255, 0, 255);
+  s.write("bin", bin, {compress:true});
+  test(s.read("bin"), bin, "binary");
+  test(new Uint8Array(s.readArrayBuffer("bin"))[3*15], 225, "readArrayBuffer");
+  // JSON
+  s.write("a.json", {list:[1,2,3,1,2,3,1,2,3,1,2,3,1,2,3,1,2,3], text:"hello hello hello hello"}, {compress:true});
+  test(s.readJSON("a.json").list.length, 18, "readJSON");
+
+  // data that doesn't compress is written as normal
+  var saved = s.getStats().savedBytes;
+  s.write("tiny", "abc", {compress:true});
+  test(s.read("tiny"), "abc", "tiny");
+  test(s.getStats().savedBytes, saved, "tiny not compressed");
+  var rnd = "";
+  for (var i=0;i<200;i++) rnd += String.fromCharCode(Math.random()*256);
+  s.write("rnd", rnd, {compress:true});
+  test(s.read("rnd"), rnd, "incompressible");
+  test(s.getStats().savedBytes, saved, "incompressible not compressed");
+  s.erase("rnd");
+  s.write("tiny", "abc", 0, 6);
+  s.write("tiny", "def", 3);
+  test(s.read("tiny"), "abcdef", "tiny written in parts");
+
+  // compressed files can't be written in parts, but can be replaced
+  var threw = false;
+  try { s.write("mod.js", "x", 5); } catch (e) { threw = true; }
+  test(threw, true, "write part");
+  test(s.read("mod.js"), code, "write part didn't change file");
+  s.write("mod.js", "exports.f7 = 1;");
+  test(s.read("mod.js"), "exports.f7 = 1;", "replaced");
+  s.write("mod.js", code, {compress:true});
+  test(s.read("mod.js"), code, "replaced again");
+
+  // compacting moves compressed files with everything else
+  s.erase("a.json");
+  s.compact();
+  test(s.read("mod.js"), code, "compacted");
+  test(s.read("bin"), bin, "compacted binary");
+  test(s.list().sort().join(","), "bin,mod.js,tiny", "list");
+  s.erase("mod.js");
+  s.erase("bin");
+  test(s.getStats().savedBytes, 0, "erased");
+  s.eraseAll();
+  result = tests==testsPass;
+}
@@ -0,0 +1,75 @@
+// Check that StorageFile's directory of where the file ends is used, and recovered if it's wrong
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+var f = s.open("log","w");
+var all = "";
+for (var i=0;i<300;i++) {
+  var line = "Line "+i+" of the log file\n";
+  f.write(line);
+  all += line;
+}
+test(f.getLength(), all.length, "getLength");
+test(s.open("log","r").getLength(), all.length, "getLength reopened");
+// the directory isn't a file we list
+test(s.list().length, 1, "list");
+test(s.list(undefined,{sf:true}).length, 1, "list sf");
+// append
+f = s.open("log","a");
+f.write("Appended\n");
+all += "Appended\n";
+test(f.getLength(), all.length, "append");
+f = s.open("log","r");
+test(f.read(all.length+10), all, "read all");
+// seek
+f.seek(1000);
+test(f.read(30), all.substr(1000,30), "seek");
+f.seek(5);
+test(f.readLine(), all.substr(5, all.indexOf("\n")-4), "seek readLine");
+f.seek(all.length);
+test(f.read(10), undefined, "seek end");
+
+// If data is added to the chunks without updating the directory, we still find the end
+var chunks = 1;
+while (s.read("log"+String.fromCharCode(chunks+1))!==undefined) chunks++;
+var last = "log"+String.fromCharCode(chunks);
+var lastLen = s.open("log","r").getLength() - (chunks-1)*s.read("log\x01").length;
+s.write(last, "Extra\n", lastLen);
+all += "Extra\n";
+test(s.open("log","r").getLength(), all.length, "stale directory");
+f = s.open("log","a");
+f.write("More\n");
+all += "More\n";
+test(f.getLength(), all.length, "stale directory append");
+
+// A record that wasn't written properly is ignored
+var dir = "log\x01\xFF";
+var dirData = s.read(dir);
+var used = 0;
+while (dirData.charCodeAt(used*8+4)!=255) used++;
+s.write(dir, "\x12\x34\x00\x00\x56\x00\x00\x02", used*8);
+test(s.open("log","r").getLength(), all.length, "bad record");
+f = s.open("log","a");
+f.write("End\n");
+all += "End\n";
+test(s.open("log","r").read(all.length+10), all, "bad record append");
+test(f.getLength(), all.length, "bad record length");
+
+// Lots of writes fill the directory, and a new one is made
+f = s.open("small","w");
+for (var i=0;i<200;i++) f.write("x");
+test(f.getLength(), 200, "full directory");
+test(s.open("small","r").read(300), "x".repeat(200), "full directory read");
+
+// erasing removes the directory too
+s.open("log","r").erase();
+s.open("small","r").erase();
+test(s.list().length, 0, "erase");
+s.eraseAll();
+result = tests==testsPass;
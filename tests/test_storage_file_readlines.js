@@ -0,0 +1,66 @@
+// Check StorageFile's read-ahead buffer, readLine and readLines
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+var f = s.open("log.csv","w");
+var lines = [];
+for (var i=0;i<200;i++) {
+  // some lines are longer than the buffer, and some go over the end of a chunk
+  var line = i+","+"abcdefghij".repeat(i%37)+","+(i*3)+"\n";
+  f.write(line);
+  lines.push(line);
+}
+var all = lines.join("");
+
+f = s.open("log.csv","r");
+var l, got = [];
+while ((l = f.readLine())!==undefined) got.push(l);
+test(got.join("|"), lines.join("|"), "readLine");
+f = s.open("log.csv","r");
+test(f.readLines().join("|"), lines.join("|"), "readLines all");
+test(f.readLines(), undefined, "readLines end");
+test(f.readLine(), undefined, "readLine end");
+
+f = s.open("log.csv","r");
+got = [];
+var part;
+while (part = f.readLines(7)) {
+  if (part.length!=7 && got.length+part.length!=lines.length) test(part.length, 7, "readLines count");
+  got = got.concat(part);
+}
+test(got.join("|"), lines.join("|"), "readLines(7)");
+
+// mixing read, readLine and readLines keeps the position right
+f = s.open("log.csv","r");
+var str = f.read(5) + f.readLine() + f.readLines(3).join("") + f.read(1000) + f.readLine();
+test(str, all.substr(0, str.length), "mixed");
+f.seek(2000);
+test(f.readLines(2).join(""), all.substr(2000, all.indexOf("\n", all.indexOf("\n", 2000)+1)+1-2000), "seek readLines");
+f.seek(all.length-3);
+test(f.read(10), all.substr(-3), "read end");
+
+// data appended after we read to the end is still found
+f = s.open("log.csv","r");
+f.readLines();
+var a = s.open("log.csv","a");
+a.write("new,line\n");
+test(f.readLine(), "new,line\n", "appended");
+a.write("no newline");
+test(f.readLines().join("|"), "no newline", "no newline");
+s.compact();
+a.write(" yet\n");
+f.seek(all.length);
+test(f.readLines().join("|"), "new,line\n|no newline yet\n", "after compact");
+
+f.erase();
+var threw = false;
+try { f.readLines(); } catch (e) { threw = true; }
+test(threw, true, "erased");
+s.eraseAll();
+result = tests==testsPass;
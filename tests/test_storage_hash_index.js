@@ -0,0 +1,57 @@
+// Check that files are still found correctly when Storage has a hash index of filenames
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+var FILES = 100;
+for (var i=0;i<FILES;i++)
+  s.write("file"+i, "contents"+i);
+// replace some files so there's something to compact
+for (var i=0;i<FILES;i+=10)
+  s.write("file"+i, "new"+i);
+s.compact(); // writes the hash index
+// the index is not a real file...
+test(s.list().length, FILES, "list");
+test(s.list(/HASH/).length, 0, "list index");
+// ... but it does take space
+test(s.getStats().fileCount, FILES+1, "index created");
+for (var i=0;i<FILES;i++)
+  test(s.read("file"+i), ((i%10)?"contents":"new")+i, "read "+i);
+test(s.read("nothere"), undefined, "missing");
+
+// Files written after the index was made go in its log
+for (var i=0;i<FILES;i+=3)
+  s.write("file"+i, "log"+i);
+s.write("extra", "extra");
+s.erase("file1");
+for (var i=0;i<FILES;i++)
+  test(s.read("file"+i), (i==1) ? undefined : ((i%3)==0) ? "log"+i : (((i%10)?"contents":"new")+i), "log read "+i);
+test(s.read("extra"), "extra", "log new file");
+test(s.read("nothere"), undefined, "log missing");
+
+// Fill up the log - after this either a new index is made or we search for files
+for (var j=0;j<4;j++)
+  for (var i=0;i<FILES;i++)
+    s.write("more"+i, "more"+j+"_"+i);
+for (var i=0;i<FILES;i++)
+  test(s.read("more"+i), "more3_"+i, "full log read "+i);
+test(s.read("extra"), "extra", "full log extra");
+test(s.read("file1"), undefined, "full log erased");
+test(s.list().length, FILES*2, "full log list");
+
+// Storage.open uses multiple files with names ending in a char code
+var f = s.open("sfile","w");
+f.write("Hello ");
+f.write("World");
+test(s.open("sfile","r").read(100), "Hello World", "StorageFile");
+
+s.eraseAll();
+test(s.getStats().fileCount, 0, "eraseAll");
+test(s.read("file2"), undefined, "eraseAll read");
+
+result = tests==testsPass;
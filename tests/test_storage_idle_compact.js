@@ -0,0 +1,48 @@
+// Check that Storage is compacted a few pages at a time when idle
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+if (s.getStats().compacting===undefined) {
+  result = 1; // no idle compaction in this build
+} else {
+  var FILES = 100;
+  function contents(i) { return ("file"+i+" ").repeat(400).substr(0,2000+i); }
+  // fill Storage so it's over 75% full, with a file we have a reference to in the middle
+  for (var i=0;i<FILES;i++)
+    s.write("file"+i, contents(i));
+  var mapped = s.read("file51");
+  test(s.getStats().compacting, false, "not compacting");
+  for (var i=0;i<FILES;i+=2) s.erase("file"+i);
+  var stats = s.getStats();
+  var pages = stats.compactPages;
+  var trash = stats.trashBytes;
+  var checks = 0;
+  var interval = setInterval(function() {
+    stats = s.getStats();
+    if (stats.compacting && ++checks<1000) {
+      // files can be read and written while compacting
+      test(s.read("file"+(1+(checks%50)*2)), contents(1+(checks%50)*2), "read while compacting");
+      if (checks==1) s.write("extra", "Hello");
+      return;
+    }
+    clearInterval(interval);
+    test(stats.compacting, false, "finished");
+    test(stats.trashBytes, 0, "no trash");
+    test(stats.compactPages>pages, true, "pages written");
+    test(stats.compactBytes>0, true, "bytes moved");
+    test(stats.compactRate>0, true, "rate");
+    test(stats.freeBytes>=trash, true, "space freed");
+    for (var i=0;i<FILES;i++)
+      test(s.read("file"+i), (i&1) ? contents(i) : undefined, "read "+i);
+    test(s.read("extra"), "Hello", "written while compacting");
+    test(mapped, contents(51), "memory mapped file moved");
+    s.eraseAll();
+    result = tests==testsPass;
+  }, 1);
+}
@@ -0,0 +1,51 @@
+// Check that files too big to move in one idle step are moved a few pages at a time
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+if (s.getStats().compacting===undefined) {
+  result = 1; // no idle compaction in this build
+} else {
+  function contents(name, len) { return (name+" ").repeat(len/4).substr(0,len); }
+  var BIG = 40000, BIG2 = 30000;
+  s.write("gap2", contents("gap2", 8000));
+  // not enough space below to move without overlapping, so it's copied into free space first
+  var big2 = contents("bg2", BIG2);
+  s.write("big2", big2.substr(0,BIG2/2), 0, BIG2);
+  s.write("gap", contents("gap", 60000));
+  s.write("big", contents("big", BIG)); // moved down under the trash 'gap' leaves
+  for (var i=0;i<14;i++) s.write("small"+i, contents("small"+i, 5000));
+  var mapped = s.read("big");
+  s.erase("gap");
+  s.erase("gap2");
+  var pages = s.getStats().compactPages;
+  var maxPages = 0, checks = 0;
+  var interval = setInterval(function() {
+    var stats = s.getStats();
+    if (stats.compactPages-pages > maxPages) maxPages = stats.compactPages-pages;
+    pages = stats.compactPages;
+    if (stats.compacting && ++checks<5000) {
+      // the rest of big2 is written while it's being moved
+      if (checks==5) s.write("big2", big2.substr(BIG2/2), BIG2/2);
+      if (checks%10==0) test(s.read("big"), contents("big", BIG), "read while compacting");
+      return;
+    }
+    clearInterval(interval);
+    test(stats.compacting, false, "finished");
+    test(stats.trashBytes, 0, "no trash");
+    test(maxPages<=4, true, "pages per step");
+    test(s.read("big"), contents("big", BIG), "big");
+    test(s.read("big2"), big2, "big2");
+    for (var i=0;i<14;i++)
+      test(s.read("small"+i), contents("small"+i, 5000), "small"+i);
+    test(mapped, contents("big", BIG), "memory mapped file moved");
+    test(s.list().length, 16, "files");
+    s.eraseAll();
+    result = tests==testsPass;
+  }, 0);
+}
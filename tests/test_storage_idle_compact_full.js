@@ -0,0 +1,46 @@
+// Check that Storage is still compacted when idle once it's so full that files are in the journal's pages
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+}
+
+var s = require("Storage");
+s.eraseAll();
+if (s.getStats().compacting===undefined) {
+  result = 1; // no idle compaction in this build
+} else {
+  function contents(i) { return ("file"+i+" ").repeat(400).substr(0,2400+i); }
+  // fill Storage until there's less free space than the journal needs
+  var files = 0;
+  while (s.getStats().freeBytes > 6000)
+    s.write("file"+files, contents(files++));
+  var stats = s.getStats();
+  test(stats.freeBytes*100 < stats.totalBytes*5, true, "nearly full");
+  for (var i=0;i<files;i+=2) s.erase("file"+i);
+  var trash = s.getStats().trashBytes;
+  var started = false, written = false, checks = 0;
+  var interval = setInterval(function() {
+    stats = s.getStats();
+    if (stats.compacting) started = true;
+    if ((stats.compacting || !started) && ++checks<1000) {
+      test(s.read("file"+(1+(checks%(files>>1))*2)), contents(1+(checks%(files>>1))*2), "read while compacting");
+      if (stats.compacting && !written) {
+        s.write("extra", "Hello"); // the first time we see it compacting, so it can't finish first
+        written = true;
+      }
+      return;
+    }
+    clearInterval(interval);
+    test(started, true, "started");
+    test(stats.compacting, false, "finished");
+    test(stats.trashBytes, 0, "no trash");
+    test(stats.freeBytes>=trash, true, "space freed");
+    for (var i=0;i<files;i++)
+      test(s.read("file"+i), (i&1) ? contents(i) : undefined, "read "+i);
+    test(s.read("extra"), "Hello", "written while compacting");
+    s.eraseAll();
+    result = tests==testsPass;
+  }, 1);
+}
@@ -0,0 +1,123 @@
+// Check save() and load(), including E.setFlags({saveDelta:1}) which only rewrites the parts of RAM that changed
+// (and mustn't damage the last save if it fails)
+var s = require("Storage");
+s.eraseAll();
+
+/* load() replaces everything in RAM, so the test is a series of steps that are run from .boot0
+(which runs after every save and load), and keeps track of where it is in "savetest.json" */
+function run() {
+  var s = require("Storage");
+  var t = s.readJSON("savetest.json",1);
+  if (!t) return;
+  function test(a,b,msg) {
+    t.tests++;
+    if (a===b) t.pass++;
+    else console.log("Test "+t.tests+" ("+msg+") failed - "+JSON.stringify(a)+" vs "+JSON.stringify(b));
+  }
+  function makeData() {
+    global.data = [];
+    for (var i=0;i<100;i++) data.push({i:i, s:"item"+i});
+  }
+  // save() or load() (from a timeout, so the test keeps running), and then run the given step
+  function next(fn, step) {
+    t.step = step;
+    s.writeJSON("savetest.json", t);
+    setTimeout(fn, 1);
+  }
+  // how many region files there are (each region is in either ".varimgN" or ".varimgN~")
+  function regions() {
+    var n = 0;
+    for (var i=0;i<16;i++) {
+      if (s.read(".varimg"+i.toString(16))!==undefined) n++;
+      if (s.read(".varimg"+i.toString(16)+"~")!==undefined) n++;
+    }
+    return n;
+  }
+  function end() {
+    s.erase(".boot0");
+    s.erase("savetest.json");
+    E.setFlags({saveDelta:0});
+    global.result = t.tests==t.pass && t.tests==17;
+  }
+
+  if (t.step=="start") { // save normally
+    makeData();
+    E.setFlags({saveDelta:0});
+    next(save, "saved");
+  } else if (t.step=="saved") {
+    test(s.read(".varimg")!==undefined, true, "varimg");
+    test(regions(), 0, "no regions");
+    data[1].s = "changed after save";
+    next(load, "loaded");
+  } else if (t.step=="loaded") {
+    test(data.length, 100, "load");
+    test(data[1].s, "item1", "load value");
+    if (E.getFlags().saveDelta===undefined) return end(); // no delta saves in this build
+    E.setFlags({saveDelta:1});
+    next(save, "deltaSaved");
+  } else if (t.step=="deltaSaved") {
+    test(regions(), 16, "regions");
+    // change one thing, and check not everything is written again
+    t.trash = s.getStats().trashCount;
+    data[5].s = "changed";
+    next(save, "deltaSavedAgain");
+  } else if (t.step=="deltaSavedAgain") {
+    test(s.getStats().trashCount-t.trash < 16, true, "only changed regions written");
+    data[5].s = "changed after save";
+    next(load, "deltaLoaded");
+  } else if (t.step=="deltaLoaded") {
+    test(data.length, 100, "delta load");
+    test(data[5].s, "changed", "delta load value");
+    test(data[6].s, "item6", "delta load unchanged value");
+    // If the manifest doesn't match the regions, nothing is loaded
+    var m = new Uint8Array(E.toArrayBuffer(s.read(".varimg")));
+    m[8] ^= 1; // change the first region's CRC
+    s.write(".varimg", m);
+    next(load, "manifestChanged");
+  } else if (t.step=="manifestChanged") {
+    test(typeof data, "undefined", "manifest mismatch not loaded");
+    // If a region is missing, nothing is loaded
+    makeData();
+    E.setFlags({saveDelta:1});
+    next(save, "deltaSavedForErase");
+  } else if (t.step=="deltaSavedForErase") {
+    s.erase(".varimg3");
+    s.erase(".varimg3~");
+    next(load, "regionErased");
+  } else if (t.step=="regionErased") {
+    test(typeof data, "undefined", "missing region not loaded");
+    makeData();
+    data[1].s = "good";
+    next(save, "goodSaved");
+  } else if (t.step=="goodSaved") {
+    test(regions(), 16, "old regions erased");
+    // A save that runs out of space mustn't damage the last one
+    var st = s.getStats();
+    s.write("fill", "x", 0, st.freeBytes+st.trashBytes-1000);
+    data[1].s = "changed, but not saved";
+    next(save, "fullSaved");
+  } else if (t.step=="fullSaved") {
+    test(regions(), 16, "regions from failed save erased");
+    next(load, "fullLoaded");
+  } else if (t.step=="fullLoaded") {
+    test(data[1].s, "good", "last save loads after failed save");
+    s.erase("fill");
+    // lose power just after the old manifest was erased
+    s.write(".varimg~", s.read(".varimg"));
+    s.erase(".varimg");
+    next(load, "switchLoaded");
+  } else if (t.step=="switchLoaded") {
+    test(data[1].s, "good", "new manifest loads");
+    data[1].s = "after";
+    next(save, "switchSaved");
+  } else if (t.step=="switchSaved") {
+    test(s.read(".varimg~"), undefined, "new manifest replaced old");
+    next(load, "switchSavedLoaded");
+  } else if (t.step=="switchSavedLoaded") {
+    test(data[1].s, "after", "save after lost power");
+    end();
+  }
+}
+s.write(".boot0", "("+run+")()");
+s.writeJSON("savetest.json", {step:"start", tests:0, pass:0});
+run();
@@ -0,0 +1,42 @@
+// Strings remember where their end is so appending is quick (ESPR_STRING_TAIL_CACHE)
+// Check appends stay correct when strings are freed, reused, copied and moved around
+
+var ok = true;
+var a = "", b = "";
+for (var i=0;i<2000;i++) {
+  a += String.fromCharCode(65+(i%26));
+  b += i%10;
+}
+if (a.length!=2000 || b.length!=2000) ok = false;
+for (var i=0;i<2000;i+=97)
+  if (a[i]!=String.fromCharCode(65+(i%26)) || b[i]!=""+(i%10)) ok = false;
+// copies get appended to separately
+var c = a;
+c += "!";
+if (a.length!=2000 || c.length!=2001 || c[2000]!="!" || a.substr(1990)!=c.substr(1990,10)) ok = false;
+// free strings and reuse their memory
+for (var j=0;j<5;j++) {
+  var s = "";
+  for (var i=0;i<300;i++) s += "x";
+  if (s.length!=300) ok = false;
+  s = undefined;
+  process.memory(); // GC
+}
+// string used as a variable name
+var o = {};
+var n = "";
+for (var i=0;i<100;i++) n += "n";
+o[n] = 1;
+n += "N";
+if (n.length!=101 || o[n.substr(0,100)]!==1) ok = false;
+// appending after memory has been moved
+E.defrag();
+a += "END";
+if (a.length!=2003 || a.substr(-3)!="END" || a[1999]!=String.fromCharCode(65+(1999%26))) ok = false;
+// C appends (JSON/templates) build long strings too
+var j = JSON.stringify(new Array(200).fill("hello"));
+if (j.length!=200*8+1) ok = false;
+var t = `${a}${b}`;
+if (t.length!=4003 || t.substr(2000,3)!="END") ok = false;
+
+result = ok;
@@ -0,0 +1,39 @@
+// Timers are kept in order of when they fire (ESPR_TIMER_HEAP)
+// Check they still fire in the right order as they're added, cleared, changed and moved around
+
+var order = [];
+var ids = [];
+// add in a jumbled order
+for (var i=0;i<50;i++) {
+  var t = (i*37)%50;
+  ids[t] = setTimeout(function(t) { order.push(t); }, 10+t*2, t);
+}
+// clear some (including the first and last to fire)
+for (var i=0;i<50;i+=7) clearTimeout(ids[i]);
+clearTimeout(ids[49]);
+// an interval that is sped up, then stopped after 3 runs
+var intervalCount = 0;
+var iv = setInterval(function() {
+  if (++intervalCount==3) clearInterval(iv);
+}, 1000);
+changeInterval(iv, 5);
+// intervals that are re-timed after being added, so they fire in a different order
+var reorder = [], ivs = [];
+for (var i=0;i<20;i++) ivs.push(setInterval(function(i) { reorder.push(i); clearInterval(ivs[i]); }, 1000, i));
+for (var i=0;i<20;i++) changeInterval(ivs[i], 50+((i*7)%20)*3);
+// a timeout that clears itself and one that clears another
+var selfCleared = setTimeout(function() { clearTimeout(selfCleared); order.push("self"); }, 1);
+var victim = setTimeout(function() { order.push("victim"); }, 40);
+setTimeout(function() { clearTimeout(victim); }, 20);
+// memory gets moved around while timers are waiting
+setTimeout(function() { E.defrag(); }, 30);
+
+setTimeout(function() {
+  var expected = ["self"];
+  for (var i=1;i<49;i++) if (i%7) expected.push(i);
+  var expectedReorder = [];
+  for (var i=0;i<20;i++) expectedReorder[(i*7)%20] = i;
+  result = order.join(",")==expected.join(",") && intervalCount==3 &&
+           reorder.join(",")==expectedReorder.join(",");
+  if (!result) print(order.join(","), reorder.join(","));
+}, 200);
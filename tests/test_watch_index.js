@@ -0,0 +1,27 @@
+// Watches are also indexed by the event their pin creates (ESPR_WATCH_INDEX)
+// Check adding and removing watches keeps everything consistent
+
+var ok = true;
+function f() {}
+var ids = [];
+for (var i=0;i<8;i++) ids.push(setWatch(f, "D"+(10+i), {repeat:true}));
+ids.push(setWatch(f, D10, {repeat:false, edge:"rising"})); // two watches on one pin
+for (var i=1;i<ids.length;i++) if (ids[i]!=ids[i-1]+1) ok = false;
+function watchCount() { return Object.keys(global["\xFF"].watches).length; }
+if (watchCount()!=9) ok = false;
+clearWatch(ids[0]);
+clearWatch(ids[3]);
+if (watchCount()!=7) ok = false;
+try { clearWatch(ids[3]); ok = false; } catch (e) { } // already cleared
+var w = global["\xFF"].watches;
+if (w[ids[0]]!==undefined || w[ids[8]].pin!=D10 || w[ids[1]].pin!=D11) ok = false;
+// new watches still get added after removals and a defrag
+E.defrag();
+var id = setWatch(f, D20, {repeat:true});
+if (id!=ids[8]+1 || watchCount()!=8) ok = false;
+clearWatch();
+if (watchCount()!=0) ok = false;
+var s = E.getStats().watches;
+if (typeof s.events!="number" || typeof s.checked!="number" || typeof s.maxLatency!="number") ok = false;
+
+result = ok;